@@ -31,6 +31,7 @@ set(functions
     localtime_r
     posix_fallocate
     setenv
+    statx
     syslog
     unsetenv
     utimensat
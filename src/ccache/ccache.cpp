@@ -26,6 +26,7 @@
 #include <ccache/context.hpp>
 #include <ccache/core/cacheentry.hpp>
 #include <ccache/core/common.hpp>
+#include <ccache/core/compileserver.hpp>
 #include <ccache/core/exceptions.hpp>
 #include <ccache/core/mainoptions.hpp>
 #include <ccache/core/manifest.hpp>
@@ -88,8 +89,11 @@
 #include <cstring>
 #include <ctime>
 #include <initializer_list>
+#include <limits>
+#include <memory>
 #include <tuple>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 
 namespace fs = util::filesystem;
@@ -351,14 +355,48 @@ guess_compiler(const fs::path& path)
 #endif
 }
 
+static bool
+is_pseudo_include_file(const std::string& path_str)
+{
+  // Typically <built-in> or <command-line>.
+  return path_str.length() >= 2 && path_str[0] == '<'
+         && path_str[path_str.length() - 1] == '>';
+}
+
+static bool
+is_ignored_include_file(const Context& ctx, const std::string& path_str)
+{
+  if (ctx.ignore_header_paths.empty()) {
+    return false;
+  }
+
+  // Canonicalize path for comparison; Clang uses ./header.h.
+  const std::string& canonical_path_str =
+    util::starts_with(path_str, "./") ? path_str.substr(2) : path_str;
+  for (const auto& ignore_header_path : ctx.ignore_header_paths) {
+    if (file_path_matches_dir_prefix_or_file(ignore_header_path,
+                                             canonical_path_str)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Include file content digests computed ahead of remember_include_file, keyed
+// by path.
+using PrehashedIncludeFiles = std::unordered_map<std::string, SourceCodeFile>;
+
 // This function hashes an include file and stores the path and hash in
 // ctx.included_files. If the include file is a PCH, cpp_hash is also updated.
-[[nodiscard]] tl::expected<void, Failure>
+// If the content digest of the include file is in `prehashed` it is used
+// instead of hashing the file again.
+[[nodiscard]] static tl::expected<void, Failure>
 remember_include_file(Context& ctx,
                       const fs::path& path,
                       Hash& cpp_hash,
                       bool system,
-                      Hash* depend_mode_hash)
+                      Hash* depend_mode_hash,
+                      const PrehashedIncludeFiles* prehashed = nullptr)
 {
   if (path == ctx.args_info.input_file) {
     // Don't remember the input file.
@@ -366,9 +404,7 @@ remember_include_file(Context& ctx,
   }
 
   util::PathString path_str(path);
-  if (path_str.str().length() >= 2 && path_str.str()[0] == '<'
-      && path_str.str()[path_str.str().length() - 1] == '>') {
-    // Typically <built-in> or <command-line>.
+  if (is_pseudo_include_file(path_str.str())) {
     return {};
   }
 
@@ -413,17 +449,8 @@ remember_include_file(Context& ctx,
     return tl::unexpected(Statistic::bad_input_file);
   }
 
-  if (!ctx.ignore_header_paths.empty()) {
-    // Canonicalize path for comparison; Clang uses ./header.h.
-    const std::string& canonical_path_str =
-      util::starts_with(path_str.str(), "./") ? path_str.str().substr(2)
-                                              : path_str;
-    for (const auto& ignore_header_path : ctx.ignore_header_paths) {
-      if (file_path_matches_dir_prefix_or_file(ignore_header_path,
-                                               canonical_path_str)) {
-        return {};
-      }
-    }
+  if (is_ignored_include_file(ctx, path_str.str())) {
+    return {};
   }
 
   // Let's hash the include file content.
@@ -457,7 +484,20 @@ remember_include_file(Context& ctx,
 
   if (ctx.config.direct_mode()) {
     if (!is_pch) { // else: the file has already been hashed.
-      auto ret = hash_source_code_file(ctx, file_digest, path2);
+      const SourceCodeFile* prehashed_file = nullptr;
+      if (prehashed) {
+        const auto it = prehashed->find(path_str.str());
+        if (it != prehashed->end()) {
+          prehashed_file = &it->second;
+        }
+      }
+      HashSourceCodeResult ret;
+      if (prehashed_file) {
+        file_digest = prehashed_file->digest;
+        ret = prehashed_file->result;
+      } else {
+        ret = hash_source_code_file(ctx, file_digest, path2);
+      }
       if (ret.contains(HashSourceCode::error)) {
         return tl::unexpected(Statistic::bad_input_file);
       }
@@ -478,6 +518,62 @@ remember_include_file(Context& ctx,
   return {};
 }
 
+struct PendingIncludeFile
+{
+  fs::path path;
+  bool system;
+};
+
+// Remember `include_files` in order like remember_include_file, but first hash
+// the content of all of them concurrently. The digests are merged in the
+// original order so the resulting hashes are the same as when remembering the
+// files one by one.
+[[nodiscard]] static tl::expected<void, Failure>
+remember_include_files(Context& ctx,
+                       std::vector<PendingIncludeFile>& include_files,
+                       Hash& cpp_hash,
+                       Hash* depend_mode_hash)
+{
+  PrehashedIncludeFiles prehashed;
+  if (ctx.config.direct_mode()) {
+    std::vector<SourceCodeFile> files_to_hash;
+    std::unordered_set<std::string> seen_paths;
+    for (const auto& include_file : include_files) {
+      std::string path_str = util::pstr(include_file.path);
+      if (include_file.path == ctx.args_info.input_file
+          || is_pseudo_include_file(path_str)
+          || (include_file.system
+              && ctx.config.sloppiness().contains(core::Sloppy::system_headers))
+          || ctx.included_files.find(path_str) != ctx.included_files.end()
+          || is_precompiled_header(include_file.path)
+          || is_ignored_include_file(ctx, path_str)
+          || !seen_paths.insert(path_str).second) {
+        continue;
+      }
+      SourceCodeFile file;
+      file.path = include_file.path;
+      files_to_hash.push_back(std::move(file));
+    }
+
+    hash_source_code_files(ctx, files_to_hash);
+    for (auto& file : files_to_hash) {
+      std::string path_str = util::pstr(file.path);
+      prehashed.emplace(std::move(path_str), std::move(file));
+    }
+  }
+
+  for (const auto& include_file : include_files) {
+    TRY(remember_include_file(ctx,
+                              include_file.path,
+                              cpp_hash,
+                              include_file.system,
+                              depend_mode_hash,
+                              &prehashed));
+  }
+  include_files.clear();
+  return {};
+}
+
 static void
 print_included_files(const Context& ctx, FILE* fp)
 {
@@ -502,6 +598,7 @@ process_preprocessed_file(Context& ctx, Hash& hash, const fs::path& path)
   }
 
   std::unordered_map<std::string, std::string> relative_inc_path_cache;
+  std::vector<PendingIncludeFile> include_files;
 
   // Bytes between p and q are pending to be hashed.
   char* q = &(*data)[0];
@@ -627,7 +724,13 @@ process_preprocessed_file(Context& ctx, Hash& hash, const fs::path& path)
         hash.hash(inc_path);
       }
 
-      TRY(remember_include_file(ctx, inc_path, hash, system, nullptr));
+      if (is_precompiled_header(inc_path)) {
+        // A PCH digest is hashed into the preprocessed stream, so remember it
+        // right away.
+        TRY(remember_include_file(ctx, inc_path, hash, system, nullptr));
+      } else {
+        include_files.push_back({inc_path, system});
+      }
       p = q; // Everything of interest between p and q has been hashed now.
     } else if (strncmp(q, incbin_directive, sizeof(incbin_directive)) == 0
                && ((q[7] == ' '
@@ -671,6 +774,8 @@ process_preprocessed_file(Context& ctx, Hash& hash, const fs::path& path)
 
   hash.hash(p, (end - p));
 
+  TRY(remember_include_files(ctx, include_files, hash, nullptr));
+
   // Explicitly check the .gch/.pch/.pth file as Clang does not include any
   // mention of it in the preprocessed output.
   if (!ctx.args_info.included_pch_file.empty()
@@ -708,6 +813,7 @@ result_key_from_depfile(Context& ctx, Hash& hash)
     return tl::unexpected(Statistic::bad_input_file);
   }
 
+  std::vector<PendingIncludeFile> include_files;
   bool seen_colon = false;
   for (std::string_view token : Depfile::tokenize(*file_content)) {
     if (token.empty()) {
@@ -715,12 +821,12 @@ result_key_from_depfile(Context& ctx, Hash& hash)
       continue;
     }
     if (seen_colon) {
-      fs::path path = core::make_relative_path(ctx, token);
-      TRY(remember_include_file(ctx, path, hash, false, &hash));
+      include_files.push_back({core::make_relative_path(ctx, token), false});
     } else if (token == ":") {
       seen_colon = true;
     }
   }
+  TRY(remember_include_files(ctx, include_files, hash, &hash));
 
   // Explicitly check the .gch/.pch/.pth file as it may not be mentioned in the
   // dependencies output.
@@ -776,11 +882,12 @@ struct DoExecuteResult
 static tl::expected<Hash::Digest, Failure>
 result_key_from_includes(Context& ctx, Hash& hash, std::string_view stdout_data)
 {
+  std::vector<PendingIncludeFile> include_files;
   for (std::string_view include : core::MsvcShowIncludesOutput::get_includes(
          stdout_data, ctx.config.msvc_dep_prefix())) {
-    const fs::path path = core::make_relative_path(ctx, include);
-    TRY(remember_include_file(ctx, path, hash, false, &hash));
+    include_files.push_back({core::make_relative_path(ctx, include), false});
   }
+  TRY(remember_include_files(ctx, include_files, hash, &hash));
 
   // Explicitly check the .pch file as it is not mentioned in the
   // includes output.
@@ -861,18 +968,31 @@ do_execute(Context& ctx, Args& args, const bool capture_stdout = true)
   return DoExecuteResult{status, stdout_data, *stderr_data_result};
 }
 
-static void
+// Returns the compile duration recorded in the manifest's header.
+static uint32_t
 read_manifest(Context& ctx, nonstd::span<const uint8_t> cache_entry_data)
 {
   try {
     core::CacheEntry cache_entry(cache_entry_data);
     cache_entry.verify_checksum();
     ctx.manifest.read(cache_entry.payload());
+    return cache_entry.header().compile_duration;
   } catch (const core::Error& e) {
     LOG("Error reading manifest: {}", e.what());
+    return 0;
   }
 }
 
+// Return how long this invocation has taken so far in milliseconds, i.e. how
+// much time a cache hit for the entry being stored will save.
+static uint32_t
+get_compile_duration(const Context& ctx)
+{
+  const auto duration = util::TimePoint::now() - ctx.time_of_invocation;
+  return static_cast<uint32_t>(std::clamp<int64_t>(
+    duration.nsec() / 1'000'000, 0, std::numeric_limits<uint32_t>::max()));
+}
+
 static void
 update_manifest(Context& ctx,
                 const Hash::Digest& manifest_key,
@@ -909,6 +1029,7 @@ update_manifest(Context& ctx,
   if (added) {
     LOG("Added result key to manifest {}", util::format_digest(manifest_key));
     core::CacheEntry::Header header(ctx.config, core::CacheEntryType::manifest);
+    header.compile_duration = get_compile_duration(ctx);
     ctx.storage.put(manifest_key,
                     core::CacheEntryType::manifest,
                     core::CacheEntry::serialize(header, ctx.manifest));
@@ -1044,7 +1165,9 @@ write_result(Context& ctx,
   }
 
   core::CacheEntry::Header header(ctx.config, core::CacheEntryType::result);
-  const auto cache_entry_data = core::CacheEntry::serialize(header, serializer);
+  header.compile_duration = get_compile_duration(ctx);
+  const auto cache_entry_data = core::CacheEntry::serialize(
+    header, serializer, ctx.config.compression_threads());
 
   if (!ctx.config.remote_only()) {
     const auto& raw_files = serializer.get_raw_files();
@@ -2144,12 +2267,18 @@ get_result_key_from_manifest(Context& ctx, const Hash::Digest& manifest_key)
 {
   std::optional<Hash::Digest> result_key;
   size_t read_manifests = 0;
+  bool manifest_updated = false;
+  uint32_t compile_duration = 0;
   ctx.storage.get(
-    manifest_key, core::CacheEntryType::manifest, [&](util::Bytes&& value) {
+    manifest_key,
+    core::CacheEntryType::manifest,
+    [&](nonstd::span<const uint8_t> value) {
       try {
-        read_manifest(ctx, value);
+        compile_duration =
+          std::max(compile_duration, read_manifest(ctx, value));
         ++read_manifests;
-        result_key = ctx.manifest.look_up_result_digest(ctx);
+        result_key =
+          ctx.manifest.look_up_result_digest(ctx, &manifest_updated);
       } catch (const core::Error& e) {
         LOG("Failed to look up result key in manifest: {}", e.what());
       }
@@ -2161,10 +2290,23 @@ get_result_key_from_manifest(Context& ctx, const Hash::Digest& manifest_key)
         return false;
       }
     });
+  // Keep the compile duration of the stored manifest so that re-storing it
+  // doesn't lower its eviction weight.
   if (read_manifests > 1 && !ctx.config.remote_only()) {
     LOG("Storing merged manifest {} locally",
         util::format_digest(manifest_key));
     core::CacheEntry::Header header(ctx.config, core::CacheEntryType::manifest);
+    header.compile_duration = compile_duration;
+    ctx.storage.local.put(manifest_key,
+                          core::CacheEntryType::manifest,
+                          core::CacheEntry::serialize(header, ctx.manifest));
+  } else if (manifest_updated && !ctx.config.remote_only()
+             && !ctx.config.read_only() && !ctx.config.read_only_direct()) {
+    // Store the updated hit count and last hit time of the result.
+    LOG("Storing updated manifest {} locally",
+        util::format_digest(manifest_key));
+    core::CacheEntry::Header header(ctx.config, core::CacheEntryType::manifest);
+    header.compile_duration = compile_duration;
     ctx.storage.local.put(manifest_key,
                           core::CacheEntryType::manifest,
                           core::CacheEntry::serialize(header, ctx.manifest));
@@ -2286,6 +2428,35 @@ calculate_result_and_manifest_key(Context& ctx,
 
 enum class FromCacheCallMode { direct, cpp };
 
+// Write the files of a result cache entry to their destinations.
+static tl::expected<bool, Failure>
+retrieve_result(const Context& ctx,
+                const Hash::Digest& result_key,
+                nonstd::span<const uint8_t> cache_entry_data)
+{
+  try {
+    core::CacheEntry cache_entry(cache_entry_data);
+    cache_entry.verify_checksum();
+    core::Result::Deserializer deserializer(cache_entry);
+    core::ResultRetriever result_retriever(ctx, result_key);
+    util::UmaskScope umask_scope(ctx.original_umask);
+    deserializer.visit(result_retriever);
+  } catch (core::ResultRetriever::WriteError& e) {
+    LOG("Write error when retrieving result from {}: {}",
+        util::format_digest(result_key),
+        e.what());
+    return tl::unexpected(Statistic::bad_output_file);
+  } catch (core::Error& e) {
+    LOG("Failed to get result from {}: {}",
+        util::format_digest(result_key),
+        e.what());
+    return false;
+  }
+
+  LOG_RAW("Succeeded getting cached result");
+  return true;
+}
+
 // Try to return the compile result from cache.
 static tl::expected<bool, Failure>
 from_cache(Context& ctx, FromCacheCallMode mode, const Hash::Digest& result_key)
@@ -2310,38 +2481,16 @@ from_cache(Context& ctx, FromCacheCallMode mode, const Hash::Digest& result_key)
     return false;
   }
 
-  // Get result from cache.
-  util::Bytes cache_entry_data;
-  ctx.storage.get(
-    result_key, core::CacheEntryType::result, [&](util::Bytes&& value) {
-      cache_entry_data = std::move(value);
-      return true;
-    });
-  if (cache_entry_data.empty()) {
-    return false;
-  }
-
-  try {
-    core::CacheEntry cache_entry(cache_entry_data);
-    cache_entry.verify_checksum();
-    core::Result::Deserializer deserializer(cache_entry.payload());
-    core::ResultRetriever result_retriever(ctx, result_key);
-    util::UmaskScope umask_scope(ctx.original_umask);
-    deserializer.visit(result_retriever);
-  } catch (core::ResultRetriever::WriteError& e) {
-    LOG("Write error when retrieving result from {}: {}",
-        util::format_digest(result_key),
-        e.what());
-    return tl::unexpected(Statistic::bad_output_file);
-  } catch (core::Error& e) {
-    LOG("Failed to get result from {}: {}",
-        util::format_digest(result_key),
-        e.what());
-    return false;
-  }
-
-  LOG_RAW("Succeeded getting cached result");
-  return true;
+  // Get result from cache. The result is retrieved in the receiver since the
+  // entry data may be a memory mapping that is only valid during the call.
+  std::optional<tl::expected<bool, Failure>> result;
+  ctx.storage.get(result_key,
+                  core::CacheEntryType::result,
+                  [&](nonstd::span<const uint8_t> value) {
+                    result = retrieve_result(ctx, result_key, value);
+                    return true;
+                  });
+  return result ? *result : false;
 }
 
 // Find the real compiler and put it into ctx.orig_args[0]. We just search the
@@ -2440,8 +2589,6 @@ set_up_uncached_err()
   return {};
 }
 
-static int cache_compilation(int argc, const char* const* argv);
-
 static tl::expected<core::StatisticsCounters, Failure>
 do_cache_compilation(Context& ctx);
 
@@ -2523,8 +2670,10 @@ split_argv(int argc, const char* const* argv)
 }
 
 // The entry point when invoked to cache a compilation.
-static int
-cache_compilation(int argc, const char* const* argv)
+int
+cache_compilation(std::unique_ptr<Context> context,
+                  int argc,
+                  const char* const* argv)
 {
   tzset(); // Needed for localtime_r.
 
@@ -2539,9 +2688,10 @@ cache_compilation(int argc, const char* const* argv)
   }
 
   {
-    Context ctx;
-    ctx.initialize(std::move(argv_parts.compiler_and_args),
-                   argv_parts.config_settings);
+    // Destroy the context before executing the original compiler below.
+    const auto ctx_owner = std::move(context);
+    Context& ctx = *ctx_owner;
+    ctx.initialize(std::move(argv_parts.compiler_and_args));
     SignalHandler signal_handler(ctx);
     DEFER(finalize_at_exit(ctx));
 
@@ -2909,7 +3059,17 @@ ccache_main(int argc, const char* const* argv)
       }
     }
 
-    return cache_compilation(argc, argv);
+    auto ctx = std::make_unique<Context>();
+    ctx->config.read(split_argv(argc, argv).config_settings);
+
+#ifndef _WIN32
+    if (const auto exit_code =
+          core::forward_to_compile_server(ctx->config, argc, argv)) {
+      return *exit_code;
+    }
+#endif
+
+    return cache_compilation(std::move(ctx), argc, argv);
   } catch (const core::ErrorBase& e) {
     PRINT(stderr, "ccache: error: {}\n", e.what());
     return EXIT_FAILURE;
@@ -24,6 +24,7 @@
 
 #include <filesystem>
 #include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -38,6 +39,12 @@ using FindExecutableFunction =
 
 int ccache_main(int argc, const char* const* argv);
 
+// Perform the compilation described by `argc` and `argv` in the current
+// process using `ctx`, whose configuration has been read.
+int cache_compilation(std::unique_ptr<Context> ctx,
+                      int argc,
+                      const char* const* argv);
+
 // Tested by unit tests.
 struct ArgvParts
 {
@@ -50,6 +50,7 @@
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
+#include <limits>
 #include <string>
 #include <unordered_map>
 #include <utility>
@@ -74,20 +75,29 @@ namespace {
 
 enum class ConfigItem {
   absolute_paths_in_stderr,
+  background_cleanup,
   base_dir,
   cache_dir,
+  cache_dir_stripes,
+  cleanup_high_watermark,
+  cleanup_low_watermark,
+  compile_server,
   compiler,
   compiler_check,
   compiler_type,
   compression,
+  compression_dictionary,
   compression_level,
+  compression_threads,
   cpp_extension,
   debug,
   debug_dir,
   debug_level,
+  deferred_lru_update,
   depend_mode,
   direct_mode,
   disable,
+  eviction_policy,
   extra_files_to_hash,
   file_clone,
   hard_link,
@@ -96,8 +106,12 @@ enum class ConfigItem {
   ignore_options,
   inode_cache,
   keep_comments_cpp,
+  local_storage_layout,
   log_file,
+  lru_update_granularity,
   max_files,
+  max_manifest_includes,
+  max_manifest_results,
   max_size,
   msvc_dep_prefix,
   namespace_,
@@ -108,8 +122,12 @@ enum class ConfigItem {
   read_only,
   read_only_direct,
   recache,
+  remote_lookup_hedging,
+  remote_lookup_parallel,
   remote_only,
   remote_storage,
+  remote_upload_async,
+  remote_upload_spool_size,
   reshare,
   response_file_format,
   run_second_cpp,
@@ -131,20 +149,29 @@ struct ConfigKeyTableEntry
 const std::unordered_map<std::string, ConfigKeyTableEntry> k_config_key_table =
   {
     {"absolute_paths_in_stderr", {ConfigItem::absolute_paths_in_stderr}},
+    {"background_cleanup", {ConfigItem::background_cleanup}},
     {"base_dir", {ConfigItem::base_dir}},
     {"cache_dir", {ConfigItem::cache_dir}},
+    {"cache_dir_stripes", {ConfigItem::cache_dir_stripes}},
+    {"cleanup_high_watermark", {ConfigItem::cleanup_high_watermark}},
+    {"cleanup_low_watermark", {ConfigItem::cleanup_low_watermark}},
+    {"compile_server", {ConfigItem::compile_server}},
     {"compiler", {ConfigItem::compiler}},
     {"compiler_check", {ConfigItem::compiler_check}},
     {"compiler_type", {ConfigItem::compiler_type}},
     {"compression", {ConfigItem::compression}},
+    {"compression_dictionary", {ConfigItem::compression_dictionary}},
     {"compression_level", {ConfigItem::compression_level}},
+    {"compression_threads", {ConfigItem::compression_threads}},
     {"cpp_extension", {ConfigItem::cpp_extension}},
     {"debug", {ConfigItem::debug}},
     {"debug_dir", {ConfigItem::debug_dir}},
     {"debug_level", {ConfigItem::debug_level}},
+    {"deferred_lru_update", {ConfigItem::deferred_lru_update}},
     {"depend_mode", {ConfigItem::depend_mode}},
     {"direct_mode", {ConfigItem::direct_mode}},
     {"disable", {ConfigItem::disable}},
+    {"eviction_policy", {ConfigItem::eviction_policy}},
     {"extra_files_to_hash", {ConfigItem::extra_files_to_hash}},
     {"file_clone", {ConfigItem::file_clone}},
     {"hard_link", {ConfigItem::hard_link}},
@@ -153,8 +180,12 @@ const std::unordered_map<std::string, ConfigKeyTableEntry> k_config_key_table =
     {"ignore_options", {ConfigItem::ignore_options}},
     {"inode_cache", {ConfigItem::inode_cache}},
     {"keep_comments_cpp", {ConfigItem::keep_comments_cpp}},
+    {"local_storage_layout", {ConfigItem::local_storage_layout}},
     {"log_file", {ConfigItem::log_file}},
+    {"lru_update_granularity", {ConfigItem::lru_update_granularity}},
     {"max_files", {ConfigItem::max_files}},
+    {"max_manifest_includes", {ConfigItem::max_manifest_includes}},
+    {"max_manifest_results", {ConfigItem::max_manifest_results}},
     {"max_size", {ConfigItem::max_size}},
     {"msvc_dep_prefix", {ConfigItem::msvc_dep_prefix}},
     {"namespace", {ConfigItem::namespace_}},
@@ -165,8 +196,12 @@ const std::unordered_map<std::string, ConfigKeyTableEntry> k_config_key_table =
     {"read_only", {ConfigItem::read_only}},
     {"read_only_direct", {ConfigItem::read_only_direct}},
     {"recache", {ConfigItem::recache}},
+    {"remote_lookup_hedging", {ConfigItem::remote_lookup_hedging}},
+    {"remote_lookup_parallel", {ConfigItem::remote_lookup_parallel}},
     {"remote_only", {ConfigItem::remote_only}},
     {"remote_storage", {ConfigItem::remote_storage}},
+    {"remote_upload_async", {ConfigItem::remote_upload_async}},
+    {"remote_upload_spool_size", {ConfigItem::remote_upload_spool_size}},
     {"reshare", {ConfigItem::reshare}},
     {"response_file_format", {ConfigItem::response_file_format}},
     {"run_second_cpp", {ConfigItem::run_second_cpp}},
@@ -180,22 +215,31 @@ const std::unordered_map<std::string, ConfigKeyTableEntry> k_config_key_table =
 
 const std::unordered_map<std::string, std::string> k_env_variable_table = {
   {"ABSSTDERR", "absolute_paths_in_stderr"},
+  {"BACKGROUND_CLEANUP", "background_cleanup"},
   {"BASEDIR", "base_dir"},
   {"CC", "compiler"}, // Alias for CCACHE_COMPILER
+  {"CLEANUP_HIGH_WATERMARK", "cleanup_high_watermark"},
+  {"CLEANUP_LOW_WATERMARK", "cleanup_low_watermark"},
   {"COMMENTS", "keep_comments_cpp"},
   {"COMPILER", "compiler"},
   {"COMPILERCHECK", "compiler_check"},
   {"COMPILERTYPE", "compiler_type"},
+  {"COMPILE_SERVER", "compile_server"},
   {"COMPRESS", "compression"},
+  {"COMPRESSDICTIONARY", "compression_dictionary"},
   {"COMPRESSLEVEL", "compression_level"},
+  {"COMPRESSTHREADS", "compression_threads"},
   {"CPP2", "run_second_cpp"},
   {"DEBUG", "debug"},
   {"DEBUGDIR", "debug_dir"},
   {"DEBUGLEVEL", "debug_level"},
+  {"DEFERRED_LRU_UPDATE", "deferred_lru_update"},
   {"DEPEND", "depend_mode"},
   {"DIR", "cache_dir"},
   {"DIRECT", "direct_mode"},
+  {"DIR_STRIPES", "cache_dir_stripes"},
   {"DISABLE", "disable"},
+  {"EVICTION_POLICY", "eviction_policy"},
   {"EXTENSION", "cpp_extension"},
   {"EXTRAFILES", "extra_files_to_hash"},
   {"FILECLONE", "file_clone"},
@@ -204,8 +248,12 @@ const std::unordered_map<std::string, std::string> k_env_variable_table = {
   {"IGNOREHEADERS", "ignore_headers_in_manifest"},
   {"IGNOREOPTIONS", "ignore_options"},
   {"INODECACHE", "inode_cache"},
+  {"LOCAL_STORAGE_LAYOUT", "local_storage_layout"},
   {"LOGFILE", "log_file"},
+  {"LRU_UPDATE_GRANULARITY", "lru_update_granularity"},
   {"MAXFILES", "max_files"},
+  {"MAXMANIFESTINCLUDES", "max_manifest_includes"},
+  {"MAXMANIFESTRESULTS", "max_manifest_results"},
   {"MAXSIZE", "max_size"},
   {"MSVC_DEP_PREFIX", "msvc_dep_prefix"},
   {"NAMESPACE", "namespace"},
@@ -216,8 +264,12 @@ const std::unordered_map<std::string, std::string> k_env_variable_table = {
   {"READONLY", "read_only"},
   {"READONLY_DIRECT", "read_only_direct"},
   {"RECACHE", "recache"},
+  {"REMOTE_LOOKUP_HEDGING", "remote_lookup_hedging"},
+  {"REMOTE_LOOKUP_PARALLEL", "remote_lookup_parallel"},
   {"REMOTE_ONLY", "remote_only"},
   {"REMOTE_STORAGE", "remote_storage"},
+  {"REMOTE_UPLOAD_ASYNC", "remote_upload_async"},
+  {"REMOTE_UPLOAD_SPOOL_SIZE", "remote_upload_spool_size"},
   {"RESHARE", "reshare"},
   {"RESPONSE_FILE_FORMAT", "response_file_format"},
   {"SECONDARY_STORAGE", "remote_storage"}, // Alias for CCACHE_REMOTE_STORAGE
@@ -279,6 +331,17 @@ format_bool(bool value)
   return value ? "true" : "false";
 }
 
+std::string
+format_size(uint64_t value, util::SizeUnitPrefixType prefix_type)
+{
+  auto result = util::format_human_readable_size(value, prefix_type);
+  if (util::ends_with(result, " bytes")) {
+    // Special case to make the output parsable by util::parse_size.
+    result.resize(result.size() - 6);
+  }
+  return result;
+}
+
 CompilerType
 parse_compiler_type(const std::string& value)
 {
@@ -306,6 +369,30 @@ parse_compiler_type(const std::string& value)
   }
 }
 
+EvictionPolicy
+parse_eviction_policy(const std::string& value)
+{
+  if (value == "lru") {
+    return EvictionPolicy::lru;
+  } else if (value == "gdsf") {
+    return EvictionPolicy::gdsf;
+  } else {
+    throw core::Error(FMT("unknown eviction policy: \"{}\"", value));
+  }
+}
+
+LocalStorageLayout
+parse_local_storage_layout(const std::string& value)
+{
+  if (value == "files") {
+    return LocalStorageLayout::files;
+  } else if (value == "pack") {
+    return LocalStorageLayout::pack;
+  } else {
+    throw core::Error(FMT("unknown local storage layout: \"{}\"", value));
+  }
+}
+
 core::Sloppiness
 parse_sloppiness(const std::string& value)
 {
@@ -797,12 +884,27 @@ Config::get_string_value(const std::string& key) const
   case ConfigItem::absolute_paths_in_stderr:
     return format_bool(m_absolute_paths_in_stderr);
 
+  case ConfigItem::background_cleanup:
+    return format_bool(m_background_cleanup);
+
   case ConfigItem::base_dir:
     return util::pstr(m_base_dir);
 
   case ConfigItem::cache_dir:
     return m_cache_dir.string();
 
+  case ConfigItem::cache_dir_stripes:
+    return m_cache_dir_stripes;
+
+  case ConfigItem::cleanup_high_watermark:
+    return FMT("{}", m_cleanup_high_watermark);
+
+  case ConfigItem::cleanup_low_watermark:
+    return FMT("{}", m_cleanup_low_watermark);
+
+  case ConfigItem::compile_server:
+    return m_compile_server.string();
+
   case ConfigItem::compiler:
     return m_compiler;
 
@@ -815,9 +917,15 @@ Config::get_string_value(const std::string& key) const
   case ConfigItem::compression:
     return format_bool(m_compression);
 
+  case ConfigItem::compression_dictionary:
+    return FMT("{}", m_compression_dictionary);
+
   case ConfigItem::compression_level:
     return FMT("{}", m_compression_level);
 
+  case ConfigItem::compression_threads:
+    return FMT("{}", m_compression_threads);
+
   case ConfigItem::cpp_extension:
     return m_cpp_extension;
 
@@ -830,6 +938,9 @@ Config::get_string_value(const std::string& key) const
   case ConfigItem::debug_level:
     return FMT("{}", m_debug_level);
 
+  case ConfigItem::deferred_lru_update:
+    return format_bool(m_deferred_lru_update);
+
   case ConfigItem::depend_mode:
     return format_bool(m_depend_mode);
 
@@ -839,6 +950,9 @@ Config::get_string_value(const std::string& key) const
   case ConfigItem::disable:
     return format_bool(m_disable);
 
+  case ConfigItem::eviction_policy:
+    return m_eviction_policy == EvictionPolicy::gdsf ? "gdsf" : "lru";
+
   case ConfigItem::extra_files_to_hash:
     return m_extra_files_to_hash;
 
@@ -863,21 +977,27 @@ Config::get_string_value(const std::string& key) const
   case ConfigItem::keep_comments_cpp:
     return format_bool(m_keep_comments_cpp);
 
+  case ConfigItem::local_storage_layout:
+    return m_local_storage_layout == LocalStorageLayout::pack ? "pack"
+                                                              : "files";
+
   case ConfigItem::log_file:
     return m_log_file.string();
 
+  case ConfigItem::lru_update_granularity:
+    return FMT("{}s", m_lru_update_granularity);
+
   case ConfigItem::max_files:
     return FMT("{}", m_max_files);
 
-  case ConfigItem::max_size: {
-    auto result =
-      util::format_human_readable_size(m_max_size, m_size_prefix_type);
-    if (util::ends_with(result, " bytes")) {
-      // Special case to make the output parsable by util::parse_size.
-      result.resize(result.size() - 6);
-    }
-    return result;
-  }
+  case ConfigItem::max_manifest_includes:
+    return FMT("{}", m_max_manifest_includes);
+
+  case ConfigItem::max_manifest_results:
+    return FMT("{}", m_max_manifest_results);
+
+  case ConfigItem::max_size:
+    return format_size(m_max_size, m_size_prefix_type);
 
   case ConfigItem::msvc_dep_prefix:
     return m_msvc_dep_prefix;
@@ -906,12 +1026,24 @@ Config::get_string_value(const std::string& key) const
   case ConfigItem::recache:
     return format_bool(m_recache);
 
+  case ConfigItem::remote_lookup_hedging:
+    return format_bool(m_remote_lookup_hedging);
+
+  case ConfigItem::remote_lookup_parallel:
+    return format_bool(m_remote_lookup_parallel);
+
   case ConfigItem::remote_only:
     return format_bool(m_remote_only);
 
   case ConfigItem::remote_storage:
     return m_remote_storage;
 
+  case ConfigItem::remote_upload_async:
+    return format_bool(m_remote_upload_async);
+
+  case ConfigItem::remote_upload_spool_size:
+    return format_size(m_remote_upload_spool_size, m_size_prefix_type);
+
   case ConfigItem::reshare:
     return format_bool(m_reshare);
 
@@ -1026,6 +1158,10 @@ Config::set_item(const std::string& key,
     m_absolute_paths_in_stderr = parse_bool(value, env_var_key, negate);
     break;
 
+  case ConfigItem::background_cleanup:
+    m_background_cleanup = parse_bool(value, env_var_key, negate);
+    break;
+
   case ConfigItem::base_dir:
     m_base_dir = value;
     if (!m_base_dir.empty()) { // The empty string means "disable"
@@ -1038,6 +1174,26 @@ Config::set_item(const std::string& key,
     set_cache_dir(value);
     break;
 
+  case ConfigItem::cache_dir_stripes:
+    m_cache_dir_stripes = value;
+    break;
+
+  case ConfigItem::cleanup_high_watermark:
+    m_cleanup_high_watermark =
+      static_cast<uint8_t>(util::value_or_throw<core::Error>(
+        util::parse_unsigned(value, 1, 100, "cleanup_high_watermark")));
+    break;
+
+  case ConfigItem::cleanup_low_watermark:
+    m_cleanup_low_watermark =
+      static_cast<uint8_t>(util::value_or_throw<core::Error>(
+        util::parse_unsigned(value, 1, 100, "cleanup_low_watermark")));
+    break;
+
+  case ConfigItem::compile_server:
+    m_compile_server = value;
+    break;
+
   case ConfigItem::compiler:
     m_compiler = value;
     break;
@@ -1054,11 +1210,29 @@ Config::set_item(const std::string& key,
     m_compression = parse_bool(value, env_var_key, negate);
     break;
 
+  case ConfigItem::compression_dictionary:
+    m_compression_dictionary =
+      static_cast<uint32_t>(util::value_or_throw<core::Error>(
+        util::parse_unsigned(value,
+                             0,
+                             std::numeric_limits<uint32_t>::max(),
+                             "compression_dictionary")));
+    break;
+
   case ConfigItem::compression_level:
     m_compression_level = static_cast<int8_t>(util::value_or_throw<core::Error>(
       util::parse_signed(value, INT8_MIN, INT8_MAX, "compression_level")));
     break;
 
+  case ConfigItem::compression_threads:
+    m_compression_threads =
+      static_cast<uint32_t>(util::value_or_throw<core::Error>(
+        util::parse_unsigned(value,
+                             1,
+                             std::numeric_limits<uint32_t>::max(),
+                             "compression_threads")));
+    break;
+
   case ConfigItem::cpp_extension:
     m_cpp_extension = value;
     break;
@@ -1076,6 +1250,10 @@ Config::set_item(const std::string& key,
       util::parse_unsigned(value, 0, UINT8_MAX, "debug level")));
     break;
 
+  case ConfigItem::deferred_lru_update:
+    m_deferred_lru_update = parse_bool(value, env_var_key, negate);
+    break;
+
   case ConfigItem::depend_mode:
     m_depend_mode = parse_bool(value, env_var_key, negate);
     break;
@@ -1088,6 +1266,10 @@ Config::set_item(const std::string& key,
     m_disable = parse_bool(value, env_var_key, negate);
     break;
 
+  case ConfigItem::eviction_policy:
+    m_eviction_policy = parse_eviction_policy(value);
+    break;
+
   case ConfigItem::extra_files_to_hash:
     m_extra_files_to_hash = value;
     break;
@@ -1120,15 +1302,42 @@ Config::set_item(const std::string& key,
     m_keep_comments_cpp = parse_bool(value, env_var_key, negate);
     break;
 
+  case ConfigItem::local_storage_layout:
+    m_local_storage_layout = parse_local_storage_layout(value);
+    break;
+
   case ConfigItem::log_file:
     m_log_file = value;
     break;
 
+  case ConfigItem::lru_update_granularity:
+    m_lru_update_granularity =
+      util::value_or_throw<core::Error>(util::parse_duration(value));
+    break;
+
   case ConfigItem::max_files:
     m_max_files = util::value_or_throw<core::Error>(
       util::parse_unsigned(value, std::nullopt, std::nullopt, "max_files"));
     break;
 
+  case ConfigItem::max_manifest_includes:
+    m_max_manifest_includes =
+      static_cast<uint32_t>(util::value_or_throw<core::Error>(
+        util::parse_unsigned(value,
+                             1,
+                             std::numeric_limits<uint32_t>::max(),
+                             "max_manifest_includes")));
+    break;
+
+  case ConfigItem::max_manifest_results:
+    m_max_manifest_results =
+      static_cast<uint32_t>(util::value_or_throw<core::Error>(
+        util::parse_unsigned(value,
+                             1,
+                             std::numeric_limits<uint32_t>::max(),
+                             "max_manifest_results")));
+    break;
+
   case ConfigItem::max_size: {
     const auto [size, prefix_type] =
       util::value_or_throw<core::Error>(util::parse_size(value));
@@ -1173,6 +1382,14 @@ Config::set_item(const std::string& key,
     m_recache = parse_bool(value, env_var_key, negate);
     break;
 
+  case ConfigItem::remote_lookup_hedging:
+    m_remote_lookup_hedging = parse_bool(value, env_var_key, negate);
+    break;
+
+  case ConfigItem::remote_lookup_parallel:
+    m_remote_lookup_parallel = parse_bool(value, env_var_key, negate);
+    break;
+
   case ConfigItem::remote_only:
     m_remote_only = parse_bool(value, env_var_key, negate);
     break;
@@ -1181,6 +1398,15 @@ Config::set_item(const std::string& key,
     m_remote_storage = value;
     break;
 
+  case ConfigItem::remote_upload_async:
+    m_remote_upload_async = parse_bool(value, env_var_key, negate);
+    break;
+
+  case ConfigItem::remote_upload_spool_size:
+    m_remote_upload_spool_size =
+      util::value_or_throw<core::Error>(util::parse_size(value)).first;
+    break;
+
   case ConfigItem::reshare:
     m_reshare = parse_bool(value, env_var_key, negate);
     break;
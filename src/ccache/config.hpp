@@ -49,6 +49,10 @@ enum class CompilerType {
 
 std::string compiler_type_to_string(CompilerType compiler_type);
 
+enum class EvictionPolicy { lru, gdsf };
+
+enum class LocalStorageLayout { files, pack };
+
 class Config : util::NonCopyable
 {
 public:
@@ -58,20 +62,29 @@ public:
 
   bool absolute_paths_in_stderr() const;
   Args::ResponseFileFormat response_file_format() const;
+  bool background_cleanup() const;
   const std::filesystem::path& base_dir() const;
   const std::filesystem::path& cache_dir() const;
+  const std::string& cache_dir_stripes() const;
+  uint8_t cleanup_high_watermark() const;
+  uint8_t cleanup_low_watermark() const;
+  const std::filesystem::path& compile_server() const;
   const std::string& compiler() const;
   const std::string& compiler_check() const;
   CompilerType compiler_type() const;
   bool compression() const;
+  uint32_t compression_dictionary() const;
   int8_t compression_level() const;
+  uint32_t compression_threads() const;
   const std::string& cpp_extension() const;
   bool debug() const;
   const std::filesystem::path& debug_dir() const;
   uint8_t debug_level() const;
+  bool deferred_lru_update() const;
   bool depend_mode() const;
   bool direct_mode() const;
   bool disable() const;
+  EvictionPolicy eviction_policy() const;
   const std::string& extra_files_to_hash() const;
   bool file_clone() const;
   bool hard_link() const;
@@ -80,8 +93,12 @@ public:
   const std::string& ignore_options() const;
   bool inode_cache() const;
   bool keep_comments_cpp() const;
+  LocalStorageLayout local_storage_layout() const;
   const std::filesystem::path& log_file() const;
+  uint64_t lru_update_granularity() const;
   uint64_t max_files() const;
+  uint32_t max_manifest_includes() const;
+  uint32_t max_manifest_results() const;
   uint64_t max_size() const;
   const std::string& msvc_dep_prefix() const;
   const std::string& path() const;
@@ -91,8 +108,12 @@ public:
   bool read_only() const;
   bool read_only_direct() const;
   bool recache() const;
+  bool remote_lookup_hedging() const;
+  bool remote_lookup_parallel() const;
   bool remote_only() const;
   const std::string& remote_storage() const;
+  bool remote_upload_async() const;
+  uint64_t remote_upload_spool_size() const;
   bool reshare() const;
   bool run_second_cpp() const;
   core::Sloppiness sloppiness() const;
@@ -175,20 +196,29 @@ private:
   bool m_absolute_paths_in_stderr = false;
   Args::ResponseFileFormat m_response_file_format =
     Args::ResponseFileFormat::auto_guess;
+  bool m_background_cleanup = false;
   std::filesystem::path m_base_dir;
   std::filesystem::path m_cache_dir;
+  std::string m_cache_dir_stripes;
+  uint8_t m_cleanup_high_watermark = 100; // Percent
+  uint8_t m_cleanup_low_watermark = 90;   // Percent
+  std::filesystem::path m_compile_server;
   std::string m_compiler;
   std::string m_compiler_check = "mtime";
   CompilerType m_compiler_type = CompilerType::auto_guess;
   bool m_compression = true;
+  uint32_t m_compression_dictionary = 0; // No dictionary
   int8_t m_compression_level = 0; // Use default level
+  uint32_t m_compression_threads = 1;
   std::string m_cpp_extension;
   bool m_debug = false;
   std::filesystem::path m_debug_dir;
   uint8_t m_debug_level = 2;
+  bool m_deferred_lru_update = false;
   bool m_depend_mode = false;
   bool m_direct_mode = true;
   bool m_disable = false;
+  EvictionPolicy m_eviction_policy = EvictionPolicy::lru;
   std::string m_extra_files_to_hash;
   bool m_file_clone = false;
   bool m_hard_link = false;
@@ -202,8 +232,12 @@ private:
   bool m_inode_cache = false;
 #endif
   bool m_keep_comments_cpp = false;
+  LocalStorageLayout m_local_storage_layout = LocalStorageLayout::files;
   std::filesystem::path m_log_file;
+  uint64_t m_lru_update_granularity = 0;
   uint64_t m_max_files = 0;
+  uint32_t m_max_manifest_includes = 10000;
+  uint32_t m_max_manifest_results = 100;
   uint64_t m_max_size = 5ULL * 1024 * 1024 * 1024;
   std::string m_msvc_dep_prefix = "Note: including file:";
   std::string m_path;
@@ -215,8 +249,12 @@ private:
   bool m_recache = false;
   bool m_reshare = false;
   bool m_run_second_cpp = true;
+  bool m_remote_lookup_hedging = false;
+  bool m_remote_lookup_parallel = false;
   bool m_remote_only = false;
   std::string m_remote_storage;
+  bool m_remote_upload_async = false;
+  uint64_t m_remote_upload_spool_size = 1024 * 1024 * 1024;
   core::Sloppiness m_sloppiness;
   bool m_stats = true;
   std::filesystem::path m_stats_log;
@@ -254,6 +292,12 @@ Config::response_file_format() const
                                   : Args::ResponseFileFormat::posix;
 }
 
+inline bool
+Config::background_cleanup() const
+{
+  return m_background_cleanup;
+}
+
 inline const std::filesystem::path&
 Config::base_dir() const
 {
@@ -266,6 +310,30 @@ Config::cache_dir() const
   return m_cache_dir;
 }
 
+inline const std::string&
+Config::cache_dir_stripes() const
+{
+  return m_cache_dir_stripes;
+}
+
+inline uint8_t
+Config::cleanup_high_watermark() const
+{
+  return m_cleanup_high_watermark;
+}
+
+inline uint8_t
+Config::cleanup_low_watermark() const
+{
+  return m_cleanup_low_watermark;
+}
+
+inline const std::filesystem::path&
+Config::compile_server() const
+{
+  return m_compile_server;
+}
+
 inline const std::string&
 Config::compiler() const
 {
@@ -312,12 +380,24 @@ Config::compression() const
   return m_compression;
 }
 
+inline uint32_t
+Config::compression_dictionary() const
+{
+  return m_compression_dictionary;
+}
+
 inline int8_t
 Config::compression_level() const
 {
   return m_compression_level;
 }
 
+inline uint32_t
+Config::compression_threads() const
+{
+  return m_compression_threads;
+}
+
 inline const std::string&
 Config::cpp_extension() const
 {
@@ -342,6 +422,12 @@ Config::debug_level() const
   return m_debug_level;
 }
 
+inline bool
+Config::deferred_lru_update() const
+{
+  return m_deferred_lru_update;
+}
+
 inline bool
 Config::depend_mode() const
 {
@@ -360,6 +446,12 @@ Config::disable() const
   return m_disable;
 }
 
+inline EvictionPolicy
+Config::eviction_policy() const
+{
+  return m_eviction_policy;
+}
+
 inline const std::string&
 Config::extra_files_to_hash() const
 {
@@ -408,18 +500,42 @@ Config::keep_comments_cpp() const
   return m_keep_comments_cpp;
 }
 
+inline LocalStorageLayout
+Config::local_storage_layout() const
+{
+  return m_local_storage_layout;
+}
+
 inline const std::filesystem::path&
 Config::log_file() const
 {
   return m_log_file;
 }
 
+inline uint64_t
+Config::lru_update_granularity() const
+{
+  return m_lru_update_granularity;
+}
+
 inline uint64_t
 Config::max_files() const
 {
   return m_max_files;
 }
 
+inline uint32_t
+Config::max_manifest_includes() const
+{
+  return m_max_manifest_includes;
+}
+
+inline uint32_t
+Config::max_manifest_results() const
+{
+  return m_max_manifest_results;
+}
+
 inline uint64_t
 Config::max_size() const
 {
@@ -486,6 +602,18 @@ Config::run_second_cpp() const
   return m_run_second_cpp;
 }
 
+inline bool
+Config::remote_lookup_hedging() const
+{
+  return m_remote_lookup_hedging;
+}
+
+inline bool
+Config::remote_lookup_parallel() const
+{
+  return m_remote_lookup_parallel;
+}
+
 inline bool
 Config::remote_only() const
 {
@@ -498,6 +626,18 @@ Config::remote_storage() const
   return m_remote_storage;
 }
 
+inline bool
+Config::remote_upload_async() const
+{
+  return m_remote_upload_async;
+}
+
+inline uint64_t
+Config::remote_upload_spool_size() const
+{
+  return m_remote_upload_spool_size;
+}
+
 inline core::Sloppiness
 Config::sloppiness() const
 {
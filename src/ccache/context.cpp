@@ -18,6 +18,7 @@
 
 #include "context.hpp"
 
+#include <ccache/core/compressiondictionary.hpp>
 #include <ccache/hashutil.hpp>
 #include <ccache/signalhandler.hpp>
 #include <ccache/util/file.hpp>
@@ -51,14 +52,15 @@ Context::Context()
 }
 
 void
-Context::initialize(Args&& compiler_and_args,
-                    const std::vector<std::string>& cmdline_config_settings)
+Context::initialize(Args&& compiler_and_args)
 {
   orig_args = std::move(compiler_and_args);
-  config.read(cmdline_config_settings);
   util::logging::init(config.debug(), config.log_file());
   ignore_header_paths =
     util::split_path_list(config.ignore_headers_in_manifest());
+  manifest.set_limits(config.max_manifest_results(),
+                      config.max_manifest_includes());
+  core::set_compression_dictionary_dir(config.cache_dir() / "dictionaries");
   set_ignore_options(util::split_into_strings(config.ignore_options(), " "));
 
   // Set default umask for all files created by ccache from now on (if
@@ -73,6 +75,14 @@ Context::initialize(Args&& compiler_and_args,
   }
 }
 
+void
+Context::refresh_invocation_state()
+{
+  actual_cwd = fs::current_path().value_or("");
+  apparent_cwd = util::apparent_cwd(actual_cwd);
+  time_of_invocation = util::TimePoint::now();
+}
+
 Context::~Context()
 {
   unlink_pending_tmp_files();
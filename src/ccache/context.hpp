@@ -50,10 +50,13 @@ public:
   Context();
   ~Context();
 
-  // Read configuration, initialize logging, etc. Typically not called from unit
-  // tests.
-  void initialize(Args&& compiler_and_args,
-                  const std::vector<std::string>& cmdline_config_settings);
+  // Initialize logging, etc. after the configuration has been read. Typically
+  // not called from unit tests.
+  void initialize(Args&& compiler_and_args);
+
+  // Update the working directories and time of invocation of a context created
+  // before the invocation, e.g. by a compile server.
+  void refresh_invocation_state();
 
   ArgsInfo args_info;
   Config config;
@@ -21,6 +21,7 @@
 #include <ccache/ccache.hpp>
 #include <ccache/core/cacheentrydatareader.hpp>
 #include <ccache/core/cacheentrydatawriter.hpp>
+#include <ccache/core/compressiondictionary.hpp>
 #include <ccache/core/exceptions.hpp>
 #include <ccache/core/result.hpp>
 #include <ccache/core/types.hpp>
@@ -45,8 +46,10 @@ const size_t k_static_header_fields_size =
   + sizeof(core::CacheEntry::Header::entry_type)
   + sizeof(core::CacheEntry::Header::compression_type)
   + sizeof(core::CacheEntry::Header::compression_level)
+  + sizeof(core::CacheEntry::Header::dictionary_id)
   + sizeof(core::CacheEntry::Header::self_contained)
   + sizeof(core::CacheEntry::Header::creation_time)
+  + sizeof(core::CacheEntry::Header::compile_duration)
   + sizeof(core::CacheEntry::Header::entry_size)
   // ccache_version length field:
   + 1
@@ -55,6 +58,24 @@ const size_t k_static_header_fields_size =
 
 const size_t k_epilogue_fields_size = sizeof(uint64_t) + sizeof(uint64_t);
 
+// Smaller payloads are compressed in one thread since the overhead of starting
+// worker threads outweighs the gain.
+const uint32_t k_min_multithreaded_compression_size = 4 * 1024 * 1024;
+
+const util::ZstdDictionary*
+dictionary_for_decompression(uint32_t dictionary_id)
+{
+  if (dictionary_id == 0) {
+    return nullptr;
+  }
+  const auto dictionary = core::get_compression_dictionary(dictionary_id);
+  if (!dictionary) {
+    throw core::Error(
+      FMT("Compression dictionary {} is not available", dictionary_id));
+  }
+  return dictionary;
+}
+
 core::CacheEntryType
 cache_entry_type_from_int(const uint8_t entry_type)
 {
@@ -81,7 +102,10 @@ namespace core {
 //   - The checksum is now for the (potentially) compressed payload instead of
 //     the uncompressed payload, and the checksum is now always stored
 //     uncompressed.
-const uint8_t CacheEntry::k_format_version = 1;
+// Version 2:
+//   - Added dictionary_id field.
+//   - Added compile_duration field.
+const uint8_t CacheEntry::k_format_version = 2;
 
 CacheEntry::Header::Header(const Config& config,
                            core::CacheEntryType entry_type_)
@@ -90,9 +114,13 @@ CacheEntry::Header::Header(const Config& config,
     entry_type(entry_type_),
     compression_type(compression_type_from_config(config)),
     compression_level(compression_level_from_config(config)),
+    dictionary_id(compression_type == CompressionType::zstd
+                    ? config.compression_dictionary()
+                    : 0),
     self_contained(entry_type != CacheEntryType::result
                    || !core::Result::Serializer::use_raw_files(config)),
     creation_time(util::TimePoint::now().sec()),
+    compile_duration(0),
     ccache_version(CCACHE_VERSION),
     namespace_(config.namespace_()),
     entry_size(0)
@@ -105,6 +133,9 @@ CacheEntry::Header::Header(const Config& config,
   } else {
     LOG("Using Zstandard with compression level {}", compression_level);
   }
+  if (dictionary_id != 0) {
+    LOG("Using Zstandard dictionary {} for small payloads", dictionary_id);
+  }
 }
 
 CacheEntry::Header::Header(nonstd::span<const uint8_t> data)
@@ -129,8 +160,10 @@ CacheEntry::Header::inspect() const
                 to_string(entry_type));
   result += FMT("Compression type: {}\n", to_string(compression_type));
   result += FMT("Compression level: {}\n", compression_level);
+  result += FMT("Dictionary ID: {}\n", dictionary_id);
   result += FMT("Self-contained: {}\n", self_contained ? "yes" : "no");
   result += FMT("Creation time: {}\n", creation_time);
+  result += FMT("Compile duration: {} ms\n", compile_duration);
   result += FMT("Ccache version: {}\n", ccache_version);
   result += FMT("Namespace: {}\n", namespace_);
   result += FMT("Entry size: {}\n", entry_size);
@@ -155,8 +188,10 @@ CacheEntry::Header::parse(nonstd::span<const uint8_t> data)
   entry_type = cache_entry_type_from_int(reader.read_int<uint8_t>());
   compression_type = compression_type_from_int(reader.read_int<uint8_t>());
   reader.read_int(compression_level);
+  reader.read_int(dictionary_id);
   self_contained = bool(reader.read_int<uint8_t>());
   reader.read_int(creation_time);
+  reader.read_int(compile_duration);
   ccache_version = reader.read_str(reader.read_int<uint8_t>());
   namespace_ = reader.read_str(reader.read_int<uint8_t>());
   reader.read_int(entry_size);
@@ -178,8 +213,10 @@ CacheEntry::Header::serialize(util::Bytes& output) const
   writer.write_int(static_cast<uint8_t>(entry_type));
   writer.write_int(static_cast<uint8_t>(compression_type));
   writer.write_int(compression_level);
+  writer.write_int(dictionary_id);
   writer.write_int<uint8_t>(self_contained);
   writer.write_int(creation_time);
+  writer.write_int(compile_duration);
   writer.write_int(static_cast<uint8_t>(ccache_version.length()));
   writer.write_str(ccache_version);
   writer.write_int(static_cast<uint8_t>(namespace_.length()));
@@ -204,19 +241,6 @@ CacheEntry::CacheEntry(nonstd::span<const uint8_t> data) : m_header(data)
   m_payload =
     data.subspan(m_header.serialized_size(), data.size() - non_payload_size);
   m_checksum = data.last(k_epilogue_fields_size);
-
-  switch (m_header.compression_type) {
-  case CompressionType::none:
-    break;
-
-  case CompressionType::zstd:
-    m_uncompressed_payload.reserve(m_header.uncompressed_payload_size());
-    util::throw_on_error<core::Error>(
-      util::zstd_decompress(
-        m_payload, m_uncompressed_payload, m_uncompressed_payload.capacity()),
-      "Cache entry payload decompression error: ");
-    break;
-  }
 }
 
 void
@@ -246,30 +270,108 @@ CacheEntry::header() const
 nonstd::span<const uint8_t>
 CacheEntry::payload() const
 {
-  return m_header.compression_type == CompressionType::none
-           ? m_payload
-           : nonstd::span<const uint8_t>(m_uncompressed_payload);
+  switch (m_header.compression_type) {
+  case CompressionType::none:
+    return m_payload;
+
+  case CompressionType::zstd:
+    if (m_uncompressed_payload.empty()) {
+      m_uncompressed_payload.reserve(m_header.uncompressed_payload_size());
+      util::throw_on_error<core::Error>(
+        util::zstd_decompress(
+          m_payload,
+          m_uncompressed_payload,
+          m_uncompressed_payload.capacity(),
+          dictionary_for_decompression(m_header.dictionary_id)),
+        "Cache entry payload decompression error: ");
+    }
+    break;
+  }
+
+  return m_uncompressed_payload;
+}
+
+CacheEntry::PayloadReader
+CacheEntry::payload_reader() const
+{
+  return PayloadReader(
+    m_payload, m_header.compression_type, m_header.dictionary_id);
+}
+
+CacheEntry::PayloadReader::PayloadReader(nonstd::span<const uint8_t> payload,
+                                         CompressionType compression_type,
+                                         uint32_t dictionary_id)
+  : m_reader(payload)
+{
+  if (compression_type == CompressionType::zstd) {
+    m_decompressor = std::make_unique<util::ZstdDecompressor>(
+      payload, dictionary_for_decompression(dictionary_id));
+  }
+}
+
+bool
+CacheEntry::PayloadReader::decompresses() const
+{
+  return bool(m_decompressor);
+}
+
+nonstd::span<const uint8_t>
+CacheEntry::PayloadReader::read_bytes(size_t size)
+{
+  if (!m_decompressor) {
+    return m_reader.read_bytes(size);
+  }
+
+  m_buffer.resize(size);
+  const auto bytes_read = util::value_or_throw<core::Error>(
+    m_decompressor->read(m_buffer),
+    "Cache entry payload decompression error: ");
+  if (bytes_read != size) {
+    throw core::Error(FMT("Cache entry payload underflow of {} bytes",
+                          size - bytes_read));
+  }
+  return m_buffer;
 }
 
 util::Bytes
 CacheEntry::serialize(const CacheEntry::Header& header,
-                      Serializer& payload_serializer)
+                      Serializer& payload_serializer,
+                      uint32_t compression_threads)
 {
+  const uint32_t payload_size = payload_serializer.serialized_size();
+  if (payload_size < k_min_multithreaded_compression_size) {
+    compression_threads = 1;
+  }
   return do_serialize(
     header,
-    payload_serializer.serialized_size(),
-    [&payload_serializer](util::Bytes& result, const CacheEntry::Header& hdr) {
+    payload_size,
+    [&](util::Bytes& result, const CacheEntry::Header& hdr) {
       switch (hdr.compression_type) {
       case CompressionType::none:
         payload_serializer.serialize(result);
         break;
 
       case CompressionType::zstd:
-        util::Bytes payload;
-        payload_serializer.serialize(payload);
+        // Compress while serializing to avoid keeping the whole uncompressed
+        // payload in memory.
+        if (compression_threads > 1) {
+          LOG("Compressing with {} threads", compression_threads);
+        }
+        util::ZstdCompressor compressor(
+          result,
+          hdr.compression_level,
+          compression_threads,
+          hdr.dictionary_id != 0
+            ? get_compression_dictionary(hdr.dictionary_id)
+            : nullptr);
+        payload_serializer.serialize_in_chunks(
+          [&](nonstd::span<const uint8_t> data) {
+            util::throw_on_error<core::Error>(
+              compressor.write(data),
+              "Cache entry payload compression error: ");
+          });
         util::throw_on_error<core::Error>(
-          util::zstd_compress(payload, result, hdr.compression_level),
-          "Cache entry payload compression error: ");
+          compressor.finish(), "Cache entry payload compression error: ");
         break;
       }
     });
@@ -290,7 +392,12 @@ CacheEntry::serialize(const CacheEntry::Header& header,
 
       case CompressionType::zstd:
         util::throw_on_error<core::Error>(
-          util::zstd_compress(payload, result, hdr.compression_level),
+          util::zstd_compress(payload,
+                              result,
+                              hdr.compression_level,
+                              hdr.dictionary_id != 0
+                                ? get_compression_dictionary(hdr.dictionary_id)
+                                : nullptr),
           "Cache entry payload compression error: ");
         break;
       }
@@ -318,6 +425,17 @@ CacheEntry::do_serialize(
           hdr.compression_level);
     }
     hdr.compression_level = level;
+  } else {
+    hdr.dictionary_id = 0;
+  }
+
+  if (hdr.dictionary_id != 0) {
+    if (serialized_payload_size > max_dictionary_payload_size) {
+      hdr.dictionary_id = 0;
+    } else if (!get_compression_dictionary(hdr.dictionary_id)) {
+      LOG("Compressing without unavailable dictionary {}", hdr.dictionary_id);
+      hdr.dictionary_id = 0;
+    }
   }
 
   const size_t max_serialized_size =
@@ -18,15 +18,19 @@
 
 #pragma once
 
+#include <ccache/core/cacheentrydatareader.hpp>
 #include <ccache/core/serializer.hpp>
 #include <ccache/core/types.hpp>
 #include <ccache/util/bytes.hpp>
+#include <ccache/util/conversion.hpp>
+#include <ccache/util/zstd.hpp>
 
 #include <nonstd/span.hpp>
 
 #include <cstdint>
 #include <filesystem>
 #include <functional>
+#include <memory>
 #include <string>
 
 // Cache entry format
@@ -36,7 +40,8 @@
 //
 // <entry>            ::= <header> <payload> <epilogue>
 // <header>           ::= <magic> <format_ver> <entry_type> <compr_type>
-//                        <compr_level> <creation_time> <ccache_ver> <namespace>
+//                        <compr_level> <dictionary_id> <creation_time>
+//                        <compile_duration> <ccache_ver> <namespace>
 //                        <entry_size>
 // <magic>            ::= uint16_t (0xccac)
 // <format_ver>       ::= uint8_t
@@ -48,7 +53,10 @@
 // <compr_none>       ::= 0 (uint8_t)
 // <compr_zstd>       ::= 1 (uint8_t)
 // <compr_level>      ::= int8_t
+// <dictionary_id>    ::= uint32_t ; Zstandard dictionary ID, 0 for none
 // <creation_time>    ::= uint64_t (Unix epoch time when entry was created)
+// <compile_duration> ::= uint32_t ; milliseconds it took to produce the entry,
+//                        0 if unknown
 // <ccache_ver>       ::= string length (uint8_t) + string data
 // <namespace>        ::= string length (uint8_t) + string data
 // <entry_size>       ::= uint64_t ; = size of entry in uncompressed form
@@ -69,6 +77,10 @@ public:
   static const uint8_t k_format_version;
   constexpr static uint8_t default_compression_level = 1;
 
+  // A dictionary mainly helps when compressing small payloads, so larger
+  // payloads are compressed without one.
+  constexpr static uint32_t max_dictionary_payload_size = 256 * 1024;
+
   class Header
   {
   public:
@@ -83,8 +95,10 @@ public:
     CacheEntryType entry_type;
     CompressionType compression_type;
     int8_t compression_level;
+    uint32_t dictionary_id;
     bool self_contained;
     uint64_t creation_time;
+    uint32_t compile_duration; // Milliseconds
     std::string ccache_version;
     std::string namespace_;
     uint64_t entry_size;
@@ -97,16 +111,47 @@ public:
     void parse(nonstd::span<const uint8_t> data);
   };
 
+  // Reads an uncompressed payload incrementally. A compressed payload is
+  // decompressed on demand so that only the data being read is kept in memory.
+  class PayloadReader
+  {
+  public:
+    explicit PayloadReader(
+      nonstd::span<const uint8_t> payload,
+      CompressionType compression_type = CompressionType::none,
+      uint32_t dictionary_id = 0);
+
+    // Whether the payload is decompressed while being read.
+    bool decompresses() const;
+
+    // Read `size` bytes. The returned data is valid until the next call.
+    // Throws `core::Error` on failure.
+    nonstd::span<const uint8_t> read_bytes(size_t size);
+
+    // Read an integer. Throws `core::Error` on failure.
+    template<typename T> T read_int();
+
+  private:
+    CacheEntryDataReader m_reader;
+    std::unique_ptr<util::ZstdDecompressor> m_decompressor;
+    util::Bytes m_buffer;
+  };
+
   explicit CacheEntry(nonstd::span<const uint8_t> data);
 
   void verify_checksum() const;
   const Header& header() const;
 
-  // Return uncompressed payload.
+  // Return uncompressed payload. A compressed payload is decompressed in full
+  // on the first call; use payload_reader() to avoid that.
   nonstd::span<const uint8_t> payload() const;
 
+  PayloadReader payload_reader() const;
+
+  // Compress with `compression_threads` threads if the payload is large.
   static util::Bytes serialize(const Header& header,
-                               Serializer& payload_serializer);
+                               Serializer& payload_serializer,
+                               uint32_t compression_threads = 1);
   static util::Bytes serialize(const Header& header,
                                nonstd::span<const uint8_t> payload);
 
@@ -124,4 +169,14 @@ private:
                  serialize_payload);
 };
 
+template<typename T>
+inline T
+CacheEntry::PayloadReader::read_int()
+{
+  const auto buffer = read_bytes(sizeof(T));
+  T value;
+  util::big_endian_to_int(buffer.data(), value);
+  return value;
+}
+
 } // namespace core
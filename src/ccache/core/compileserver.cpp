@@ -0,0 +1,808 @@
+// Copyright (C) 2025 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "compileserver.hpp"
+
+#include <ccache/ccache.hpp>
+#include <ccache/config.hpp>
+#include <ccache/context.hpp>
+#include <ccache/core/cacheentrydatareader.hpp>
+#include <ccache/core/cacheentrydatawriter.hpp>
+#include <ccache/core/exceptions.hpp>
+#include <ccache/util/bytes.hpp>
+#include <ccache/util/conversion.hpp>
+#include <ccache/util/fd.hpp>
+#include <ccache/util/file.hpp>
+#include <ccache/util/filesystem.hpp>
+#include <ccache/util/format.hpp>
+#include <ccache/util/logging.hpp>
+#include <ccache/util/path.hpp>
+#include <ccache/util/process.hpp>
+#include <ccache/util/string.hpp>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h> // NOLINT: sigaction et al are defined in signal.h
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifndef environ
+extern char** environ;
+#endif
+
+// Compile server protocol
+// =======================
+//
+// Integers are big-endian.
+//
+// The client sends one request, passing its stdin, stdout and stderr file
+// descriptors as SCM_RIGHTS ancillary data with the first byte:
+//
+// <request>      ::= <request_size> <version> <umask> <cwd> <args> <env>
+// <request_size> ::= uint32_t ; size of the rest of the request
+// <version>      ::= uint8_t
+// <umask>        ::= uint32_t
+// <cwd>          ::= <string>
+// <args>         ::= <n_strings> <string>*
+// <env>          ::= <n_strings> <string>*
+// <n_strings>    ::= uint32_t
+// <string>       ::= <length> <bytes>
+// <length>       ::= uint32_t
+//
+// The server answers with the status of the compilation when the worker
+// process has exited:
+//
+// <response>     ::= <status_type> <status>
+// <status_type>  ::= uint8_t ; 0 = exited, 1 = killed by signal
+// <status>       ::= int32_t ; exit code or signal number
+
+namespace fs = util::filesystem;
+
+namespace core {
+
+namespace {
+
+const uint8_t k_protocol_version = 1;
+
+// Upper bound of a request to guard against garbage from a misbehaving peer.
+const uint32_t k_max_request_size = 16 * 1024 * 1024;
+
+const size_t k_number_of_forwarded_fds = 3; // stdin, stdout, stderr
+
+const size_t k_response_size = 1 + 4;
+
+const uint8_t k_status_exited = 0;
+const uint8_t k_status_signaled = 1;
+
+// How long a worker waits for the connected client to send its request.
+const int k_request_timeout_sec = 5;
+
+// Written to the self-pipe by the signal handler.
+const char k_child_exited_event = 'c';
+const char k_termination_event = 't';
+
+int g_self_pipe_write_fd = -1;
+
+struct Request
+{
+  mode_t umask = 0;
+  std::string cwd;
+  std::vector<std::string> args;
+  std::vector<std::string> env;
+};
+
+struct Job
+{
+  util::Fd connection;
+  // Read end of a pipe closed by the worker when it has received the request.
+  // Until then, the connection is readable because of the pending request.
+  util::Fd receiving;
+  pid_t pid = -1;
+  bool killed = false;
+};
+
+sockaddr_un
+make_socket_address(const fs::path& socket_path)
+{
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  const auto path = util::pstr(socket_path).str();
+  if (path.length() >= sizeof(address.sun_path)) {
+    throw Error(FMT("compile server socket path is too long: {}", path));
+  }
+  std::memcpy(address.sun_path, path.c_str(), path.length() + 1);
+  return address;
+}
+
+util::Fd
+connect_to_server(const fs::path& socket_path)
+{
+  const auto address = make_socket_address(socket_path);
+  util::Fd fd(socket(AF_UNIX, SOCK_STREAM, 0));
+  if (!fd) {
+    return {};
+  }
+  util::set_cloexec_flag(*fd);
+  if (connect(*fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address))
+      != 0) {
+    return {};
+  }
+  return fd;
+}
+
+bool
+read_exactly(int fd, void* buffer, size_t size)
+{
+  size_t bytes_read = 0;
+  while (bytes_read < size) {
+    const auto n =
+      read(fd, static_cast<uint8_t*>(buffer) + bytes_read, size - bytes_read);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    bytes_read += static_cast<size_t>(n);
+  }
+  return true;
+}
+
+void
+write_string(CacheEntryDataWriter& writer, std::string_view string)
+{
+  writer.write_int(static_cast<uint32_t>(string.length()));
+  writer.write_str(string);
+}
+
+std::string
+read_string(CacheEntryDataReader& reader)
+{
+  return std::string(reader.read_str(reader.read_int<uint32_t>()));
+}
+
+void
+write_strings(CacheEntryDataWriter& writer,
+              const std::vector<std::string>& strings)
+{
+  writer.write_int(static_cast<uint32_t>(strings.size()));
+  for (const auto& string : strings) {
+    write_string(writer, string);
+  }
+}
+
+std::vector<std::string>
+read_strings(CacheEntryDataReader& reader)
+{
+  std::vector<std::string> result;
+  const auto count = reader.read_int<uint32_t>();
+  for (uint32_t i = 0; i < count; ++i) {
+    result.push_back(read_string(reader));
+  }
+  return result;
+}
+
+util::Bytes
+serialize_request(const Request& request)
+{
+  util::Bytes payload;
+  CacheEntryDataWriter payload_writer(payload);
+  payload_writer.write_int(k_protocol_version);
+  payload_writer.write_int(static_cast<uint32_t>(request.umask));
+  write_string(payload_writer, request.cwd);
+  write_strings(payload_writer, request.args);
+  write_strings(payload_writer, request.env);
+
+  util::Bytes output;
+  CacheEntryDataWriter writer(output);
+  writer.write_int(static_cast<uint32_t>(payload.size()));
+  writer.write_bytes(payload);
+  return output;
+}
+
+Request
+deserialize_request(nonstd::span<const uint8_t> payload)
+{
+  CacheEntryDataReader reader(payload);
+  const auto version = reader.read_int<uint8_t>();
+  if (version != k_protocol_version) {
+    throw Error(FMT("unknown compile server protocol version: {} != {}",
+                    version,
+                    k_protocol_version));
+  }
+  Request request;
+  request.umask = static_cast<mode_t>(reader.read_int<uint32_t>());
+  request.cwd = read_string(reader);
+  request.args = read_strings(reader);
+  request.env = read_strings(reader);
+  return request;
+}
+
+bool
+send_request(int socket_fd, const util::Bytes& request)
+{
+  const int fds[k_number_of_forwarded_fds] = {
+    STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+
+  union
+  {
+    char buffer[CMSG_SPACE(sizeof(fds))];
+    cmsghdr align;
+  } control{};
+
+  iovec iov{};
+  iov.iov_base = const_cast<uint8_t*>(request.data());
+  iov.iov_len = request.size();
+
+  msghdr message{};
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control.buffer;
+  message.msg_controllen = sizeof(control.buffer);
+
+  cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  std::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  ssize_t sent;
+  do {
+    sent = sendmsg(socket_fd, &message, 0);
+  } while (sent == -1 && errno == EINTR);
+  if (sent <= 0) {
+    return false;
+  }
+  return static_cast<size_t>(sent) == request.size()
+         || util::write_fd(
+           socket_fd, request.data() + sent, request.size() - sent);
+}
+
+// Receive a request and the file descriptors passed with it. Returns false if
+// the peer didn't send a complete and valid request.
+bool
+receive_request(int socket_fd, Request& request, std::vector<util::Fd>& fds)
+{
+  uint8_t size_buffer[4];
+
+  union
+  {
+    char buffer[CMSG_SPACE(sizeof(int) * k_number_of_forwarded_fds)];
+    cmsghdr align;
+  } control{};
+
+  iovec iov{};
+  iov.iov_base = size_buffer;
+  iov.iov_len = sizeof(size_buffer);
+
+  msghdr message{};
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control.buffer;
+  message.msg_controllen = sizeof(control.buffer);
+
+  ssize_t received;
+  do {
+    received = recvmsg(socket_fd, &message, MSG_WAITALL);
+  } while (received == -1 && errno == EINTR);
+
+  for (cmsghdr* cmsg = CMSG_FIRSTHDR(&message); cmsg;
+       cmsg = CMSG_NXTHDR(&message, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      const size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      for (size_t i = 0; i < count; ++i) {
+        int fd;
+        std::memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+        util::set_cloexec_flag(fd);
+        fds.emplace_back(fd);
+      }
+    }
+  }
+
+  if (received != sizeof(size_buffer) || (message.msg_flags & MSG_CTRUNC)
+      || fds.size() != k_number_of_forwarded_fds) {
+    LOG_RAW("Compile server: Received incomplete request");
+    return false;
+  }
+
+  uint32_t size;
+  util::big_endian_to_int(size_buffer, size);
+  if (size > k_max_request_size) {
+    LOG("Compile server: Too large request ({} bytes)", size);
+    return false;
+  }
+
+  util::Bytes payload(size);
+  if (!read_exactly(socket_fd, payload.data(), payload.size())) {
+    LOG_RAW("Compile server: Received truncated request");
+    return false;
+  }
+
+  try {
+    request = deserialize_request(payload);
+  } catch (const Error& e) {
+    LOG("Compile server: Invalid request: {}", e.what());
+    return false;
+  }
+  return true;
+}
+
+bool
+peer_is_trusted(int socket_fd)
+{
+#ifdef SO_PEERCRED
+  ucred credentials{};
+  socklen_t length = sizeof(credentials);
+  if (getsockopt(socket_fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length)
+      != 0) {
+    LOG("Compile server: getsockopt failed: {}", strerror(errno));
+    return false;
+  }
+  if (credentials.uid != getuid()) {
+    LOG("Compile server: Rejecting connection from uid {}", credentials.uid);
+    return false;
+  }
+  return true;
+#else
+  // Rely on the permissions of the socket file.
+  (void)socket_fd;
+  return true;
+#endif
+}
+
+void
+on_signal(int signum)
+{
+  const int saved_errno = errno;
+  const char event =
+    signum == SIGCHLD ? k_child_exited_event : k_termination_event;
+  std::ignore = write(g_self_pipe_write_fd, &event, 1);
+  errno = saved_errno;
+}
+
+const int k_termination_signals[] = {SIGINT, SIGTERM, SIGHUP};
+
+void
+set_signal_handler(int signum, void (*handler)(int))
+{
+  struct sigaction act = {};
+  act.sa_handler = handler;
+  sigemptyset(&act.sa_mask);
+  act.sa_flags = SA_RESTART;
+  sigaction(signum, &act, nullptr);
+}
+
+void
+restore_default_signal_handlers()
+{
+  for (int signum : k_termination_signals) {
+    set_signal_handler(signum, SIG_DFL);
+  }
+  set_signal_handler(SIGCHLD, SIG_DFL);
+  set_signal_handler(SIGPIPE, SIG_DFL);
+}
+
+// Return the entries of `env` that affect the configuration, sorted.
+std::vector<std::string>
+get_config_environment(const std::vector<std::string>& env)
+{
+  std::vector<std::string> result;
+  for (const auto& entry : env) {
+    if (util::starts_with(entry, "CCACHE_") || util::starts_with(entry, "HOME=")
+        || util::starts_with(entry, "XDG_CACHE_HOME=")
+        || util::starts_with(entry, "XDG_CONFIG_HOME=")
+        || util::starts_with(entry, "XDG_RUNTIME_DIR=")) {
+      result.push_back(entry);
+    }
+  }
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+// Receive the request on `connection`, set up the worker process to look like
+// the client and run the compilation. Called in the forked worker process.
+[[noreturn]] void
+run_worker(util::Fd connection,
+           util::Fd received,
+           std::unique_ptr<Context>& prepared_ctx,
+           const std::vector<std::string>& server_config_env,
+           const CompilationHandler& handler)
+{
+  restore_default_signal_handlers();
+
+  timeval timeout{};
+  timeout.tv_sec = k_request_timeout_sec;
+  setsockopt(*connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  Request request;
+  std::vector<util::Fd> fds;
+  if (!receive_request(*connection, request, fds)) {
+    _exit(EXIT_FAILURE);
+  }
+  connection.close();
+  received.close(); // Let the server watch the connection.
+  if (request.args.empty()) {
+    LOG_RAW("Compile server: Received request without arguments");
+    _exit(EXIT_FAILURE);
+  }
+
+  for (size_t i = 0; i < fds.size(); ++i) {
+    const int target_fd = static_cast<int>(i);
+    if (*fds[i] == target_fd) {
+      std::ignore = fds[i].release();
+      fcntl(target_fd, F_SETFD, 0); // Clear FD_CLOEXEC.
+    } else {
+      dup2(*fds[i], target_fd);
+      fds[i].close();
+    }
+  }
+
+  if (chdir(request.cwd.c_str()) != 0) {
+    PRINT(stderr,
+          "ccache: error: compile server failed to change directory to {}:"
+          " {}\n",
+          request.cwd,
+          strerror(errno));
+    _exit(EXIT_FAILURE);
+  }
+
+  // The strings must live as long as the process since environ refers to them.
+  static std::vector<std::string> env_strings;
+  static std::vector<char*> env_pointers;
+  env_strings = request.env;
+  for (auto& string : env_strings) {
+    env_pointers.push_back(string.data());
+  }
+  env_pointers.push_back(nullptr);
+  environ = env_pointers.data();
+
+  util::set_umask(request.umask);
+
+  std::vector<const char*> argv;
+  for (const auto& arg : request.args) {
+    argv.push_back(arg.c_str());
+  }
+  argv.push_back(nullptr);
+  const int argc = static_cast<int>(request.args.size());
+
+  int exit_code;
+  try {
+    // Use the state prepared by the server unless the client's configuration
+    // may differ from the server's.
+    const auto config_settings = split_argv(argc, argv.data()).config_settings;
+    std::unique_ptr<Context> ctx;
+    if (config_settings.empty()
+        && get_config_environment(request.env) == server_config_env) {
+      ctx = std::move(prepared_ctx);
+      ctx->refresh_invocation_state();
+    } else {
+      LOG_RAW("Compile server: Reading configuration of client");
+      ctx = std::make_unique<Context>();
+      ctx->config.read(config_settings);
+    }
+    exit_code = handler(std::move(ctx), argc, argv.data());
+  } catch (const ErrorBase& e) {
+    PRINT(stderr, "ccache: error: {}\n", e.what());
+    exit_code = EXIT_FAILURE;
+  }
+  fflush(nullptr);
+  exit(exit_code);
+}
+
+void
+send_response(int socket_fd, int wait_status)
+{
+  util::Bytes response;
+  CacheEntryDataWriter writer(response);
+  if (WIFSIGNALED(wait_status)) {
+    writer.write_int(k_status_signaled);
+    writer.write_int(static_cast<int32_t>(WTERMSIG(wait_status)));
+  } else {
+    writer.write_int(k_status_exited);
+    writer.write_int(static_cast<int32_t>(WEXITSTATUS(wait_status)));
+  }
+  std::ignore = util::write_fd(socket_fd, response.data(), response.size());
+}
+
+void
+handle_connection(util::Fd connection,
+                  std::vector<util::Fd>& server_fds,
+                  std::vector<Job>& jobs,
+                  std::unique_ptr<Context>& prepared_ctx,
+                  const std::vector<std::string>& server_config_env,
+                  const CompilationHandler& handler)
+{
+  util::set_cloexec_flag(*connection);
+
+  if (!peer_is_trusted(*connection)) {
+    return;
+  }
+
+  int pipe_fds[2];
+  if (pipe(pipe_fds) != 0) {
+    LOG("Compile server: Failed to create pipe: {}", strerror(errno));
+    return;
+  }
+  util::Fd receiving(pipe_fds[0]);
+  util::Fd received(pipe_fds[1]);
+  util::set_cloexec_flag(*receiving);
+  util::set_cloexec_flag(*received);
+
+#ifdef INODE_CACHE_SUPPORTED
+  prepared_ctx->inode_cache.prepare();
+#endif
+
+  fflush(nullptr);
+  const pid_t pid = fork();
+  if (pid == -1) {
+    LOG("Compile server: fork failed: {}", strerror(errno));
+    return;
+  }
+  if (pid == 0) {
+    for (auto& fd : server_fds) {
+      fd.close();
+    }
+    for (auto& job : jobs) {
+      job.connection.close();
+      job.receiving.close();
+    }
+    receiving.close();
+    run_worker(std::move(connection),
+               std::move(received),
+               prepared_ctx,
+               server_config_env,
+               handler);
+  }
+
+  LOG("Compile server: Started worker {}", pid);
+  jobs.push_back(Job{std::move(connection), std::move(receiving), pid});
+}
+
+void
+reap_workers(std::vector<Job>& jobs)
+{
+  int status;
+  pid_t pid = -1;
+  while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+    const auto it =
+      std::find_if(jobs.begin(), jobs.end(), [&](const auto& job) {
+        return job.pid == pid;
+      });
+    if (it == jobs.end()) {
+      continue;
+    }
+    if (!it->killed) {
+      send_response(*it->connection, status);
+    }
+    jobs.erase(it);
+  }
+}
+
+} // namespace
+
+std::optional<int>
+forward_to_compile_server(const Config& config,
+                          int argc,
+                          const char* const* argv)
+{
+  if (config.disable() || config.compile_server().empty()) {
+    return std::nullopt;
+  }
+
+  const auto cwd = fs::current_path();
+  if (!cwd) {
+    return std::nullopt;
+  }
+
+  const util::Fd connection = connect_to_server(config.compile_server());
+  if (!connection) {
+    // No server running, so compile in-process.
+    return std::nullopt;
+  }
+
+  Request request;
+  request.umask = util::get_umask();
+  request.cwd = util::pstr(*cwd).str();
+  for (int i = 0; i < argc; ++i) {
+    request.args.emplace_back(argv[i]);
+  }
+  for (char** env = environ; *env; ++env) {
+    request.env.emplace_back(*env);
+  }
+
+  if (!send_request(*connection, serialize_request(request))) {
+    // The server has not started the compilation, so it's safe to compile
+    // in-process.
+    return std::nullopt;
+  }
+
+  uint8_t response[k_response_size];
+  if (!read_exactly(*connection, response, sizeof(response))) {
+    throw Fatal("lost connection to compile server");
+  }
+  CacheEntryDataReader reader(response);
+  const auto status_type = reader.read_int<uint8_t>();
+  const auto status = reader.read_int<int32_t>();
+  if (status_type == k_status_signaled) {
+    // Die the same way as the worker did.
+    signal(status, SIG_DFL);
+    kill(getpid(), status);
+    return 128 + status;
+  }
+  return status;
+}
+
+void
+run_compile_server(const Config& config, const CompilationHandler& handler)
+{
+  const auto& socket_path = config.compile_server();
+  if (socket_path.empty()) {
+    throw Error("compile_server is not configured");
+  }
+
+  const auto address = make_socket_address(socket_path);
+
+  if (connect_to_server(socket_path)) {
+    throw Error(
+      FMT("a compile server is already listening on {}", socket_path));
+  }
+  // A stale socket file from a server that didn't exit cleanly prevents bind.
+  util::remove(socket_path, util::LogFailure::no);
+
+  util::Fd listen_fd(socket(AF_UNIX, SOCK_STREAM, 0));
+  if (!listen_fd) {
+    throw Error(FMT("failed to create socket: {}", strerror(errno)));
+  }
+  util::set_cloexec_flag(*listen_fd);
+
+  {
+    // Only the owner may connect to the socket.
+    const auto original_umask = util::set_umask(077);
+    const int result = bind(*listen_fd,
+                            reinterpret_cast<const sockaddr*>(&address),
+                            sizeof(address));
+    util::set_umask(original_umask);
+    if (result != 0) {
+      throw Error(
+        FMT("failed to bind to {}: {}", socket_path, strerror(errno)));
+    }
+  }
+  if (listen(*listen_fd, SOMAXCONN) != 0) {
+    throw Error(
+      FMT("failed to listen on {}: {}", socket_path, strerror(errno)));
+  }
+
+  int pipe_fds[2];
+  if (pipe(pipe_fds) != 0) {
+    throw Error(FMT("failed to create pipe: {}", strerror(errno)));
+  }
+  std::vector<util::Fd> server_fds;
+  server_fds.emplace_back(std::move(listen_fd));
+  server_fds.emplace_back(pipe_fds[0]);
+  server_fds.emplace_back(pipe_fds[1]);
+  for (const auto& fd : server_fds) {
+    util::set_cloexec_flag(*fd);
+  }
+  fcntl(pipe_fds[1], F_SETFL, fcntl(pipe_fds[1], F_GETFL) | O_NONBLOCK);
+  g_self_pipe_write_fd = pipe_fds[1];
+
+  for (int signum : k_termination_signals) {
+    set_signal_handler(signum, on_signal);
+  }
+  set_signal_handler(SIGCHLD, on_signal);
+  set_signal_handler(SIGPIPE, SIG_IGN);
+
+  // State inherited by all workers. Config can't be copied, so the
+  // configuration is read again.
+  auto prepared_ctx = std::make_unique<Context>();
+  prepared_ctx->config.read();
+  prepared_ctx->storage.initialize();
+  prepared_ctx->storage.create_backends();
+  std::vector<std::string> server_env;
+  for (char** env = environ; *env; ++env) {
+    server_env.emplace_back(*env);
+  }
+  const auto server_config_env = get_config_environment(server_env);
+
+  LOG("Compile server: Listening on {}", socket_path);
+
+  std::vector<Job> jobs;
+  bool terminating = false;
+
+  while (!terminating || !jobs.empty()) {
+    std::vector<pollfd> poll_fds;
+    poll_fds.push_back({*server_fds[1], POLLIN, 0});
+    if (!terminating) {
+      poll_fds.push_back({*server_fds[0], POLLIN, 0});
+    }
+    const size_t first_job_index = poll_fds.size();
+    for (const auto& job : jobs) {
+      // A connection becomes readable (EOF) when the client goes away.
+      const int fd = job.killed    ? -1
+                     : job.receiving ? *job.receiving
+                                     : *job.connection;
+      poll_fds.push_back({fd, POLLIN, 0});
+    }
+
+    if (poll(poll_fds.data(), poll_fds.size(), -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw Error(FMT("poll failed: {}", strerror(errno)));
+    }
+
+    if (poll_fds[0].revents & POLLIN) {
+      char events[64];
+      const auto n = read(*server_fds[1], events, sizeof(events));
+      for (ssize_t i = 0; i < n; ++i) {
+        if (events[i] == k_termination_event && !terminating) {
+          LOG_RAW("Compile server: Terminating");
+          terminating = true;
+          server_fds[0].close();
+          util::remove(socket_path, util::LogFailure::no);
+        }
+      }
+    }
+
+    for (size_t i = first_job_index; i < poll_fds.size(); ++i) {
+      auto& job = jobs[i - first_job_index];
+      if (poll_fds[i].revents != 0 && job.receiving) {
+        job.receiving.close();
+      } else if (poll_fds[i].revents != 0 && !job.killed) {
+        LOG("Compile server: Client of worker {} went away; killing it",
+            job.pid);
+        kill(job.pid, SIGTERM);
+        job.killed = true;
+      }
+    }
+
+    reap_workers(jobs);
+
+    if (!terminating && (poll_fds[1].revents & POLLIN)) {
+      util::Fd connection(accept(*server_fds[0], nullptr, nullptr));
+      if (connection) {
+        handle_connection(std::move(connection),
+                          server_fds,
+                          jobs,
+                          prepared_ctx,
+                          server_config_env,
+                          handler);
+      } else if (errno != EINTR && errno != ECONNABORTED) {
+        LOG("Compile server: accept failed: {}", strerror(errno));
+      }
+    }
+  }
+
+  for (int signum : k_termination_signals) {
+    set_signal_handler(signum, SIG_DFL);
+  }
+  set_signal_handler(SIGCHLD, SIG_DFL);
+  g_self_pipe_write_fd = -1;
+}
+
+} // namespace core
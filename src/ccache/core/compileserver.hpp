@@ -0,0 +1,57 @@
+// Copyright (C) 2025 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <optional>
+
+class Config;
+class Context;
+
+namespace core {
+
+// The compile server is an opt-in long-lived ccache process listening on the
+// Unix socket configured by `compile_server`. A ccache invocation that finds a
+// server forwards its argument vector, environment, working directory, umask
+// and standard file descriptors to it and waits for the exit status. The server
+// reads the configuration and sets up storage backends and the inode cache
+// once, and forks a worker for each compilation so that the worker starts out
+// from that state and any in-process state is isolated between compilations.
+
+using CompilationHandler = std::function<int(
+  std::unique_ptr<Context> ctx, int argc, const char* const* argv)>;
+
+// Forward the compilation described by `argc` and `argv` to the compile server,
+// if configured in `config` and running. Returns the exit code of the
+// compilation, or std::nullopt if the compilation should be performed
+// in-process. Throws core::Fatal if the connection to the server is lost after
+// the compilation has been handed over.
+std::optional<int> forward_to_compile_server(const Config& config,
+                                             int argc,
+                                             const char* const* argv);
+
+// Serve forwarded compilations until SIGINT, SIGTERM or SIGHUP is received.
+// `handler` is called in a forked worker process for each compilation with a
+// context whose configuration has been read. Throws core::Error on failure to
+// set up the listening socket.
+void run_compile_server(const Config& config,
+                        const CompilationHandler& handler);
+
+} // namespace core
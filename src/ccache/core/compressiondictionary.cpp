@@ -0,0 +1,98 @@
+// Copyright (C) 2025 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "compressiondictionary.hpp"
+
+#include <ccache/util/file.hpp>
+#include <ccache/util/filesystem.hpp>
+#include <ccache/util/format.hpp>
+#include <ccache/util/logging.hpp>
+#include <ccache/util/zstd.hpp>
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace fs = util::filesystem;
+
+namespace {
+
+std::mutex g_mutex;
+fs::path g_dictionary_dir;
+
+// Dictionaries that failed to load are stored as nullptr so that they are only
+// looked for once.
+std::unordered_map<uint32_t, std::unique_ptr<util::ZstdDictionary>>
+  g_dictionaries;
+
+} // namespace
+
+namespace core {
+
+void
+set_compression_dictionary_dir(const fs::path& dir)
+{
+  std::lock_guard<std::mutex> lock(g_mutex);
+  if (dir != g_dictionary_dir) {
+    g_dictionary_dir = dir;
+    g_dictionaries.clear();
+  }
+}
+
+fs::path
+get_compression_dictionary_path(uint32_t id)
+{
+  std::lock_guard<std::mutex> lock(g_mutex);
+  return g_dictionary_dir / FMT("{}.dict", id);
+}
+
+const util::ZstdDictionary*
+get_compression_dictionary(uint32_t id)
+{
+  std::lock_guard<std::mutex> lock(g_mutex);
+  const auto it = g_dictionaries.find(id);
+  if (it != g_dictionaries.end()) {
+    return it->second.get();
+  }
+
+  auto& dictionary = g_dictionaries[id];
+  if (g_dictionary_dir.empty()) {
+    return nullptr;
+  }
+  const auto path = g_dictionary_dir / FMT("{}.dict", id);
+  auto data = util::read_file<util::Bytes>(path);
+  if (!data) {
+    LOG("Failed to read compression dictionary {}: {}", path, data.error());
+    return nullptr;
+  }
+  auto loaded = util::ZstdDictionary::create(std::move(*data));
+  if (!loaded) {
+    LOG("Failed to load compression dictionary {}: {}", path, loaded.error());
+    return nullptr;
+  }
+  if ((*loaded)->id() != id) {
+    LOG(
+      "Compression dictionary {} has unexpected ID {}", path, (*loaded)->id());
+    return nullptr;
+  }
+  LOG("Loaded compression dictionary {}", path);
+  dictionary = std::move(*loaded);
+  return dictionary.get();
+}
+
+} // namespace core
@@ -0,0 +1,41 @@
+// Copyright (C) 2025 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+
+namespace util {
+class ZstdDictionary;
+}
+
+namespace core {
+
+// Compression dictionaries are stored as `<id>.dict` in a directory that is set
+// up once per process, normally the `dictionaries` subdirectory of the cache
+// directory.
+void set_compression_dictionary_dir(const std::filesystem::path& dir);
+
+std::filesystem::path get_compression_dictionary_path(uint32_t id);
+
+// Return the dictionary with ID `id`, loading it on first use, or nullptr if it
+// isn't available. Thread-safe.
+const util::ZstdDictionary* get_compression_dictionary(uint32_t id);
+
+} // namespace core
@@ -20,7 +20,10 @@
 
 #include <ccache/ccache.hpp>
 #include <ccache/config.hpp>
+#include <ccache/context.hpp>
 #include <ccache/core/cacheentry.hpp>
+#include <ccache/core/compileserver.hpp>
+#include <ccache/core/compressiondictionary.hpp>
 #include <ccache/core/exceptions.hpp>
 #include <ccache/core/filerecompressor.hpp>
 #include <ccache/core/manifest.hpp>
@@ -32,7 +35,9 @@
 #include <ccache/hash.hpp>
 #include <ccache/inodecache.hpp>
 #include <ccache/progressbar.hpp>
+#include <ccache/storage/latencyfile.hpp>
 #include <ccache/storage/local/localstorage.hpp>
+#include <ccache/storage/local/statsfile.hpp>
 #include <ccache/storage/storage.hpp>
 #include <ccache/util/assertions.hpp>
 #include <ccache/util/cpu.hpp>
@@ -109,6 +114,9 @@ Common options:
                                size counters (normally not needed as this is
                                done automatically)
     -C, --clear                clear the cache completely (except configuration)
+        --compile-server       serve compilations on the socket specified by
+                               the compile_server configuration option until
+                               terminated
         --config-path PATH     operate on configuration file PATH instead of the
                                default
     -d, --dir PATH             operate on cache directory PATH instead of the
@@ -118,6 +126,10 @@ Common options:
         --evict-older-than AGE remove files used less recently than AGE
                                (unsigned integer with a d (days) or s (seconds)
                                suffix)
+        --maintenance-threads THREADS
+                               use up to THREADS threads for --cleanup, --clear,
+                               --evict-* and --show-compression; default: number
+                               of CPUs
     -F, --max-files NUM        set maximum number of files in cache to NUM (use
                                0 for no limit)
     -M, --max-size SIZE        set maximum size of cache to SIZE (use 0 for no
@@ -139,6 +151,8 @@ Common options:
     -s, --show-stats           show summary of configuration and statistics
                                counters in human-readable format (use
                                -v/--verbose once or twice for more details)
+        --train-dictionary     train a compression dictionary on small cache
+                               entries (see compression_dictionary)
     -v, --verbose              increase verbosity
     -z, --zero-stats           zero statistics counters
 
@@ -181,6 +195,7 @@ Options for scripting or debugging:
         --print-stats          print statistics counter IDs and corresponding
                                values in machine-parsable format
         --print-version        print version only
+        --upload-spooled       upload entries spooled for remote storage
 
 See also the manual on <https://ccache.dev/documentation.html>.
 )";
@@ -228,17 +243,15 @@ inspect_path(const fs::path& path)
   core::CacheEntry cache_entry(*cache_entry_data);
   std::ignore = fputs(cache_entry.header().inspect().c_str(), stdout);
 
-  const auto payload = cache_entry.payload();
-
   switch (cache_entry.header().entry_type) {
   case core::CacheEntryType::manifest: {
     core::Manifest manifest;
-    manifest.read(payload);
+    manifest.read(cache_entry.payload());
     manifest.inspect(stdout);
     break;
   }
   case core::CacheEntryType::result:
-    Result::Deserializer result_deserializer(payload);
+    Result::Deserializer result_deserializer(cache_entry);
     ResultInspector result_inspector(stdout);
     result_deserializer.visit(result_inspector);
     break;
@@ -249,6 +262,36 @@ inspect_path(const fs::path& path)
   return EXIT_SUCCESS;
 }
 
+static void
+print_remote_lookup_latencies(const Config& config)
+{
+  const auto histograms =
+    storage::LatencyFile(storage::get_latency_file_path(config)).read();
+  if (histograms.empty()) {
+    return;
+  }
+
+  using C = util::TextTable::Cell;
+  util::TextTable table;
+  table.add_heading("Remote storage lookup latency:");
+  for (const auto& [url, histogram] : histograms) {
+    table.add_row({
+      FMT("  {}:", url),
+      C(FMT("{:.1f} ms", histogram.mean_ms())).right_align(),
+      "mean,",
+      C(FMT("< {:.0f} ms", histogram.quantile_ms(0.9))).right_align(),
+      "p90,",
+      C(histogram.count()).right_align(),
+      "lookups,",
+      C(histogram.hits()).right_align(),
+      "hits,",
+      C(histogram.misses()).right_align(),
+      "misses",
+    });
+  }
+  PRINT_RAW(stdout, table.render());
+}
+
 static void
 print_compression_statistics(const Config& config,
                              const storage::local::CompressionStatistics& cs)
@@ -333,7 +376,8 @@ trim_dir(const std::string& dir,
       }
       initial_size += de.size_on_disk();
       const auto name = de.path().filename();
-      if (name == "ccache.conf" || name == "stats") {
+      if (name == "ccache.conf"
+          || storage::local::StatsFile::is_stats_file_name(name)) {
         throw Fatal(
           FMT("this looks like a local cache directory (found {})", de.path()));
       }
@@ -435,6 +479,7 @@ get_usage_text(const std::string_view ccache_name)
 
 enum {
   CHECKSUM_FILE,
+  COMPILE_SERVER,
   CONFIG_PATH,
   DUMP_MANIFEST,
   DUMP_RESULT,
@@ -444,16 +489,19 @@ enum {
   FORMAT,
   HASH_FILE,
   INSPECT,
+  MAINTENANCE_THREADS,
   PRINT_LOG_STATS,
   PRINT_STATS,
   PRINT_VERSION,
   RECOMPRESS_THREADS,
   SHOW_LOG_STATS,
+  TRAIN_DICTIONARY,
   TRIM_DIR,
   TRIM_MAX_SIZE,
   TRIM_METHOD,
   TRIM_RECOMPRESS,
   TRIM_RECOMPRESS_THREADS,
+  UPLOAD_SPOOLED,
 };
 
 const char options_string[] = "cCd:k:hF:M:po:svVxX:z";
@@ -461,6 +509,7 @@ const option long_options[] = {
   {"checksum-file", required_argument, nullptr, CHECKSUM_FILE},
   {"cleanup", no_argument, nullptr, 'c'},
   {"clear", no_argument, nullptr, 'C'},
+  {"compile-server", no_argument, nullptr, COMPILE_SERVER},
   {"config-path", required_argument, nullptr, CONFIG_PATH},
   {"dir", required_argument, nullptr, 'd'},
   {"directory", required_argument, nullptr, 'd'},               // bwd compat
@@ -474,6 +523,7 @@ const option long_options[] = {
   {"hash-file", required_argument, nullptr, HASH_FILE},
   {"help", no_argument, nullptr, 'h'},
   {"inspect", required_argument, nullptr, INSPECT},
+  {"maintenance-threads", required_argument, nullptr, MAINTENANCE_THREADS},
   {"max-files", required_argument, nullptr, 'F'},
   {"max-size", required_argument, nullptr, 'M'},
   {"print-log-stats", no_argument, nullptr, PRINT_LOG_STATS},
@@ -486,6 +536,7 @@ const option long_options[] = {
   {"show-config", no_argument, nullptr, 'p'},
   {"show-log-stats", no_argument, nullptr, SHOW_LOG_STATS},
   {"show-stats", no_argument, nullptr, 's'},
+  {"train-dictionary", no_argument, nullptr, TRAIN_DICTIONARY},
   {"trim-dir", required_argument, nullptr, TRIM_DIR},
   {"trim-max-size", required_argument, nullptr, TRIM_MAX_SIZE},
   {"trim-method", required_argument, nullptr, TRIM_METHOD},
@@ -494,6 +545,7 @@ const option long_options[] = {
    required_argument,
    nullptr,
    TRIM_RECOMPRESS_THREADS},
+  {"upload-spooled", no_argument, nullptr, UPLOAD_SPOOLED},
   {"verbose", no_argument, nullptr, 'v'},
   {"version", no_argument, nullptr, 'V'},
   {"zero-stats", no_argument, nullptr, 'z'},
@@ -516,6 +568,7 @@ process_main_options(int argc, const char* const* argv)
   std::optional<std::string> evict_namespace;
   std::optional<uint64_t> evict_max_age;
 
+  uint32_t maintenance_threads = std::thread::hardware_concurrency();
   uint32_t recompress_threads = std::thread::hardware_concurrency();
 
   // First pass: Handle non-command options that affect command options.
@@ -546,6 +599,12 @@ process_main_options(int argc, const char* const* argv)
       util::setenv("CCACHE_CONFIGPATH", arg);
       break;
 
+    case MAINTENANCE_THREADS:
+      maintenance_threads =
+        static_cast<uint32_t>(util::value_or_throw<Error>(util::parse_unsigned(
+          arg, 1, std::numeric_limits<uint32_t>::max(), "threads")));
+      break;
+
     case RECOMPRESS_THREADS:
       recompress_threads =
         static_cast<uint32_t>(util::value_or_throw<Error>(util::parse_unsigned(
@@ -594,6 +653,7 @@ process_main_options(int argc, const char* const* argv)
     Config config;
     config.read();
     util::logging::init(config.debug(), config.log_file());
+    set_compression_dictionary_dir(config.cache_dir() / "dictionaries");
 
     util::UmaskScope umask_scope(config.umask());
 
@@ -603,6 +663,7 @@ process_main_options(int argc, const char* const* argv)
     case CONFIG_PATH:
     case 'd': // --dir
     case FORMAT:
+    case MAINTENANCE_THREADS:
     case RECOMPRESS_THREADS:
     case TRIM_MAX_SIZE:
     case TRIM_METHOD:
@@ -625,6 +686,17 @@ process_main_options(int argc, const char* const* argv)
       break;
     }
 
+    case COMPILE_SERVER:
+#ifdef _WIN32
+      throw Error("the compile server is not supported on Windows");
+#else
+      // Don't keep debug logs in memory since they would be inherited by all
+      // workers.
+      util::logging::init(false, config.log_file());
+      run_compile_server(config, cache_compilation);
+      break;
+#endif
+
     case EVICT_NAMESPACE: {
       evict_namespace = arg;
       break;
@@ -651,9 +723,7 @@ process_main_options(int argc, const char* const* argv)
       }
       ResultExtractor result_extractor(".", get_raw_file_path);
       core::CacheEntry cache_entry(*cache_entry_data);
-      const auto payload = cache_entry.payload();
-
-      Result::Deserializer result_deserializer(payload);
+      Result::Deserializer result_deserializer(cache_entry);
       result_deserializer.visit(result_extractor);
       cache_entry.verify_checksum();
       return EXIT_SUCCESS;
@@ -691,7 +761,8 @@ process_main_options(int argc, const char* const* argv)
     {
       ProgressBar progress_bar("Cleaning...");
       storage::local::LocalStorage(config).clean_all(
-        [&](double progress) { progress_bar.update(progress); });
+        [&](double progress) { progress_bar.update(progress); },
+        maintenance_threads);
       if (isatty(STDOUT_FILENO)) {
         PRINT_RAW(stdout, "\n");
       }
@@ -702,7 +773,8 @@ process_main_options(int argc, const char* const* argv)
     {
       ProgressBar progress_bar("Clearing...");
       storage::local::LocalStorage(config).wipe_all(
-        [&](double progress) { progress_bar.update(progress); });
+        [&](double progress) { progress_bar.update(progress); },
+        maintenance_threads);
       if (isatty(STDOUT_FILENO)) {
         PRINT_RAW(stdout, "\n");
       }
@@ -794,6 +866,28 @@ process_main_options(int argc, const char* const* argv)
       PRINT_RAW(stdout,
                 statistics.format_human_readable(
                   config, last_updated, verbosity, false));
+      if (verbosity > 0) {
+        print_remote_lookup_latencies(config);
+      }
+      break;
+    }
+
+    case TRAIN_DICTIONARY: {
+      ProgressBar progress_bar("Training...");
+      const auto dictionary =
+        storage::local::LocalStorage(config).train_compression_dictionary(
+          [&](double progress) { progress_bar.update(progress); });
+      if (isatty(STDOUT_FILENO)) {
+        PRINT_RAW(stdout, "\n");
+      }
+      PRINT(stdout,
+            "Trained dictionary {} ({}) on {} cache entries\n"
+            "Set compression_dictionary to {} to use it\n",
+            dictionary.id,
+            util::format_human_readable_size(dictionary.size,
+                                             config.size_unit_prefix_type()),
+            dictionary.samples,
+            dictionary.id);
       break;
     }
 
@@ -809,6 +903,14 @@ process_main_options(int argc, const char* const* argv)
                trim_recompress_threads);
       break;
 
+    case UPLOAD_SPOOLED: {
+      storage::Storage storage(config);
+      storage.initialize();
+      storage.upload_spooled_entries(true);
+      storage.finalize();
+      break;
+    }
+
     case 'V': // --version
     {
       PRINT_RAW(stdout,
@@ -825,7 +927,8 @@ process_main_options(int argc, const char* const* argv)
       ProgressBar progress_bar("Scanning...");
       const auto compression_statistics =
         storage::local::LocalStorage(config).get_compression_statistics(
-          [&](double progress) { progress_bar.update(progress); });
+          [&](double progress) { progress_bar.update(progress); },
+          maintenance_threads);
       if (isatty(STDOUT_FILENO)) {
         PRINT_RAW(stdout, "\n\n");
       }
@@ -847,6 +950,7 @@ process_main_options(int argc, const char* const* argv)
 
     case 'z': // --zero-stats
       storage::local::LocalStorage(config).zero_all_statistics();
+      util::remove(storage::get_latency_file_path(config));
       PRINT_RAW(stdout, "Statistics zeroed\n");
       break;
 
@@ -864,7 +968,8 @@ process_main_options(int argc, const char* const* argv)
     storage::local::LocalStorage(config).evict(
       [&](double progress) { progress_bar.update(progress); },
       evict_max_age,
-      evict_namespace);
+      evict_namespace,
+      maintenance_threads);
     if (isatty(STDOUT_FILENO)) {
       PRINT_RAW(stdout, "\n");
     }
@@ -24,11 +24,16 @@
 #include <ccache/core/exceptions.hpp>
 #include <ccache/hash.hpp>
 #include <ccache/hashutil.hpp>
+#include <ccache/util/direntry.hpp>
 #include <ccache/util/format.hpp>
 #include <ccache/util/logging.hpp>
+#include <ccache/util/path.hpp>
 #include <ccache/util/string.hpp>
 #include <ccache/util/xxh3_64.hpp>
 
+#include <algorithm>
+#include <limits>
+
 // Manifest data format
 // ====================
 //
@@ -51,13 +56,18 @@
 // <ctime>         ::= int64_t ; status change time (ns), 0 = not recorded
 // <results>       ::= <n_results> <result>*
 // <n_results>     ::= uint32_t
-// <result>        ::= <n_indexes> <include_index>* <key>
+// <result>        ::= <n_indexes> <include_index>* <key> <hit_count>
+//                     <last_hit>
 // <n_indexes>     ::= uint32_t
 // <include_index> ::= uint32_t
 // <result_key>    ::= Hash::Digest::size() bytes
+// <hit_count>     ::= uint32_t ; number of lookups that matched the result
+// <last_hit>      ::= int64_t ; time (ns) of the latest recorded matching
+//                               lookup or of the addition of the result
 
-const uint32_t k_max_manifest_entries = 100;
-const uint32_t k_max_manifest_file_info_entries = 10000;
+// How old the recorded last hit time of a matching result must be to make it
+// worth storing the manifest again to record a newer one.
+const util::Duration k_last_hit_update_interval(24 * 60 * 60);
 
 namespace std {
 
@@ -83,7 +93,9 @@ namespace core {
 //   - First version.
 // Version 1:
 //   - mtime and ctime are now stored with nanoseconds resolution.
-const uint8_t Manifest::k_format_version = 1;
+// Version 2:
+//   - Added hit count and last hit time to results.
+const uint8_t Manifest::k_format_version = 2;
 
 void
 Manifest::read(nonstd::span<const uint8_t> data)
@@ -128,6 +140,8 @@ Manifest::read(nonstd::span<const uint8_t> data)
       entry.file_info_indexes.push_back(reader.read_int<uint32_t>());
     }
     reader.read_and_copy_bytes(entry.key);
+    reader.read_int(entry.hit_count);
+    entry.last_hit.set_nsec(reader.read_int<int64_t>());
   }
 
   if (m_results.empty()) {
@@ -145,59 +159,208 @@ Manifest::read(nonstd::span<const uint8_t> data)
           files[file_info.index],
           FileStats{file_info.fsize, file_info.mtime, file_info.ctime});
       }
-      add_result(result.key, included_files, [&](const std::string& path) {
-        return included_files_stats[path];
-      });
+      const bool added =
+        add_result(result.key, included_files, [&](const std::string& path) {
+          return included_files_stats[path];
+        });
+      if (added) {
+        m_results.back().hit_count = result.hit_count;
+        m_results.back().last_hit = result.last_hit;
+      }
     }
   }
 }
 
 std::optional<Hash::Digest>
-Manifest::look_up_result_digest(const Context& ctx) const
+Manifest::look_up_result_digest(const Context& ctx, bool* updated)
 {
-  std::unordered_map<std::string, FileStats> stated_files;
-  std::unordered_map<std::string, Hash::Digest> hashed_files;
-
-  // Check newest result first since it's more likely to match.
-  for (size_t i = m_results.size(); i > 0; i--) {
-    const auto& result = m_results[i - 1];
-    if (result_matches(ctx, result, stated_files, hashed_files)) {
-      return result.key;
+  // Each referenced file is stated at most once and hashed at most once, and
+  // the validity of each FileInfo is determined at most once even if it's
+  // referenced by several results.
+  std::vector<FileInfoState> file_info_states(m_file_infos.size(),
+                                              FileInfoState::unchecked);
+  std::vector<std::optional<FileStats>> file_stats(m_files.size());
+  std::vector<bool> stated_files(m_files.size());
+
+  // First check all FileInfos that can be checked by a stat call. This is cheap
+  // and rules out most results that can't match.
+  for (const auto& result : m_results) {
+    for (uint32_t file_info_index : result.file_info_indexes) {
+      auto& state = file_info_states[file_info_index];
+      if (state != FileInfoState::unchecked) {
+        continue;
+      }
+      const auto& fi = m_file_infos[file_info_index];
+      if (!stated_files[fi.index]) {
+        stated_files[fi.index] = true;
+        file_stats[fi.index] = stat_file(m_files[fi.index]);
+      }
+      state = check_file_info_stats(ctx, fi, file_stats[fi.index]);
+    }
+  }
+
+  const auto order = get_results_in_lookup_order();
+
+  // Digests of hashed files, std::nullopt if hashing failed or the file can't
+  // be used in direct mode.
+  std::vector<std::optional<Hash::Digest>> file_digests(m_files.size());
+  std::vector<bool> hashed_files(m_files.size());
+  std::vector<SourceCodeFile> files_to_hash;
+  std::vector<uint32_t> file_indexes_to_hash;
+
+  for (size_t i = 0; i < order.size(); ++i) {
+    auto& result = m_results[order[i]];
+
+    const auto is_invalid = [&](uint32_t file_info_index) {
+      return file_info_states[file_info_index] == FileInfoState::invalid;
+    };
+    if (std::any_of(result.file_info_indexes.begin(),
+                    result.file_info_indexes.end(),
+                    is_invalid)) {
+      continue;
+    }
+
+    // Hash the files that this result needs in one go so that it can be done
+    // concurrently.
+    files_to_hash.clear();
+    file_indexes_to_hash.clear();
+    for (uint32_t file_info_index : result.file_info_indexes) {
+      const auto& fi = m_file_infos[file_info_index];
+      if (file_info_states[file_info_index] == FileInfoState::needs_hashing
+          && !hashed_files[fi.index]) {
+        hashed_files[fi.index] = true;
+        SourceCodeFile file;
+        file.path = m_files[fi.index];
+        file.size_hint = file_stats[fi.index]->size;
+        files_to_hash.push_back(std::move(file));
+        file_indexes_to_hash.push_back(fi.index);
+      }
+    }
+    hash_source_code_files(ctx, files_to_hash);
+    for (size_t j = 0; j < files_to_hash.size(); ++j) {
+      const auto& file = files_to_hash[j];
+      if (file.result.contains(HashSourceCode::error)) {
+        LOG("Failed hashing {}", file.path);
+      } else if (!file.result.contains(HashSourceCode::found_time)) {
+        file_digests[file_indexes_to_hash[j]] = file.digest;
+      }
+    }
+
+    bool match = true;
+    for (uint32_t file_info_index : result.file_info_indexes) {
+      auto& state = file_info_states[file_info_index];
+      if (state == FileInfoState::needs_hashing) {
+        const auto& fi = m_file_infos[file_info_index];
+        const auto& digest = file_digests[fi.index];
+        state = digest && *digest == fi.digest ? FileInfoState::valid
+                                               : FileInfoState::invalid;
+      }
+      if (state == FileInfoState::invalid) {
+        match = false;
+        break;
+      }
+    }
+    if (!match) {
+      continue;
+    }
+
+    if (result.hit_count < std::numeric_limits<uint32_t>::max()) {
+      ++result.hit_count;
+    }
+    if (updated) {
+      // Require more hits than the result tried first to avoid storing the
+      // manifest on every lookup when two results alternate.
+      const bool order_changed =
+        i > 0 && result.hit_count > m_results[order[0]].hit_count;
+      *updated = order_changed
+                 || ctx.time_of_invocation - result.last_hit
+                      > k_last_hit_update_interval;
     }
+    result.last_hit = ctx.time_of_invocation;
+    return result.key;
   }
 
   return std::nullopt;
 }
 
+std::vector<size_t>
+Manifest::get_results_in_lookup_order() const
+{
+  // Most frequently hit results first. Among results with equal hit counts, the
+  // newest is more likely to match.
+  std::vector<size_t> order;
+  order.reserve(m_results.size());
+  for (size_t i = m_results.size(); i > 0; --i) {
+    order.push_back(i - 1);
+  }
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return m_results[a].hit_count > m_results[b].hit_count;
+  });
+  return order;
+}
+
+std::optional<Manifest::FileStats>
+Manifest::stat_file(const std::string& path)
+{
+  util::DirEntry entry(path);
+  if (!entry) {
+    LOG("Info: {} is mentioned in a manifest entry but can't be read ({})",
+        path,
+        strerror(entry.error_number()));
+    return std::nullopt;
+  }
+  return FileStats{entry.size(), entry.mtime(), entry.ctime()};
+}
+
+Manifest::FileInfoState
+Manifest::check_file_info_stats(const Context& ctx,
+                                const FileInfo& fi,
+                                const std::optional<FileStats>& fs) const
+{
+  if (!fs || fi.fsize != fs->size) {
+    return FileInfoState::invalid;
+  }
+
+  const auto& path = m_files[fi.index];
+
+  // Clang stores the mtime of the included files in the precompiled header,
+  // and will error out if that header is later used without rebuilding.
+  if ((ctx.config.compiler_type() == CompilerType::clang
+       || ctx.config.compiler_type() == CompilerType::other)
+      && ctx.args_info.output_is_precompiled_header
+      && !ctx.args_info.fno_pch_timestamp && fi.mtime != fs->mtime) {
+    LOG("Precompiled header includes {}, which has a new mtime", path);
+    return FileInfoState::invalid;
+  }
+
+  if (ctx.config.sloppiness().contains(core::Sloppy::file_stat_matches)) {
+    if (!ctx.config.sloppiness().contains(
+          core::Sloppy::file_stat_matches_ctime)) {
+      if (fi.mtime == fs->mtime && fi.ctime == fs->ctime) {
+        LOG("mtime/ctime hit for {}", path);
+        return FileInfoState::valid;
+      } else {
+        LOG("mtime/ctime miss for {}", path);
+      }
+    } else {
+      if (fi.mtime == fs->mtime) {
+        LOG("mtime hit for {}", path);
+        return FileInfoState::valid;
+      } else {
+        LOG("mtime miss for {}", path);
+      }
+    }
+  }
+
+  return FileInfoState::needs_hashing;
+}
+
 bool
 Manifest::add_result(
   const Hash::Digest& result_key,
   const std::unordered_map<std::string, Hash::Digest>& included_files,
   const FileStater& stat_file_function)
 {
-  if (m_results.size() > k_max_manifest_entries) {
-    // Normally, there shouldn't be many result entries in the manifest since
-    // new entries are added only if an include file has changed but not the
-    // source file, and you typically change source files more often than header
-    // files. However, it's certainly possible to imagine cases where the
-    // manifest will grow large (for instance, a generated header file that
-    // changes for every build), and this must be taken care of since processing
-    // an ever growing manifest eventually will take too much time. A good way
-    // of solving this would be to maintain the result entries in LRU order and
-    // discarding the old ones. An easy way is to throw away all entries when
-    // there are too many. Let's do that for now.
-    LOG("More than {} entries in manifest file; discarding",
-        k_max_manifest_entries);
-    clear();
-  } else if (m_file_infos.size() > k_max_manifest_file_info_entries) {
-    // Rarely, FileInfo entries can grow large in pathological cases where many
-    // included files change, but the main file does not. This also puts an
-    // upper bound on the number of FileInfo entries.
-    LOG("More than {} FileInfo entries in manifest file; discarding",
-        k_max_manifest_file_info_entries);
-    clear();
-  }
-
   std::unordered_map<std::string, uint32_t /*index*/> mf_files;
   for (uint32_t i = 0; i < m_files.size(); ++i) {
     mf_files.emplace(m_files[i], i);
@@ -221,15 +384,128 @@ Manifest::add_result(
     file_info_indexes.push_back(*index);
   }
 
-  ResultEntry entry{std::move(file_info_indexes), result_key};
+  ResultEntry entry;
+  entry.file_info_indexes = std::move(file_info_indexes);
+  entry.key = result_key;
   if (std::find(m_results.begin(), m_results.end(), entry) == m_results.end()) {
+    entry.last_hit = util::TimePoint::now();
     m_results.push_back(std::move(entry));
+    evict_least_recently_used_results();
     return true;
   } else {
     return false;
   }
 }
 
+void
+Manifest::set_limits(uint32_t max_results, uint32_t max_file_infos)
+{
+  m_max_results = max_results;
+  m_max_file_infos = max_file_infos;
+}
+
+void
+Manifest::evict_least_recently_used_results()
+{
+  // Normally, there shouldn't be many result entries in the manifest since new
+  // entries are added only if an include file has changed but not the source
+  // file, and you typically change source files more often than header files.
+  // However, it's certainly possible to imagine cases where the manifest will
+  // grow large (for instance, a generated header file that changes for every
+  // build), and this must be taken care of since processing an ever growing
+  // manifest eventually will take too much time. Rarely, FileInfo entries can
+  // also grow large in pathological cases where many included files change,
+  // but the main file does not.
+  if (m_results.size() <= m_max_results
+      && m_file_infos.size() <= m_max_file_infos) {
+    return;
+  }
+
+  std::vector<uint32_t> reference_counts(m_file_infos.size());
+  for (const auto& result : m_results) {
+    for (uint32_t file_info_index : result.file_info_indexes) {
+      ++reference_counts[file_info_index];
+    }
+  }
+  size_t referenced_file_infos =
+    m_file_infos.size()
+    - std::count(reference_counts.begin(), reference_counts.end(), 0);
+
+  // Least recently used first. The newest result (just added) is kept even if
+  // it alone exceeds the limits.
+  std::vector<size_t> candidates;
+  for (size_t i = 0; i + 1 < m_results.size(); ++i) {
+    candidates.push_back(i);
+  }
+  std::stable_sort(
+    candidates.begin(), candidates.end(), [&](size_t a, size_t b) {
+      return m_results[a].last_hit < m_results[b].last_hit;
+    });
+
+  std::vector<bool> evicted(m_results.size());
+  size_t remaining_results = m_results.size();
+  for (size_t candidate : candidates) {
+    if (remaining_results <= m_max_results
+        && referenced_file_infos <= m_max_file_infos) {
+      break;
+    }
+    evicted[candidate] = true;
+    --remaining_results;
+    for (uint32_t file_info_index : m_results[candidate].file_info_indexes) {
+      if (--reference_counts[file_info_index] == 0) {
+        --referenced_file_infos;
+      }
+    }
+  }
+
+  LOG("Evicting {} least recently used result(s) from manifest",
+      m_results.size() - remaining_results);
+
+  std::vector<ResultEntry> results;
+  results.reserve(remaining_results);
+  for (size_t i = 0; i < m_results.size(); ++i) {
+    if (!evicted[i]) {
+      results.push_back(std::move(m_results[i]));
+    }
+  }
+  m_results = std::move(results);
+
+  remove_unreferenced_file_infos();
+}
+
+void
+Manifest::remove_unreferenced_file_infos()
+{
+  const uint32_t unused = std::numeric_limits<uint32_t>::max();
+
+  std::vector<uint32_t> new_file_info_indexes(m_file_infos.size(), unused);
+  std::vector<FileInfo> file_infos;
+  for (auto& result : m_results) {
+    for (uint32_t& file_info_index : result.file_info_indexes) {
+      auto& new_index = new_file_info_indexes[file_info_index];
+      if (new_index == unused) {
+        new_index = static_cast<uint32_t>(file_infos.size());
+        file_infos.push_back(m_file_infos[file_info_index]);
+      }
+      file_info_index = new_index;
+    }
+  }
+
+  std::vector<uint32_t> new_file_indexes(m_files.size(), unused);
+  std::vector<std::string> files;
+  for (auto& file_info : file_infos) {
+    auto& new_index = new_file_indexes[file_info.index];
+    if (new_index == unused) {
+      new_index = static_cast<uint32_t>(files.size());
+      files.push_back(std::move(m_files[file_info.index]));
+    }
+    file_info.index = new_index;
+  }
+
+  m_file_infos = std::move(file_infos);
+  m_files = std::move(files);
+}
+
 uint32_t
 Manifest::serialized_size() const
 {
@@ -248,6 +524,8 @@ Manifest::serialized_size() const
     size += 4; // n_file_info_indexes
     size += result.file_info_indexes.size() * 4;
     size += std::tuple_size<Hash::Digest>();
+    size += 4; // hit_count
+    size += 8; // last_hit
   }
 
   // In order to support 32-bit ccache builds, restrict size to uint32_t for
@@ -288,6 +566,8 @@ Manifest::serialize(util::Bytes& output)
       writer.write_int(index);
     }
     writer.write_bytes(result.key);
+    writer.write_int(result.hit_count);
+    writer.write_int(result.last_hit.nsec());
   }
 }
 
@@ -304,14 +584,6 @@ Manifest::ResultEntry::operator==(const ResultEntry& other) const
   return file_info_indexes == other.file_info_indexes && key == other.key;
 }
 
-void
-Manifest::clear()
-{
-  m_files.clear();
-  m_file_infos.clear();
-  m_results.clear();
-}
-
 std::optional<uint32_t>
 Manifest::get_file_info_index(
   const std::string& path,
@@ -350,90 +622,6 @@ Manifest::get_file_info_index(
   }
 }
 
-bool
-Manifest::result_matches(
-  const Context& ctx,
-  const ResultEntry& result,
-  std::unordered_map<std::string, FileStats>& stated_files,
-  std::unordered_map<std::string, Hash::Digest>& hashed_files) const
-{
-  for (uint32_t file_info_index : result.file_info_indexes) {
-    const auto& fi = m_file_infos[file_info_index];
-    const auto& path = m_files[fi.index];
-
-    auto stated_files_iter = stated_files.find(path);
-    if (stated_files_iter == stated_files.end()) {
-      util::DirEntry entry(path);
-      if (!entry) {
-        LOG("Info: {} is mentioned in a manifest entry but can't be read ({})",
-            path,
-            strerror(entry.error_number()));
-        return false;
-      }
-      FileStats st;
-      st.size = entry.size();
-      st.mtime = entry.mtime();
-      st.ctime = entry.ctime();
-      stated_files_iter = stated_files.emplace(path, st).first;
-    }
-    const FileStats& fs = stated_files_iter->second;
-
-    if (fi.fsize != fs.size) {
-      return false;
-    }
-
-    // Clang stores the mtime of the included files in the precompiled header,
-    // and will error out if that header is later used without rebuilding.
-    if ((ctx.config.compiler_type() == CompilerType::clang
-         || ctx.config.compiler_type() == CompilerType::other)
-        && ctx.args_info.output_is_precompiled_header
-        && !ctx.args_info.fno_pch_timestamp && fi.mtime != fs.mtime) {
-      LOG("Precompiled header includes {}, which has a new mtime", path);
-      return false;
-    }
-
-    if (ctx.config.sloppiness().contains(core::Sloppy::file_stat_matches)) {
-      if (!ctx.config.sloppiness().contains(
-            core::Sloppy::file_stat_matches_ctime)) {
-        if (fi.mtime == fs.mtime && fi.ctime == fs.ctime) {
-          LOG("mtime/ctime hit for {}", path);
-          continue;
-        } else {
-          LOG("mtime/ctime miss for {}", path);
-        }
-      } else {
-        if (fi.mtime == fs.mtime) {
-          LOG("mtime hit for {}", path);
-          continue;
-        } else {
-          LOG("mtime miss for {}", path);
-        }
-      }
-    }
-
-    auto hashed_files_iter = hashed_files.find(path);
-    if (hashed_files_iter == hashed_files.end()) {
-      Hash::Digest actual_digest;
-      auto ret = hash_source_code_file(ctx, actual_digest, path, fs.size);
-      if (ret.contains(HashSourceCode::error)) {
-        LOG("Failed hashing {}", path);
-        return false;
-      }
-      if (ret.contains(HashSourceCode::found_time)) {
-        return false;
-      }
-
-      hashed_files_iter = hashed_files.emplace(path, actual_digest).first;
-    }
-
-    if (fi.digest != hashed_files_iter->second) {
-      return false;
-    }
-  }
-
-  return true;
-}
-
 void
 Manifest::inspect(FILE* const stream) const
 {
@@ -478,6 +666,11 @@ Manifest::inspect(FILE* const stream) const
     }
     PRINT_RAW(stream, "\n");
     PRINT(stream, "    Key: {}\n", util::format_digest(m_results[i].key));
+    PRINT(stream, "    Hit count: {}\n", m_results[i].hit_count);
+    PRINT(stream,
+          "    Last hit: {}.{:09}\n",
+          m_results[i].last_hit.sec(),
+          m_results[i].last_hit.nsec_decimal_part());
   }
 }
 
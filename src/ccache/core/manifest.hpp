@@ -55,7 +55,19 @@ public:
 
   void read(nonstd::span<const uint8_t> data);
 
-  std::optional<Hash::Digest> look_up_result_digest(const Context& ctx) const;
+  // Look up the result key whose include files match the current state of the
+  // file system and update the hit count and last hit time of the result.
+  // Results are tried in order of decreasing hit count. If `updated` is
+  // non-null, it's set to whether the manifest is worth storing, i.e. whether
+  // the matching result wasn't tried first but will be next time or its
+  // recorded last hit time is old.
+  std::optional<Hash::Digest> look_up_result_digest(const Context& ctx,
+                                                    bool* updated);
+
+  // Set the maximum number of results and FileInfo entries. Adding a result
+  // that makes the manifest exceed a limit evicts the least recently used
+  // results and FileInfo entries and paths that are no longer referenced.
+  void set_limits(uint32_t max_results, uint32_t max_file_infos);
 
   bool add_result(
     const Hash::Digest& result_key,
@@ -86,6 +98,8 @@ private:
   {
     std::vector<uint32_t> file_info_indexes; // Indexes to m_file_infos.
     Hash::Digest key;                        // Key of the result.
+    uint32_t hit_count = 0;                  // Number of matching lookups.
+    util::TimePoint last_hit;                // Time of latest matching lookup.
 
     bool operator==(const ResultEntry& other) const;
   };
@@ -93,8 +107,11 @@ private:
   std::vector<std::string> m_files;   // Names of referenced include files.
   std::vector<FileInfo> m_file_infos; // Info about referenced include files.
   std::vector<ResultEntry> m_results;
+  uint32_t m_max_results = 100;
+  uint32_t m_max_file_infos = 10000;
 
-  void clear();
+  void evict_least_recently_used_results();
+  void remove_unreferenced_file_infos();
 
   std::optional<uint32_t> get_file_info_index(
     const std::string& path,
@@ -103,11 +120,20 @@ private:
     const std::unordered_map<FileInfo, uint32_t>& mf_file_infos,
     const FileStater& file_state);
 
-  bool result_matches(
-    const Context& ctx,
-    const ResultEntry& result,
-    std::unordered_map<std::string, FileStats>& stated_files,
-    std::unordered_map<std::string, Hash::Digest>& hashed_files) const;
+  enum class FileInfoState : uint8_t {
+    unchecked,
+    valid,
+    invalid,
+    needs_hashing,
+  };
+
+  std::vector<size_t> get_results_in_lookup_order() const;
+
+  static std::optional<FileStats> stat_file(const std::string& path);
+
+  FileInfoState check_file_info_stats(const Context& ctx,
+                                      const FileInfo& fi,
+                                      const std::optional<FileStats>& fs) const;
 };
 
 } // namespace core
@@ -21,6 +21,7 @@
 #include <ccache/ccache.hpp>
 #include <ccache/config.hpp>
 #include <ccache/context.hpp>
+#include <ccache/core/cacheentry.hpp>
 #include <ccache/core/cacheentrydatareader.hpp>
 #include <ccache/core/cacheentrydatawriter.hpp>
 #include <ccache/core/exceptions.hpp>
@@ -28,6 +29,7 @@
 #include <ccache/util/bytes.hpp>
 #include <ccache/util/direntry.hpp>
 #include <ccache/util/expected.hpp>
+#include <ccache/util/fd.hpp>
 #include <ccache/util/file.hpp>
 #include <ccache/util/filestream.hpp>
 #include <ccache/util/filesystem.hpp>
@@ -80,6 +82,10 @@ const uint8_t k_raw_file_marker = 1;
 
 const uint8_t k_max_raw_file_entries = 10;
 
+// Embedded files larger than this in a compressed payload are passed to
+// Visitor::on_streamed_embedded_file in chunks of at most this size.
+const size_t k_max_embedded_file_chunk_size = 1024 * 1024;
+
 bool
 should_store_raw_file(const Config& config, core::Result::FileType type)
 {
@@ -180,12 +186,31 @@ Deserializer::Deserializer(nonstd::span<const uint8_t> data) : m_data(data)
 {
 }
 
+Deserializer::Deserializer(const CacheEntry& cache_entry)
+  : m_cache_entry(&cache_entry)
+{
+}
+
+void
+Deserializer::Visitor::on_streamed_embedded_file(uint8_t file_number,
+                                                 FileType file_type,
+                                                 uint64_t /*file_size*/,
+                                                 const DataReader& read_data)
+{
+  util::Bytes data;
+  read_data([&](nonstd::span<const uint8_t> chunk) {
+    data.insert(data.end(), chunk);
+  });
+  on_embedded_file(file_number, file_type, data);
+}
+
 void
 Deserializer::visit(Deserializer::Visitor& visitor) const
 {
   Header header;
 
-  CacheEntryDataReader reader(m_data);
+  auto reader = m_cache_entry ? m_cache_entry->payload_reader()
+                              : CacheEntry::PayloadReader(m_data);
   header.format_version = reader.read_int<uint8_t>();
   if (header.format_version != k_format_version) {
     visitor.on_header(header);
@@ -220,7 +245,21 @@ Deserializer::visit(Deserializer::Visitor& visitor) const
     const auto file_type = FileType(type);
     const auto file_size = reader.read_int<uint64_t>();
 
-    if (marker == k_embedded_file_marker) {
+    if (marker == k_embedded_file_marker && reader.decompresses()
+        && file_size > k_max_embedded_file_chunk_size) {
+      uint64_t bytes_left = file_size;
+      const auto read_data = [&](const util::DataReceiver& data_receiver) {
+        while (bytes_left > 0) {
+          const auto chunk = reader.read_bytes(static_cast<size_t>(
+            std::min<uint64_t>(bytes_left, k_max_embedded_file_chunk_size)));
+          bytes_left -= chunk.size();
+          data_receiver(chunk);
+        }
+      };
+      visitor.on_streamed_embedded_file(
+        file_number, file_type, file_size, read_data);
+      read_data([](nonstd::span<const uint8_t> /*chunk*/) {});
+    } else if (marker == k_embedded_file_marker) {
       visitor.on_embedded_file(
         file_number, file_type, reader.read_bytes(file_size));
     } else {
@@ -280,7 +319,21 @@ Serializer::serialized_size() const
 void
 Serializer::serialize(util::Bytes& output)
 {
-  CacheEntryDataWriter writer(output);
+  serialize_in_chunks([&](nonstd::span<const uint8_t> data) {
+    output.insert(output.end(), data);
+  });
+}
+
+void
+Serializer::serialize_in_chunks(const util::DataReceiver& data_receiver)
+{
+  // Fields are collected in `buffer` while file data is passed on directly.
+  util::Bytes buffer;
+  CacheEntryDataWriter writer(buffer);
+  const auto flush_buffer = [&] {
+    data_receiver(buffer);
+    buffer.clear();
+  };
 
   writer.write_int(k_format_version);
   writer.write_int(static_cast<uint8_t>(m_file_entries.size()));
@@ -313,16 +366,35 @@ Serializer::serialize(util::Bytes& output)
       m_raw_files.push_back(
         RawFile{file_number, std::get<std::string>(entry.data)});
     } else if (is_file_entry) {
+      flush_buffer();
       const auto& path = std::get<std::string>(entry.data);
-      const auto data = util::value_or_throw<Error>(
-        util::read_file<util::Bytes>(path), FMT("Failed to read {}: ", path));
-      writer.write_bytes(data);
+      util::Fd fd(open(util::pstr(path).c_str(), O_RDONLY | O_BINARY));
+      if (!fd) {
+        throw Error(FMT("Failed to open {}: {}", path, strerror(errno)));
+      }
+      uint64_t bytes_read = 0;
+      util::throw_on_error<Error>(
+        util::read_fd(*fd,
+                      [&](nonstd::span<const uint8_t> data) {
+                        bytes_read += data.size();
+                        data_receiver(data);
+                      }),
+        FMT("Failed to read {}: ", path));
+      if (bytes_read != file_size) {
+        throw Error(FMT("{} changed size while being read ({} != {} bytes)",
+                        path,
+                        bytes_read,
+                        file_size));
+      }
     } else {
-      writer.write_bytes(std::get<nonstd::span<const uint8_t>>(entry.data));
+      flush_buffer();
+      data_receiver(std::get<nonstd::span<const uint8_t>>(entry.data));
     }
 
     ++file_number;
   }
+
+  flush_buffer();
 }
 
 bool
@@ -20,11 +20,13 @@
 
 #include <ccache/core/serializer.hpp>
 #include <ccache/util/bytes.hpp>
+#include <ccache/util/types.hpp>
 
 #include <nonstd/span.hpp>
 
 #include <cstdint>
 #include <filesystem>
+#include <functional>
 #include <string>
 #include <variant>
 #include <vector>
@@ -34,6 +36,7 @@ class Context;
 
 namespace core {
 
+class CacheEntry;
 class CacheEntryDataParser;
 
 namespace Result {
@@ -104,9 +107,13 @@ std::filesystem::path gcno_file_in_unmangled_form(const Context& ctx);
 class Deserializer
 {
 public:
-  // Read a result from `data`.
+  // Read a result from uncompressed `data`.
   Deserializer(nonstd::span<const uint8_t> data);
 
+  // Read a result from the payload of `cache_entry`, which must outlive the
+  // deserializer. A compressed payload is decompressed incrementally.
+  Deserializer(const CacheEntry& cache_entry);
+
   struct Header
   {
     uint8_t format_version = 0;
@@ -126,6 +133,18 @@ public:
     virtual void on_raw_file(uint8_t file_number,
                              FileType file_type,
                              uint64_t file_size) = 0;
+
+    // Calling the function passes the file data in chunks to a receiver.
+    using DataReader = std::function<void(const util::DataReceiver&)>;
+
+    // Called instead of on_embedded_file for large files in a compressed
+    // payload, which are decompressed on demand. The data is skipped if
+    // `read_data` isn't called. The default implementation collects the data
+    // and calls on_embedded_file.
+    virtual void on_streamed_embedded_file(uint8_t file_number,
+                                           FileType file_type,
+                                           uint64_t file_size,
+                                           const DataReader& read_data);
   };
 
   // Throws core::Error on error.
@@ -133,6 +152,7 @@ public:
 
 private:
   nonstd::span<const uint8_t> m_data;
+  const CacheEntry* m_cache_entry = nullptr;
 
   void parse_file_entry(CacheEntryDataParser& parser,
                         uint8_t file_number) const;
@@ -160,6 +180,7 @@ public:
   // core::Serializer
   uint32_t serialized_size() const override;
   void serialize(util::Bytes& output) override;
+  void serialize_in_chunks(const util::DataReceiver& data_receiver) override;
 
   static bool use_raw_files(const Config& config);
 
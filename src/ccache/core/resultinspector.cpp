@@ -47,6 +47,19 @@ ResultInspector::on_embedded_file(uint8_t file_number,
         data.size());
 }
 
+void
+ResultInspector::on_streamed_embedded_file(uint8_t file_number,
+                                           Result::FileType file_type,
+                                           uint64_t file_size,
+                                           const DataReader& /*read_data*/)
+{
+  PRINT(m_stream,
+        "Embedded file #{}: {} ({} bytes)\n",
+        file_number,
+        Result::file_type_to_string(file_type),
+        file_size);
+}
+
 void
 ResultInspector::on_raw_file(uint8_t file_number,
                              Result::FileType file_type,
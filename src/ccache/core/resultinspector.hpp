@@ -41,6 +41,10 @@ public:
   void on_raw_file(uint8_t file_number,
                    Result::FileType file_type,
                    uint64_t file_size) override;
+  void on_streamed_embedded_file(uint8_t file_number,
+                                 Result::FileType file_type,
+                                 uint64_t file_size,
+                                 const DataReader& read_data) override;
 
 private:
   FILE* m_stream;
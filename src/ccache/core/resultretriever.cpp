@@ -31,6 +31,7 @@
 #include <ccache/util/format.hpp>
 #include <ccache/util/logging.hpp>
 #include <ccache/util/path.hpp>
+#include <ccache/util/pathstring.hpp>
 #include <ccache/util/string.hpp>
 #include <ccache/util/wincompat.hpp>
 
@@ -93,6 +94,59 @@ ResultRetriever::on_embedded_file(uint8_t file_number,
   }
 }
 
+void
+ResultRetriever::on_streamed_embedded_file(uint8_t file_number,
+                                           FileType file_type,
+                                           uint64_t file_size,
+                                           const DataReader& read_data)
+{
+  if (file_type == FileType::stdout_output
+      || file_type == FileType::stderr_output
+      || file_type == FileType::dependency) {
+    // These need the whole content.
+    Visitor::on_streamed_embedded_file(
+      file_number, file_type, file_size, read_data);
+    return;
+  }
+
+  LOG("Reading streamed embedded entry #{} {} ({} bytes)",
+      file_number,
+      Result::file_type_to_string(file_type),
+      file_size);
+
+  const auto dest_path = get_dest_path(file_type);
+  if (dest_path.empty()) {
+    LOG_RAW("Not writing");
+    return;
+  } else if (util::is_dev_null_path(dest_path)) {
+    LOG("Not writing to {}", dest_path);
+    return;
+  }
+
+  LOG("Writing to {}", dest_path);
+  util::PathString dest_path_str(dest_path);
+  unlink(dest_path_str.c_str());
+  util::Fd fd(open(
+    dest_path_str.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666));
+  if (!fd) {
+    throw WriteError(
+      FMT("Failed to open {} for writing: {}", dest_path, strerror(errno)));
+  }
+  try {
+    read_data([&](nonstd::span<const uint8_t> data) {
+      util::throw_on_error<WriteError>(
+        util::write_fd(*fd, data.data(), data.size()),
+        FMT("Failed to write to {}: ", dest_path));
+    });
+  } catch (...) {
+    // Don't leave a partially written file behind if decompression or writing
+    // fails.
+    fd.close();
+    util::remove(dest_path);
+    throw;
+  }
+}
+
 void
 ResultRetriever::on_raw_file(uint8_t file_number,
                              FileType file_type,
@@ -133,9 +187,13 @@ ResultRetriever::on_raw_file(uint8_t file_number,
                            e.what()));
     }
 
-    // Update modification timestamp to save the file from LRU cleanup (and, if
-    // hard-linked, to make the object file newer than the source file).
-    util::set_timestamps(raw_file_path);
+    if (m_ctx.config.hard_link()) {
+      // Update modification timestamp to make the object file newer than the
+      // source file (and to save the file from LRU cleanup).
+      util::set_timestamps(raw_file_path);
+    } else {
+      m_ctx.storage.local.mark_as_used(*m_result_key, raw_file_path, de);
+    }
   } else {
     // Should never happen.
     LOG("Did not copy {} since destination path is unknown for type {}",
@@ -19,6 +19,7 @@
 #pragma once
 
 #include <ccache/util/bytes.hpp>
+#include <ccache/util/types.hpp>
 
 #include <nonstd/span.hpp>
 
@@ -32,6 +33,18 @@ public:
   virtual ~Serializer() = default;
   virtual uint32_t serialized_size() const = 0;
   virtual void serialize(util::Bytes& output) = 0;
+
+  // Serialize by passing the data in chunks to `data_receiver`. The default
+  // implementation passes the result of serialize() as one chunk.
+  virtual void serialize_in_chunks(const util::DataReceiver& data_receiver);
 };
 
+inline void
+Serializer::serialize_in_chunks(const util::DataReceiver& data_receiver)
+{
+  util::Bytes output;
+  serialize(output);
+  data_receiver(output);
+}
+
 } // namespace core
@@ -81,7 +81,10 @@ enum class Statistic {
   disabled = 81,
   bad_input_file = 82,
   modified_input_file = 83,
-  END = 84
+  remote_storage_upload_queued = 84,
+  remote_storage_upload_dropped = 85,
+  evicted_compile_milliseconds = 86,
+  END = 87
 };
 
 enum class StatisticsFormat {
@@ -147,6 +147,11 @@ const StatisticsField k_statistics_fields[] = {
   // Failure reading a file specified by extra_files_to_hash/CCACHE_EXTRAFILES.
   FIELD(error_hashing_extra_file, "Error hashing extra file", FLAG_ERROR),
 
+  // Sum of the compile durations (in milliseconds) of results evicted by
+  // cleanups, i.e. roughly the compile time that will have to be spent again if
+  // the evicted results are needed.
+  FIELD(evicted_compile_milliseconds, nullptr),
+
   // Number of files in a subdirectory of the cache. This is only set for level
   // 1 subdirectories.
   FIELD(files_in_cache, nullptr, FLAG_NOZERO),
@@ -234,6 +239,13 @@ const StatisticsField k_statistics_fields[] = {
   // Timeout when connecting to, reading from or writing to remote storage.
   FIELD(remote_storage_timeout, nullptr),
 
+  // An asynchronous upload to remote storage was dropped since the spool was
+  // full or all upload attempts failed.
+  FIELD(remote_storage_upload_dropped, nullptr),
+
+  // An entry was spooled for asynchronous upload to remote storage.
+  FIELD(remote_storage_upload_queued, nullptr),
+
   // Last time statistics counters were zeroed.
   FIELD(stats_zeroed_timestamp, nullptr),
 
@@ -454,6 +466,7 @@ Statistics::format_human_readable(const Config& config,
   const uint64_t local_writes = S(local_storage_write);
   const uint64_t local_size = S(cache_size_kibibyte) * 1024;
   const uint64_t cleanups = S(cleanups_performed);
+  const uint64_t evicted_compile_milliseconds = S(evicted_compile_milliseconds);
   const uint64_t remote_hits = S(remote_storage_hit);
   const uint64_t remote_misses = S(remote_storage_miss);
   const uint64_t remote_reads =
@@ -461,6 +474,8 @@ Statistics::format_human_readable(const Config& config,
   const uint64_t remote_writes = S(remote_storage_write);
   const uint64_t remote_errors = S(remote_storage_error);
   const uint64_t remote_timeouts = S(remote_storage_timeout);
+  const uint64_t remote_uploads_queued = S(remote_storage_upload_queued);
+  const uint64_t remote_uploads_dropped = S(remote_storage_upload_dropped);
 
   if (!from_log || verbosity > 0 || (local_hits + local_misses) > 0) {
     table.add_heading("Local storage:");
@@ -494,6 +509,13 @@ Statistics::format_human_readable(const Config& config,
     if (cleanups > 0 || verbosity > 1) {
       table.add_row({"  Cleanups:", cleanups});
     }
+    if (evicted_compile_milliseconds > 0 || verbosity > 1) {
+      table.add_row(
+        {"  Evicted compile time:",
+         C(FMT("{:.1f} s",
+               static_cast<double>(evicted_compile_milliseconds) / 1000))
+           .right_align()});
+    }
   }
   if (verbosity > 0 || (local_hits + local_misses) > 0) {
     add_ratio_row(table, "  Hits:", local_hits, local_hits + local_misses);
@@ -520,6 +542,12 @@ Statistics::format_human_readable(const Config& config,
     if (verbosity > 1 || remote_timeouts > 0) {
       table.add_row({"  Timeouts:", remote_timeouts});
     }
+    if (verbosity > 0 && remote_uploads_queued > 0) {
+      table.add_row({"  Uploads queued:", remote_uploads_queued});
+    }
+    if (verbosity > 1 || remote_uploads_dropped > 0) {
+      table.add_row({"  Uploads dropped:", remote_uploads_dropped});
+    }
   }
 
   return table.render();
@@ -33,6 +33,7 @@
 #include <ccache/util/logging.hpp>
 #include <ccache/util/path.hpp>
 #include <ccache/util/string.hpp>
+#include <ccache/util/threadpool.hpp>
 #include <ccache/util/time.hpp>
 #include <ccache/util/wincompat.hpp>
 
@@ -56,10 +57,16 @@
 #  include <immintrin.h>
 #endif
 
+#include <algorithm>
+#include <thread>
+
 namespace fs = util::filesystem;
 
 namespace {
 
+// Minimum number of files to hash per thread in hash_source_code_files.
+const size_t k_min_source_code_files_per_thread = 16;
+
 // Pre-condition: str[pos - 1] == '_'
 HashSourceCode
 check_for_temporal_macros_helper(std::string_view str, size_t pos)
@@ -325,6 +332,37 @@ hash_source_code_file(const Context& ctx,
   return result;
 }
 
+void
+hash_source_code_files(const Context& ctx, std::vector<SourceCodeFile>& files)
+{
+  const auto hash_file = [&ctx](SourceCodeFile& file) {
+    if (!util::DirEntry(file.path).is_regular_file()) {
+      file.result = HashSourceCodeResult(HashSourceCode::error);
+      return;
+    }
+    file.result =
+      hash_source_code_file(ctx, file.digest, file.path, file.size_hint);
+  };
+
+  // Starting threads is not free, so only use as many threads as there are
+  // files to keep them reasonably busy.
+  const size_t threads =
+    std::min<size_t>(std::thread::hardware_concurrency(),
+                     files.size() / k_min_source_code_files_per_thread);
+  if (threads <= 1) {
+    for (auto& file : files) {
+      hash_file(file);
+    }
+    return;
+  }
+
+  util::ThreadPool thread_pool(threads);
+  for (auto& file : files) {
+    thread_pool.enqueue([&] { hash_file(file); });
+  }
+  thread_pool.shut_down();
+}
+
 bool
 hash_binary_file(const Context& ctx,
                  Hash::Digest& digest,
@@ -25,6 +25,7 @@
 #include <filesystem>
 #include <string>
 #include <string_view>
+#include <vector>
 
 class Config;
 class Context;
@@ -48,6 +49,22 @@ HashSourceCodeResult hash_source_code_file(const Context& ctx,
                                            const std::filesystem::path& path,
                                            size_t size_hint = 0);
 
+struct SourceCodeFile
+{
+  std::filesystem::path path;
+  size_t size_hint = 0;
+
+  // Set by hash_source_code_files.
+  HashSourceCodeResult result;
+  Hash::Digest digest;
+};
+
+// Hash each of `files` like hash_source_code_file, concurrently if there are
+// enough files to make it worthwhile. A file that isn't a regular file gets
+// HashSourceCode::error without being read.
+void hash_source_code_files(const Context& ctx,
+                            std::vector<SourceCodeFile>& files);
+
 // Hash a binary file (using the inode cache if enabled) and put its digest in
 // `digest`
 //
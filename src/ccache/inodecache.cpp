@@ -534,6 +534,7 @@ InodeCache::available(int fd)
 std::optional<std::pair<HashSourceCodeResult, Hash::Digest>>
 InodeCache::get(const fs::path& path, ContentType type)
 {
+  std::lock_guard<std::mutex> lock(m_mutex);
   if (!initialize()) {
     return std::nullopt;
   }
@@ -586,6 +587,7 @@ InodeCache::put(const fs::path& path,
                 const Hash::Digest& file_digest,
                 HashSourceCodeResult return_value)
 {
+  std::lock_guard<std::mutex> lock(m_mutex);
   if (!initialize()) {
     return false;
   }
@@ -615,6 +617,23 @@ InodeCache::put(const fs::path& path,
   return true;
 }
 
+bool
+InodeCache::prepare()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+#ifndef _WIN32
+  const auto path = get_path();
+  if (m_sr
+      && !util::DirEntry(path).same_inode_as(util::DirEntry(path, *m_fd))) {
+    // Dropped by another process, so map the new file.
+    m_sr = nullptr;
+    m_map.unmap();
+    m_fd.close();
+  }
+#endif
+  return initialize();
+}
+
 bool
 InodeCache::drop()
 {
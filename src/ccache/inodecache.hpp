@@ -30,6 +30,7 @@
 #include <cstdint>
 #include <filesystem>
 #include <functional>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <utility>
@@ -91,6 +92,13 @@ public:
            const Hash::Digest& file_digest,
            HashSourceCodeResult return_value);
 
+  // Map the cache file ahead of the first lookup, e.g. in a compile server
+  // whose workers inherit the mapping. A file that has been dropped since it
+  // was mapped is replaced by the current one.
+  //
+  // Returns false if the inode cache is disabled or can't be used.
+  bool prepare();
+
   // Unmaps the current cache and removes the mapped file from disk.
   //
   // Returns true on success, false otherwise.
@@ -145,4 +153,7 @@ private:
   const pid_t m_self_pid;
   util::TimePoint m_last_fs_space_check;
   util::MemoryMap m_map;
+
+  // Protects the mapping since files may be hashed concurrently.
+  std::mutex m_mutex;
 };
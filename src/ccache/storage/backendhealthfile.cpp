@@ -0,0 +1,284 @@
+// Copyright (C) 2025 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "backendhealthfile.hpp"
+
+#include <ccache/util/defer.hpp>
+#include <ccache/util/direntry.hpp>
+#include <ccache/util/fd.hpp>
+#include <ccache/util/file.hpp>
+#include <ccache/util/filesystem.hpp>
+#include <ccache/util/format.hpp>
+#include <ccache/util/logging.hpp>
+#include <ccache/util/path.hpp>
+#include <ccache/util/temporaryfile.hpp>
+#include <ccache/util/wincompat.hpp>
+#include <ccache/util/xxh3_64.hpp>
+
+#include <fcntl.h>
+#ifdef HAVE_UNISTD_H
+#  include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+namespace fs = util::filesystem;
+
+namespace storage {
+
+struct BackendHealthFile::Slot
+{
+  // Hash of the backend URL, 0 for an unused slot.
+  std::atomic<uint64_t> key;
+  std::atomic<uint32_t> consecutive_failures;
+  uint32_t reserved;
+  std::atomic<int64_t> open_until_nsec;
+  std::atomic<int64_t> probe_until_nsec;
+};
+
+namespace {
+
+// Increment the version if the layout of SharedRegion changes.
+const uint32_t k_version = 1;
+
+const uint32_t k_magic = 0x63486c74; // "cHlt"
+
+// Maximum number of backends whose health is tracked.
+const size_t k_slots = 64;
+
+struct SharedRegion
+{
+  uint32_t magic;
+  uint32_t version;
+  BackendHealthFile::Slot slots[k_slots];
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free);
+static_assert(std::atomic<int64_t>::is_always_lock_free);
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
+
+std::optional<util::MemoryMap>
+map_health_file(const fs::path& path)
+{
+  util::Fd fd(open(util::pstr(path).c_str(), O_RDWR | O_BINARY));
+  if (!fd) {
+    if (errno != ENOENT) {
+      LOG("Failed to open {}: {}", path, strerror(errno));
+    }
+    return std::nullopt;
+  }
+  if (util::is_on_network_file_system(*fd)) {
+    return std::nullopt;
+  }
+  if (util::DirEntry(path).size() != sizeof(SharedRegion)) {
+    LOG("Ignoring {} with unexpected size", path);
+    return std::nullopt;
+  }
+
+  auto map = util::MemoryMap::map(*fd, sizeof(SharedRegion));
+  if (!map) {
+    LOG("Failed to map {}: {}", path, map.error());
+    return std::nullopt;
+  }
+  const auto* sr = reinterpret_cast<const SharedRegion*>(map->ptr());
+  if (sr->magic != k_magic || sr->version != k_version) {
+    LOG("Ignoring {} with unexpected magic or version", path);
+    return std::nullopt;
+  }
+  return std::move(*map);
+}
+
+// Create a zeroed health file at `path` unless it already exists.
+void
+create_health_file(const fs::path& path)
+{
+  // Create the new file to a temporary name to prevent other processes from
+  // mapping it before it is fully initialized.
+  auto tmp_file = util::TemporaryFile::create(path);
+  if (!tmp_file) {
+    LOG("Failed to create health file: {}", tmp_file.error());
+    return;
+  }
+
+  DEFER(unlink(util::pstr(tmp_file->path).c_str()));
+
+  if (util::is_on_network_file_system(*tmp_file->fd)) {
+    return;
+  }
+  if (auto result = util::fallocate(*tmp_file->fd, sizeof(SharedRegion));
+      !result) {
+    LOG("Failed to allocate file space for {}: {}", path, result.error());
+    return;
+  }
+  auto map = util::MemoryMap::map(*tmp_file->fd, sizeof(SharedRegion));
+  if (!map) {
+    LOG("Failed to map new health file {}: {}", path, map.error());
+    return;
+  }
+  auto* sr = reinterpret_cast<SharedRegion*>(map->ptr());
+  sr->magic = k_magic;
+  sr->version = k_version;
+  map->unmap();
+  tmp_file->fd.close();
+
+  // Linking fails if another process won the race to create the file, in which
+  // case that file will be used.
+  fs::create_hard_link(tmp_file->path, path);
+}
+
+uint64_t
+hash_backend(std::string_view backend)
+{
+  util::XXH3_64 hash;
+  hash.update(backend.data(), backend.size());
+  return std::max<uint64_t>(hash.digest(), 1);
+}
+
+} // namespace
+
+BackendHealthFile::BackendHealthFile(const fs::path& path) : m_path(path)
+{
+}
+
+bool
+BackendHealthFile::allow_request(std::string_view backend, util::TimePoint now)
+{
+  Slot* slot = find_slot(backend, false);
+  if (!slot) {
+    return true;
+  }
+  if (slot->consecutive_failures.load(std::memory_order_relaxed)
+      < k_failure_threshold) {
+    return true;
+  }
+  if (now.nsec() < slot->open_until_nsec.load(std::memory_order_relaxed)) {
+    return false;
+  }
+
+  // Half-open: let the first process to take the probe lease make a request.
+  int64_t probe_until = slot->probe_until_nsec.load(std::memory_order_relaxed);
+  if (now.nsec() < probe_until) {
+    return false;
+  }
+  const int64_t new_probe_until =
+    (now + util::Duration(k_probe_lease_sec)).nsec();
+  if (!slot->probe_until_nsec.compare_exchange_strong(
+        probe_until, new_probe_until, std::memory_order_relaxed)) {
+    return false;
+  }
+  LOG("Probing {} after {} consecutive failures",
+      backend,
+      slot->consecutive_failures.load(std::memory_order_relaxed));
+  return true;
+}
+
+void
+BackendHealthFile::record_success(std::string_view backend)
+{
+  Slot* slot = find_slot(backend, false);
+  // Avoid writing to the shared page in the common case of a healthy backend.
+  if (!slot
+      || slot->consecutive_failures.load(std::memory_order_relaxed) == 0) {
+    return;
+  }
+  if (slot->consecutive_failures.exchange(0, std::memory_order_relaxed)
+      >= k_failure_threshold) {
+    LOG("Closing circuit for {}", backend);
+  }
+  slot->open_until_nsec.store(0, std::memory_order_relaxed);
+  slot->probe_until_nsec.store(0, std::memory_order_relaxed);
+}
+
+void
+BackendHealthFile::record_failure(std::string_view backend, util::TimePoint now)
+{
+  Slot* slot = find_slot(backend, true);
+  if (!slot) {
+    return;
+  }
+  const uint32_t failures =
+    slot->consecutive_failures.fetch_add(1, std::memory_order_relaxed) + 1;
+  if (failures < k_failure_threshold) {
+    return;
+  }
+
+  const uint32_t doublings = std::min(failures - k_failure_threshold, 16U);
+  const int64_t cooldown_sec =
+    std::min(k_initial_cooldown_sec << doublings, k_max_cooldown_sec);
+  slot->open_until_nsec.store((now + util::Duration(cooldown_sec)).nsec(),
+                              std::memory_order_relaxed);
+  slot->probe_until_nsec.store(0, std::memory_order_relaxed);
+  LOG("Opening circuit for {} for {} s after {} consecutive failures",
+      backend,
+      cooldown_sec,
+      failures);
+}
+
+BackendHealthFile::State
+BackendHealthFile::state(std::string_view backend, util::TimePoint now)
+{
+  const Slot* slot = find_slot(backend, false);
+  if (!slot
+      || slot->consecutive_failures.load(std::memory_order_relaxed)
+           < k_failure_threshold) {
+    return State::closed;
+  }
+  return now.nsec() < slot->open_until_nsec.load(std::memory_order_relaxed)
+           ? State::open
+           : State::half_open;
+}
+
+BackendHealthFile::Slot*
+BackendHealthFile::find_slot(std::string_view backend, bool create)
+{
+  if (!m_map) {
+    m_map = map_health_file(m_path);
+    if (!m_map && create) {
+      create_health_file(m_path);
+      m_map = map_health_file(m_path);
+    }
+    if (!m_map) {
+      return nullptr;
+    }
+  }
+
+  auto& sr = *reinterpret_cast<SharedRegion*>(m_map->ptr());
+  const uint64_t key = hash_backend(backend);
+  for (size_t i = 0; i < k_slots; ++i) {
+    Slot& slot = sr.slots[(key + i) % k_slots];
+    uint64_t slot_key = slot.key.load(std::memory_order_relaxed);
+    if (slot_key == key) {
+      return &slot;
+    }
+    if (slot_key == 0) {
+      if (!create) {
+        return nullptr;
+      }
+      if (slot.key.compare_exchange_strong(
+            slot_key, key, std::memory_order_relaxed)
+          || slot_key == key) {
+        return &slot;
+      }
+    }
+  }
+  return nullptr;
+}
+
+} // namespace storage
@@ -0,0 +1,86 @@
+// Copyright (C) 2025 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include <ccache/util/memorymap.hpp>
+#include <ccache/util/noncopyable.hpp>
+#include <ccache/util/timepoint.hpp>
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string_view>
+
+namespace storage {
+
+// Health of remote storage backends, shared by all ccache processes using the
+// same cache directory so that an unavailable backend only costs a few
+// processes a timeout. Each backend has a circuit breaker:
+//
+// - closed: Requests are made. Consecutive failures are counted and the circuit
+//   opens when k_failure_threshold is reached.
+// - open: Requests are skipped until a cooldown has passed. The cooldown
+//   doubles for each failure after the threshold, up to k_max_cooldown_sec.
+// - half-open: The cooldown has passed and one process at a time may probe the
+//   backend. Success closes the circuit and failure opens it again.
+//
+// The state is kept in a memory mapped file with a fixed number of slots that
+// are updated with atomic operations. If the file can't be mapped, e.g. since
+// it's on a network file system, all requests are allowed.
+class BackendHealthFile : util::NonCopyable
+{
+public:
+  enum class State { closed, open, half_open };
+
+  static constexpr uint32_t k_failure_threshold = 3;
+  static constexpr int64_t k_initial_cooldown_sec = 10;
+  static constexpr int64_t k_max_cooldown_sec = 300;
+
+  // Time that a process may spend probing a backend in the half-open state
+  // before another process gets to probe it.
+  static constexpr int64_t k_probe_lease_sec = 60;
+
+  explicit BackendHealthFile(const std::filesystem::path& path);
+
+  // Return whether a request to `backend` should be made. In the half-open
+  // state, true is only returned to the process that gets to probe.
+  bool allow_request(std::string_view backend,
+                     util::TimePoint now = util::TimePoint::now());
+
+  // Record that a request to `backend` succeeded, closing the circuit.
+  void record_success(std::string_view backend);
+
+  // Record that a request to `backend` failed.
+  void record_failure(std::string_view backend,
+                      util::TimePoint now = util::TimePoint::now());
+
+  State state(std::string_view backend,
+              util::TimePoint now = util::TimePoint::now());
+
+  // State of one backend in the shared file.
+  struct Slot;
+
+private:
+  std::filesystem::path m_path;
+  std::optional<util::MemoryMap> m_map;
+
+  Slot* find_slot(std::string_view backend, bool create);
+};
+
+} // namespace storage
@@ -0,0 +1,227 @@
+// Copyright (C) 2025 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "latencyfile.hpp"
+
+#include <ccache/core/atomicfile.hpp>
+#include <ccache/core/exceptions.hpp>
+#include <ccache/util/file.hpp>
+#include <ccache/util/format.hpp>
+#include <ccache/util/lockfile.hpp>
+#include <ccache/util/logging.hpp>
+#include <ccache/util/string.hpp>
+#include <ccache/util/tokenizer.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+namespace fs = std::filesystem;
+
+namespace storage {
+
+void
+LatencyHistogram::add(double ms)
+{
+  m_total_us += static_cast<uint64_t>(ms * 1000);
+  size_t bucket = 0;
+  while (bucket + 1 < k_buckets && ms >= std::ldexp(1.0, bucket)) {
+    ++bucket;
+  }
+  ++m_buckets[bucket];
+}
+
+void
+LatencyHistogram::add_hit()
+{
+  ++m_hits;
+}
+
+void
+LatencyHistogram::add_miss()
+{
+  ++m_misses;
+}
+
+void
+LatencyHistogram::merge(const LatencyHistogram& other)
+{
+  m_total_us += other.m_total_us;
+  for (size_t i = 0; i < k_buckets; ++i) {
+    m_buckets[i] += other.m_buckets[i];
+  }
+  m_hits += other.m_hits;
+  m_misses += other.m_misses;
+}
+
+uint64_t
+LatencyHistogram::count() const
+{
+  uint64_t result = 0;
+  for (const auto value : m_buckets) {
+    result += value;
+  }
+  return result;
+}
+
+uint64_t
+LatencyHistogram::hits() const
+{
+  return m_hits;
+}
+
+uint64_t
+LatencyHistogram::misses() const
+{
+  return m_misses;
+}
+
+double
+LatencyHistogram::mean_ms() const
+{
+  const auto n = count();
+  return n == 0 ? 0.0 : static_cast<double>(m_total_us) / 1000 / n;
+}
+
+double
+LatencyHistogram::quantile_ms(double quantile) const
+{
+  const auto n = count();
+  if (n == 0) {
+    return 0.0;
+  }
+  const auto wanted = static_cast<uint64_t>(std::ceil(quantile * n));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < k_buckets; ++i) {
+    seen += m_buckets[i];
+    if (seen >= wanted && seen > 0) {
+      return std::ldexp(1.0, i);
+    }
+  }
+  return std::ldexp(1.0, k_buckets - 1);
+}
+
+std::string
+LatencyHistogram::to_string() const
+{
+  std::string result = FMT("{}", m_total_us);
+  for (const auto value : m_buckets) {
+    result += FMT(" {}", value);
+  }
+  result += FMT(" {} {}", m_hits, m_misses);
+  return result;
+}
+
+LatencyHistogram
+LatencyHistogram::from_string(const std::string& str)
+{
+  LatencyHistogram result;
+  const char* p = str.c_str();
+  char* end;
+  result.m_total_us = std::strtoull(p, &end, 10);
+  for (size_t i = 0; i < k_buckets && end != p; ++i) {
+    p = end;
+    result.m_buckets[i] = std::strtoull(p, &end, 10);
+  }
+  // Hits and misses are missing in files written by older ccache versions.
+  for (auto* counter : {&result.m_hits, &result.m_misses}) {
+    if (end == p) {
+      break;
+    }
+    p = end;
+    *counter = std::strtoull(p, &end, 10);
+  }
+  return result;
+}
+
+std::optional<std::chrono::milliseconds>
+get_adaptive_timeout(const LatencyHistogram& histogram,
+                     std::chrono::milliseconds max)
+{
+  if (histogram.count() < k_min_latency_samples) {
+    return std::nullopt;
+  }
+  const auto timeout = std::chrono::milliseconds(
+    static_cast<int64_t>(4 * histogram.quantile_ms(0.99)));
+  return std::clamp(timeout, std::min(k_min_adaptive_timeout, max), max);
+}
+
+std::optional<std::chrono::milliseconds>
+get_hedge_delay(const LatencyHistogram& histogram)
+{
+  if (histogram.count() < k_min_latency_samples) {
+    return std::nullopt;
+  }
+  return std::chrono::milliseconds(
+    static_cast<int64_t>(histogram.quantile_ms(0.95)));
+}
+
+LatencyFile::LatencyFile(const fs::path& path) : m_path(path)
+{
+}
+
+LatencyHistograms
+LatencyFile::read() const
+{
+  LatencyHistograms result;
+
+  const auto data = util::read_file<std::string>(m_path);
+  if (!data) {
+    // A nonexistent latency file is OK.
+    return result;
+  }
+
+  for (const auto line : util::Tokenizer(*data, "\n")) {
+    const auto space_pos = line.find(' ');
+    if (space_pos == std::string_view::npos) {
+      continue;
+    }
+    result[std::string(line.substr(0, space_pos))] =
+      LatencyHistogram::from_string(std::string(line.substr(space_pos + 1)));
+  }
+
+  return result;
+}
+
+void
+LatencyFile::update(const LatencyHistograms& updates) const
+{
+  util::LockFile lock(m_path);
+  if (!lock.acquire()) {
+    LOG("Failed to acquire lock for {}", m_path);
+    return;
+  }
+
+  auto histograms = read();
+  for (const auto& [url, histogram] : updates) {
+    histograms[url].merge(histogram);
+  }
+
+  core::AtomicFile file(m_path, core::AtomicFile::Mode::text);
+  for (const auto& [url, histogram] : histograms) {
+    file.write(FMT("{} {}\n", url, histogram.to_string()));
+  }
+  try {
+    file.commit();
+  } catch (const core::Error& e) {
+    // Like for stats files, failure to write is a soft error.
+    LOG("Error: {}", e.what());
+  }
+}
+
+} // namespace storage
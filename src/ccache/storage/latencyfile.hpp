@@ -0,0 +1,103 @@
+// Copyright (C) 2025 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <optional>
+#include <string>
+
+namespace storage {
+
+// Histogram of operation latencies with exponentially growing buckets: bucket
+// 0 counts latencies below 1 ms, bucket i counts latencies in [2^(i-1), 2^i)
+// ms and the last bucket counts everything above. The number of lookups that
+// were hits and misses are counted as well.
+class LatencyHistogram
+{
+public:
+  static constexpr size_t k_buckets = 16;
+
+  void add(double ms);
+  void add_hit();
+  void add_miss();
+  void merge(const LatencyHistogram& other);
+
+  uint64_t count() const;
+  uint64_t hits() const;
+  uint64_t misses() const;
+  double mean_ms() const;
+
+  // Return an upper bound of latency at `quantile` (0.0-1.0) in milliseconds,
+  // or 0 if the histogram is empty.
+  double quantile_ms(double quantile) const;
+
+  std::string to_string() const;
+  static LatencyHistogram from_string(const std::string& str);
+
+private:
+  uint64_t m_total_us = 0;
+  std::array<uint64_t, k_buckets> m_buckets{};
+  uint64_t m_hits = 0;
+  uint64_t m_misses = 0;
+};
+
+// Histograms keyed by remote storage backend URL (without secrets).
+using LatencyHistograms = std::map<std::string, LatencyHistogram>;
+
+// Minimum number of latencies in a histogram for deriving timeouts from it.
+constexpr uint64_t k_min_latency_samples = 20;
+
+constexpr auto k_min_adaptive_timeout = std::chrono::milliseconds{500};
+
+// Return an operation timeout adapted to the latencies in `histogram`: four
+// times the 99th percentile, clamped to [k_min_adaptive_timeout, `max`].
+// Returns std::nullopt if too few latencies are known.
+std::optional<std::chrono::milliseconds>
+get_adaptive_timeout(const LatencyHistogram& histogram,
+                     std::chrono::milliseconds max);
+
+// Return the time to wait for a lookup before starting a hedged one, i.e. the
+// 95th percentile of the latencies in `histogram`. Returns std::nullopt if too
+// few latencies are known.
+std::optional<std::chrono::milliseconds>
+get_hedge_delay(const LatencyHistogram& histogram);
+
+// A text file with one line per backend containing the URL followed by the
+// histogram.
+class LatencyFile
+{
+public:
+  explicit LatencyFile(const std::filesystem::path& path);
+
+  // Read histograms. No lock is acquired. If the file doesn't exist the result
+  // is empty.
+  LatencyHistograms read() const;
+
+  // Acquire a lock, merge `updates` into the stored histograms and write them.
+  void update(const LatencyHistograms& updates) const;
+
+private:
+  std::filesystem::path m_path;
+};
+
+} // namespace storage
@@ -23,6 +23,7 @@
 #include <ccache/core/atomicfile.hpp>
 #include <ccache/core/cacheentry.hpp>
 #include <ccache/core/common.hpp>
+#include <ccache/core/compressiondictionary.hpp>
 #include <ccache/core/exceptions.hpp>
 #include <ccache/core/filerecompressor.hpp>
 #include <ccache/core/manifest.hpp>
@@ -30,11 +31,13 @@
 #include <ccache/util/assertions.hpp>
 #include <ccache/util/duration.hpp>
 #include <ccache/util/expected.hpp>
+#include <ccache/util/fd.hpp>
 #include <ccache/util/file.hpp>
 #include <ccache/util/filestream.hpp>
 #include <ccache/util/filesystem.hpp>
 #include <ccache/util/format.hpp>
 #include <ccache/util/logging.hpp>
+#include <ccache/util/memorymap.hpp>
 #include <ccache/util/path.hpp>
 #include <ccache/util/pathstring.hpp>
 #include <ccache/util/process.hpp>
@@ -43,6 +46,7 @@
 #include <ccache/util/texttable.hpp>
 #include <ccache/util/threadpool.hpp>
 #include <ccache/util/wincompat.hpp>
+#include <ccache/util/zstd.hpp>
 
 #ifdef INODE_CACHE_SUPPORTED
 #  include <ccache/inodecache.hpp>
@@ -79,8 +83,10 @@
 #include <atomic>
 #include <cstdlib>
 #include <memory>
+#include <mutex>
 #include <numeric>
 #include <string>
+#include <unordered_set>
 #include <utility>
 
 namespace fs = util::filesystem;
@@ -117,6 +123,17 @@ const uint8_t k_min_cache_levels = 2;
 // k_max_cache_files_per_directory.
 const uint8_t k_max_cache_levels = 4;
 
+// Minimum size of a cache entry to memory-map it instead of reading it. Mapping
+// has a fixed cost that is higher than copying a small amount of data.
+const size_t k_min_mapped_entry_size = 64 * 1024;
+
+// With the GDSF eviction policy, an entry is kept this much longer than with
+// LRU per millisecond of compile time per KiB of size and per use...
+const util::Duration k_gdsf_bonus_per_cost_density(60);
+
+// ...but at most this much longer.
+const util::Duration k_max_gdsf_bonus(30 * 24 * 60 * 60); // 30 days
+
 namespace {
 
 struct Level2Counters
@@ -137,6 +154,7 @@ struct Level1Counters
 {
   Level2Counters level_2_counters[16] = {};
   uint64_t cleanups = 0;
+  uint64_t evicted_compile_milliseconds = 0;
 
   uint64_t
   files() const
@@ -184,6 +202,8 @@ set_counters(const StatsFile& stats_file, const Level1Counters& level_1_cs)
                        level_1_cs.level_2_counters[i].size / 1024);
     });
     cs.increment(Statistic::cleanups_performed, level_1_cs.cleanups);
+    cs.increment(Statistic::evicted_compile_milliseconds,
+                 level_1_cs.evicted_compile_milliseconds);
   });
 }
 
@@ -215,25 +235,64 @@ calculate_wanted_cache_level(const uint64_t files_in_level_1)
 }
 
 static void
-delete_file(const DirEntry& dir_entry,
+delete_file(const fs::path& path,
+            const uint64_t size_on_disk,
             uint64_t& cache_size,
             uint64_t& files_in_cache)
 {
-  const auto result =
-    util::remove_nfs_safe(dir_entry.path(), util::LogFailure::no);
+  const auto result = util::remove_nfs_safe(path, util::LogFailure::no);
   if (!result && result.error().value() != ENOENT
       && result.error().value() != ESTALE) {
-    LOG("Failed to unlink {} ({})", dir_entry.path(), strerror(errno));
+    LOG("Failed to unlink {} ({})", path, strerror(errno));
   } else {
     // The counters are intentionally subtracted even if there was no file to
     // delete since the final cache size calculation will be incorrect if they
     // aren't. (This can happen when there are several parallel ongoing
     // cleanups of the same directory.)
-    cache_size -= dir_entry.size_on_disk();
+    cache_size -= std::min(size_on_disk, cache_size);
     --files_in_cache;
   }
 }
 
+// Read the content of `path` into `buffer`, or memory-map it into `map` if it
+// is large. Cache entry files are never modified in place (they are replaced by
+// renaming) so the mapping stays valid even if the file is replaced or removed.
+// Files on network file systems are always read since truncation or replacement
+// on the server would raise SIGBUS when accessing the mapping.
+static tl::expected<nonstd::span<const uint8_t>, std::string>
+read_or_map_file(const fs::path& path,
+                 util::Bytes& buffer,
+                 util::MemoryMap& map)
+{
+  util::Fd fd(open(util::pstr(path).c_str(), O_RDONLY | O_BINARY));
+  if (!fd) {
+    return tl::unexpected(strerror(errno));
+  }
+  // Stat the opened file since `path` may have been replaced since it was
+  // looked up.
+  DirEntry dir_entry(path, *fd);
+  if (!dir_entry) {
+    return tl::unexpected(strerror(dir_entry.error_number()));
+  }
+
+  if (dir_entry.size() >= k_min_mapped_entry_size
+      && !util::is_on_network_file_system(*fd)) {
+    auto mapped = util::MemoryMap::map_read_only(*fd, dir_entry.size());
+    if (mapped) {
+      map = std::move(*mapped);
+      return map.data();
+    }
+    LOG("Failed to map {}: {}", path, mapped.error());
+  }
+
+  auto data = util::read_fd(*fd);
+  if (!data) {
+    return tl::unexpected(data.error());
+  }
+  buffer = std::move(*data);
+  return nonstd::span<const uint8_t>(buffer);
+}
+
 #ifdef FILE_CLONING_SUPPORTED
 
 // Clone a file from `src` to `dest`. If `via_tmp_file` is true, `src` is cloned
@@ -296,10 +355,39 @@ clone_file(const fs::path& src, const fs::path& dest, bool via_tmp_file)
 
 #endif // FILE_CLONING_SUPPORTED
 
+// Size change of files in a level 2 directory, added to the counters in
+// `stats_file` on destruction.
+struct Level2SizeChange
+{
+  Level2SizeChange(const StatsFile& stats_file_, uint8_t l2_index_)
+    : stats_file(stats_file_),
+      l2_index(l2_index_)
+  {
+  }
+
+  ~Level2SizeChange()
+  {
+    const int64_t change = kibibyte;
+    if (change != 0) {
+      stats_file.update([&](auto& cs) {
+        cs.increment(Statistic::cache_size_kibibyte, change);
+        cs.increment_offsetted(
+          Statistic::subdir_size_kibibyte_base, l2_index, change);
+      });
+    }
+  }
+
+  StatsFile stats_file;
+  uint8_t l2_index;
+  std::atomic<int64_t> kibibyte = 0;
+};
+
 struct CleanDirResult
 {
   Level2Counters before;
   Level2Counters after;
+  // Sum of compile durations of evicted results.
+  uint64_t evicted_compile_milliseconds = 0;
 };
 
 template<typename T>
@@ -313,30 +401,47 @@ ratio(T numerator, T denominator)
   }
 }
 
-static CleanDirResult
-clean_dir(
-  const fs::path& l2_dir,
-  const uint64_t max_size,
-  const uint64_t max_files,
-  const std::optional<uint64_t> max_age = std::nullopt,
-  const std::optional<std::string> namespace_ = std::nullopt,
-  const ProgressReceiver& progress_receiver = [](double /*progress*/) {})
+// Return the files in `l2_dir`, least recently used first. If `indexed_files`
+// is set, the LRU index is used instead of scanning the directory if it lists
+// that many files.
+static std::vector<LruIndex::Entry>
+get_files_in_lru_order(LruIndex& lru_index,
+                       const fs::path& l2_dir,
+                       const std::optional<uint64_t> indexed_files,
+                       const ProgressReceiver& progress_receiver)
 {
-  LOG("Cleaning up cache directory {}", l2_dir);
+  const auto entries = lru_index.load();
+  if (entries && indexed_files) {
+    if (entries->size() == *indexed_files) {
+      LOG("Using LRU index of {}", l2_dir);
+      return *entries;
+    }
+    LOG("Not using LRU index of {} since it has {} files, expected {}",
+        l2_dir,
+        entries->size(),
+        *indexed_files);
+  }
 
-  auto files = get_cache_dir_files(l2_dir);
-  progress_receiver(1.0 / 3);
+  // Uses recorded in the journal (see the deferred_lru_update option) may be
+  // newer than the modification time of the files. Costs and use counts are
+  // only known from the index.
+  std::unordered_map<std::string, const LruIndex::Entry*> indexed_entries;
+  if (entries) {
+    for (const auto& entry : *entries) {
+      indexed_entries.emplace(util::pstr(entry.path).str(), &entry);
+    }
+  }
 
-  uint64_t cache_size = 0;
-  uint64_t files_in_cache = 0;
-  auto current_time = util::TimePoint::now();
-  std::unordered_map<std::string /*result_file*/,
-                     std::vector<fs::path> /*associated_raw_files*/>
-    raw_files_map;
+  const auto dir_entries = get_cache_dir_files(l2_dir);
+  progress_receiver(1.0 / 3);
 
-  for (size_t i = 0; i < files.size();
-       ++i, progress_receiver(1.0 / 3 + 1.0 * ratio(i, files.size()) / 3)) {
-    const auto& file = files[i];
+  std::vector<LruIndex::Entry> files;
+  files.reserve(dir_entries.size());
+  const auto current_time = util::TimePoint::now();
+  for (size_t i = 0; i < dir_entries.size(); ++i,
+              progress_receiver(1.0 / 3
+                                + 1.0 * ratio(i, dir_entries.size()) / 3)) {
+    const auto& file = dir_entries[i];
 
     if (!file.is_regular_file()) {
       // Not a file or missing file.
@@ -350,47 +455,315 @@ clean_dir(
       continue;
     }
 
-    if (namespace_ && file_type_from_path(file.path()) == FileType::raw) {
-      util::PathString path_str(file.path());
-      const std::string result_path =
-        FMT("{}R", path_str.str().substr(0, path_str.str().length() - 2));
-      raw_files_map[result_path].push_back(file.path());
+    files.push_back({file.path(), file.mtime(), file.size_on_disk()});
+    const auto indexed = indexed_entries.find(util::pstr(file.path()).str());
+    if (indexed != indexed_entries.end()) {
+      const auto& entry = *indexed->second;
+      files.back().cost = entry.cost;
+      files.back().uses = entry.uses;
+      if (entry.journaled && entry.last_used > files.back().last_used) {
+        files.back().last_used = entry.last_used;
+        files.back().journaled = true;
+      }
     }
-
-    cache_size += file.size_on_disk();
-    files_in_cache += 1;
   }
 
   // Sort according to modification time, oldest first.
   std::sort(files.begin(), files.end(), [](const auto& f1, const auto& f2) {
-    return f1.mtime() < f2.mtime();
+    return f1.last_used < f2.last_used;
   });
 
+  return files;
+}
+
+// Return the compile duration stored in the header of the cache entry at
+// `path`, or 0 if it can't be read.
+static uint32_t
+read_compile_duration(const fs::path& path)
+{
+  try {
+    return core::CacheEntry::Header(path).compile_duration;
+  } catch (core::Error&) {
+    return 0;
+  }
+}
+
+// Like above but for a packed entry.
+static uint32_t
+read_compile_duration(const PackStore& pack_store,
+                      const PackStore::Entry& entry)
+{
+  try {
+    const auto data =
+      util::value_or_throw<core::Error>(pack_store.read(entry));
+    return core::CacheEntry::Header(data).compile_duration;
+  } catch (core::Error&) {
+    return 0;
+  }
+}
+
+static std::string
+result_path_for_raw_file(const fs::path& raw_path)
+{
+  util::PathString path_str(raw_path);
+  return FMT("{}R", path_str.str().substr(0, path_str.str().length() - 2));
+}
+
+// Return the time that the GDSF (Greedy-Dual-Size-Frequency) eviction policy
+// uses instead of `last_used` to order an entry for eviction. The time is moved
+// forward in proportion to how often the entry has been used and how expensive
+// it is to recreate per byte, so that, for instance, a small object file that
+// took long to compile outlives a large one that was quick to compile.
+static util::TimePoint
+gdsf_eviction_time(util::TimePoint last_used,
+                   uint32_t cost,
+                   uint32_t uses,
+                   uint64_t size_on_disk)
+{
+  const double density =
+    static_cast<double>(cost) * uses
+    / static_cast<double>(std::max<uint64_t>(size_on_disk / 1024, 1));
+  const double bonus = std::min(
+    static_cast<double>(k_max_gdsf_bonus.sec()),
+    density * static_cast<double>(k_gdsf_bonus_per_cost_density.sec()));
+  return last_used + util::Duration(static_cast<int64_t>(bonus));
+}
+
+// Return the GDSF eviction times of `files`. The costs of files whose cost is
+// unknown are read from their headers. Raw files get the eviction time of their
+// result since the result is useless without them, and the size of the result
+// includes its raw files.
+static std::vector<util::TimePoint>
+get_gdsf_eviction_times(std::vector<LruIndex::Entry>& files)
+{
+  std::unordered_map<std::string, uint64_t> result_sizes;
+  for (auto& file : files) {
+    const auto type = file_type_from_path(file.path);
+    if (type == FileType::raw) {
+      result_sizes[result_path_for_raw_file(file.path)] += file.size_on_disk;
+    } else {
+      if (file.cost == 0
+          && (type == FileType::result || type == FileType::manifest)) {
+        file.cost = read_compile_duration(file.path);
+      }
+      result_sizes[util::pstr(file.path).str()] += file.size_on_disk;
+    }
+  }
+
+  std::vector<util::TimePoint> times;
+  times.reserve(files.size());
+  std::unordered_map<std::string, util::TimePoint> result_times;
+  for (const auto& file : files) {
+    if (file_type_from_path(file.path) == FileType::raw) {
+      times.push_back(file.last_used);
+    } else {
+      const auto path = util::pstr(file.path).str();
+      times.push_back(gdsf_eviction_time(
+        file.last_used, file.cost, file.uses, result_sizes[path]));
+      result_times.emplace(path, times.back());
+    }
+  }
+  for (size_t i = 0; i < files.size(); ++i) {
+    if (file_type_from_path(files[i].path) == FileType::raw) {
+      const auto result =
+        result_times.find(result_path_for_raw_file(files[i].path));
+      if (result != result_times.end()) {
+        times[i] = std::max(times[i], result->second);
+      }
+    }
+  }
+  return times;
+}
+
+// Sort `items` by `times`, which holds the time of each item, oldest first.
+// Items with equal times keep their relative order.
+template<typename T>
+static void
+sort_by_time(std::vector<T>& items, std::vector<util::TimePoint>& times)
+{
+  std::vector<size_t> order(items.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](size_t i1, size_t i2) {
+    return times[i1] < times[i2];
+  });
+  std::vector<T> sorted_items;
+  std::vector<util::TimePoint> sorted_times;
+  sorted_items.reserve(items.size());
+  sorted_times.reserve(items.size());
+  for (const auto i : order) {
+    sorted_items.push_back(std::move(items[i]));
+    sorted_times.push_back(times[i]);
+  }
+  items = std::move(sorted_items);
+  times = std::move(sorted_times);
+}
+
+// If `expected_files` is set, the LRU index of `l2_dir` is used instead of
+// scanning the directory if it's consistent with `expected_files` (the files
+// counter of the directory). The GDSF eviction policy is only used when
+// neither `max_age` nor `namespace_` is set since those select files by age.
+static CleanDirResult
+clean_dir(
+  const fs::path& l2_dir,
+  const uint64_t max_size,
+  const uint64_t max_files,
+  const std::optional<uint64_t> max_age = std::nullopt,
+  const std::optional<std::string> namespace_ = std::nullopt,
+  const ProgressReceiver& progress_receiver = [](double /*progress*/) {},
+  const std::optional<uint64_t> expected_files = std::nullopt,
+  const EvictionPolicy eviction_policy = EvictionPolicy::lru)
+{
+  LOG("Cleaning up cache directory {}", l2_dir);
+
+  PackStore pack_store(l2_dir / PackStore::k_dir_name);
+  auto packed_entries = pack_store.entries();
+  const auto pack_usage_before = pack_store.usage();
+
+  LruIndex lru_index(l2_dir);
+  std::optional<uint64_t> indexed_files;
+  if (expected_files && *expected_files >= packed_entries.size()) {
+    indexed_files = *expected_files - packed_entries.size();
+  }
+  auto files = get_files_in_lru_order(
+    lru_index, l2_dir, indexed_files, progress_receiver);
+  const bool use_gdsf =
+    eviction_policy == EvictionPolicy::gdsf && !max_age && !namespace_;
+
+  // Files and packed entries are evicted in order of these times.
+  std::vector<util::TimePoint> eviction_times;
+  if (use_gdsf) {
+    eviction_times = get_gdsf_eviction_times(files);
+    sort_by_time(files, eviction_times);
+  } else {
+    eviction_times.reserve(files.size());
+    for (const auto& file : files) {
+      eviction_times.push_back(file.last_used);
+    }
+  }
+  progress_receiver(2.0 / 3);
+
+  uint64_t cache_size = 0;
+  uint64_t files_in_cache = 0;
+  auto current_time = util::TimePoint::now();
+  std::unordered_map<std::string /*result_file*/,
+                     std::vector<LruIndex::Entry> /*associated_raw_files*/>
+    raw_files_map;
+
+  for (const auto& file : files) {
+    if (namespace_ && file_type_from_path(file.path) == FileType::raw) {
+      raw_files_map[result_path_for_raw_file(file.path)].push_back(file);
+    }
+
+    cache_size += file.size_on_disk;
+    files_in_cache += 1;
+  }
+  cache_size += pack_usage_before.size;
+  files_in_cache += packed_entries.size();
+
+  std::vector<util::TimePoint> packed_eviction_times;
+  packed_eviction_times.reserve(packed_entries.size());
+  for (const auto& entry : packed_entries) {
+    packed_eviction_times.push_back(
+      use_gdsf ? gdsf_eviction_time(entry.last_used,
+                                    read_compile_duration(pack_store, entry),
+                                    1,
+                                    entry.record_size())
+               : entry.last_used);
+  }
+  sort_by_time(packed_entries, packed_eviction_times);
+
   LOG("Before cleanup: {:.0f} KiB, {:.0f} files",
       static_cast<double>(cache_size) / 1024,
       static_cast<double>(files_in_cache));
   Level2Counters counters_before{files_in_cache, cache_size};
 
-  bool cleaned = false;
-  for (size_t i = 0; i < files.size();
-       ++i, progress_receiver(2.0 / 3 + 1.0 * ratio(i, files.size()) / 3)) {
-    const auto& file = files[i];
+  auto limits_reached = [&](util::TimePoint last_used) {
+    return (max_size == 0 || cache_size <= max_size)
+           && (max_files == 0 || files_in_cache <= max_files)
+           && (!max_age
+               || last_used > (current_time - util::Duration(*max_age)))
+           && (!namespace_ || max_age);
+  };
 
-    if (!file || file.is_directory()) {
-      continue;
+  // The compile time of evicted results is only summed up with the gdsf policy
+  // to avoid reading the header of each evicted result with the LRU policy.
+  const bool sum_evicted_compile_time = eviction_policy == EvictionPolicy::gdsf;
+  uint64_t evicted_compile_milliseconds = 0;
+  std::unordered_set<std::string> deleted_files;
+  auto delete_file_and_forget = [&](const LruIndex::Entry& file) {
+    if (sum_evicted_compile_time
+        && file_type_from_path(file.path) == FileType::result) {
+      evicted_compile_milliseconds +=
+        file.cost != 0 ? file.cost : read_compile_duration(file.path);
     }
+    delete_file(file.path, file.size_on_disk, cache_size, files_in_cache);
+    deleted_files.insert(util::pstr(file.path).str());
+  };
 
-    if ((max_size == 0 || cache_size <= max_size)
-        && (max_files == 0 || files_in_cache <= max_files)
-        && (!max_age
-            || file.mtime() > (current_time - util::Duration(*max_age)))
-        && (!namespace_ || max_age)) {
+  // Packed entries are evicted in the same order as files. They are only marked
+  // as removed here and the space is reclaimed by compaction below.
+  std::vector<PackStore::Entry> removed_packed_entries;
+  uint64_t removed_packed_size = 0;
+  size_t packed_index = 0;
+  // Evict packed entries with an eviction time at or before `time` (or all if
+  // nullopt). Returns false if the limits were reached.
+  auto evict_packed_entries = [&](std::optional<util::TimePoint> time) {
+    for (; packed_index < packed_entries.size()
+           && (!time || packed_eviction_times[packed_index] <= *time);
+         ++packed_index) {
+      const auto& entry = packed_entries[packed_index];
+      if (limits_reached(entry.last_used)) {
+        return false;
+      }
+      if (namespace_) {
+        try {
+          const auto data =
+            util::value_or_throw<core::Error>(pack_store.read(entry));
+          core::CacheEntry::Header header(data);
+          if (header.namespace_ != *namespace_) {
+            continue;
+          }
+        } catch (core::Error&) {
+          // Failed to read header: ignore.
+          continue;
+        }
+        if (entry.type == core::CacheEntryType::result) {
+          const auto result_path = util::pstr(
+            l2_dir / FMT("{}R", util::format_digest(entry.key).substr(2)));
+          const auto raw_files = raw_files_map.find(result_path.str());
+          if (raw_files != raw_files_map.end()) {
+            for (const auto& raw_file : raw_files->second) {
+              delete_file_and_forget(raw_file);
+            }
+          }
+        }
+      }
+      if (sum_evicted_compile_time
+          && entry.type == core::CacheEntryType::result) {
+        evicted_compile_milliseconds +=
+          read_compile_duration(pack_store, entry);
+      }
+      removed_packed_entries.push_back(entry);
+      removed_packed_size += entry.record_size();
+      cache_size -= std::min(entry.record_size(), cache_size);
+      --files_in_cache;
+    }
+    return true;
+  };
+
+  bool cleaned = false;
+  bool limits_exceeded = true;
+  for (size_t i = 0; i < files.size(); ++i) {
+    const auto& file = files[i];
+    if (!evict_packed_entries(eviction_times[i])
+        || limits_reached(file.last_used)) {
+      limits_exceeded = false;
       break;
     }
 
     if (namespace_) {
       try {
-        core::CacheEntry::Header header(file.path());
+        core::CacheEntry::Header header(file.path);
         if (header.namespace_ != *namespace_) {
           continue;
         }
@@ -401,19 +774,47 @@ clean_dir(
 
       // For namespace eviction we need to remove raw files based on result
       // filename since they don't have a header.
-      if (file_type_from_path(file.path()) == FileType::result) {
-        const auto entry = raw_files_map.find(util::pstr(file.path()));
+      if (file_type_from_path(file.path) == FileType::result) {
+        const auto entry = raw_files_map.find(util::pstr(file.path));
         if (entry != raw_files_map.end()) {
           for (const auto& raw_file : entry->second) {
-            delete_file(DirEntry(raw_file), cache_size, files_in_cache);
+            delete_file_and_forget(raw_file);
           }
         }
       }
     }
 
-    delete_file(file, cache_size, files_in_cache);
+    delete_file_and_forget(file);
     cleaned = true;
   }
+  if (limits_exceeded) {
+    evict_packed_entries(std::nullopt);
+  }
+
+  if (!removed_packed_entries.empty()) {
+    pack_store.remove(removed_packed_entries);
+    cleaned = true;
+  }
+  if (pack_usage_before.size > 0) {
+    pack_store.compact();
+    cache_size = cache_size + removed_packed_size - pack_usage_before.size
+                 + pack_store.usage().size;
+  }
+
+  // Write a new snapshot of the LRU index so that the next automatic cleanup
+  // doesn't need to scan the directory. Also apply uses recorded in the journal
+  // to the modification timestamps so that they are not lost if the index is.
+  std::vector<LruIndex::Entry> remaining_files;
+  remaining_files.reserve(files.size() - deleted_files.size());
+  for (const auto& file : files) {
+    if (deleted_files.count(util::pstr(file.path).str()) == 0) {
+      if (file.journaled) {
+        util::set_timestamps(file.path, file.last_used);
+      }
+      remaining_files.push_back(file);
+    }
+  }
+  lru_index.write(remaining_files);
 
   LOG("After cleanup: {:.0f} KiB, {:.0f} files",
       static_cast<double>(cache_size) / 1024,
@@ -424,7 +825,7 @@ clean_dir(
     LOG("Cleaned up cache directory {}", l2_dir);
   }
 
-  return {counters_before, counters_after};
+  return {counters_before, counters_after, evicted_compile_milliseconds};
 }
 
 FileType
@@ -480,7 +881,11 @@ LocalStorage::finalize()
           l1_index, l2_index, l2_files_in_cache, l2_cache_size_kibibyte);
       }
 
-      perform_automatic_cleanup();
+      if (m_config.background_cleanup()) {
+        start_background_cleanup();
+      } else {
+        perform_automatic_cleanup();
+      }
     }
   }
 
@@ -489,37 +894,53 @@ LocalStorage::finalize()
   }
 }
 
-std::optional<util::Bytes>
-LocalStorage::get(const Hash::Digest& key, const core::CacheEntryType type)
+bool
+LocalStorage::get(const Hash::Digest& key,
+                  const core::CacheEntryType type,
+                  const EntryReceiver& entry_receiver)
 {
-  std::optional<util::Bytes> return_value;
+  if (m_config.local_storage_layout() == LocalStorageLayout::pack) {
+    const auto result = get_pack_store(key).get(key, type, entry_receiver);
+    if (result) {
+      LOG("Retrieved {} from local storage (packed)", util::format_digest(key));
+      increment_statistic(Statistic::local_storage_read_hit);
+      if (type == core::CacheEntryType::result) {
+        increment_statistic(Statistic::local_storage_hit);
+      }
+      return *result;
+    }
+  }
+
+  util::Bytes buffer;
+  util::MemoryMap map;
+  std::optional<nonstd::span<const uint8_t>> value;
 
   const auto cache_file = look_up_cache_file(key, type);
   if (cache_file.dir_entry.is_regular_file()) {
-    const auto value = util::read_file<util::Bytes>(cache_file.path);
-    if (value) {
-      LOG("Retrieved {} from local storage ({})",
+    const auto data = read_or_map_file(cache_file.path, buffer, map);
+    if (data) {
+      LOG("Retrieved {} from local storage ({}{})",
           util::format_digest(key),
-          cache_file.path);
+          cache_file.path,
+          map.ptr() ? ", mapped" : "");
 
-      // Update modification timestamp to save file from LRU cleanup.
-      util::set_timestamps(cache_file.path);
+      mark_as_used(key, cache_file.path, cache_file.dir_entry);
 
-      return_value = *value;
+      value = *data;
     } else {
-      LOG("Failed to read {}: {}", cache_file.path, value.error());
+      LOG("Failed to read {}: {}", cache_file.path, data.error());
     }
   } else {
     LOG("No {} in local storage", util::format_digest(key));
   }
 
-  increment_statistic(return_value ? Statistic::local_storage_read_hit
-                                   : Statistic::local_storage_read_miss);
-  if (return_value && type == core::CacheEntryType::result) {
+  increment_statistic(value ? Statistic::local_storage_read_hit
+                            : Statistic::local_storage_read_miss);
+  if (value && type == core::CacheEntryType::result) {
     increment_statistic(Statistic::local_storage_hit);
   }
 
-  return return_value;
+  return value && entry_receiver(*value);
 }
 
 void
@@ -528,6 +949,12 @@ LocalStorage::put(const Hash::Digest& key,
                   nonstd::span<const uint8_t> value,
                   bool only_if_missing)
 {
+  if (m_config.local_storage_layout() == LocalStorageLayout::pack
+      && value.size() <= PackStore::k_max_entry_size) {
+    put_packed(key, type, value, only_if_missing);
+    return;
+  }
+
   const auto cache_file = look_up_cache_file(key, type);
   if (only_if_missing && cache_file.dir_entry.exists()) {
     LOG("Not storing {} in local storage since it already exists",
@@ -551,23 +978,48 @@ LocalStorage::put(const Hash::Digest& key,
     return;
   }
 
+  // A packed entry stored before the value grew too large to be packed would
+  // otherwise hide the file since packed entries are looked up first. Its space
+  // is reclaimed when the pack store is compacted during cleanup.
+  const bool removed_packed =
+    m_config.local_storage_layout() == LocalStorageLayout::pack
+    && get_pack_store(key).remove(key, type);
+
   LOG("Stored {} in local storage ({})",
       util::format_digest(key),
       cache_file.path);
   m_stored_data = true;
 
+  DirEntry new_dir_entry(cache_file.path, DirEntry::LogOnError::yes);
+  if (new_dir_entry.exists()) {
+    // Record the compile duration so that cleanup doesn't have to read it from
+    // the file when using the GDSF eviction policy.
+    uint32_t cost = 0;
+    try {
+      cost = core::CacheEntry::Header(value).compile_duration;
+    } catch (core::Error&) {
+      // Not a valid cache entry: cost unknown.
+    }
+    auto lru_index = get_lru_index(key);
+    if (lru_index.record_use(
+          cache_file.path, new_dir_entry.size_on_disk(), cost)
+        == LruIndex::RecordResult::compaction_needed) {
+      lru_index.compact();
+    }
+  }
+
   if (!m_config.stats()) {
     return;
   }
 
   increment_statistic(Statistic::local_storage_write);
 
-  DirEntry new_dir_entry(cache_file.path, DirEntry::LogOnError::yes);
   if (!new_dir_entry.exists()) {
     return;
   }
 
-  int64_t files_change = cache_file.dir_entry.exists() ? 0 : 1;
+  int64_t files_change =
+    (cache_file.dir_entry.exists() ? 0 : 1) - (removed_packed ? 1 : 0);
   int64_t size_change_kibibyte =
     kibibyte_size_diff(cache_file.dir_entry, new_dir_entry);
   auto counters =
@@ -584,15 +1036,54 @@ LocalStorage::put(const Hash::Digest& key,
   // Make sure we have a CACHEDIR.TAG in the cache part of cache_dir. This can
   // be done almost anywhere, but we might as well do it near the end as we save
   // the stat call if we exit early.
-  util::create_cachedir_tag(
-    FMT("{}/{}", m_config.cache_dir(), util::format_digest(key)[0]));
+  util::create_cachedir_tag(get_subdir(key[0] >> 4));
+}
+
+void
+LocalStorage::mark_as_used(const Hash::Digest& key,
+                           const fs::path& path,
+                           const DirEntry& dir_entry) const
+{
+  const auto granularity = m_config.lru_update_granularity();
+  const auto recently = util::TimePoint::now() - util::Duration(granularity);
+  if (granularity > 0 && dir_entry.mtime() > recently) {
+    // Recently marked as used.
+    return;
+  }
+
+  if (m_config.deferred_lru_update()) {
+    // The modification timestamp is only updated by cleanup, so look for a
+    // recent use in the LRU index instead.
+    auto lru_index = get_lru_index(key);
+    if (granularity > 0 && lru_index.has_recorded_use_since(path, recently)) {
+      return;
+    }
+
+    auto l2_content_lock = get_level_2_content_lock(key);
+    if (l2_content_lock.acquire()) {
+      const auto result =
+        lru_index.record_use(path, dir_entry.size_on_disk());
+      if (result == LruIndex::RecordResult::compaction_needed) {
+        lru_index.compact();
+      }
+      if (result != LruIndex::RecordResult::not_recorded) {
+        // The modification timestamp will be updated by the next cleanup.
+        return;
+      }
+    }
+  }
+
+  // Update modification timestamp to save file from LRU cleanup.
+  util::set_timestamps(path);
 }
 
 void
 LocalStorage::remove(const Hash::Digest& key, const core::CacheEntryType type)
 {
   const auto cache_file = look_up_cache_file(key, type);
-  if (!cache_file.dir_entry) {
+  auto pack_store = get_pack_store(key);
+  const bool packed = pack_store.contains(key, type);
+  if (!cache_file.dir_entry && !packed) {
     LOG("No {} to remove from local storage", util::format_digest(key));
     return;
   }
@@ -603,15 +1094,90 @@ LocalStorage::remove(const Hash::Digest& key, const core::CacheEntryType type)
     auto l2_content_lock = get_level_2_content_lock(key);
     if (!l2_content_lock.acquire()) {
       LOG("Not removing {} due to lock failure", cache_file.path);
+      return;
+    }
+    if (packed) {
+      pack_store.remove(key, type);
+    }
+    if (cache_file.dir_entry) {
+      util::remove_nfs_safe(cache_file.path);
+      get_lru_index(key).record_removal(cache_file.path);
     }
+  }
+
+  if (packed) {
+    // The space is reclaimed when the pack store is compacted during cleanup.
+    LOG("Removed {} from local storage (packed)", util::format_digest(key));
+    increment_files_and_size_counters(key, -1, 0);
+  }
+  if (cache_file.dir_entry) {
+    LOG("Removed {} from local storage ({})",
+        util::format_digest(key),
+        cache_file.path);
+    increment_files_and_size_counters(
+      key,
+      -1,
+      -static_cast<int64_t>(cache_file.dir_entry.size_on_disk() / 1024));
+  }
+}
+
+void
+LocalStorage::put_packed(const Hash::Digest& key,
+                         const core::CacheEntryType type,
+                         nonstd::span<const uint8_t> value,
+                         bool only_if_missing)
+{
+  auto pack_store = get_pack_store(key);
+  const auto cache_file = look_up_cache_file(key, type);
+  if (only_if_missing
+      && (cache_file.dir_entry.exists() || pack_store.contains(key, type))) {
+    LOG("Not storing {} in local storage since it already exists",
+        util::format_digest(key));
+    return;
+  }
+
+  auto l2_content_lock = get_level_2_content_lock(key);
+  if (!l2_content_lock.acquire()) {
+    LOG("Not storing {} due to lock failure", util::format_digest(key));
+    return;
+  }
+
+  const auto result = pack_store.put(key, type, value);
+  if (!result) {
+    LOG("Failed to store {} in local storage: {}",
+        util::format_digest(key),
+        result.error());
+    return;
+  }
+
+  int64_t files_change = result->added ? 1 : 0;
+  auto size_change_kibibyte =
+    static_cast<int64_t>(result->new_data_size / 1024)
+    - static_cast<int64_t>(result->old_data_size / 1024);
+
+  // A file stored before the layout was changed would otherwise only waste
+  // space since packed entries are looked up first.
+  if (cache_file.dir_entry.is_regular_file()) {
     util::remove_nfs_safe(cache_file.path);
+    get_lru_index(key).record_removal(cache_file.path);
+    --files_change;
+    size_change_kibibyte -=
+      static_cast<int64_t>(cache_file.dir_entry.size_on_disk() / 1024);
   }
 
-  LOG("Removed {} from local storage ({})",
-      util::format_digest(key),
-      cache_file.path);
-  increment_files_and_size_counters(
-    key, -1, -static_cast<int64_t>(cache_file.dir_entry.size_on_disk() / 1024));
+  LOG("Stored {} in local storage (packed)", util::format_digest(key));
+  m_stored_data = true;
+
+  if (!m_config.stats()) {
+    return;
+  }
+
+  increment_statistic(Statistic::local_storage_write);
+  increment_files_and_size_counters(key, files_change, size_change_kibibyte);
+
+  l2_content_lock.release();
+
+  util::create_cachedir_tag(get_subdir(key[0] >> 4));
 }
 
 fs::path
@@ -649,6 +1215,11 @@ LocalStorage::put_raw_files(
 
   int64_t files_change = 0;
   int64_t size_kibibyte_change = 0;
+  auto lru_index = get_lru_index(key);
+  // Files stored without the lock are not journaled, which makes cleanup fall
+  // back to scanning the directory.
+  auto l2_content_lock = get_level_2_content_lock(key);
+  const bool locked = l2_content_lock.acquire();
 
   for (auto [file_number, source_path] : raw_files) {
     const auto dest_path = get_raw_file_path(cache_file.path, file_number);
@@ -665,6 +1236,9 @@ LocalStorage::put_raw_files(
       throw;
     }
     DirEntry new_dir_entry(dest_path);
+    if (new_dir_entry && locked) {
+      lru_index.record_use(dest_path, new_dir_entry.size_on_disk());
+    }
     files_change += (new_dir_entry ? 1 : 0) - (old_dir_entry ? 1 : 0);
     size_kibibyte_change += kibibyte_size_diff(old_dir_entry, new_dir_entry);
   }
@@ -749,7 +1323,7 @@ LocalStorage::zero_all_statistics()
   const auto zeroable_fields = core::Statistics::get_zeroable_fields();
 
   for_each_level_1_and_2_stats_file(
-    m_config.cache_dir(), [=](const fs::path& path) {
+    get_level_1_dirs(), [=](const fs::path& path) {
       StatsFile(path).update([=](auto& cs) {
         for (const auto statistic : zeroable_fields) {
           cs.set(statistic, 0);
@@ -769,12 +1343,13 @@ LocalStorage::get_all_statistics() const
 
   // Add up the stats in each directory.
   for_each_level_1_and_2_stats_file(
-    m_config.cache_dir(), [&](const auto& path) {
+    get_level_1_dirs(), [&](const auto& path) {
       counters.set(Statistic::stats_zeroed_timestamp, 0); // Don't add
-      counters.increment(StatsFile(path).read());
+      const StatsFile stats_file(path);
+      counters.increment(stats_file.read());
       zero_timestamp = std::max(counters.get(Statistic::stats_zeroed_timestamp),
                                 zero_timestamp);
-      last_updated = std::max(last_updated, DirEntry(path).mtime());
+      last_updated = std::max(last_updated, stats_file.last_updated());
     });
 
   counters.set(Statistic::stats_zeroed_timestamp, zero_timestamp);
@@ -784,59 +1359,123 @@ LocalStorage::get_all_statistics() const
 void
 LocalStorage::evict(const ProgressReceiver& progress_receiver,
                     std::optional<uint64_t> max_age,
-                    std::optional<std::string> namespace_)
+                    std::optional<std::string> namespace_,
+                    const uint32_t threads)
 {
-  return do_clean_all(progress_receiver, 0, 0, max_age, namespace_);
+  return do_clean_all(progress_receiver, 0, 0, max_age, namespace_, threads);
 }
 
 void
-LocalStorage::clean_all(const ProgressReceiver& progress_receiver)
+LocalStorage::clean_all(const ProgressReceiver& progress_receiver,
+                        const uint32_t threads)
 {
   return do_clean_all(progress_receiver,
                       m_config.max_size(),
                       m_config.max_files(),
                       std::nullopt,
-                      std::nullopt);
+                      std::nullopt,
+                      threads);
 }
 
 // Wipe all cached files in all subdirectories.
 void
-LocalStorage::wipe_all(const ProgressReceiver& progress_receiver)
+LocalStorage::wipe_all(const ProgressReceiver& progress_receiver,
+                       const uint32_t threads)
 {
   util::LongLivedLockFileManager lock_manager;
+  std::vector<util::LockFile> acquired_locks[16];
+  bool wiped[16][16] = {};
 
-  for_each_cache_subdir(
-    progress_receiver, [&](uint8_t l1_index, const auto& l1_progress_receiver) {
-      auto acquired_locks =
+  for_each_level_2_cache_subdir(
+    threads,
+    progress_receiver,
+    [&](uint8_t l1_index, uint8_t l2_index) {
+      auto l2_dir = get_subdir(l1_index, l2_index);
+      const auto files = get_cache_dir_files(l2_dir);
+      for (const auto& file : files) {
+        util::remove_nfs_safe(file.path());
+      }
+
+      auto pack_store = get_pack_store(l1_index, l2_index);
+      const bool has_packed_entries = pack_store.usage().entries > 0;
+      pack_store.clear();
+      LruIndex(l2_dir).remove();
+
+      wiped[l1_index][l2_index] = !files.empty() || has_packed_entries;
+    },
+    [&](uint8_t l1_index) {
+      acquired_locks[l1_index] =
         acquire_all_level_2_content_locks(lock_manager, l1_index);
+    },
+    [&](uint8_t l1_index) {
       Level1Counters level_1_counters;
+      for_each_cache_subdir([&](uint8_t l2_index) {
+        if (wiped[l1_index][l2_index]) {
+          ++level_1_counters.cleanups;
+        }
+      });
+      set_counters(get_stats_file(l1_index), level_1_counters);
+      acquired_locks[l1_index].clear();
+    });
+}
 
-      for_each_cache_subdir(
-        l1_progress_receiver,
-        [&](uint8_t l2_index, const ProgressReceiver& l2_progress_receiver) {
-          auto l2_dir = get_subdir(l1_index, l2_index);
-          const auto files = get_cache_dir_files(l2_dir);
-          l2_progress_receiver(0.5);
-
-          for (size_t i = 0; i < files.size(); ++i) {
-            util::remove_nfs_safe(files[i].path());
-            l2_progress_receiver(0.5 + 0.5 * ratio(i, files.size()));
-          }
+CompressionStatistics
+LocalStorage::get_compression_statistics(
+  const ProgressReceiver& progress_receiver, const uint32_t threads) const
+{
+  CompressionStatistics cs{};
+  std::mutex cs_mutex;
+
+  for_each_level_2_cache_subdir(
+    threads, progress_receiver, [&](uint8_t l1_index, uint8_t l2_index) {
+      CompressionStatistics l2_cs{};
+
+      const auto files = get_cache_dir_files(get_subdir(l1_index, l2_index));
+      for (const auto& cache_file : files) {
+        try {
+          core::CacheEntry::Header header(cache_file.path());
+          l2_cs.actual_size += cache_file.size_on_disk();
+          l2_cs.content_size += util::likely_size_on_disk(header.entry_size);
+        } catch (core::Error&) {
+          l2_cs.incompressible_size += cache_file.size_on_disk();
+        }
+      }
 
-          if (!files.empty()) {
-            ++level_1_counters.cleanups;
+      const auto pack_store = get_pack_store(l1_index, l2_index);
+      for (const auto& entry : pack_store.entries()) {
+        const auto data = pack_store.read(entry);
+        try {
+          if (!data) {
+            throw core::Error(data.error());
           }
-        });
+          core::CacheEntry::Header header(*data);
+          l2_cs.actual_size += entry.record_size();
+          l2_cs.content_size += header.entry_size;
+        } catch (core::Error&) {
+          l2_cs.incompressible_size += entry.record_size();
+        }
+      }
 
-      set_counters(get_stats_file(l1_index), level_1_counters);
+      std::lock_guard<std::mutex> lock(cs_mutex);
+      cs.actual_size += l2_cs.actual_size;
+      cs.content_size += l2_cs.content_size;
+      cs.incompressible_size += l2_cs.incompressible_size;
     });
+
+  return cs;
 }
 
-CompressionStatistics
-LocalStorage::get_compression_statistics(
+TrainedDictionary
+LocalStorage::train_compression_dictionary(
   const ProgressReceiver& progress_receiver) const
 {
-  CompressionStatistics cs{};
+  // Same defaults as the zstd command line tool: a dictionary of 110 KiB
+  // trained on 100 times as much sample data.
+  const size_t max_dictionary_size = 110 * 1024;
+  const size_t max_samples_size = 100 * max_dictionary_size;
+
+  util::Bytes samples;
+  std::vector<size_t> sample_sizes;
 
   for_each_cache_subdir(
     progress_receiver,
@@ -844,25 +1483,80 @@ LocalStorage::get_compression_statistics(
       for_each_cache_subdir(
         l1_progress_receiver,
         [&](const auto& l2_index, const auto& l2_progress_receiver) {
-          auto l2_dir = get_subdir(l1_index, l2_index);
-          const auto files = get_cache_dir_files(l2_dir);
+          if (samples.size() >= max_samples_size) {
+            return;
+          }
+          const auto files =
+            get_cache_dir_files(get_subdir(l1_index, l2_index));
           l2_progress_receiver(0.2);
 
-          for (size_t i = 0; i < files.size(); ++i) {
+          auto add_sample = [&](const util::Bytes& data) {
+            core::CacheEntry cache_entry(data);
+            cache_entry.verify_checksum();
+            const auto payload = cache_entry.payload();
+            if (payload.size()
+                <= core::CacheEntry::max_dictionary_payload_size) {
+              samples.insert(samples.end(), payload);
+              sample_sizes.push_back(payload.size());
+            }
+          };
+
+          for (size_t i = 0;
+               i < files.size() && samples.size() < max_samples_size;
+               ++i) {
             const auto& cache_file = files[i];
+            if (file_type_from_path(cache_file.path()) == FileType::unknown
+                || cache_file.size()
+                     > core::CacheEntry::max_dictionary_payload_size) {
+              continue;
+            }
             try {
-              core::CacheEntry::Header header(cache_file.path());
-              cs.actual_size += cache_file.size_on_disk();
-              cs.content_size += util::likely_size_on_disk(header.entry_size);
-            } catch (core::Error&) {
-              cs.incompressible_size += cache_file.size_on_disk();
+              add_sample(util::value_or_throw<core::Error>(
+                util::read_file<util::Bytes>(cache_file.path())));
+            } catch (core::Error& e) {
+              LOG("Skipping {} when training dictionary: {}",
+                  cache_file.path(),
+                  e.what());
             }
             l2_progress_receiver(0.2 + 0.8 * ratio(i, files.size()));
           }
+
+          const auto pack_store = get_pack_store(l1_index, l2_index);
+          for (const auto& entry : pack_store.entries()) {
+            if (samples.size() >= max_samples_size) {
+              break;
+            }
+            try {
+              add_sample(
+                util::value_or_throw<core::Error>(pack_store.read(entry)));
+            } catch (core::Error& e) {
+              LOG("Skipping packed {} when training dictionary: {}",
+                  util::format_digest(entry.key),
+                  e.what());
+            }
+          }
         });
     });
 
-  return cs;
+  const auto dictionary = util::value_or_throw<core::Error>(
+    util::zstd_train_dictionary(samples, sample_sizes, max_dictionary_size),
+    FMT("Failed to train dictionary on {} cache entries: ",
+        sample_sizes.size()));
+  const uint32_t id =
+    util::value_or_throw<core::Error>(util::ZstdDictionary::create(dictionary))
+      ->id();
+
+  const auto path = core::get_compression_dictionary_path(id);
+  if (auto result = fs::create_directories(path.parent_path()); !result) {
+    throw core::Error(FMT("Failed to create directory {}: {}",
+                          path.parent_path(),
+                          result.error()));
+  }
+  core::AtomicFile file(path, core::AtomicFile::Mode::binary);
+  file.write(dictionary);
+  file.commit();
+
+  return {id, dictionary.size(), sample_sizes.size()};
 }
 
 void
@@ -897,7 +1591,10 @@ LocalStorage::recompress(const std::optional<int8_t> level,
           auto files = get_cache_dir_files(l2_dir);
           l2_progress_receiver(0.1);
 
-          auto stats_file = get_stats_file(l1_index);
+          // The size changes of all files in the directory are added to the
+          // counters at once when the last task is done.
+          auto size_change = std::make_shared<Level2SizeChange>(
+            get_stats_file(l1_index), l2_index);
 
           for (size_t i = 0; i < files.size(); ++i) {
             const auto& file = files[i];
@@ -907,18 +1604,8 @@ LocalStorage::recompress(const std::optional<int8_t> level,
                 try {
                   DirEntry new_dir_entry = recompressor.recompress(
                     file, level, core::FileRecompressor::KeepAtime::no);
-                  auto size_change_kibibyte =
+                  size_change->kibibyte +=
                     kibibyte_size_diff(file, new_dir_entry);
-                  if (size_change_kibibyte != 0) {
-                    StatsFile(stats_file).update([=](auto& cs) {
-                      cs.increment(Statistic::cache_size_kibibyte,
-                                   size_change_kibibyte);
-                      cs.increment_offsetted(
-                        Statistic::subdir_size_kibibyte_base,
-                        l2_index,
-                        size_change_kibibyte);
-                    });
-                  }
                 } catch (core::Error&) {
                   // Ignore for now.
                   incompressible_size += file.size_on_disk();
@@ -1019,16 +1706,27 @@ LocalStorage::recompress(const std::optional<int8_t> level,
 
 // Private methods
 
+const Level1Dirs&
+LocalStorage::get_level_1_dirs() const
+{
+  std::call_once(m_level_1_dirs_once, [&] {
+    m_level_1_dirs =
+      storage::local::get_level_1_dirs(m_config.cache_dir(),
+                                       m_config.cache_dir_stripes());
+  });
+  return m_level_1_dirs;
+}
+
 fs::path
 LocalStorage::get_subdir(uint8_t l1_index) const
 {
-  return m_config.cache_dir() / FMT("{:x}", l1_index);
+  return get_level_1_dirs()[l1_index] / FMT("{:x}", l1_index);
 }
 
 fs::path
 LocalStorage::get_subdir(uint8_t l1_index, uint8_t l2_index) const
 {
-  return m_config.cache_dir() / FMT("{:x}/{:x}", l1_index, l2_index);
+  return get_level_1_dirs()[l1_index] / FMT("{:x}/{:x}", l1_index, l2_index);
 }
 
 LocalStorage::LookUpCacheFileResult
@@ -1055,14 +1753,31 @@ LocalStorage::look_up_cache_file(const Hash::Digest& key,
 StatsFile
 LocalStorage::get_stats_file(uint8_t l1_index) const
 {
-  return StatsFile(FMT("{}/{:x}/stats", m_config.cache_dir(), l1_index));
+  return StatsFile(get_subdir(l1_index) / "stats");
 }
 
 StatsFile
 LocalStorage::get_stats_file(uint8_t l1_index, uint8_t l2_index) const
 {
-  return StatsFile(
-    FMT("{}/{:x}/{:x}/stats", m_config.cache_dir(), l1_index, l2_index));
+  return StatsFile(get_subdir(l1_index, l2_index) / "stats");
+}
+
+LruIndex
+LocalStorage::get_lru_index(const Hash::Digest& key) const
+{
+  return LruIndex(get_subdir(key[0] >> 4, key[0] & 0xF));
+}
+
+PackStore
+LocalStorage::get_pack_store(uint8_t l1_index, uint8_t l2_index) const
+{
+  return PackStore(get_subdir(l1_index, l2_index) / PackStore::k_dir_name);
+}
+
+PackStore
+LocalStorage::get_pack_store(const Hash::Digest& key) const
+{
+  return get_pack_store(key[0] >> 4, key[0] & 0xF);
 }
 
 void
@@ -1081,9 +1796,18 @@ LocalStorage::move_to_wanted_cache_level(const StatisticsCounters& counters,
     // Note: Two ccache processes may move the file at the same time, so failure
     // to rename is OK.
     LOG("Moving {} to {}", cache_file_path, wanted_path);
-    fs::rename(cache_file_path, wanted_path);
+    auto lru_index = get_lru_index(key);
+    auto l2_content_lock = get_level_2_content_lock(key);
+    const bool locked = l2_content_lock.acquire();
+    auto move_file = [&](const fs::path& from, const fs::path& to) {
+      if (fs::rename(from, to) && locked) {
+        lru_index.record_removal(from);
+        lru_index.record_use(to, DirEntry(to).size_on_disk());
+      }
+    };
+    move_file(cache_file_path, wanted_path);
     for (auto [file_number, dest_path] : m_added_raw_files) {
-      fs::rename(dest_path, get_raw_file_path(wanted_path, file_number));
+      move_file(dest_path, get_raw_file_path(wanted_path, file_number));
     }
   }
 }
@@ -1103,6 +1827,9 @@ LocalStorage::recount_level_1_dir(util::LongLivedLockFileManager& lock_manager,
     for (const auto& file : files) {
       level_2_counters.size += file.size_on_disk();
     }
+    const auto pack_usage = get_pack_store(l1_index, l2_index).usage();
+    level_2_counters.files += pack_usage.entries;
+    level_2_counters.size += pack_usage.size;
   });
 
   set_counters(get_stats_file(l1_index), level_1_counters);
@@ -1181,37 +1908,99 @@ LocalStorage::perform_automatic_cleanup()
   // since precision is not important. It doesn't matter if some compilation
   // sneaks in a new result during our calculation - if maximum cache size
   // becomes exceeded it will be taken care of the next time instead.
-  auto evaluation = evaluate_cleanup();
+  auto evaluation = evaluate_cleanup(m_config.cleanup_high_watermark());
   if (!evaluation) {
     // No cleanup needed.
     return;
   }
 
   auto_cleanup_lock.make_long_lived(lock_manager);
+  clean_up_level_1_dir(lock_manager, *evaluation);
+}
 
-  if (!has_consistent_counters(evaluation->l1_counters)) {
-    LOG("Recounting {} due to inconsistent counters", evaluation->l1_path);
-    recount_level_1_dir(lock_manager, evaluation->l1_index);
-    evaluation->l1_counters = get_stats_file(evaluation->l1_index).read();
+void
+LocalStorage::start_background_cleanup()
+{
+  {
+    auto auto_cleanup_lock = get_auto_cleanup_lock();
+    if (!auto_cleanup_lock.try_acquire()) {
+      // Somebody else is already performing automatic cleanup.
+      return;
+    }
+    if (!evaluate_cleanup(m_config.cleanup_high_watermark())) {
+      return;
+    }
+    // Release the lock so that the background process can acquire it. If
+    // another process starts a cleanup in the meantime, the background process
+    // just exits.
+  }
+
+  LOG_RAW("Starting background cleanup");
+  if (!util::start_background_process()) {
+    return;
+  }
+
+  try {
+    perform_background_cleanup();
+  } catch (const core::ErrorBase& e) {
+    LOG("Background cleanup failed: {}", e.what());
+  }
+  _exit(0);
+}
+
+void
+LocalStorage::perform_background_cleanup()
+{
+  util::LongLivedLockFileManager lock_manager;
+  auto auto_cleanup_lock = get_auto_cleanup_lock();
+  if (!auto_cleanup_lock.try_acquire()) {
+    LOG_RAW("Leaving cleanup to the running cleanup process");
+    return;
+  }
+  auto_cleanup_lock.make_long_lived(lock_manager);
+
+  // Clean up one level 2 directory at a time until the cache is below the low
+  // watermark. Since compilations don't wait for this process, it's fine to
+  // remove more than an inline cleanup would.
+  const auto watermark = std::min(m_config.cleanup_low_watermark(),
+                                  m_config.cleanup_high_watermark());
+  uint64_t cleanups = 0;
+  while (auto evaluation = evaluate_cleanup(watermark)) {
+    if (!clean_up_level_1_dir(lock_manager, *evaluation)) {
+      break;
+    }
+    ++cleanups;
+  }
+  LOG("Background cleanup finished after {} cleanups", cleanups);
+}
+
+bool
+LocalStorage::clean_up_level_1_dir(util::LongLivedLockFileManager& lock_manager,
+                                   EvaluateCleanupResult& evaluation)
+{
+  if (!has_consistent_counters(evaluation.l1_counters)) {
+    LOG("Recounting {} due to inconsistent counters", evaluation.l1_path);
+    recount_level_1_dir(lock_manager, evaluation.l1_index);
+    evaluation.l1_counters = get_stats_file(evaluation.l1_index).read();
   }
 
   uint8_t largest_level_2_index =
-    get_largest_level_2_index(evaluation->l1_counters);
+    get_largest_level_2_index(evaluation.l1_counters);
 
   auto l2_content_lock =
-    get_level_2_content_lock(evaluation->l1_index, largest_level_2_index);
+    get_level_2_content_lock(evaluation.l1_index, largest_level_2_index);
   l2_content_lock.make_long_lived(lock_manager);
   if (!l2_content_lock.acquire()) {
     LOG("Failed to acquire content lock for {}/{}",
-        evaluation->l1_index,
+        evaluation.l1_index,
         largest_level_2_index);
-    return;
+    return false;
   }
 
   // Need to reread the counters again after acquiring the lock since another
-  // compilation may have modified the size since evaluation->l1_counters was
+  // compilation may have modified the size since evaluation.l1_counters was
   // read.
-  auto stats_file = get_stats_file(evaluation->l1_index);
+  auto stats_file = get_stats_file(evaluation.l1_index);
   auto counters = stats_file.read();
   if (!has_consistent_counters(counters)) {
     // The cache_size_kibibyte counter doesn't match the 16
@@ -1220,15 +2009,15 @@ LocalStorage::perform_automatic_cleanup()
     // counters) has modified the cache size after the recount_level_1_dir call
     // above. Bail out now and leave it to the next ccache invocation to clean
     // up the inconsistency.
-    LOG("Inconsistent counters in {}, bailing out", evaluation->l1_path);
-    return;
+    LOG("Inconsistent counters in {}, bailing out", evaluation.l1_path);
+    return false;
   }
 
   // Since counting files and their sizes is costly, remove more than needed to
-  // amortize the cost. Trimming the directory down to 90% of the max size means
-  // that statistically about 20% of the directory content will be removed each
-  // automatic cleanup (since subdirectories will be between 90% and about 110%
-  // filled at steady state).
+  // amortize the cost. Trimming the directory down to the low watermark (90% by
+  // default) means that statistically about 20% of the directory content will
+  // be removed each automatic cleanup (since subdirectories will be between 90%
+  // and about 110% filled at steady state).
   //
   // We trim based on number of files instead of size. The main reason for this
   // is to be more forgiving if there are one or a few large cache entries among
@@ -1241,11 +2030,24 @@ LocalStorage::perform_automatic_cleanup()
   // practice removing much newer entries than the oldest in other
   // subdirectories. By doing cleanup based on the number of files, both example
   // scenarios are improved.
-  const uint64_t target_files = static_cast<uint64_t>(
-    0.9 * static_cast<double>(evaluation->total_files) / 256);
+  const uint64_t target_files =
+    static_cast<uint64_t>(m_config.cleanup_low_watermark() / 100.0
+                          * static_cast<double>(evaluation.total_files) / 256);
 
   auto clean_dir_result = clean_dir(
-    get_subdir(evaluation->l1_index, largest_level_2_index), 0, target_files);
+    get_subdir(evaluation.l1_index, largest_level_2_index),
+    0,
+    target_files,
+    std::nullopt,
+    std::nullopt,
+    [](double /*progress*/) {},
+    // Uses are only recorded in the LRU index with deferred_lru_update, so
+    // otherwise the modification times of the files are needed.
+    m_config.deferred_lru_update()
+      ? std::optional<uint64_t>(counters.get_offsetted(
+        Statistic::subdir_files_base, largest_level_2_index))
+      : std::nullopt,
+    m_config.eviction_policy());
 
   stats_file.update([&](auto& cs) {
     const auto old_files =
@@ -1266,7 +2068,33 @@ LocalStorage::perform_automatic_cleanup()
                      largest_level_2_index,
                      new_size_kibibyte);
     cs.increment(Statistic::cleanups_performed, cleanups);
+    cs.increment(Statistic::evicted_compile_milliseconds,
+                 clean_dir_result.evicted_compile_milliseconds);
   });
+
+  return clean_dir_result.after.files != clean_dir_result.before.files;
+}
+
+// Return the number of files and the size that clean_dir is estimated to keep
+// in a directory with `counters` given the limits, assuming that all files are
+// of the same size.
+static Level2Counters
+estimate_clean_dir(const Level2Counters& counters,
+                   const uint64_t max_size,
+                   const uint64_t max_files)
+{
+  if (counters.files == 0) {
+    return counters;
+  }
+  const uint64_t file_size = counters.size / counters.files;
+  uint64_t files = counters.files;
+  if (max_files > 0) {
+    files = std::min(files, max_files);
+  }
+  if (max_size > 0 && file_size > 0) {
+    files = std::min(files, max_size / file_size);
+  }
+  return {files, files * file_size};
 }
 
 void
@@ -1274,72 +2102,113 @@ LocalStorage::do_clean_all(const ProgressReceiver& progress_receiver,
                            uint64_t max_size,
                            uint64_t max_files,
                            std::optional<uint64_t> max_age,
-                           std::optional<std::string> namespace_)
+                           std::optional<std::string> namespace_,
+                           const uint32_t threads)
 {
   util::LongLivedLockFileManager lock_manager;
 
-  uint64_t current_size = 0;
-  uint64_t current_files = 0;
+  // Level 2 directories are cleaned until the cache is within the limits. To be
+  // able to clean them in parallel, the directories to clean are chosen up
+  // front based on the counters, estimating how much each cleanup removes.
+  struct Level2Limits
+  {
+    uint64_t max_size = 0;
+    uint64_t max_files = 0;
+  };
+  Level2Limits level_2_limits[16][16];
   if (max_size > 0 || max_files > 0) {
+    std::vector<StatisticsCounters> counters;
+    uint64_t current_size = 0;
+    uint64_t current_files = 0;
     for_each_cache_subdir([&](uint8_t i) {
-      auto counters = get_stats_file(i).read();
-      current_size += 1024 * counters.get(Statistic::cache_size_kibibyte);
-      current_files += counters.get(Statistic::files_in_cache);
+      counters.push_back(get_stats_file(i).read());
+      current_size += 1024 * counters[i].get(Statistic::cache_size_kibibyte);
+      current_files += counters[i].get(Statistic::files_in_cache);
+    });
+
+    for_each_cache_subdir([&](uint8_t l1_index) {
+      const auto& l1_counters = counters[l1_index];
+      const bool consistent = has_consistent_counters(l1_counters);
+      for_each_cache_subdir([&](uint8_t l2_index) {
+        auto& limits = level_2_limits[l1_index][l2_index];
+        limits.max_size = current_size > max_size ? max_size / 256 : 0;
+        limits.max_files = current_files > max_files ? max_files / 256 : 0;
+
+        // Without trustworthy level 2 counters, assume that the files are
+        // evenly distributed within the level 1 directory.
+        const Level2Counters before =
+          consistent
+            ? Level2Counters{l1_counters.get_offsetted(
+                               Statistic::subdir_files_base, l2_index),
+                             1024
+                               * l1_counters.get_offsetted(
+                                 Statistic::subdir_size_kibibyte_base,
+                                 l2_index)}
+            : Level2Counters{
+                l1_counters.get(Statistic::files_in_cache) / 16,
+                1024 * l1_counters.get(Statistic::cache_size_kibibyte) / 16};
+        const auto after =
+          estimate_clean_dir(before, limits.max_size, limits.max_files);
+
+        // removed_size/remove_files should never be larger than
+        // current_size/current_files, but in case there's some error we
+        // certainly don't want to underflow, so better safe than sorry.
+        current_size -= std::min(before.size - after.size, current_size);
+        current_files -= std::min(before.files - after.files, current_files);
+      });
     });
   }
 
-  for_each_cache_subdir(
-    progress_receiver, [&](uint8_t l1_index, const auto& l1_progress_receiver) {
-      auto acquired_locks =
+  std::vector<util::LockFile> acquired_locks[16];
+  CleanDirResult clean_dir_results[16][16];
+
+  for_each_level_2_cache_subdir(
+    threads,
+    progress_receiver,
+    [&](uint8_t l1_index, uint8_t l2_index) {
+      const auto& limits = level_2_limits[l1_index][l2_index];
+      clean_dir_results[l1_index][l2_index] =
+        clean_dir(get_subdir(l1_index, l2_index),
+                  limits.max_size,
+                  limits.max_files,
+                  max_age,
+                  namespace_,
+                  [](double /*progress*/) {},
+                  std::nullopt,
+                  m_config.eviction_policy());
+
+      // Fix erroneous files/size counters for raw files in L2 stats files.
+      // See also comments in finalize().
+      get_stats_file(l1_index, l2_index)
+        .update(
+          [](auto& cs) {
+            cs.set(Statistic::cache_size_kibibyte, 0);
+            cs.set(Statistic::files_in_cache, 0);
+          },
+          StatsFile::OnlyIfChanged::yes);
+    },
+    [&](uint8_t l1_index) {
+      acquired_locks[l1_index] =
         acquire_all_level_2_content_locks(lock_manager, l1_index);
+    },
+    [&](uint8_t l1_index) {
       Level1Counters level_1_counters;
-
-      for_each_cache_subdir(
-        l1_progress_receiver,
-        [&](uint8_t l2_index, const ProgressReceiver& l2_progress_receiver) {
-          uint64_t level_2_max_size =
-            current_size > max_size ? max_size / 256 : 0;
-          uint64_t level_2_max_files =
-            current_files > max_files ? max_files / 256 : 0;
-          auto clean_dir_result = clean_dir(get_subdir(l1_index, l2_index),
-                                            level_2_max_size,
-                                            level_2_max_files,
-                                            max_age,
-                                            namespace_,
-                                            l2_progress_receiver);
-          uint64_t removed_size =
-            clean_dir_result.before.size - clean_dir_result.after.size;
-          uint64_t removed_files =
-            clean_dir_result.before.files - clean_dir_result.after.files;
-
-          // removed_size/remove_files should never be larger than
-          // current_size/current_files, but in case there's some error we
-          // certainly don't want to underflow, so better safe than sorry.
-          current_size -= std::min(removed_size, current_size);
-          current_files -= std::min(removed_files, current_files);
-
-          level_1_counters.level_2_counters[l2_index] = clean_dir_result.after;
-          if (clean_dir_result.after.files != clean_dir_result.before.files) {
-            ++level_1_counters.cleanups;
-          }
-
-          // Fix erroneous files/size counters for raw files in L2 stats files.
-          // See also comments in finalize().
-          get_stats_file(l1_index, l2_index)
-            .update(
-              [](auto& cs) {
-                cs.set(Statistic::cache_size_kibibyte, 0);
-                cs.set(Statistic::files_in_cache, 0);
-              },
-              StatsFile::OnlyIfChanged::yes);
-        });
-
+      for_each_cache_subdir([&](uint8_t l2_index) {
+        const auto& result = clean_dir_results[l1_index][l2_index];
+        level_1_counters.level_2_counters[l2_index] = result.after;
+        if (result.after.files != result.before.files) {
+          ++level_1_counters.cleanups;
+        }
+        level_1_counters.evicted_compile_milliseconds +=
+          result.evicted_compile_milliseconds;
+      });
       set_counters(get_stats_file(l1_index), level_1_counters);
+      acquired_locks[l1_index].clear();
     });
 }
 
 std::optional<LocalStorage::EvaluateCleanupResult>
-LocalStorage::evaluate_cleanup()
+LocalStorage::evaluate_cleanup(uint8_t watermark)
 {
   // We trust that the L1 size and files counters are correct, but the L2 size
   // and files counters may be inconsistent if older ccache versions have been
@@ -1387,22 +2256,27 @@ LocalStorage::evaluate_cleanup()
     }
   });
 
+  const auto apply_watermark = [&](uint64_t limit) {
+    return static_cast<uint64_t>(static_cast<double>(limit) * watermark / 100);
+  };
+  const uint64_t max_size = apply_watermark(m_config.max_size());
+  const uint64_t max_files = apply_watermark(m_config.max_files());
+
   std::string max_size_str =
-    m_config.max_size() > 0
-      ? FMT(", max size {}",
-            util::format_human_readable_size(m_config.max_size(),
-                                             m_config.size_unit_prefix_type()))
-      : "";
+    max_size > 0 ? FMT(", max size {}",
+                       util::format_human_readable_size(
+                         max_size, m_config.size_unit_prefix_type()))
+                 : "";
   std::string max_files_str =
-    m_config.max_files() > 0 ? FMT(", max files {}", m_config.max_files()) : "";
+    max_files > 0 ? FMT(", max files {}", max_files) : "";
   std::string info_str = FMT("size {}, files {}{}{}",
                              util::format_human_readable_size(
                                total_size, m_config.size_unit_prefix_type()),
                              total_files,
                              max_size_str,
                              max_files_str);
-  if ((m_config.max_size() == 0 || total_size <= m_config.max_size())
-      && (m_config.max_files() == 0 || total_files <= m_config.max_files())) {
+  if ((max_size == 0 || total_size <= max_size)
+      && (max_files == 0 || total_files <= max_files)) {
     LOG("No automatic cleanup needed ({})", info_str);
     return std::nullopt;
   }
@@ -1481,7 +2355,9 @@ LocalStorage::get_path_in_cache(const uint8_t level,
   ASSERT(level >= 1 && level <= 8);
   ASSERT(name.length() >= level);
 
-  fs::path path(m_config.cache_dir());
+  const auto l1_index = util::parse_unsigned(name.substr(0, 1), 0, 15, "", 16);
+  ASSERT(l1_index);
+  fs::path path(get_level_1_dirs()[*l1_index]);
   for (uint8_t i = 0; i < level; ++i) {
     path /= std::string(1, name.at(i));
   }
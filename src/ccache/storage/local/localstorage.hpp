@@ -23,6 +23,8 @@
 #include <ccache/core/statisticscounters.hpp>
 #include <ccache/core/types.hpp>
 #include <ccache/hash.hpp>
+#include <ccache/storage/local/lruindex.hpp>
+#include <ccache/storage/local/packstore.hpp>
 #include <ccache/storage/local/statsfile.hpp>
 #include <ccache/storage/local/util.hpp>
 #include <ccache/util/bytes.hpp>
@@ -35,6 +37,8 @@
 
 #include <cstdint>
 #include <filesystem>
+#include <functional>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <string_view>
@@ -45,6 +49,13 @@ class Config;
 
 namespace storage::local {
 
+struct TrainedDictionary
+{
+  uint32_t id;
+  uint64_t size;
+  uint64_t samples;
+};
+
 struct CompressionStatistics
 {
   // Storage that would be needed to store the content of compressible entries
@@ -70,8 +81,15 @@ public:
 
   // --- Cache entry handling ---
 
-  std::optional<util::Bytes> get(const Hash::Digest& key,
-                                 core::CacheEntryType type);
+  using EntryReceiver = std::function<bool(nonstd::span<const uint8_t> value)>;
+
+  // Call `entry_receiver` with the data of the entry if it exists. Large
+  // entries are memory-mapped instead of read, so the data is only valid
+  // during the call. Returns the return value of `entry_receiver`, or false if
+  // the entry doesn't exist or can't be read.
+  bool get(const Hash::Digest& key,
+           core::CacheEntryType type,
+           const EntryReceiver& entry_receiver);
 
   void put(const Hash::Digest& key,
            core::CacheEntryType type,
@@ -80,6 +98,13 @@ public:
 
   void remove(const Hash::Digest& key, core::CacheEntryType type);
 
+  // Mark the cache file `path` (belonging to `key`) as used to save it from
+  // LRU cleanup. See the deferred_lru_update and lru_update_granularity
+  // options.
+  void mark_as_used(const Hash::Digest& key,
+                    const std::filesystem::path& path,
+                    const util::DirEntry& dir_entry) const;
+
   static std::filesystem::path
   get_raw_file_path(const std::filesystem::path& result_path,
                     uint8_t file_number);
@@ -113,24 +138,36 @@ public:
   get_all_statistics() const;
 
   // --- Cleanup ---
+  //
+  // These methods process level 2 directories in parallel using up to
+  // `threads` threads.
 
   void evict(const ProgressReceiver& progress_receiver,
              std::optional<uint64_t> max_age,
-             std::optional<std::string> namespace_);
+             std::optional<std::string> namespace_,
+             uint32_t threads = 1);
 
-  void clean_all(const ProgressReceiver& progress_receiver);
+  void clean_all(const ProgressReceiver& progress_receiver,
+                 uint32_t threads = 1);
 
-  void wipe_all(const ProgressReceiver& progress_receiver);
+  void wipe_all(const ProgressReceiver& progress_receiver,
+                uint32_t threads = 1);
 
   // --- Compression ---
 
   CompressionStatistics
-  get_compression_statistics(const ProgressReceiver& progress_receiver) const;
+  get_compression_statistics(const ProgressReceiver& progress_receiver,
+                             uint32_t threads = 1) const;
 
   void recompress(std::optional<int8_t> level,
                   uint32_t threads,
                   const ProgressReceiver& progress_receiver);
 
+  // Train a compression dictionary on small cache entries and store it in the
+  // compression dictionary directory. Throws `core::Error` on failure.
+  TrainedDictionary
+  train_compression_dictionary(const ProgressReceiver& progress_receiver) const;
+
 private:
   const Config& m_config;
 
@@ -156,12 +193,29 @@ private:
   LookUpCacheFileResult look_up_cache_file(const Hash::Digest& key,
                                            core::CacheEntryType type) const;
 
+  // Parent directories of the level 1 subdirectories, determined from
+  // cache_dir and cache_dir_stripes when first needed since the configuration
+  // has not been read when the object is created.
+  mutable std::once_flag m_level_1_dirs_once;
+  mutable Level1Dirs m_level_1_dirs;
+
+  const Level1Dirs& get_level_1_dirs() const;
+
   std::filesystem::path get_subdir(uint8_t l1_index) const;
   std::filesystem::path get_subdir(uint8_t l1_index, uint8_t l2_index) const;
 
   StatsFile get_stats_file(uint8_t l1_index) const;
   StatsFile get_stats_file(uint8_t l1_index, uint8_t l2_index) const;
 
+  LruIndex get_lru_index(const Hash::Digest& key) const;
+  PackStore get_pack_store(uint8_t l1_index, uint8_t l2_index) const;
+  PackStore get_pack_store(const Hash::Digest& key) const;
+
+  void put_packed(const Hash::Digest& key,
+                  core::CacheEntryType type,
+                  nonstd::span<const uint8_t> value,
+                  bool only_if_missing);
+
   void move_to_wanted_cache_level(const core::StatisticsCounters& counters,
                                   const Hash::Digest& key,
                                   core::CacheEntryType type,
@@ -175,13 +229,20 @@ private:
   std::optional<core::StatisticsCounters> increment_files_and_size_counters(
     const Hash::Digest& key, int64_t files, int64_t size_kibibyte);
 
+  // Clean up a level 2 directory if the cache is above the high watermark.
   void perform_automatic_cleanup();
 
+  // Start a detached process that cleans up the cache to the low watermark if
+  // the cache is above the high watermark.
+  void start_background_cleanup();
+  void perform_background_cleanup();
+
   void do_clean_all(const ProgressReceiver& progress_receiver,
                     uint64_t max_size,
                     uint64_t max_files,
                     std::optional<uint64_t> max_age,
-                    std::optional<std::string> namespace_);
+                    std::optional<std::string> namespace_,
+                    uint32_t threads);
 
   struct EvaluateCleanupResult
   {
@@ -191,7 +252,14 @@ private:
     uint64_t total_files;
   };
 
-  std::optional<EvaluateCleanupResult> evaluate_cleanup();
+  // Return the level 1 directory to clean up if the cache is above `watermark`
+  // percent of max_size or max_files.
+  std::optional<EvaluateCleanupResult> evaluate_cleanup(uint8_t watermark);
+
+  // Trim the largest level 2 directory of the level 1 directory chosen by
+  // evaluate_cleanup. Returns whether any files were removed.
+  bool clean_up_level_1_dir(util::LongLivedLockFileManager& lock_manager,
+                            EvaluateCleanupResult& evaluation);
 
   std::vector<util::LockFile> acquire_all_level_2_content_locks(
     util::LongLivedLockFileManager& lock_manager, uint8_t l1_index);
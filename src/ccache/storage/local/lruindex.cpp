@@ -0,0 +1,394 @@
+// Copyright (C) 2025 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "lruindex.hpp"
+
+#include <ccache/core/atomicfile.hpp>
+#include <ccache/core/exceptions.hpp>
+#include <ccache/util/direntry.hpp>
+#include <ccache/util/fd.hpp>
+#include <ccache/util/file.hpp>
+#include <ccache/util/filesystem.hpp>
+#include <ccache/util/format.hpp>
+#include <ccache/util/logging.hpp>
+#include <ccache/util/path.hpp>
+#include <ccache/util/string.hpp>
+#include <ccache/util/wincompat.hpp>
+
+#include <fcntl.h>
+#ifdef HAVE_UNISTD_H
+#  include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace fs = util::filesystem;
+
+namespace storage::local {
+
+namespace {
+
+// Increment the version if the format of the index changes.
+const char k_header_prefix[] = "ccache-lru 2 ";
+
+// The journal is compacted when it's larger than this factor times the size of
+// the last snapshot plus k_min_journal_growth.
+const uint64_t k_max_journal_growth_factor = 2;
+const uint64_t k_min_journal_growth = 64 * 1024;
+
+// Maximum length of the header line, including newline.
+const size_t k_max_header_length = 64;
+
+// Maximum number of bytes read from the end of the journal when looking for a
+// recent use.
+const uint64_t k_max_recent_use_scan = 64 * 1024;
+
+// Parse the header line "ccache-lru 2 <snapshot size>". Returns the snapshot
+// size.
+std::optional<uint64_t>
+parse_header(std::string_view line)
+{
+  if (!util::starts_with(line, k_header_prefix)) {
+    return std::nullopt;
+  }
+  const auto size =
+    util::parse_unsigned(line.substr(sizeof(k_header_prefix) - 1));
+  return size ? std::optional(*size) : std::nullopt;
+}
+
+std::optional<std::string>
+relative_name(const fs::path& dir, const fs::path& path)
+{
+  const auto name = util::pstr(path.lexically_relative(dir)).str();
+  if (name.empty() || util::starts_with(name, "..")) {
+    return std::nullopt;
+  }
+  return name;
+}
+
+LruIndex::RecordResult
+append_line(const fs::path& index_path, const std::string& line)
+{
+  // Only append to an existing index since a journal without a snapshot is
+  // useless.
+  util::Fd fd(
+    open(util::pstr(index_path).c_str(), O_RDWR | O_APPEND | O_BINARY));
+  if (!fd) {
+    return LruIndex::RecordResult::not_recorded;
+  }
+
+  char header[k_max_header_length];
+  const auto bytes_read = read(*fd, header, sizeof(header));
+  if (bytes_read <= 0) {
+    return LruIndex::RecordResult::not_recorded;
+  }
+  const std::string_view header_view(header, static_cast<size_t>(bytes_read));
+  const auto newline = header_view.find('\n');
+  if (newline == std::string_view::npos) {
+    return LruIndex::RecordResult::not_recorded;
+  }
+  const auto snapshot_size = parse_header(header_view.substr(0, newline));
+  if (!snapshot_size) {
+    return LruIndex::RecordResult::not_recorded;
+  }
+
+  // The caller holds the level 2 content lock, so no other process appends to
+  // or rewrites the index meanwhile. This matters on NFS where O_APPEND doesn't
+  // guarantee that the write goes to the end of the file.
+  if (!util::write_fd(*fd, line.data(), line.size())) {
+    return LruIndex::RecordResult::not_recorded;
+  }
+
+  const auto size = lseek(*fd, 0, SEEK_END);
+  return size > 0
+             && static_cast<uint64_t>(size)
+                  > k_max_journal_growth_factor * *snapshot_size
+                      + k_min_journal_growth
+           ? LruIndex::RecordResult::compaction_needed
+           : LruIndex::RecordResult::recorded;
+}
+
+} // namespace
+
+LruIndex::LruIndex(const fs::path& l2_dir)
+  : m_dir(l2_dir),
+    m_path(l2_dir / k_file_name)
+{
+}
+
+LruIndex::RecordResult
+LruIndex::record_use(const fs::path& path,
+                     uint64_t size_on_disk,
+                     uint32_t cost)
+{
+  const auto name = relative_name(m_dir, path);
+  if (!name) {
+    return RecordResult::not_recorded;
+  }
+  return append_line(m_path,
+                     FMT("+ {} {} {} 1 {}\n",
+                         util::TimePoint::now().sec(),
+                         size_on_disk,
+                         cost,
+                         *name));
+}
+
+void
+LruIndex::record_removal(const fs::path& path)
+{
+  const auto name = relative_name(m_dir, path);
+  if (name) {
+    append_line(m_path, FMT("- {}\n", *name));
+  }
+}
+
+bool
+LruIndex::has_recorded_use_since(const fs::path& path,
+                                 util::TimePoint since) const
+{
+  const auto name = relative_name(m_dir, path);
+  if (!name) {
+    return false;
+  }
+  const auto size = util::DirEntry(m_path).size();
+  const auto pos = size > k_max_recent_use_scan ? size - k_max_recent_use_scan
+                                                : 0;
+  const auto data = util::read_file_part<std::string>(
+    m_path, static_cast<size_t>(pos), static_cast<size_t>(size - pos));
+  if (!data) {
+    return false;
+  }
+
+  // Records are appended in the order they happen, so look at them from the
+  // end until one is older than `since`.
+  std::string_view rest(*data);
+  const auto end = rest.rfind('\n');
+  if (end == std::string_view::npos) {
+    return false;
+  }
+  rest = rest.substr(0, end); // Ignore a partially written last record.
+  while (true) {
+    const auto newline = rest.rfind('\n');
+    if (newline == std::string_view::npos && pos > 0) {
+      // The first record may have been cut by starting to read at `pos`.
+      return false;
+    }
+    const auto line =
+      newline == std::string_view::npos ? rest : rest.substr(newline + 1);
+
+    const auto fields = util::split_into_views(line, " ");
+    if (fields.size() == 6 && fields[0] == "+") {
+      const auto time = util::parse_unsigned(
+        fields[1], std::nullopt, std::numeric_limits<int64_t>::max());
+      if (!time || static_cast<int64_t>(*time) < since.sec()) {
+        return false;
+      }
+      if (fields[5] == *name) {
+        return true;
+      }
+    } else if (fields.size() != 2 || fields[0] != "-" || fields[1] == *name) {
+      // Header, bad record or removal of `path`.
+      return false;
+    }
+
+    if (newline == std::string_view::npos) {
+      return false;
+    }
+    rest = rest.substr(0, newline);
+  }
+}
+
+std::optional<std::vector<LruIndex::Entry>>
+LruIndex::load()
+{
+  m_loaded_size = 0;
+
+  const auto content = util::read_file<std::string>(m_path);
+  if (!content) {
+    return std::nullopt;
+  }
+  std::string_view data(*content);
+
+  struct Record
+  {
+    std::string_view name;
+    bool removed;
+    int64_t time;
+    uint64_t size;
+    uint32_t cost;
+    uint32_t uses;
+    bool journaled;
+  };
+  std::vector<Record> records;
+  std::unordered_map<std::string_view, size_t> last_record;
+
+  size_t pos = 0;
+  size_t snapshot_end = 0;
+  bool header_seen = false;
+  while (pos < data.size()) {
+    const auto newline = data.find('\n', pos);
+    if (newline == std::string_view::npos) {
+      // Partially written record. Ignore it for now.
+      break;
+    }
+    const auto line = data.substr(pos, newline - pos);
+    pos = newline + 1;
+
+    if (!header_seen) {
+      const auto snapshot_size = parse_header(line);
+      if (!snapshot_size) {
+        LOG("Ignoring {} due to bad header", m_path);
+        return std::nullopt;
+      }
+      header_seen = true;
+      snapshot_end = pos + *snapshot_size;
+      continue;
+    }
+    const bool journaled = pos > snapshot_end;
+
+    const auto fields = util::split_into_views(line, " ");
+    std::optional<Record> record;
+    if (fields.size() == 6 && fields[0] == "+") {
+      const auto time = util::parse_unsigned(
+        fields[1], std::nullopt, std::numeric_limits<int64_t>::max());
+      const auto size = util::parse_unsigned(fields[2]);
+      const auto cost = util::parse_unsigned(
+        fields[3], std::nullopt, std::numeric_limits<uint32_t>::max());
+      const auto uses = util::parse_unsigned(
+        fields[4], std::nullopt, std::numeric_limits<uint32_t>::max());
+      if (time && size && cost && uses) {
+        record = Record{fields[5],
+                        false,
+                        static_cast<int64_t>(*time),
+                        *size,
+                        static_cast<uint32_t>(*cost),
+                        static_cast<uint32_t>(*uses),
+                        journaled};
+      }
+    } else if (fields.size() == 2 && fields[0] == "-") {
+      record = Record{fields[1], true, 0, 0, 0, 0, journaled};
+    }
+    if (!record) {
+      // Skip a torn record instead of discarding the whole index. An entry
+      // that goes missing this way makes the index disagree with the file
+      // counter, which makes cleanup fall back to scanning the directory.
+      LOG("Ignoring bad record in {}: {}", m_path, line);
+      continue;
+    }
+
+    // A use of an existing entry adds to its use count and keeps its cost
+    // unless a new one is recorded.
+    const auto previous = last_record.find(record->name);
+    if (!record->removed && previous != last_record.end()
+        && !records[previous->second].removed) {
+      const auto& previous_record = records[previous->second];
+      if (record->cost == 0) {
+        record->cost = previous_record.cost;
+      }
+      record->uses = static_cast<uint32_t>(
+        std::min<uint64_t>(uint64_t{previous_record.uses} + record->uses,
+                           std::numeric_limits<uint32_t>::max()));
+    }
+    last_record[record->name] = records.size();
+    records.push_back(*record);
+  }
+  if (!header_seen) {
+    return std::nullopt;
+  }
+
+  std::vector<Entry> entries;
+  entries.reserve(last_record.size());
+  for (size_t i = 0; i < records.size(); ++i) {
+    const auto& record = records[i];
+    if (!record.removed && last_record[record.name] == i) {
+      entries.push_back({m_dir / record.name,
+                         util::TimePoint(record.time),
+                         record.size,
+                         record.cost,
+                         record.uses,
+                         record.journaled});
+    }
+  }
+
+  m_loaded_size = pos;
+  return entries;
+}
+
+void
+LruIndex::write(const std::vector<Entry>& entries)
+{
+  std::string snapshot;
+  for (const auto& entry : entries) {
+    const auto name = relative_name(m_dir, entry.path);
+    if (name) {
+      snapshot += FMT("+ {} {} {} {} {}\n",
+                      entry.last_used.sec(),
+                      entry.size_on_disk,
+                      entry.cost,
+                      entry.uses,
+                      *name);
+    }
+  }
+  std::string header = FMT("{}{}\n", k_header_prefix, snapshot.size());
+
+  if (m_loaded_size > 0) {
+    // Keep records appended by other processes since the index was loaded.
+    const auto content = util::read_file<std::string>(m_path);
+    if (content && content->size() > m_loaded_size) {
+      const auto end = content->rfind('\n');
+      if (end != std::string::npos && end >= m_loaded_size) {
+        snapshot.append(*content, m_loaded_size, end + 1 - m_loaded_size);
+      }
+    }
+  }
+
+  try {
+    core::AtomicFile file(m_path, core::AtomicFile::Mode::binary);
+    file.write(header);
+    if (!snapshot.empty()) {
+      file.write(snapshot);
+    }
+    file.commit();
+    m_loaded_size = 0;
+  } catch (const core::Error& e) {
+    LOG("Failed to write {}: {}", m_path, e.what());
+  }
+}
+
+void
+LruIndex::compact()
+{
+  const auto entries = load();
+  if (entries) {
+    LOG("Compacting {}", m_path);
+    write(*entries);
+  }
+}
+
+void
+LruIndex::remove()
+{
+  util::remove_nfs_safe(m_path);
+  m_loaded_size = 0;
+}
+
+} // namespace storage::local
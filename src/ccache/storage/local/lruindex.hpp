@@ -0,0 +1,113 @@
+// Copyright (C) 2025 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include <ccache/util/timepoint.hpp>
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <vector>
+
+namespace storage::local {
+
+// An LRU index keeps track of the files in a level 2 cache directory and when
+// they were last used so that cleanup can pick files to evict without stat-ing
+// all files in the directory.
+//
+// The index is a text journal. It starts with a snapshot of all files, oldest
+// first, written by write(). Each use, addition or removal of a file is then
+// appended as a single line by record_use() and record_removal(). Since
+// records are appended in the order they happen, replaying the journal yields
+// the files in LRU order without sorting.
+//
+// Appending and rewriting both require the level 2 content lock since a record
+// appended while write() replaces the file would otherwise be lost. Bad records
+// are skipped when loading.
+//
+// The journal is only appended to if a snapshot exists, i.e. after the first
+// cleanup of the directory. It is compacted when it grows too large compared to
+// the last snapshot.
+//
+// Each entry also carries the time it took to produce it (the compile duration
+// stored in the cache entry header) and a use count, which the GDSF eviction
+// policy uses to keep entries that are expensive to recreate.
+class LruIndex
+{
+public:
+  struct Entry
+  {
+    std::filesystem::path path;
+    util::TimePoint last_used;
+    uint64_t size_on_disk;
+    // Compile duration in milliseconds, 0 if unknown.
+    uint32_t cost = 0;
+    // Number of recorded additions and uses.
+    uint32_t uses = 1;
+    // Whether the last use was recorded in the journal after the snapshot.
+    bool journaled = false;
+  };
+
+  enum class RecordResult { not_recorded, recorded, compaction_needed };
+
+  // Name of the index file in a level 2 cache directory.
+  static constexpr char k_file_name[] = "lru";
+
+  explicit LruIndex(const std::filesystem::path& l2_dir);
+
+  // Return whether a use of `path` at or after `since` is recorded. Only the
+  // end of the journal is read, so an older record of such a use may be missed.
+  bool has_recorded_use_since(const std::filesystem::path& path,
+                              util::TimePoint since) const;
+
+  // Return all files, least recently used first, or std::nullopt if there is
+  // no index or if its header is bad.
+  std::optional<std::vector<Entry>> load();
+
+  // --- Methods that require the level 2 content lock ---
+
+  // Record that `path` (a file in the level 2 directory or a subdirectory of
+  // it) was added or used. A `cost` of 0 keeps the previously recorded cost.
+  // Returns not_recorded if there is no index and compaction_needed if the
+  // journal should be compacted.
+  RecordResult record_use(const std::filesystem::path& path,
+                          uint64_t size_on_disk,
+                          uint32_t cost = 0);
+
+  // Record that `path` was removed.
+  void record_removal(const std::filesystem::path& path);
+
+  // Replace the journal with a snapshot of `entries`, which must be sorted
+  // least recently used first. Records appended since the index was loaded by
+  // load() are kept.
+  void write(const std::vector<Entry>& entries);
+
+  // Replace the journal with a snapshot of its current content.
+  void compact();
+
+  // Remove the index.
+  void remove();
+
+private:
+  std::filesystem::path m_dir;
+  std::filesystem::path m_path;
+  uint64_t m_loaded_size = 0;
+};
+
+} // namespace storage::local
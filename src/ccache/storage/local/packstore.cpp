@@ -0,0 +1,808 @@
+// Copyright (C) 2025 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "packstore.hpp"
+
+#include <ccache/util/defer.hpp>
+#include <ccache/util/direntry.hpp>
+#include <ccache/util/duration.hpp>
+#include <ccache/util/fd.hpp>
+#include <ccache/util/file.hpp>
+#include <ccache/util/filesystem.hpp>
+#include <ccache/util/format.hpp>
+#include <ccache/util/logging.hpp>
+#include <ccache/util/memorymap.hpp>
+#include <ccache/util/path.hpp>
+#include <ccache/util/string.hpp>
+#include <ccache/util/temporaryfile.hpp>
+#include <ccache/util/wincompat.hpp>
+
+#include <fcntl.h>
+#ifdef HAVE_UNISTD_H
+#  include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <map>
+#include <set>
+#include <tuple>
+#include <unordered_map>
+
+namespace fs = util::filesystem;
+
+using util::DirEntry;
+
+namespace storage::local {
+
+namespace {
+
+// Increment the version if the format of the index or segment files changes.
+const uint32_t k_version = 1;
+
+const uint32_t k_index_magic = 0x63506b49;  // "cPkI"
+const uint32_t k_record_magic = 0x63506b52; // "cPkR"
+
+const uint32_t k_min_index_capacity = 1024;
+
+// The index is rebuilt with a larger capacity when more than this fraction of
+// its slots are used (including slots of removed entries).
+const double k_max_index_load = 0.7;
+
+// A new segment is started when appending to the current segment would make it
+// larger than this.
+const uint64_t k_max_segment_size = 16 * 1024 * 1024;
+
+// A segment is compacted when less than this fraction of it is used by live
+// entries.
+const double k_min_segment_live_ratio = 0.75;
+
+enum class SlotState : uint32_t { empty = 0, used = 1, removed = 2 };
+
+struct IndexHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t capacity;
+  // Number of slots that are used or removed.
+  uint32_t used_slots;
+  uint32_t live_entries;
+  uint32_t current_segment;
+  // Total size of records in all segments.
+  uint64_t data_size;
+};
+
+struct IndexSlot
+{
+  // A slot is only written while its state is empty. The state is set last so
+  // that a reader never sees a partially written slot.
+  std::atomic<SlotState> state;
+  std::atomic<uint32_t> last_used;
+  uint32_t segment;
+  uint32_t offset;
+  uint32_t size;
+  uint8_t type;
+  Hash::Digest key;
+  uint8_t padding[3];
+};
+
+struct RecordHeader
+{
+  uint32_t magic;
+  uint32_t size;
+  uint8_t type;
+  Hash::Digest key;
+  uint8_t padding[3];
+};
+
+static_assert(std::atomic<SlotState>::is_always_lock_free);
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
+
+size_t
+get_index_size(uint32_t capacity)
+{
+  return sizeof(IndexHeader) + size_t{capacity} * sizeof(IndexSlot);
+}
+
+uint32_t
+get_index_capacity(size_t entries)
+{
+  uint32_t capacity = k_min_index_capacity;
+  while (static_cast<double>(capacity) * k_max_index_load
+         < static_cast<double>(2 * entries)) {
+    capacity *= 2;
+  }
+  return capacity;
+}
+
+uint32_t
+get_start_slot(const Hash::Digest& key, uint32_t capacity)
+{
+  // The first byte selects the level 2 directory, so use the following bytes.
+  uint32_t value;
+  memcpy(&value, key.data() + 1, sizeof(value));
+  return value & (capacity - 1);
+}
+
+fs::path
+get_segment_path(const fs::path& dir, uint32_t segment)
+{
+  return dir / FMT("{}.seg", segment);
+}
+
+uint64_t
+get_file_size(const fs::path& path, int fd)
+{
+#ifndef _WIN32
+  return DirEntry(path, fd).size();
+#else
+  (void)fd;
+  return DirEntry(path).size();
+#endif
+}
+
+class Index
+{
+public:
+  Index() = default;
+  Index(util::MemoryMap map, bool writable);
+
+  // Map the index at `path`. Returns nullopt if it doesn't exist or is
+  // invalid.
+  static std::optional<Index> open(const fs::path& path, bool writable);
+
+  // Map the index at `path` for writing if possible, otherwise for reading.
+  static std::optional<Index> open_for_lookup(const fs::path& path);
+
+  bool
+  writable() const
+  {
+    return m_writable;
+  }
+
+  IndexHeader&
+  header()
+  {
+    return *reinterpret_cast<IndexHeader*>(m_map.ptr());
+  }
+
+  IndexSlot*
+  slots()
+  {
+    return reinterpret_cast<IndexSlot*>(static_cast<uint8_t*>(m_map.ptr())
+                                        + sizeof(IndexHeader));
+  }
+
+  IndexSlot* find(const Hash::Digest& key, core::CacheEntryType type);
+
+  // Add an entry. There must be a free slot.
+  void insert(const PackStore::Entry& entry);
+
+  std::vector<PackStore::Entry> entries();
+
+private:
+  util::MemoryMap m_map;
+  bool m_writable = false;
+};
+
+Index::Index(util::MemoryMap map, bool writable)
+  : m_map(std::move(map)),
+    m_writable(writable)
+{
+}
+
+std::optional<Index>
+Index::open(const fs::path& path, bool writable)
+{
+  util::Fd fd(::open(util::pstr(path).c_str(),
+                     (writable ? O_RDWR : O_RDONLY) | O_BINARY));
+  if (!fd) {
+    return std::nullopt;
+  }
+  const auto file_size = get_file_size(path, *fd);
+  if (file_size < sizeof(IndexHeader)) {
+    LOG("Ignoring {} with unexpected size", path);
+    return std::nullopt;
+  }
+
+  auto map = writable ? util::MemoryMap::map(*fd, file_size)
+                      : util::MemoryMap::map_read_only(*fd, file_size);
+  if (!map) {
+    LOG("Failed to map {}: {}", path, map.error());
+    return std::nullopt;
+  }
+
+  const auto& header = *reinterpret_cast<const IndexHeader*>(map->ptr());
+  if (header.magic != k_index_magic || header.version != k_version
+      || header.capacity == 0
+      || (header.capacity & (header.capacity - 1)) != 0
+      || get_index_size(header.capacity) != file_size) {
+    LOG("Ignoring {} with unexpected header", path);
+    return std::nullopt;
+  }
+
+  return Index(std::move(*map), writable);
+}
+
+std::optional<Index>
+Index::open_for_lookup(const fs::path& path)
+{
+  auto index = open(path, true);
+  if (!index && (errno == EACCES || errno == EROFS)) {
+    // Read-only cache directory.
+    index = open(path, false);
+  }
+  return index;
+}
+
+IndexSlot*
+Index::find(const Hash::Digest& key, core::CacheEntryType type)
+{
+  const uint32_t capacity = header().capacity;
+  const uint32_t start = get_start_slot(key, capacity);
+  for (uint32_t i = 0; i < capacity; ++i) {
+    auto& slot = slots()[(start + i) & (capacity - 1)];
+    const auto state = slot.state.load(std::memory_order_acquire);
+    if (state == SlotState::empty) {
+      return nullptr;
+    }
+    if (state == SlotState::used && slot.key == key
+        && slot.type == static_cast<uint8_t>(type)) {
+      return &slot;
+    }
+  }
+  return nullptr;
+}
+
+void
+Index::insert(const PackStore::Entry& entry)
+{
+  auto& h = header();
+  uint32_t i = get_start_slot(entry.key, h.capacity);
+  while (slots()[i].state.load(std::memory_order_relaxed)
+         != SlotState::empty) {
+    i = (i + 1) & (h.capacity - 1);
+  }
+
+  auto& slot = slots()[i];
+  slot.last_used.store(static_cast<uint32_t>(entry.last_used.sec()),
+                       std::memory_order_relaxed);
+  slot.segment = entry.segment;
+  slot.offset = entry.offset;
+  slot.size = entry.size;
+  slot.type = static_cast<uint8_t>(entry.type);
+  slot.key = entry.key;
+  slot.state.store(SlotState::used, std::memory_order_release);
+
+  ++h.used_slots;
+  ++h.live_entries;
+}
+
+std::vector<PackStore::Entry>
+Index::entries()
+{
+  std::vector<PackStore::Entry> result;
+  const uint32_t capacity = header().capacity;
+  for (uint32_t i = 0; i < capacity; ++i) {
+    const auto& slot = slots()[i];
+    if (slot.state.load(std::memory_order_acquire) == SlotState::used) {
+      result.push_back(
+        {slot.key,
+         static_cast<core::CacheEntryType>(slot.type),
+         slot.segment,
+         slot.offset,
+         slot.size,
+         util::TimePoint(slot.last_used.load(std::memory_order_relaxed))});
+    }
+  }
+  return result;
+}
+
+// Write a new index containing `entries` to `path`.
+tl::expected<void, std::string>
+write_index(const fs::path& path,
+            const std::vector<PackStore::Entry>& entries,
+            uint32_t current_segment,
+            uint64_t data_size)
+{
+  auto tmp_file = util::TemporaryFile::create(path);
+  if (!tmp_file) {
+    return tl::unexpected(tmp_file.error());
+  }
+  DEFER(unlink(util::pstr(tmp_file->path).c_str()));
+
+  const uint32_t capacity = get_index_capacity(entries.size());
+  const size_t size = get_index_size(capacity);
+  if (auto result = util::fallocate(*tmp_file->fd, size); !result) {
+    return tl::unexpected(result.error());
+  }
+  auto map = util::MemoryMap::map(*tmp_file->fd, size);
+  if (!map) {
+    return tl::unexpected(map.error());
+  }
+
+  // The file is zero-filled by fallocate, so all slots are empty.
+  auto& header = *reinterpret_cast<IndexHeader*>(map->ptr());
+  header.magic = k_index_magic;
+  header.version = k_version;
+  header.capacity = capacity;
+  header.current_segment = current_segment;
+  header.data_size = data_size;
+
+  Index index(std::move(*map), true);
+  for (const auto& entry : entries) {
+    index.insert(entry);
+  }
+  index = Index();
+  tmp_file->fd.close();
+
+  if (auto result = fs::rename(tmp_file->path, path); !result) {
+    return tl::unexpected(result.error().message());
+  }
+  return {};
+}
+
+// Appends records to segment files, starting a new segment when the current
+// one is full.
+class SegmentWriter
+{
+public:
+  SegmentWriter(const fs::path& dir, uint32_t segment)
+    : m_dir(dir),
+      m_segment(segment)
+  {
+  }
+
+  uint32_t
+  segment() const
+  {
+    return m_segment;
+  }
+
+  // Append a record and return the entry referring to it.
+  tl::expected<PackStore::Entry, std::string>
+  append(const Hash::Digest& key,
+         core::CacheEntryType type,
+         nonstd::span<const uint8_t> value,
+         util::TimePoint last_used);
+
+private:
+  fs::path m_dir;
+  uint32_t m_segment;
+  util::Fd m_fd;
+  uint64_t m_offset = 0;
+
+  tl::expected<void, std::string> open_segment();
+};
+
+tl::expected<void, std::string>
+SegmentWriter::open_segment()
+{
+  const auto path = get_segment_path(m_dir, m_segment);
+  m_fd = util::Fd(::open(
+    util::pstr(path).c_str(), O_WRONLY | O_CREAT | O_BINARY, 0666));
+  if (!m_fd) {
+    return tl::unexpected(FMT("Failed to open {}: {}", path, strerror(errno)));
+  }
+  // Start after any records (or partially written records) already present.
+  const auto offset = lseek(*m_fd, 0, SEEK_END);
+  if (offset < 0) {
+    return tl::unexpected(
+      FMT("Failed to seek in {}: {}", path, strerror(errno)));
+  }
+  m_offset = static_cast<uint64_t>(offset);
+  return {};
+}
+
+tl::expected<PackStore::Entry, std::string>
+SegmentWriter::append(const Hash::Digest& key,
+                      core::CacheEntryType type,
+                      nonstd::span<const uint8_t> value,
+                      util::TimePoint last_used)
+{
+  const uint64_t record_size = sizeof(RecordHeader) + value.size();
+  if (!m_fd) {
+    if (auto result = open_segment(); !result) {
+      return tl::unexpected(result.error());
+    }
+  }
+  if (m_offset > 0 && m_offset + record_size > k_max_segment_size) {
+    ++m_segment;
+    if (auto result = open_segment(); !result) {
+      return tl::unexpected(result.error());
+    }
+  }
+
+  RecordHeader header{};
+  header.magic = k_record_magic;
+  header.size = static_cast<uint32_t>(value.size());
+  header.type = static_cast<uint8_t>(type);
+  header.key = key;
+
+  util::Bytes record;
+  record.reserve(record_size);
+  record.insert(record.end(),
+                reinterpret_cast<const uint8_t*>(&header),
+                sizeof(header));
+  record.insert(record.end(), value);
+  if (auto result = util::write_fd(*m_fd, record.data(), record.size());
+      !result) {
+    // Leave the partial record to be skipped by later appends.
+    return tl::unexpected(result.error());
+  }
+
+  PackStore::Entry entry{key,
+                         type,
+                         m_segment,
+                         static_cast<uint32_t>(m_offset),
+                         static_cast<uint32_t>(value.size()),
+                         last_used};
+  m_offset += record_size;
+  return entry;
+}
+
+// Map the record of `entry` in `segment_path` and call `receiver` with its
+// data.
+template<typename T>
+tl::expected<T, std::string>
+with_record(const fs::path& segment_path,
+            const PackStore::Entry& entry,
+            const std::function<T(nonstd::span<const uint8_t>)>& receiver)
+{
+  util::Fd fd(::open(util::pstr(segment_path).c_str(), O_RDONLY | O_BINARY));
+  if (!fd) {
+    return tl::unexpected(strerror(errno));
+  }
+  const uint64_t end = uint64_t{entry.offset} + entry.record_size();
+  if (get_file_size(segment_path, *fd) < end) {
+    return tl::unexpected("truncated segment");
+  }
+  auto map = util::MemoryMap::map_read_only(*fd, end);
+  if (!map) {
+    return tl::unexpected(map.error());
+  }
+
+  RecordHeader header;
+  memcpy(&header, map->data().data() + entry.offset, sizeof(header));
+  if (header.magic != k_record_magic || header.size != entry.size
+      || header.type != static_cast<uint8_t>(entry.type)
+      || header.key != entry.key) {
+    return tl::unexpected("record mismatch");
+  }
+  return receiver(
+    map->data().subspan(entry.offset + sizeof(RecordHeader), entry.size));
+}
+
+} // namespace
+
+uint64_t
+PackStore::Entry::record_size() const
+{
+  return sizeof(RecordHeader) + size;
+}
+
+PackStore::PackStore(const fs::path& dir) : m_dir(dir)
+{
+}
+
+std::optional<bool>
+PackStore::get(const Hash::Digest& key,
+               core::CacheEntryType type,
+               const EntryReceiver& entry_receiver) const
+{
+  auto index = Index::open_for_lookup(get_index_path());
+  if (!index) {
+    return std::nullopt;
+  }
+  auto* slot = index->find(key, type);
+  if (!slot) {
+    return std::nullopt;
+  }
+
+  const Entry entry{
+    key, type, slot->segment, slot->offset, slot->size, util::TimePoint()};
+  const auto segment_path = get_segment_path(m_dir, entry.segment);
+  const auto result =
+    with_record<bool>(segment_path, entry, [&](auto data) {
+      // Update last use time to save the entry from LRU cleanup.
+      if (index->writable()) {
+        slot->last_used.store(
+          static_cast<uint32_t>(util::TimePoint::now().sec()),
+          std::memory_order_relaxed);
+      }
+      return entry_receiver(data);
+    });
+  if (!result) {
+    LOG("Failed to read {} from {}: {}",
+        util::format_digest(key),
+        segment_path,
+        result.error());
+    return std::nullopt;
+  }
+  return *result;
+}
+
+bool
+PackStore::contains(const Hash::Digest& key, core::CacheEntryType type) const
+{
+  auto index = Index::open(get_index_path(), false);
+  return index && index->find(key, type);
+}
+
+std::vector<PackStore::Entry>
+PackStore::entries() const
+{
+  auto index = Index::open(get_index_path(), false);
+  return index ? index->entries() : std::vector<Entry>();
+}
+
+tl::expected<util::Bytes, std::string>
+PackStore::read(const Entry& entry) const
+{
+  return with_record<util::Bytes>(
+    get_segment_path(m_dir, entry.segment), entry, [](auto data) {
+      return util::Bytes(data.data(), data.size());
+    });
+}
+
+PackStore::Usage
+PackStore::usage() const
+{
+  Usage result;
+  auto index = Index::open(get_index_path(), false);
+  if (index) {
+    const auto& header = index->header();
+    result.entries = header.live_entries;
+    result.size = header.data_size + get_index_size(header.capacity);
+  }
+  return result;
+}
+
+tl::expected<PackStore::PutResult, std::string>
+PackStore::put(const Hash::Digest& key,
+               core::CacheEntryType type,
+               nonstd::span<const uint8_t> value)
+{
+  if (value.size() > k_max_entry_size) {
+    return tl::unexpected("entry too large");
+  }
+  if (auto result = fs::create_directories(m_dir); !result) {
+    return tl::unexpected(result.error().message());
+  }
+
+  const auto index_path = get_index_path();
+  auto index = Index::open(index_path, true);
+  if (!index) {
+    if (auto result = write_index(index_path, {}, 0, 0); !result) {
+      return tl::unexpected(
+        FMT("Failed to create {}: {}", index_path, result.error()));
+    }
+    index = Index::open(index_path, true);
+  } else if (static_cast<double>(index->header().used_slots + 1)
+             > k_max_index_load
+                 * static_cast<double>(index->header().capacity)) {
+    // Grow the index and drop removed slots.
+    const auto& header = index->header();
+    const auto entries = index->entries();
+    const auto current_segment = header.current_segment;
+    const auto data_size = header.data_size;
+    index.reset();
+    if (auto result =
+          write_index(index_path, entries, current_segment, data_size);
+        !result) {
+      return tl::unexpected(
+        FMT("Failed to rebuild {}: {}", index_path, result.error()));
+    }
+    index = Index::open(index_path, true);
+  }
+  if (!index) {
+    return tl::unexpected(FMT("Failed to open {}", index_path));
+  }
+
+  auto& header = index->header();
+  SegmentWriter writer(m_dir, header.current_segment);
+  const auto entry = writer.append(key, type, value, util::TimePoint::now());
+  if (!entry) {
+    return tl::unexpected(entry.error());
+  }
+
+  // Insert the new entry before removing the old one so that concurrent
+  // readers always find one of them.
+  auto* old_slot = index->find(key, type);
+  index->insert(*entry);
+  if (old_slot) {
+    old_slot->state.store(SlotState::removed, std::memory_order_release);
+    --header.live_entries;
+  }
+
+  PutResult result{!old_slot, header.data_size, 0};
+  header.current_segment = writer.segment();
+  header.data_size += entry->record_size();
+  result.new_data_size = header.data_size;
+  return result;
+}
+
+bool
+PackStore::remove(const Hash::Digest& key, core::CacheEntryType type)
+{
+  auto index = Index::open(get_index_path(), true);
+  if (!index) {
+    return false;
+  }
+  auto* slot = index->find(key, type);
+  if (!slot) {
+    return false;
+  }
+  slot->state.store(SlotState::removed, std::memory_order_release);
+  --index->header().live_entries;
+  return true;
+}
+
+void
+PackStore::remove(const std::vector<Entry>& entries)
+{
+  auto index = Index::open(get_index_path(), true);
+  if (!index) {
+    return;
+  }
+  for (const auto& entry : entries) {
+    auto* slot = index->find(entry.key, entry.type);
+    if (slot && slot->segment == entry.segment
+        && slot->offset == entry.offset) {
+      slot->state.store(SlotState::removed, std::memory_order_release);
+      --index->header().live_entries;
+    }
+  }
+}
+
+void
+PackStore::compact()
+{
+  const auto index_path = get_index_path();
+  auto index = Index::open(index_path, true);
+  if (!index) {
+    return;
+  }
+  auto entries = index->entries();
+  const auto& header = index->header();
+  const bool has_removed_slots = header.used_slots != header.live_entries;
+  uint32_t current_segment = header.current_segment;
+  index.reset();
+
+  std::unordered_map<uint32_t, uint64_t> live_size;
+  for (const auto& entry : entries) {
+    live_size[entry.segment] += entry.record_size();
+  }
+
+  std::map<uint32_t, uint64_t> segment_sizes;
+  const auto now = util::TimePoint::now();
+  util::traverse_directory(m_dir, [&](const auto& de) {
+    if (de.is_directory()) {
+      return;
+    }
+    if (util::TemporaryFile::is_tmp_file(de.path())) {
+      // Left-over temporary index file.
+      if (de.mtime() + util::Duration(3600) < now) {
+        util::remove(de.path());
+      }
+      return;
+    }
+    const auto name = util::pstr(de.path().filename()).str();
+    if (!util::ends_with(name, ".seg")) {
+      return;
+    }
+    const auto segment =
+      util::parse_unsigned(name.substr(0, name.length() - 4), 0, UINT32_MAX);
+    if (segment) {
+      segment_sizes[static_cast<uint32_t>(*segment)] = de.size();
+    }
+  }).or_else([&](const auto& error) {
+    LOG("Failed to compact {}: {}", m_dir, error);
+  });
+
+  std::set<uint32_t> compacted_segments;
+  uint32_t next_segment = current_segment;
+  for (const auto& [segment, size] : segment_sizes) {
+    next_segment = std::max(next_segment, segment + 1);
+    if (static_cast<double>(live_size[segment])
+        < k_min_segment_live_ratio * static_cast<double>(size)) {
+      compacted_segments.insert(segment);
+    }
+  }
+  if (compacted_segments.empty() && !has_removed_slots) {
+    return;
+  }
+
+  uint64_t data_size = 0;
+  for (const auto& [segment, size] : segment_sizes) {
+    if (compacted_segments.count(segment) == 0) {
+      data_size += size;
+    }
+  }
+
+  if (!compacted_segments.empty()) {
+    // Move live entries to new segments, reading the old segments
+    // sequentially.
+    std::sort(
+      entries.begin(), entries.end(), [](const auto& e1, const auto& e2) {
+        return std::tie(e1.segment, e1.offset)
+               < std::tie(e2.segment, e2.offset);
+      });
+    SegmentWriter writer(m_dir, next_segment);
+    std::vector<Entry> kept_entries;
+    for (const auto& entry : entries) {
+      if (compacted_segments.count(entry.segment) == 0) {
+        kept_entries.push_back(entry);
+        continue;
+      }
+      auto new_entry =
+        read(entry).and_then([&](const util::Bytes& data) {
+          return writer.append(entry.key, entry.type, data, entry.last_used);
+        });
+      if (!new_entry) {
+        LOG("Dropping {} from {} during compaction: {}",
+            util::format_digest(entry.key),
+            m_dir,
+            new_entry.error());
+        continue;
+      }
+      data_size += new_entry->record_size();
+      kept_entries.push_back(*new_entry);
+    }
+    entries = std::move(kept_entries);
+    current_segment = writer.segment();
+  }
+
+  if (auto result =
+        write_index(index_path, entries, current_segment, data_size);
+      !result) {
+    LOG("Failed to rebuild {}: {}", index_path, result.error());
+    return;
+  }
+  for (const auto segment : compacted_segments) {
+    util::remove(get_segment_path(m_dir, segment));
+  }
+  LOG("Compacted {} ({} segments rewritten, {} entries)",
+      m_dir,
+      compacted_segments.size(),
+      entries.size());
+}
+
+void
+PackStore::clear()
+{
+  if (!DirEntry(m_dir).is_directory()) {
+    return;
+  }
+  util::traverse_directory(m_dir, [](const auto& de) {
+    if (!de.is_directory()) {
+      util::remove(de.path());
+    }
+  }).or_else([&](const auto& error) {
+    LOG("Failed to clear {}: {}", m_dir, error);
+  });
+}
+
+fs::path
+PackStore::get_index_path() const
+{
+  return m_dir / "index";
+}
+
+} // namespace storage::local
@@ -0,0 +1,132 @@
+// Copyright (C) 2025 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include <ccache/core/types.hpp>
+#include <ccache/hash.hpp>
+#include <ccache/util/bytes.hpp>
+#include <ccache/util/timepoint.hpp>
+
+#include <nonstd/span.hpp>
+#include <tl/expected.hpp>
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace storage::local {
+
+// A pack store keeps small cache entries of a level 2 cache directory in
+// append-only segment files instead of one file per entry. An index file maps
+// keys to segment, offset and size. The index is an open addressing hash table
+// that is mapped into memory, so lookups don't need to take a lock. Entries
+// are never modified in place: removing or replacing an entry only marks the
+// old index slot as removed, and the space is reclaimed by compact().
+//
+// Methods that modify the store must be called with the level 2 content lock
+// held. Other methods may be called without the lock.
+class PackStore
+{
+public:
+  struct Entry
+  {
+    Hash::Digest key;
+    core::CacheEntryType type;
+    uint32_t segment;
+    uint32_t offset;
+    uint32_t size;
+    util::TimePoint last_used;
+
+    // Number of bytes used by the entry in its segment.
+    uint64_t record_size() const;
+  };
+
+  struct PutResult
+  {
+    // Whether the key was not present before.
+    bool added;
+    // Size of all segments before and after the put.
+    uint64_t old_data_size;
+    uint64_t new_data_size;
+  };
+
+  struct Usage
+  {
+    uint64_t entries = 0;
+    uint64_t size = 0;
+  };
+
+  using EntryReceiver = std::function<bool(nonstd::span<const uint8_t> value)>;
+
+  // Name of the pack store directory in a level 2 cache directory.
+  static constexpr char k_dir_name[] = "pack";
+
+  // Maximum size of an entry that can be stored in a pack store.
+  static constexpr uint32_t k_max_entry_size = 64 * 1024;
+
+  explicit PackStore(const std::filesystem::path& dir);
+
+  // Call `entry_receiver` with the data of the entry if it exists and mark the
+  // entry as used. The data is only valid during the call. Returns nullopt if
+  // the entry doesn't exist or can't be read, otherwise the return value of
+  // `entry_receiver`.
+  std::optional<bool> get(const Hash::Digest& key,
+                          core::CacheEntryType type,
+                          const EntryReceiver& entry_receiver) const;
+
+  bool contains(const Hash::Digest& key, core::CacheEntryType type) const;
+
+  // Return all entries.
+  std::vector<Entry> entries() const;
+
+  // Read the data of `entry`.
+  tl::expected<util::Bytes, std::string> read(const Entry& entry) const;
+
+  // Return the number of entries and the size of all files in the store.
+  Usage usage() const;
+
+  // --- Methods that require the level 2 content lock ---
+
+  tl::expected<PutResult, std::string> put(const Hash::Digest& key,
+                                           core::CacheEntryType type,
+                                           nonstd::span<const uint8_t> value);
+
+  // Returns whether the entry existed.
+  bool remove(const Hash::Digest& key, core::CacheEntryType type);
+
+  void remove(const std::vector<Entry>& entries);
+
+  // Rewrite live entries of segments that mostly contain removed entries to a
+  // new segment, delete the old segments and drop removed slots from the
+  // index.
+  void compact();
+
+  // Delete all files in the store.
+  void clear();
+
+private:
+  std::filesystem::path m_dir;
+
+  std::filesystem::path get_index_path() const;
+};
+
+} // namespace storage::local
@@ -1,4 +1,4 @@
-// Copyright (C) 2021-2024 Joel Rosdahl and other contributors
+// Copyright (C) 2021-2025 Joel Rosdahl and other contributors
 //
 // See doc/AUTHORS.adoc for a complete list of contributors.
 //
@@ -20,22 +20,291 @@
 
 #include <ccache/core/atomicfile.hpp>
 #include <ccache/core/exceptions.hpp>
+#include <ccache/util/defer.hpp>
+#include <ccache/util/direntry.hpp>
+#include <ccache/util/fd.hpp>
 #include <ccache/util/file.hpp>
 #include <ccache/util/filesystem.hpp>
 #include <ccache/util/format.hpp>
 #include <ccache/util/lockfile.hpp>
 #include <ccache/util/logging.hpp>
+#include <ccache/util/memorymap.hpp>
+#include <ccache/util/path.hpp>
+#include <ccache/util/temporaryfile.hpp>
+
+#include <fcntl.h>
+
+#include <atomic>
+#include <cstring>
+#include <string_view>
 
 namespace fs = util::filesystem;
 
+using util::DirEntry;
+
 namespace storage::local {
 
+namespace {
+
+// Increment the version if the layout of SharedRegion changes. The version is
+// also part of the file name so that ccache versions using different layouts
+// don't touch each other's files.
+const uint32_t k_version = 1;
+
+const uint32_t k_magic = 0x63436e74; // "cCnt"
+
+// Maximum number of counters, leaving room for counters added in future ccache
+// versions.
+const size_t k_max_counters = 256;
+
+static_assert(static_cast<size_t>(core::Statistic::END) <= k_max_counters);
+static_assert(std::atomic<uint64_t>::is_always_lock_free);
+static_assert(std::atomic<int64_t>::is_always_lock_free);
+
+struct SharedRegion
+{
+  uint32_t magic;
+  uint32_t version;
+  std::atomic<int64_t> last_updated_nsec;
+  std::atomic<uint64_t> counters[k_max_counters];
+};
+
+enum class MapMode { read_only, read_write };
+
+// Map the counter file at `path`. Returns nullopt if the file doesn't exist,
+// is invalid or (in read-write mode) is on a network file system.
+std::optional<util::MemoryMap>
+map_counter_file(const fs::path& path, MapMode mode)
+{
+  util::Fd fd(open(util::pstr(path).c_str(),
+                   mode == MapMode::read_only ? O_RDONLY : O_RDWR));
+  if (!fd) {
+    if (errno != ENOENT) {
+      LOG("Failed to open {}: {}", path, strerror(errno));
+    }
+    return std::nullopt;
+  }
+  if (mode == MapMode::read_write && util::is_on_network_file_system(*fd)) {
+    return std::nullopt;
+  }
+  if (DirEntry(path).size() != sizeof(SharedRegion)) {
+    LOG("Ignoring {} with unexpected size", path);
+    return std::nullopt;
+  }
+
+  auto map = mode == MapMode::read_only
+               ? util::MemoryMap::map_read_only(*fd, sizeof(SharedRegion))
+               : util::MemoryMap::map(*fd, sizeof(SharedRegion));
+  if (!map) {
+    LOG("Failed to map {}: {}", path, map.error());
+    return std::nullopt;
+  }
+
+  const auto* sr = reinterpret_cast<const SharedRegion*>(map->data().data());
+  if (sr->magic != k_magic || sr->version != k_version) {
+    LOG("Ignoring {} with unexpected magic or version", path);
+    return std::nullopt;
+  }
+  return std::move(*map);
+}
+
+// Create a zeroed counter file at `path` unless it already exists. Returns
+// false if the file could not be created or if it would be on a network file
+// system.
+bool
+create_counter_file(const fs::path& path)
+{
+  // Create the new file to a temporary name to prevent other processes from
+  // mapping it before it is fully initialized.
+  auto tmp_file = util::TemporaryFile::create(path);
+  if (!tmp_file) {
+    LOG("Failed to create counter file: {}", tmp_file.error());
+    return false;
+  }
+
+  DEFER(unlink(util::pstr(tmp_file->path).c_str()));
+
+  if (util::is_on_network_file_system(*tmp_file->fd)) {
+    return false;
+  }
+
+  if (auto result = util::fallocate(*tmp_file->fd, sizeof(SharedRegion));
+      !result) {
+    LOG("Failed to allocate file space for {}: {}", path, result.error());
+    return false;
+  }
+
+  auto map = util::MemoryMap::map(*tmp_file->fd, sizeof(SharedRegion));
+  if (!map) {
+    LOG("Failed to map new counter file {}: {}", path, map.error());
+    return false;
+  }
+
+  // The file is zero-filled by fallocate, so only the header needs to be set.
+  auto* sr = reinterpret_cast<SharedRegion*>(map->ptr());
+  sr->magic = k_magic;
+  sr->version = k_version;
+  map->unmap();
+  tmp_file->fd.close();
+
+  // Linking fails if another process won the race to create the file, in which
+  // case that file will be used.
+  if (auto result = fs::create_hard_link(tmp_file->path, path);
+      !result && !DirEntry(path).exists()) {
+    LOG("Failed to link new counter file {}: {}", path, result.error());
+    return false;
+  }
+  return true;
+}
+
+core::StatisticsCounters
+load_counters(const SharedRegion& sr)
+{
+  core::StatisticsCounters counters;
+  for (size_t i = 0; i < k_max_counters; ++i) {
+    const uint64_t value = sr.counters[i].load(std::memory_order_relaxed);
+    // Don't extend the counters with zero-valued future counters.
+    if (value != 0 || i < counters.size()) {
+      counters.set_raw(i, value);
+    }
+  }
+  return counters;
+}
+
+// Add `diff` to `counter` without letting it go below zero. Returns the new
+// value.
+uint64_t
+add_to_counter(std::atomic<uint64_t>& counter, int64_t diff)
+{
+  uint64_t value = counter.load(std::memory_order_relaxed);
+  uint64_t new_value;
+  do {
+    new_value = diff < 0 && value < static_cast<uint64_t>(-diff)
+                  ? 0
+                  : value + static_cast<uint64_t>(diff);
+  } while (!counter.compare_exchange_weak(
+    value, new_value, std::memory_order_relaxed));
+  return new_value;
+}
+
+// Add `counters` to the counters in `sr`. Counters beyond k_max_counters are
+// dropped.
+void
+add_counters(SharedRegion& sr, const core::StatisticsCounters& counters)
+{
+  for (size_t i = 0; i < std::min(counters.size(), k_max_counters); ++i) {
+    if (counters.get_raw(i) != 0) {
+      sr.counters[i].fetch_add(counters.get_raw(i), std::memory_order_relaxed);
+    }
+  }
+}
+
+void
+set_last_updated(SharedRegion& sr)
+{
+  sr.last_updated_nsec.store(util::TimePoint::now().nsec(),
+                             std::memory_order_relaxed);
+}
+
+} // namespace
+
 StatsFile::StatsFile(const fs::path& path) : m_path(path)
 {
 }
 
+fs::path
+StatsFile::get_mapped_path() const
+{
+  return FMT("{}.v{}", m_path, k_version);
+}
+
+bool
+StatsFile::is_stats_file_name(const fs::path& filename)
+{
+  return filename == "stats"
+         || filename == StatsFile("stats").get_mapped_path();
+}
+
 core::StatisticsCounters
 StatsFile::read() const
+{
+  // Counters in a legacy stats file that has not been migrated yet are
+  // included.
+  auto counters = read_legacy();
+  if (auto map = map_counter_file(get_mapped_path(), MapMode::read_only)) {
+    counters.increment(load_counters(
+      *reinterpret_cast<const SharedRegion*>(map->data().data())));
+  }
+  return counters;
+}
+
+util::TimePoint
+StatsFile::last_updated() const
+{
+  util::TimePoint result = DirEntry(m_path).mtime();
+  if (auto map = map_counter_file(get_mapped_path(), MapMode::read_only)) {
+    const auto* sr = reinterpret_cast<const SharedRegion*>(map->data().data());
+    util::TimePoint mapped_time;
+    mapped_time.set_nsec(sr->last_updated_nsec.load(std::memory_order_relaxed));
+    result = std::max(result, mapped_time);
+  }
+  return result;
+}
+
+std::optional<core::StatisticsCounters>
+StatsFile::update(
+  std::function<void(core::StatisticsCounters& counters)> function,
+  OnlyIfChanged only_if_changed) const
+{
+  const auto mapped_path = get_mapped_path();
+  auto map = map_counter_file(mapped_path, MapMode::read_write);
+  if (!map && create_counter_file(mapped_path)) {
+    map = map_counter_file(mapped_path, MapMode::read_write);
+  }
+  if (!map) {
+    return update_legacy(function, only_if_changed);
+  }
+  auto& sr = *reinterpret_cast<SharedRegion*>(map->ptr());
+
+  if (DirEntry(m_path).exists()) {
+    // The legacy stats file must be removed before its counters are added
+    // since another process may be migrating it simultaneously. The lock
+    // also keeps older ccache versions from updating the file meanwhile.
+    util::LockFile lock(m_path);
+    if (lock.acquire()) {
+      const auto legacy_counters = read_legacy();
+      if (fs::remove(m_path)) {
+        add_counters(sr, legacy_counters);
+        LOG("Migrated {} to {}", m_path, mapped_path);
+      }
+    }
+  }
+
+  const auto orig_counters = load_counters(sr);
+  auto counters = orig_counters;
+  function(counters);
+
+  // Add the difference instead of storing the new values to not lose updates
+  // made by other processes after the counters were loaded.
+  bool changed = false;
+  for (size_t i = 0; i < std::min(counters.size(), k_max_counters); ++i) {
+    const uint64_t orig =
+      i < orig_counters.size() ? orig_counters.get_raw(i) : 0;
+    const auto diff = static_cast<int64_t>(counters.get_raw(i) - orig);
+    if (diff != 0) {
+      counters.set_raw(i, add_to_counter(sr.counters[i], diff));
+      changed = true;
+    }
+  }
+  if (changed || only_if_changed == OnlyIfChanged::no) {
+    set_last_updated(sr);
+  }
+
+  return counters;
+}
+
+core::StatisticsCounters
+StatsFile::read_legacy() const
 {
   core::StatisticsCounters counters;
 
@@ -62,7 +331,7 @@ StatsFile::read() const
 }
 
 std::optional<core::StatisticsCounters>
-StatsFile::update(
+StatsFile::update_legacy(
   std::function<void(core::StatisticsCounters& counters)> function,
   OnlyIfChanged only_if_changed) const
 {
@@ -72,7 +341,7 @@ StatsFile::update(
     return std::nullopt;
   }
 
-  auto counters = read();
+  auto counters = read_legacy();
   const auto orig_counters = counters;
   function(counters);
   if (only_if_changed == OnlyIfChanged::no || counters != orig_counters) {
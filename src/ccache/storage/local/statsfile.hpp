@@ -1,4 +1,4 @@
-// Copyright (C) 2021-2024 Joel Rosdahl and other contributors
+// Copyright (C) 2021-2025 Joel Rosdahl and other contributors
 //
 // See doc/AUTHORS.adoc for a complete list of contributors.
 //
@@ -19,6 +19,7 @@
 #pragma once
 
 #include <ccache/core/statisticscounters.hpp>
+#include <ccache/util/timepoint.hpp>
 
 #include <filesystem>
 #include <functional>
@@ -26,26 +27,52 @@
 
 namespace storage::local {
 
+// Statistics counters for a cache directory.
+//
+// The counters are stored in a file (see get_mapped_path) that is mapped into
+// shared memory by running processes and updated with atomic additions, so no
+// lock is needed. Counters found in a legacy text stats file (the path passed
+// to the constructor) written by an older ccache version are migrated into the
+// mapped file on the next update.
+//
+// On network file systems, where shared mappings are not coherent between
+// hosts, the legacy text file is updated under a lock instead.
 class StatsFile
 {
 public:
   explicit StatsFile(const std::filesystem::path& path);
 
+  // Return the path of the memory-mapped counter file.
+  std::filesystem::path get_mapped_path() const;
+
+  // Return whether `filename` is the name of a legacy or memory-mapped stats
+  // file in a cache directory.
+  static bool is_stats_file_name(const std::filesystem::path& filename);
+
   // Read counters. No lock is acquired. If the file doesn't exist all returned
   // counters will be zero.
   core::StatisticsCounters read() const;
 
+  // Return the time of the last update, or a zero time point if the counters
+  // have never been updated.
+  util::TimePoint last_updated() const;
+
   enum class OnlyIfChanged { no, yes };
 
-  // Acquire a lock, read counters, call `function` with the counters, write the
-  // counters and release the lock. Returns the resulting counters or nullopt on
-  // error (e.g. if the lock could not be acquired).
+  // Read counters, call `function` with the counters and add the changes made
+  // by `function` to the stored counters. Returns the resulting counters or
+  // nullopt on error (e.g. if the counter file could not be created).
   std::optional<core::StatisticsCounters>
   update(std::function<void(core::StatisticsCounters& counters)>,
          OnlyIfChanged only_if_changed = OnlyIfChanged::no) const;
 
 private:
   std::filesystem::path m_path;
+
+  core::StatisticsCounters read_legacy() const;
+  std::optional<core::StatisticsCounters> update_legacy(
+    std::function<void(core::StatisticsCounters& counters)> function,
+    OnlyIfChanged only_if_changed) const;
 };
 
 } // namespace storage::local
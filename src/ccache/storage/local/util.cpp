@@ -19,12 +19,21 @@
 #include "util.hpp"
 
 #include <ccache/core/exceptions.hpp>
+#include <ccache/storage/local/lruindex.hpp>
+#include <ccache/storage/local/packstore.hpp>
+#include <ccache/storage/local/statsfile.hpp>
 #include <ccache/util/expected.hpp>
 #include <ccache/util/file.hpp>
 #include <ccache/util/filesystem.hpp>
 #include <ccache/util/format.hpp>
+#include <ccache/util/lockfile.hpp>
 #include <ccache/util/path.hpp>
 #include <ccache/util/string.hpp>
+#include <ccache/util/threadpool.hpp>
+
+#include <algorithm>
+#include <exception>
+#include <mutex>
 
 namespace fs = util::filesystem;
 
@@ -54,15 +63,142 @@ for_each_cache_subdir(const ProgressReceiver& progress_receiver,
   progress_receiver(1.0);
 }
 
+void
+for_each_level_2_cache_subdir(const uint32_t threads,
+                              const ProgressReceiver& progress_receiver,
+                              const Level2Visitor& visit_level_2,
+                              const Level1Visitor& begin_level_1,
+                              const Level1Visitor& end_level_1)
+{
+  // Don't queue more work than the threads can start on to avoid beginning
+  // (e.g. locking) more level 1 subdirectories than needed.
+  const size_t thread_count = std::max(threads, uint32_t{1});
+  util::ThreadPool thread_pool(thread_count, thread_count);
+
+  std::mutex mutex;
+  std::exception_ptr exception;
+  uint8_t remaining_level_2_subdirs[16] = {};
+  size_t visited_level_2_subdirs = 0;
+
+  auto run = [&](const std::function<void()>& function) {
+    try {
+      function();
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!exception) {
+        exception = std::current_exception();
+      }
+    }
+  };
+
+  progress_receiver(0.0);
+  for_each_cache_subdir([&](uint8_t l1_index) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (exception) {
+        return;
+      }
+      remaining_level_2_subdirs[l1_index] = 16;
+    }
+    if (begin_level_1) {
+      run([&] { begin_level_1(l1_index); });
+    }
+
+    for_each_cache_subdir([&](uint8_t l2_index) {
+      thread_pool.enqueue([&, l1_index, l2_index] {
+        run([&] { visit_level_2(l1_index, l2_index); });
+
+        bool level_1_done;
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          level_1_done = --remaining_level_2_subdirs[l1_index] == 0;
+        }
+        if (level_1_done && end_level_1) {
+          run([&] { end_level_1(l1_index); });
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        ++visited_level_2_subdirs;
+        progress_receiver(static_cast<double>(visited_level_2_subdirs) / 256);
+      });
+    });
+  });
+  thread_pool.shut_down();
+
+  if (exception) {
+    std::rethrow_exception(exception);
+  }
+}
+
+Level1Dirs
+get_level_1_dirs(const fs::path& cache_dir, std::string_view stripes)
+{
+  Level1Dirs result;
+  result.fill(cache_dir);
+
+  std::vector<std::pair<fs::path, uint64_t>> dirs;
+  uint64_t total_weight = 0;
+  for (const auto& entry : util::split_path_list(stripes)) {
+    auto dir = util::pstr(entry).str();
+    uint64_t weight = 1;
+    const auto lp_pos = dir.find('(');
+    if (lp_pos != std::string::npos && dir.back() == ')') {
+      const auto parsed_weight = util::parse_unsigned(
+        dir.substr(lp_pos + 1, dir.length() - lp_pos - 2), 1, 1000, "weight");
+      if (!parsed_weight) {
+        throw core::Error(FMT("Invalid cache directory stripe \"{}\": {}",
+                              dir,
+                              parsed_weight.error()));
+      }
+      weight = *parsed_weight;
+      dir.erase(lp_pos);
+    }
+    dirs.emplace_back(util::lexically_normal(dir), weight);
+    total_weight += weight;
+  }
+  if (dirs.empty()) {
+    return result;
+  }
+
+  // Give each directory its share of the 16 subdirectories, rounded down, and
+  // then one more to the directories with the largest remainders. A directory
+  // with a too small weight may get no subdirectory at all.
+  std::vector<uint64_t> counts;
+  std::vector<size_t> by_remainder;
+  uint64_t assigned = 0;
+  for (size_t i = 0; i < dirs.size(); ++i) {
+    counts.push_back(16 * dirs[i].second / total_weight);
+    assigned += counts.back();
+    by_remainder.push_back(i);
+  }
+  std::stable_sort(
+    by_remainder.begin(), by_remainder.end(), [&](size_t a, size_t b) {
+      return 16 * dirs[a].second % total_weight
+             > 16 * dirs[b].second % total_weight;
+    });
+  for (size_t i = 0; assigned < 16; ++i, ++assigned) {
+    ++counts[by_remainder[i]];
+  }
+
+  size_t level_1 = 0;
+  for (size_t i = 0; i < dirs.size(); ++i) {
+    for (uint64_t j = 0; j < counts[i]; ++j) {
+      result[level_1++] = dirs[i].first;
+    }
+  }
+  return result;
+}
+
 void
 for_each_level_1_and_2_stats_file(
-  const fs::path& cache_dir,
+  const Level1Dirs& level_1_dirs,
   const std::function<void(const fs::path& path)> function)
 {
   for (size_t level_1 = 0; level_1 <= 0xF; ++level_1) {
-    function(FMT("{}/{:x}/stats", cache_dir, level_1));
+    const auto& dir = level_1_dirs[level_1];
+    function(FMT("{}/{:x}/stats", dir, level_1));
     for (size_t level_2 = 0; level_2 <= 0xF; ++level_2) {
-      function(FMT("{}/{:x}/{:x}/stats", cache_dir, level_1, level_2));
+      function(FMT("{}/{:x}/{:x}/stats", dir, level_1, level_2));
     }
   }
 }
@@ -78,8 +214,13 @@ get_cache_dir_files(const fs::path& dir)
   util::throw_on_error<core::Error>(
     util::traverse_directory(dir, [&](const auto& de) {
       std::string name = util::pstr(de.path().filename());
-      if (name == "CACHEDIR.TAG" || name == "stats"
-          || util::starts_with(name, ".nfs")) {
+      if (name == "CACHEDIR.TAG" || StatsFile::is_stats_file_name(name)
+          || name == LruIndex::k_file_name || util::starts_with(name, ".nfs")
+          || util::ends_with(name, util::LockFile::k_kernel_lock_file_suffix)) {
+        return;
+      }
+      if (de.path().parent_path().filename() == PackStore::k_dir_name) {
+        // Handled by PackStore.
         return;
       }
 
@@ -20,8 +20,11 @@
 
 #include <ccache/util/direntry.hpp>
 
+#include <array>
+#include <cstdint>
 #include <filesystem>
 #include <functional>
+#include <string_view>
 #include <vector>
 
 namespace storage::local {
@@ -36,19 +39,48 @@ void for_each_cache_subdir(const SubdirVisitor& visitor);
 void for_each_cache_subdir(const ProgressReceiver& progress_receiver,
                            const SubdirProgressVisitor& visitor);
 
+using Level1Visitor = std::function<void(uint8_t l1_index)>;
+using Level2Visitor = std::function<void(uint8_t l1_index, uint8_t l2_index)>;
+
+// Call `visit_level_2` for each level 2 subdirectory in the cache using up to
+// `threads` threads. Level 1 subdirectories are started in order:
+// `begin_level_1` is called in the calling thread before any of its level 2
+// subdirectories is visited and `end_level_1` is called when all of them have
+// been visited, which allows for taking locks and updating counters once per
+// level 1 subdirectory. Progress is reported as the fraction of visited level 2
+// subdirectories. The first exception thrown by a visitor is rethrown when all
+// started visits are done.
+void for_each_level_2_cache_subdir(uint32_t threads,
+                                   const ProgressReceiver& progress_receiver,
+                                   const Level2Visitor& visit_level_2,
+                                   const Level1Visitor& begin_level_1 = {},
+                                   const Level1Visitor& end_level_1 = {});
+
+// Parent directories of the level 1 subdirectories 0-f.
+using Level1Dirs = std::array<std::filesystem::path, 16>;
+
+// Get the parent directory of each level 1 subdirectory. Without `stripes`, all
+// are in `cache_dir`. Otherwise they are distributed over the directories in
+// `stripes`, a path list where each directory may have a "(weight)" suffix, in
+// proportion to the weights. Throws core::Error for an invalid weight.
+Level1Dirs get_level_1_dirs(const std::filesystem::path& cache_dir,
+                            std::string_view stripes);
+
 void for_each_level_1_and_2_stats_file(
-  const std::filesystem::path& cache_dir,
+  const Level1Dirs& level_1_dirs,
   const std::function<void(const std::filesystem::path& path)> function);
 
 // Get a list of files in a subdirectory of the cache.
 //
 // The function works under the assumption that directory entries with one
 // character names (except ".") are subdirectories and that there are no other
-// subdirectories.
+// subdirectories except pack store directories.
 //
 // Files ignored:
 // - CACHEDIR.TAG
-// - stats
+// - stats and stats.v1
+// - lru (see LruIndex)
+// - files in pack store directories (see PackStore)
 // - .nfs* (temporary NFS files that may be left for open but deleted files).
 std::vector<util::DirEntry>
 get_cache_dir_files(const std::filesystem::path& dir);
@@ -53,6 +53,8 @@ public:
 
   tl::expected<bool, Failure> remove(const Hash::Digest& key) override;
 
+  void cancel() override;
+
 private:
   enum class Layout { bazel, flat, subdirs };
 
@@ -261,6 +263,12 @@ HttpStorageBackend::remove(const Hash::Digest& key)
   return true;
 }
 
+void
+HttpStorageBackend::cancel()
+{
+  m_http_client.stop();
+}
+
 std::string
 HttpStorageBackend::get_entry_path(const Hash::Digest& key) const
 {
@@ -26,7 +26,7 @@ namespace storage::remote {
 bool
 RemoteStorage::Backend::is_framework_attribute(const std::string& name)
 {
-  return name == "read-only" || name == "shards";
+  return name == "read-only" || name == "replicas" || name == "shards";
 }
 
 std::chrono::milliseconds
@@ -86,6 +86,16 @@ public:
     // removed, otherwise false.
     virtual tl::expected<bool, Failure> remove(const Hash::Digest& key) = 0;
 
+    // Make an operation running in another thread fail as soon as possible,
+    // e.g. by shutting down its connection. The backend is not used again
+    // afterwards. May be called from any thread.
+    virtual void cancel();
+
+    // Close connections opened so far. Called before the process forks
+    // processes that use the backend since a connection can't be shared
+    // between processes. Connections are opened again when needed.
+    virtual void close_connections();
+
     // Determine whether an attribute is handled by the remote storage
     // framework itself.
     static bool is_framework_attribute(const std::string& name);
@@ -119,6 +129,16 @@ RemoteStorage::redact_secrets(
 {
 }
 
+inline void
+RemoteStorage::Backend::cancel()
+{
+}
+
+inline void
+RemoteStorage::Backend::close_connections()
+{
+}
+
 inline RemoteStorage::Backend::Failed::Failed(Failure failure)
   : Failed("", failure)
 {
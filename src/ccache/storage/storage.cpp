@@ -19,9 +19,11 @@
 #include "storage.hpp"
 
 #include <ccache/config.hpp>
+#include <ccache/core/atomicfile.hpp>
 #include <ccache/core/cacheentry.hpp>
 #include <ccache/core/exceptions.hpp>
 #include <ccache/core/statistic.hpp>
+#include <ccache/storage/local/statsfile.hpp>
 #include <ccache/storage/remote/filestorage.hpp>
 #ifdef HAVE_HTTP_STORAGE_BACKEND
 #  include <ccache/storage/remote/httpstorage.hpp>
@@ -31,10 +33,16 @@
 #endif
 #include <ccache/util/assertions.hpp>
 #include <ccache/util/bytes.hpp>
+#include <ccache/util/direntry.hpp>
 #include <ccache/util/expected.hpp>
 #include <ccache/util/file.hpp>
+#include <ccache/util/filesystem.hpp>
 #include <ccache/util/format.hpp>
+#include <ccache/util/lockfile.hpp>
 #include <ccache/util/logging.hpp>
+#include <ccache/util/longlivedlockfilemanager.hpp>
+#include <ccache/util/path.hpp>
+#include <ccache/util/process.hpp>
 #include <ccache/util/string.hpp>
 #include <ccache/util/timer.hpp>
 #include <ccache/util/tokenizer.hpp>
@@ -42,14 +50,34 @@
 
 #include <cxxurl/url.hpp>
 
+#ifdef HAVE_UNISTD_H
+#  include <unistd.h>
+#endif
+
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <map>
+#include <mutex>
 #include <memory>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
+namespace fs = util::filesystem;
+
 namespace storage {
 
+// A spooled upload is stored as <key> <only_if_missing> <entry> in a file
+// named <formatted key><k_spool_file_suffix>.
+constexpr std::string_view k_spool_file_suffix = ".upload";
+
+// Number of times a spooled upload is attempted before being dropped.
+const uint32_t k_max_upload_attempts = 3;
+
 const std::unordered_map<std::string /*scheme*/,
                          std::shared_ptr<remote::RemoteStorage>>
   k_remote_storage_implementations = {
@@ -59,6 +87,7 @@ const std::unordered_map<std::string /*scheme*/,
 #endif
 #ifdef HAVE_REDIS_STORAGE_BACKEND
     {"redis", std::make_shared<remote::RedisStorage>()},
+    {"redis+cluster", std::make_shared<remote::RedisStorage>()},
     {"redis+unix", std::make_shared<remote::RedisStorage>()},
 #endif
 };
@@ -92,6 +121,9 @@ struct RemoteStorageConfig
   // "shard" attribute.
   std::vector<RemoteStorageShardConfig> shards;
 
+  // "replicas" attribute.
+  size_t replicas = 1;
+
   // "read-only" attribute.
   bool read_only = false;
 
@@ -99,13 +131,43 @@ struct RemoteStorageConfig
   std::vector<remote::RemoteStorage::Backend::Attribute> attributes;
 };
 
+struct RemoteLookupResult
+{
+  tl::expected<std::optional<util::Bytes>,
+               remote::RemoteStorage::Backend::Failure>
+    value;
+  double ms;
+};
+
+// Results of asynchronous lookups in order of completion.
+struct LookupCompletions
+{
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::vector<std::pair<size_t /*index*/, RemoteLookupResult>> results;
+};
+
+// A lookup whose result was ignored since another lookup was faster.
+struct AbandonedLookup
+{
+  std::shared_ptr<LookupCompletions> completions;
+  size_t index;
+};
+
 // An instantiated remote storage backend.
 struct RemoteStorageBackendEntry
 {
   Url url;                     // With expanded "*"
   std::string url_for_logging; // With expanded "*"
-  std::unique_ptr<remote::RemoteStorage::Backend> impl;
+  // Created on first use and again after being used by an abandoned lookup.
+  std::shared_ptr<remote::RemoteStorage::Backend> impl;
   bool failed = false;
+
+  // Second instance of the backend for hedged lookups, created on first use.
+  std::shared_ptr<remote::RemoteStorage::Backend> hedge_impl;
+
+  // Canceled lookups that may still be running in discarded instances.
+  std::vector<AbandonedLookup> abandoned_lookups;
 };
 
 // An instantiated remote storage.
@@ -113,7 +175,8 @@ struct RemoteStorageEntry
 {
   RemoteStorageConfig config;
   std::shared_ptr<remote::RemoteStorage> storage;
-  std::vector<RemoteStorageBackendEntry> backends;
+  // A deque since pointers to backends must stay valid when adding more.
+  std::deque<RemoteStorageBackendEntry> backends;
 };
 
 static std::string
@@ -208,6 +271,9 @@ parse_storage_config(const std::string_view entry)
         }
         result.shards.push_back({std::string(name), weight, url});
       }
+    } else if (key == "replicas") {
+      result.replicas = util::value_or_throw<core::Error>(
+        util::parse_unsigned(value, 1, std::nullopt, "replicas"));
     }
 
     result.attributes.push_back(
@@ -244,24 +310,166 @@ get_storage(const std::string& scheme)
   }
 }
 
+static RemoteLookupResult
+look_up(remote::RemoteStorage::Backend& backend, const Hash::Digest& key)
+{
+  Timer timer;
+  auto value = backend.get(key);
+  return {std::move(value), timer.measure_ms()};
+}
+
+// Start looking up `key` in `backend` in a thread so that the lookup can be
+// abandoned without waiting for it. The thread must not refer to the Storage
+// since it may still run when the lookup's caller has returned.
+static std::thread
+start_lookup(std::shared_ptr<remote::RemoteStorage::Backend> backend,
+             const Hash::Digest& key,
+             const std::shared_ptr<LookupCompletions>& completions,
+             const size_t index)
+{
+  return std::thread(
+    [backend = std::move(backend), key, completions, index]() mutable {
+      auto result = look_up(*backend, key);
+      backend.reset();
+      {
+        std::lock_guard<std::mutex> lock(completions->mutex);
+        completions->results.emplace_back(index, std::move(result));
+      }
+      completions->cv.notify_one();
+    });
+}
+
+// Wait for the lookup that completes as number `handled` + 1.
+static std::pair<size_t, RemoteLookupResult>
+wait_for_lookup(LookupCompletions& completions, const size_t handled)
+{
+  std::unique_lock<std::mutex> lock(completions.mutex);
+  completions.cv.wait(lock,
+                      [&] { return completions.results.size() > handled; });
+  return std::move(completions.results[handled]);
+}
+
+static bool
+has_completed(const LookupCompletions& completions, const size_t index)
+{
+  return std::any_of(completions.results.begin(),
+                     completions.results.end(),
+                     [&](const auto& result) { return result.first == index; });
+}
+
+// Cancel lookup `index` of `key` made in `impl`, an instance of `backend`, if
+// it's still running. `impl` is then discarded so that it isn't used for
+// anything else and the lookup's result and latency are ignored.
+static void
+abandon_lookup(RemoteStorageBackendEntry& backend,
+               std::shared_ptr<remote::RemoteStorage::Backend>& impl,
+               const Hash::Digest& key,
+               const std::shared_ptr<LookupCompletions>& completions,
+               const size_t index)
+{
+  {
+    std::lock_guard<std::mutex> lock(completions->mutex);
+    if (has_completed(*completions, index)) {
+      return;
+    }
+  }
+  LOG("Abandoning lookup of {} in {}",
+      util::format_digest(key),
+      backend.url_for_logging);
+  impl->cancel();
+  impl.reset();
+  backend.abandoned_lookups.push_back({completions, index});
+}
+
+fs::path
+get_latency_file_path(const Config& config)
+{
+  return config.cache_dir() / "remote_latency";
+}
+
+fs::path
+get_backend_health_file_path(const Config& config)
+{
+  return config.cache_dir() / "remote_health";
+}
+
 Storage::Storage(const Config& config) : local(config), m_config(config)
 {
 }
 
 // Define the destructor in the implementation file to avoid having to declare
 // RemoteStorageEntry and its constituents in the header file.
-Storage::~Storage() = default;
+Storage::~Storage()
+{
+  join_lookup_threads();
+}
 
 void
 Storage::initialize()
 {
+  if (m_initialized) {
+    // Already initialized by a compile server.
+    return;
+  }
+  m_initialized = true;
   add_remote_storages();
+  if (!m_remote_storages.empty()) {
+    m_backend_health.emplace(get_backend_health_file_path(m_config));
+  }
+}
+
+void
+Storage::create_backends()
+{
+  for (auto& entry : m_remote_storages) {
+    for (const auto& shard : entry->config.shards) {
+      const auto backend = get_backend(*entry, shard.url, "preparing", false);
+      if (backend) {
+        backend->impl->close_connections();
+      }
+    }
+    // Let users of the backends try again instead of inheriting a failure.
+    for (auto& backend : entry->backends) {
+      backend.failed = false;
+    }
+  }
 }
 
 void
 Storage::finalize()
 {
+  // Wait for canceled lookups so that no lookup thread is running when forking
+  // the background uploader or when the process exits.
+  for (auto& entry : m_remote_storages) {
+    for (auto& backend : entry->backends) {
+      for (const auto& lookup : backend.abandoned_lookups) {
+        std::lock_guard<std::mutex> lock(lookup.completions->mutex);
+        if (!has_completed(*lookup.completions, lookup.index)) {
+          LOG("Waiting for abandoned lookup in {}", backend.url_for_logging);
+        }
+      }
+      backend.abandoned_lookups.clear();
+    }
+  }
+  join_lookup_threads();
+  if (m_config.stats() && !m_lookup_latencies.empty()) {
+    LatencyFile(get_latency_file_path(m_config)).update(m_lookup_latencies);
+  }
+
   local.finalize();
+
+  if (m_spooled_entries) {
+    start_background_uploader();
+  }
+}
+
+void
+Storage::join_lookup_threads()
+{
+  for (auto& thread : m_lookup_threads) {
+    thread.join();
+  }
+  m_lookup_threads.clear();
 }
 
 void
@@ -270,22 +478,23 @@ Storage::get(const Hash::Hash::Digest& key,
              const EntryReceiver& entry_receiver)
 {
   if (!m_config.remote_only()) {
-    auto value = local.get(key, type);
-    if (value) {
-      if (m_config.reshare()) {
-        put_in_remote_storage(key, *value, true);
-      }
-      if (entry_receiver(std::move(*value))) {
-        return;
-      }
+    const bool done =
+      local.get(key, type, [&](nonstd::span<const uint8_t> value) {
+        if (m_config.reshare()) {
+          put_in_remote_storage(key, value, true);
+        }
+        return entry_receiver(value);
+      });
+    if (done) {
+      return;
     }
   }
 
-  get_from_remote_storage(key, type, [&](util::Bytes&& data) {
+  get_from_remote_storage(key, type, [&](nonstd::span<const uint8_t> data) {
     if (!m_config.remote_only()) {
       local.put(key, type, data, true);
     }
-    return entry_receiver(std::move(data));
+    return entry_receiver(data);
   });
 }
 
@@ -365,12 +574,64 @@ Storage::mark_backend_as_failed(
 {
   // The backend is expected to log details about the error.
   backend_entry.failed = true;
+  if (m_backend_health) {
+    m_backend_health->record_failure(backend_entry.url_for_logging);
+  }
   local.increment_statistic(
     failure == remote::RemoteStorage::Backend::Failure::timeout
       ? core::Statistic::remote_storage_timeout
       : core::Statistic::remote_storage_error);
 }
 
+void
+Storage::mark_backend_as_succeeded(RemoteStorageBackendEntry& backend_entry)
+{
+  if (m_backend_health) {
+    m_backend_health->record_success(backend_entry.url_for_logging);
+  }
+}
+
+bool
+Storage::is_backend_healthy(const std::string& url_for_logging)
+{
+  return !m_backend_health
+         || m_backend_health->allow_request(url_for_logging);
+}
+
+const LatencyHistogram*
+Storage::get_known_latencies(const std::string& url_for_logging)
+{
+  if (!m_known_latencies) {
+    m_known_latencies = LatencyFile(get_latency_file_path(m_config)).read();
+  }
+  const auto it = m_known_latencies->find(url_for_logging);
+  return it != m_known_latencies->end() ? &it->second : nullptr;
+}
+
+std::vector<remote::RemoteStorage::Backend::Attribute>
+Storage::get_backend_attributes(const RemoteStorageEntry& entry,
+                                const std::string& url_for_logging)
+{
+  auto attributes = entry.config.attributes;
+  for (auto& attr : attributes) {
+    if (attr.key != "operation-timeout" || attr.value != "auto") {
+      continue;
+    }
+    const auto* latencies = get_known_latencies(url_for_logging);
+    const auto timeout =
+      latencies ? get_adaptive_timeout(*latencies,
+                                       remote::k_default_operation_timeout)
+                : std::nullopt;
+    attr.value = FMT(
+      "{}", timeout.value_or(remote::k_default_operation_timeout).count());
+    LOG("Using {} operation timeout {} ms for {}",
+        timeout ? "adaptive" : "default",
+        attr.value,
+        url_for_logging);
+  }
+  return attributes;
+}
+
 static double
 to_half_open_unit_interval(uint64_t value)
 {
@@ -380,19 +641,20 @@ to_half_open_unit_interval(uint64_t value)
   return static_cast<double>(value & mask) / denominator;
 }
 
-static Url
-get_shard_url(const Hash::Digest& key,
-              const std::vector<RemoteStorageShardConfig>& shards)
+// Return the URLs of the shards that store `key`, best first.
+static std::vector<Url>
+get_shard_urls(const Hash::Digest& key, const RemoteStorageConfig& config)
 {
+  const auto& shards = config.shards;
   ASSERT(!shards.empty());
 
   if (shards.size() == 1) {
-    return shards.front().url;
+    return {shards.front().url};
   }
 
-  // This is the "weighted rendezvous hashing" algorithm.
-  double highest_score = -1.0;
-  Url best_shard_url;
+  // This is the "weighted rendezvous hashing" algorithm, keeping the
+  // config.replicas shards with the highest scores.
+  std::vector<std::pair<double, const RemoteStorageShardConfig*>> scores;
   for (const auto& shard_config : shards) {
     util::XXH3_64 hash;
     hash.update(key.data(), key.size());
@@ -401,18 +663,22 @@ get_shard_url(const Hash::Digest& key,
     ASSERT(score >= 0.0 && score < 1.0);
     const double weighted_score =
       score == 0.0 ? 0.0 : shard_config.weight / -std::log(score);
-    if (weighted_score > highest_score) {
-      best_shard_url = shard_config.url;
-      highest_score = weighted_score;
-    }
+    scores.emplace_back(weighted_score, &shard_config);
   }
+  std::stable_sort(scores.begin(), scores.end(), [](auto& a, auto& b) {
+    return a.first > b.first;
+  });
 
-  return best_shard_url;
+  std::vector<Url> result;
+  for (size_t i = 0; i < std::min(config.replicas, scores.size()); ++i) {
+    result.push_back(scores[i].second->url);
+  }
+  return result;
 }
 
 RemoteStorageBackendEntry*
 Storage::get_backend(RemoteStorageEntry& entry,
-                     const Hash::Digest& key,
+                     const Url& shard_url,
                      const std::string_view operation_description,
                      const bool for_writing)
 {
@@ -423,7 +689,6 @@ Storage::get_backend(RemoteStorageEntry& entry,
     return nullptr;
   }
 
-  const auto shard_url = get_shard_url(key, entry.config.shards);
   const auto url_str_for_logging =
     get_redacted_url_str_for_logging(shard_url.str());
   auto backend =
@@ -432,26 +697,37 @@ Storage::get_backend(RemoteStorageEntry& entry,
                  [&](const auto& x) { return x.url.str() == shard_url.str(); });
 
   if (backend == entry.backends.end()) {
-    entry.backends.push_back({shard_url, url_str_for_logging, {}, false});
+    entry.backends.push_back(
+      {shard_url, url_str_for_logging, {}, false, {}, {}});
+    backend = std::prev(entry.backends.end());
+  } else if (backend->failed) {
+    LOG("Not {} {} since it failed earlier",
+        operation_description,
+        url_str_for_logging);
+    return nullptr;
+  }
+
+  if (!backend->impl) {
+    // Consult the health shared with other processes before constructing the
+    // backend since that may already connect to the server.
+    if (!is_backend_healthy(url_str_for_logging)) {
+      LOG("Not {} {} since it failed recently",
+          operation_description,
+          url_str_for_logging);
+      return nullptr;
+    }
     try {
-      entry.backends.back().impl =
-        entry.storage->create_backend(shard_url, entry.config.attributes);
+      backend->impl = entry.storage->create_backend(
+        shard_url, get_backend_attributes(entry, url_str_for_logging));
     } catch (const remote::RemoteStorage::Backend::Failed& e) {
       LOG("Failed to construct backend for {}{}",
           url_str_for_logging,
           std::string_view(e.what()).empty() ? "" : FMT(": {}", e.what()));
-      mark_backend_as_failed(entry.backends.back(), e.failure());
+      mark_backend_as_failed(*backend, e.failure());
       return nullptr;
     }
-    return &entry.backends.back();
-  } else if (backend->failed) {
-    LOG("Not {} {} since it failed earlier",
-        operation_description,
-        url_str_for_logging);
-    return nullptr;
-  } else {
-    return &*backend;
   }
+  return &*backend;
 }
 
 void
@@ -459,40 +735,196 @@ Storage::get_from_remote_storage(const Hash::Digest& key,
                                  const core::CacheEntryType type,
                                  const EntryReceiver& entry_receiver)
 {
+  // Lookups are made in parallel if there is more than one storage or
+  // replica to look in.
+  if (m_config.remote_lookup_parallel()
+      && (m_remote_storages.size() > 1
+          || std::any_of(m_remote_storages.begin(),
+                         m_remote_storages.end(),
+                         [](const auto& entry) {
+                           return entry->config.replicas > 1
+                                  && entry->config.shards.size() > 1;
+                         }))) {
+    get_from_remote_storage_in_parallel(key, type, entry_receiver);
+    return;
+  }
+
   for (const auto& entry : m_remote_storages) {
-    auto backend = get_backend(*entry, key, "getting from", false);
-    if (!backend) {
-      continue;
+    // On a miss or failure, fall back to the next replica.
+    const auto shard_urls = get_shard_urls(key, entry->config);
+    for (size_t i = 0; i < shard_urls.size(); ++i) {
+      auto backend = get_backend(*entry, shard_urls[i], "getting from", false);
+      if (!backend) {
+        continue;
+      }
+
+      const auto* primary_backend = backend;
+      const auto* replica_url =
+        i + 1 < shard_urls.size() ? &shard_urls[i + 1] : nullptr;
+      auto lookup = m_config.remote_lookup_hedging()
+                      ? look_up_hedged(*entry, backend, replica_url, key)
+                      : look_up(*backend->impl, key);
+      if (backend != primary_backend) {
+        // The hedged lookup in the next replica was used.
+        ++i;
+      }
+      if (handle_remote_lookup_result(
+            *backend, key, type, lookup, entry_receiver)) {
+        return;
+      }
     }
+  }
+}
 
-    Timer timer;
-    auto result = backend->impl->get(key);
-    const auto ms = timer.measure_ms();
-    if (!result) {
-      mark_backend_as_failed(*backend, result.error());
-      continue;
+void
+Storage::get_from_remote_storage_in_parallel(
+  const Hash::Digest& key,
+  const core::CacheEntryType type,
+  const EntryReceiver& entry_receiver)
+{
+  const auto completions = std::make_shared<LookupCompletions>();
+
+  std::vector<RemoteStorageBackendEntry*> backends;
+  for (const auto& entry : m_remote_storages) {
+    for (const auto& shard_url : get_shard_urls(key, entry->config)) {
+      auto backend = get_backend(*entry, shard_url, "getting from", false);
+      if (!backend) {
+        continue;
+      }
+      m_lookup_threads.push_back(
+        start_lookup(backend->impl, key, completions, backends.size()));
+      backends.push_back(backend);
     }
+  }
 
-    auto& value = *result;
-    if (value) {
-      LOG("Retrieved {} from {} ({:.2f} ms)",
-          util::format_digest(key),
-          backend->url_for_logging,
-          ms);
-      local.increment_statistic(core::Statistic::remote_storage_read_hit);
-      if (type == core::CacheEntryType::result) {
-        local.increment_statistic(core::Statistic::remote_storage_hit);
+  LOG("Looking up {} in {} remote storage backends in parallel",
+      util::format_digest(key),
+      backends.size());
+
+  // Handle lookups in order of completion until one is accepted.
+  for (size_t handled = 0; handled < backends.size(); ++handled) {
+    auto completed = wait_for_lookup(*completions, handled);
+    if (handle_remote_lookup_result(*backends[completed.first],
+                                    key,
+                                    type,
+                                    completed.second,
+                                    entry_receiver)) {
+      for (size_t i = 0; i < backends.size(); ++i) {
+        abandon_lookup(*backends[i], backends[i]->impl, key, completions, i);
       }
-      if (entry_receiver(std::move(*value))) {
-        return;
+      return;
+    }
+  }
+}
+
+RemoteLookupResult
+Storage::look_up_hedged(RemoteStorageEntry& entry,
+                        RemoteStorageBackendEntry*& backend,
+                        const Url* replica_url,
+                        const Hash::Digest& key)
+{
+  const auto* latencies = get_known_latencies(backend->url_for_logging);
+  const auto delay = latencies ? get_hedge_delay(*latencies) : std::nullopt;
+  if (!delay) {
+    return look_up(*backend->impl, key);
+  }
+
+  const auto completions = std::make_shared<LookupCompletions>();
+  m_lookup_threads.push_back(start_lookup(backend->impl, key, completions, 0));
+  {
+    std::unique_lock<std::mutex> lock(completions->mutex);
+    if (completions->cv.wait_for(
+          lock, *delay, [&] { return !completions->results.empty(); })) {
+      return std::move(completions->results[0].second);
+    }
+  }
+
+  RemoteStorageBackendEntry* backends[2] = {backend, nullptr};
+  std::shared_ptr<remote::RemoteStorage::Backend>* impls[2] = {&backend->impl,
+                                                               nullptr};
+  if (replica_url) {
+    backends[1] = get_backend(entry, *replica_url, "hedging to", false);
+    if (backends[1]) {
+      impls[1] = &backends[1]->impl;
+    }
+  }
+  if (!backends[1]) {
+    if (!backend->hedge_impl) {
+      try {
+        backend->hedge_impl = entry.storage->create_backend(
+          backend->url,
+          get_backend_attributes(entry, backend->url_for_logging));
+      } catch (const remote::RemoteStorage::Backend::Failed& e) {
+        LOG("Failed to construct hedging backend for {}{}",
+            backend->url_for_logging,
+            std::string_view(e.what()).empty() ? "" : FMT(": {}", e.what()));
+        return wait_for_lookup(*completions, 0).second;
       }
-    } else {
-      LOG("No {} in {} ({:.2f} ms)",
-          util::format_digest(key),
-          backend->url_for_logging,
-          ms);
-      local.increment_statistic(core::Statistic::remote_storage_read_miss);
     }
+    backends[1] = backend;
+    impls[1] = &backend->hedge_impl;
+  }
+  LOG("Hedging lookup of {} in {} after {} ms",
+      util::format_digest(key),
+      backends[1]->url_for_logging,
+      delay->count());
+  m_lookup_threads.push_back(start_lookup(*impls[1], key, completions, 1));
+
+  // Use the first successful result. The other lookup is abandoned.
+  for (size_t handled = 0;; ++handled) {
+    auto completed = wait_for_lookup(*completions, handled);
+    const size_t index = completed.first;
+    auto& lookup = completed.second;
+    if (lookup.value || handled == 1) {
+      abandon_lookup(
+        *backends[1 - index], *impls[1 - index], key, completions, 1 - index);
+      backend = backends[index];
+      return std::move(lookup);
+    }
+    LOG("{} lookup of {} in {} failed, waiting for {} lookup",
+        index == 0 ? "Primary" : "Hedged",
+        util::format_digest(key),
+        backends[index]->url_for_logging,
+        index == 0 ? "hedged" : "primary");
+    m_lookup_latencies[backends[index]->url_for_logging].add(lookup.ms);
+    mark_backend_as_failed(*backends[index], lookup.value.error());
+  }
+}
+
+bool
+Storage::handle_remote_lookup_result(RemoteStorageBackendEntry& backend,
+                                     const Hash::Digest& key,
+                                     const core::CacheEntryType type,
+                                     RemoteLookupResult& lookup,
+                                     const EntryReceiver& entry_receiver)
+{
+  m_lookup_latencies[backend.url_for_logging].add(lookup.ms);
+  if (!lookup.value) {
+    mark_backend_as_failed(backend, lookup.value.error());
+    return false;
+  }
+
+  mark_backend_as_succeeded(backend);
+  auto& value = *lookup.value;
+  if (value) {
+    LOG("Retrieved {} from {} ({:.2f} ms)",
+        util::format_digest(key),
+        backend.url_for_logging,
+        lookup.ms);
+    local.increment_statistic(core::Statistic::remote_storage_read_hit);
+    m_lookup_latencies[backend.url_for_logging].add_hit();
+    if (type == core::CacheEntryType::result) {
+      local.increment_statistic(core::Statistic::remote_storage_hit);
+    }
+    return entry_receiver(*value);
+  } else {
+    LOG("No {} in {} ({:.2f} ms)",
+        util::format_digest(key),
+        backend.url_for_logging,
+        lookup.ms);
+    local.increment_statistic(core::Statistic::remote_storage_read_miss);
+    m_lookup_latencies[backend.url_for_logging].add_miss();
+    return false;
   }
 }
 
@@ -507,62 +939,290 @@ Storage::put_in_remote_storage(const Hash::Digest& key,
     return;
   }
 
+#ifndef _WIN32
+  if (m_config.remote_upload_async() && has_remote_storage()) {
+    spool_for_remote_storage(key, value, only_if_missing);
+    return;
+  }
+#endif
+
+  upload_to_remote_storage(key, value, only_if_missing);
+}
+
+bool
+Storage::upload_to_remote_storage(const Hash::Digest& key,
+                                  nonstd::span<const uint8_t> value,
+                                  bool only_if_missing)
+{
+  bool success = true;
+
   for (const auto& entry : m_remote_storages) {
-    auto backend = get_backend(*entry, key, "putting in", true);
-    if (!backend) {
-      continue;
-    }
+    for (const auto& shard_url : get_shard_urls(key, entry->config)) {
+      auto backend = get_backend(*entry, shard_url, "putting in", true);
+      if (!backend) {
+        success = success && entry->config.read_only;
+        continue;
+      }
 
-    Timer timer;
-    const auto result = backend->impl->put(key, value, only_if_missing);
-    const auto ms = timer.measure_ms();
-    if (!result) {
-      // The backend is expected to log details about the error.
-      mark_backend_as_failed(*backend, result.error());
-      continue;
+      Timer timer;
+      const auto result = backend->impl->put(key, value, only_if_missing);
+      const auto ms = timer.measure_ms();
+      if (!result) {
+        // The backend is expected to log details about the error.
+        mark_backend_as_failed(*backend, result.error());
+        success = false;
+        continue;
+      }
+
+      mark_backend_as_succeeded(*backend);
+      const bool stored = *result;
+      LOG("{} {} in {} ({:.2f} ms)",
+          stored ? "Stored" : "Did not have to store",
+          util::format_digest(key),
+          backend->url_for_logging,
+          ms);
+      local.increment_statistic(core::Statistic::remote_storage_write);
     }
+  }
 
-    const bool stored = *result;
-    LOG("{} {} in {} ({:.2f} ms)",
-        stored ? "Stored" : "Did not have to store",
-        util::format_digest(key),
-        backend->url_for_logging,
-        ms);
-    local.increment_statistic(core::Statistic::remote_storage_write);
+  return success;
+}
+
+fs::path
+Storage::get_spool_dir() const
+{
+  return m_config.cache_dir() / "uploads";
+}
+
+// The total size of spooled uploads is kept in the cache_size_kibibyte counter
+// of a stats file in the spool directory so that it doesn't have to be summed
+// up on each upload.
+static local::StatsFile
+get_spool_stats_file(const fs::path& spool_dir)
+{
+  return local::StatsFile(spool_dir / "stats");
+}
+
+static int64_t
+to_kibibytes(uint64_t size)
+{
+  return static_cast<int64_t>((size + 1023) / 1024);
+}
+
+static void
+update_spool_size(const fs::path& spool_dir, int64_t kibibytes)
+{
+  get_spool_stats_file(spool_dir).update([&](auto& counters) {
+    counters.increment(core::Statistic::cache_size_kibibyte, kibibytes);
+  });
+}
+
+// Remove the spooled upload at `path`, if any.
+static void
+remove_spool_file(const fs::path& spool_dir, const fs::path& path)
+{
+  const util::DirEntry dir_entry(path);
+  if (dir_entry.is_regular_file() && util::remove(path).value_or(false)) {
+    update_spool_size(spool_dir, -to_kibibytes(dir_entry.size()));
   }
 }
 
+static fs::path
+get_spool_file_path(const fs::path& spool_dir, const Hash::Digest& key)
+{
+  return spool_dir / FMT("{}{}", util::format_digest(key), k_spool_file_suffix);
+}
+
 void
-Storage::remove_from_remote_storage(const Hash::Digest& key)
+Storage::spool_for_remote_storage(const Hash::Digest& key,
+                                  nonstd::span<const uint8_t> value,
+                                  bool only_if_missing)
 {
-  for (const auto& entry : m_remote_storages) {
-    auto backend = get_backend(*entry, key, "removing from", true);
-    if (!backend) {
-      continue;
+  const auto spool_dir = get_spool_dir();
+
+  const uint64_t spool_size =
+    get_spool_stats_file(spool_dir).read().get(
+      core::Statistic::cache_size_kibibyte)
+    * 1024;
+  if (spool_size + value.size() > m_config.remote_upload_spool_size()) {
+    LOG("Not spooling {} for remote storage since the spool is full",
+        util::format_digest(key));
+    local.increment_statistic(core::Statistic::remote_storage_upload_dropped);
+    return;
+  }
+
+  util::throw_on_error<core::Error>(fs::create_directories(spool_dir),
+                                    FMT("Failed to create {}: ", spool_dir));
+  const auto path = get_spool_file_path(spool_dir, key);
+  // An earlier spooled upload of the same key is replaced.
+  const util::DirEntry old_entry(path);
+  const auto old_kibibytes =
+    old_entry.is_regular_file() ? to_kibibytes(old_entry.size()) : 0;
+  core::AtomicFile file(path, core::AtomicFile::Mode::binary);
+  file.write(key);
+  file.write(util::Bytes{only_if_missing});
+  file.write(value);
+  file.commit();
+  update_spool_size(
+    spool_dir, to_kibibytes(key.size() + 1 + value.size()) - old_kibibytes);
+
+  LOG("Spooled {} for remote storage", util::format_digest(key));
+  local.increment_statistic(core::Statistic::remote_storage_upload_queued);
+  m_spooled_entries = true;
+}
+
+void
+Storage::start_background_uploader()
+{
+  if (!util::start_background_process()) {
+    return;
+  }
+
+  try {
+    Storage storage(m_config);
+    storage.initialize();
+    storage.upload_spooled_entries(false);
+    storage.finalize();
+  } catch (const core::ErrorBase& e) {
+    LOG("Background upload failed: {}", e.what());
+  }
+  _exit(0);
+}
+
+void
+Storage::upload_spooled_entries(const bool wait)
+{
+  const auto spool_dir = get_spool_dir();
+  if (!util::DirEntry(spool_dir).is_directory()) {
+    return;
+  }
+
+  util::LongLivedLockFileManager lock_manager;
+  util::LockFile lock(spool_dir / "uploader");
+  lock.make_long_lived(lock_manager);
+  if (!(wait ? lock.acquire() : lock.try_acquire())) {
+    LOG_RAW("Leaving spooled uploads to the running uploader");
+    return;
+  }
+
+  // Entries may be spooled by another process just before the lock is released,
+  // so check again afterwards.
+  while (upload_spooled_entries_once()) {
+    lock.release();
+    if (!lock.try_acquire()) {
+      break;
     }
+  }
+}
 
-    Timer timer;
-    const auto result = backend->impl->remove(key);
-    const auto ms = timer.measure_ms();
-    if (!result) {
-      mark_backend_as_failed(*backend, result.error());
-      continue;
+bool
+Storage::upload_spooled_entries_once()
+{
+  const auto spool_dir = get_spool_dir();
+  std::map<fs::path, uint32_t> attempts;
+
+  while (true) {
+    std::vector<fs::path> paths;
+    util::throw_on_error<core::Error>(
+      util::traverse_directory(spool_dir, [&](const auto& de) {
+        if (util::ends_with(util::pstr(de.path()).str(), k_spool_file_suffix)
+            && attempts[de.path()] < k_max_upload_attempts) {
+          paths.push_back(de.path());
+        }
+      }));
+    if (paths.empty()) {
+      break;
     }
 
-    const bool removed = *result;
-    if (removed) {
-      LOG("Removed {} from {} ({:.2f} ms)",
-          util::format_digest(key),
-          backend->url_for_logging,
-          ms);
-    } else {
-      LOG("No {} to remove from {} ({:.2f} ms)",
-          util::format_digest(key),
-          backend->url_for_logging,
-          ms);
+    uint32_t max_attempts = 0;
+    for (const auto& path : paths) {
+      max_attempts = std::max(max_attempts, attempts[path]);
+    }
+    if (max_attempts > 0) {
+      // Back off before retrying and give failed backends a new chance.
+      std::this_thread::sleep_for(std::chrono::seconds(max_attempts));
+      for (auto& entry : m_remote_storages) {
+        for (auto& backend : entry->backends) {
+          // Backends that failed to be constructed are constructed again.
+          backend.failed = !is_backend_healthy(backend.url_for_logging);
+        }
+      }
     }
 
-    local.increment_statistic(core::Statistic::remote_storage_write);
+    for (const auto& path : paths) {
+      const auto data = util::read_file<util::Bytes>(path);
+      Hash::Digest key;
+      if (!data || data->size() <= key.size() + 1) {
+        // Already uploaded by someone else or corrupt.
+        remove_spool_file(spool_dir, path);
+        continue;
+      }
+      std::copy(data->begin(), data->begin() + key.size(), key.begin());
+      const bool only_if_missing = (*data)[key.size()] != 0;
+      const auto value =
+        nonstd::span<const uint8_t>(*data).subspan(key.size() + 1);
+
+      if (upload_to_remote_storage(key, value, only_if_missing)) {
+        remove_spool_file(spool_dir, path);
+      } else if (++attempts[path] == k_max_upload_attempts) {
+        LOG("Dropping spooled upload of {} after {} attempts",
+            util::format_digest(key),
+            k_max_upload_attempts);
+        local.increment_statistic(
+          core::Statistic::remote_storage_upload_dropped);
+        remove_spool_file(spool_dir, path);
+      }
+    }
+  }
+
+  bool spooled = false;
+  util::throw_on_error<core::Error>(
+    util::traverse_directory(spool_dir, [&](const auto& de) {
+      spooled = spooled
+                || util::ends_with(util::pstr(de.path()).str(),
+                                   k_spool_file_suffix);
+    }));
+  return spooled;
+}
+
+void
+Storage::remove_from_remote_storage(const Hash::Digest& key)
+{
+  // Don't let a pending asynchronous upload bring the entry back.
+  const auto spool_dir = get_spool_dir();
+  remove_spool_file(spool_dir, get_spool_file_path(spool_dir, key));
+
+  for (const auto& entry : m_remote_storages) {
+    for (const auto& shard_url : get_shard_urls(key, entry->config)) {
+      auto backend = get_backend(*entry, shard_url, "removing from", true);
+      if (!backend) {
+        continue;
+      }
+
+      Timer timer;
+      const auto result = backend->impl->remove(key);
+      const auto ms = timer.measure_ms();
+      if (!result) {
+        mark_backend_as_failed(*backend, result.error());
+        continue;
+      }
+
+      mark_backend_as_succeeded(*backend);
+      const bool removed = *result;
+      if (removed) {
+        LOG("Removed {} from {} ({:.2f} ms)",
+            util::format_digest(key),
+            backend->url_for_logging,
+            ms);
+      } else {
+        LOG("No {} to remove from {} ({:.2f} ms)",
+            util::format_digest(key),
+            backend->url_for_logging,
+            ms);
+      }
+
+      local.increment_statistic(core::Statistic::remote_storage_write);
+    }
   }
 }
 
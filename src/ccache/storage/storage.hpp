@@ -20,6 +20,8 @@
 
 #include <ccache/core/types.hpp>
 #include <ccache/hash.hpp>
+#include <ccache/storage/backendhealthfile.hpp>
+#include <ccache/storage/latencyfile.hpp>
 #include <ccache/storage/local/localstorage.hpp>
 #include <ccache/storage/remote/remotestorage.hpp>
 #include <ccache/util/bytes.hpp>
@@ -27,18 +29,30 @@
 #include <nonstd/span.hpp>
 
 #include <cstdint>
+#include <filesystem>
 #include <functional>
 #include <memory>
+#include <optional>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <vector>
 
+class Url;
+
 namespace storage {
 
 constexpr auto k_redacted_password = "********";
 
 std::vector<std::string> get_features();
 
+// Path of the file recording remote storage lookup latencies.
+std::filesystem::path get_latency_file_path(const Config& config);
+
+// Path of the file recording remote storage backend health.
+std::filesystem::path get_backend_health_file_path(const Config& config);
+
+struct RemoteLookupResult;
 struct RemoteStorageBackendEntry;
 struct RemoteStorageEntry;
 
@@ -51,9 +65,14 @@ public:
   void initialize();
   void finalize();
 
+  // Construct the backends of all remote storage shards ahead of their first
+  // use, e.g. in a compile server whose workers inherit them.
+  void create_backends();
+
   local::LocalStorage local;
 
-  using EntryReceiver = std::function<bool(util::Bytes&&)>;
+  // The data passed to the receiver is only valid during the call.
+  using EntryReceiver = local::LocalStorage::EntryReceiver;
 
   void get(const Hash::Digest& key,
            core::CacheEntryType type,
@@ -68,17 +87,45 @@ public:
   bool has_remote_storage() const;
   std::string get_remote_storage_config_for_logging() const;
 
+  // Upload entries spooled by asynchronous remote uploads. If `wait` is true,
+  // wait for a running uploader to finish instead of leaving the spool to it.
+  void upload_spooled_entries(bool wait);
+
 private:
   const Config& m_config;
+  bool m_initialized = false;
   std::vector<std::unique_ptr<RemoteStorageEntry>> m_remote_storages;
+  bool m_spooled_entries = false;
+  LatencyHistograms m_lookup_latencies;
+  // Latencies recorded by earlier ccache invocations, read on first use.
+  std::optional<LatencyHistograms> m_known_latencies;
+  std::optional<BackendHealthFile> m_backend_health;
+  // Threads running remote lookups, joined by finalize().
+  std::vector<std::thread> m_lookup_threads;
 
   void add_remote_storages();
 
+  void join_lookup_threads();
+
   void mark_backend_as_failed(RemoteStorageBackendEntry& backend_entry,
                               remote::RemoteStorage::Backend::Failure failure);
+  void mark_backend_as_succeeded(RemoteStorageBackendEntry& backend_entry);
+
+  // Return whether the shared backend health allows a request to `backend`.
+  bool is_backend_healthy(const std::string& url_for_logging);
+
+  // Return latencies of `url_for_logging` recorded by earlier invocations.
+  const LatencyHistogram*
+  get_known_latencies(const std::string& url_for_logging);
+
+  // Return the attributes of `entry` with "auto" values resolved for
+  // `url_for_logging`.
+  std::vector<remote::RemoteStorage::Backend::Attribute>
+  get_backend_attributes(const RemoteStorageEntry& entry,
+                         const std::string& url_for_logging);
 
   RemoteStorageBackendEntry* get_backend(RemoteStorageEntry& entry,
-                                         const Hash::Digest& key,
+                                         const Url& shard_url,
                                          std::string_view operation_description,
                                          const bool for_writing);
 
@@ -86,10 +133,42 @@ private:
                                core::CacheEntryType type,
                                const EntryReceiver& entry_receiver);
 
+  void get_from_remote_storage_in_parallel(const Hash::Digest& key,
+                                           core::CacheEntryType type,
+                                           const EntryReceiver& entry_receiver);
+
+  // Look up `key` in `backend` and, if no reply has arrived when the usual 95th
+  // percentile latency has passed, also in the backend of `replica_url` or, if
+  // null or unavailable, in a second instance of `backend`. `backend` is set to
+  // the backend whose result is returned.
+  RemoteLookupResult look_up_hedged(RemoteStorageEntry& entry,
+                                    RemoteStorageBackendEntry*& backend,
+                                    const Url* replica_url,
+                                    const Hash::Digest& key);
+
+  // Return whether `entry_receiver` accepted the looked up value.
+  bool handle_remote_lookup_result(RemoteStorageBackendEntry& backend,
+                                   const Hash::Digest& key,
+                                   core::CacheEntryType type,
+                                   RemoteLookupResult& lookup,
+                                   const EntryReceiver& entry_receiver);
+
   void put_in_remote_storage(const Hash::Digest& key,
                              nonstd::span<const uint8_t> value,
                              bool only_if_missing);
 
+  // Return false if writing to any backend failed.
+  bool upload_to_remote_storage(const Hash::Digest& key,
+                                nonstd::span<const uint8_t> value,
+                                bool only_if_missing);
+
+  std::filesystem::path get_spool_dir() const;
+  void spool_for_remote_storage(const Hash::Digest& key,
+                                nonstd::span<const uint8_t> value,
+                                bool only_if_missing);
+  void start_background_uploader();
+  bool upload_spooled_entries_once();
+
   void remove_from_remote_storage(const Hash::Digest& key);
 };
 
@@ -85,6 +85,11 @@ public:
            LogOnError log_on_error = LogOnError::no);
 #endif
 
+  // Create an entry for `path` from an already known lstat(2) result, e.g.
+  // from a directory scan, so that no extra stat call is made. `st` must not
+  // refer to a symlink since exists() and the accessors follow symlinks.
+  DirEntry(const std::filesystem::path& path, const stat_t& st);
+
   // Return true if the file could be lstat(2)-ed (i.e., the directory entry
   // exists without following symlinks), otherwise false.
   operator bool() const;
@@ -157,6 +162,15 @@ inline DirEntry::DirEntry(const std::filesystem::path& path,
 }
 #endif
 
+inline DirEntry::DirEntry(const std::filesystem::path& path, const stat_t& st)
+  : m_path(path),
+    m_stat(st),
+    m_errno(0),
+    m_initialized(true),
+    m_exists(true)
+{
+}
+
 inline DirEntry::operator bool() const
 {
   do_stat();
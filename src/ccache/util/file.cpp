@@ -40,10 +40,22 @@
 #  include <dirent.h>
 #endif
 
+#ifdef HAVE_LINUX_FS_H
+#  include <sys/statfs.h>
+#elif defined(HAVE_STRUCT_STATFS_F_FSTYPENAME)
+#  include <sys/mount.h>
+#  include <sys/param.h>
+#endif
+
 #ifdef HAVE_SYS_SENDFILE_H
 #  include <sys/sendfile.h>
 #endif
 
+#ifdef HAVE_STATX
+#  include <sys/syscall.h>
+#  include <sys/sysmacros.h>
+#endif
+
 #ifdef HAVE_UNISTD_H
 #  include <unistd.h>
 #endif
@@ -72,6 +84,7 @@
 #include <cstring>
 #include <fstream>
 #include <locale>
+#include <string_view>
 #include <type_traits>
 #include <vector>
 
@@ -263,6 +276,39 @@ fallocate(int fd, size_t new_size)
     });
 }
 
+bool
+is_on_network_file_system(int fd)
+{
+#ifdef HAVE_LINUX_FS_H
+  struct statfs buf;
+  if (fstatfs(fd, &buf) != 0) {
+    return false;
+  }
+  switch (static_cast<uintmax_t>(buf.f_type)) {
+  case 0x6969:     // NFS_SUPER_MAGIC
+  case 0x517b:     // SMB_SUPER_MAGIC
+  case 0xff534d42: // CIFS_SUPER_MAGIC
+  case 0xfe534d42: // SMB2_SUPER_MAGIC
+  case 0x5346414f: // AFS_SUPER_MAGIC
+  case 0x73757245: // CODA_SUPER_MAGIC
+    return true;
+  default:
+    return false;
+  }
+#elif defined(HAVE_STRUCT_STATFS_F_FSTYPENAME)
+  struct statfs buf;
+  if (fstatfs(fd, &buf) != 0) {
+    return false;
+  }
+  const std::string_view type = buf.f_fstypename;
+  return type == "nfs" || type == "smbfs" || type == "afpfs"
+         || type == "webdav";
+#else
+  (void)fd;
+  return false;
+#endif
+}
+
 void
 set_cloexec_flag(int fd)
 {
@@ -564,7 +610,140 @@ set_timestamps(const fs::path& path,
 #endif
 }
 
-#ifdef HAVE_DIRENT_H
+#if defined(HAVE_STATX) && defined(SYS_getdents64) && defined(HAVE_DIRENT_H)
+
+// Buffer size for getdents64(2). It's larger than the buffer used by readdir(3)
+// so that a full cache directory is typically read with one or two calls.
+const size_t k_getdents_buffer_size = 64 * 1024;
+
+// Field offsets in struct linux_dirent64, which libc doesn't declare.
+const size_t k_dirent64_reclen_offset = 16;
+const size_t k_dirent64_type_offset = 18;
+const size_t k_dirent64_name_offset = 19;
+
+// Only the fields that DirEntry exposes are requested, so file systems that
+// need extra work to provide the others (e.g. owner and link count on network
+// file systems) can skip it.
+const unsigned int k_statx_mask = STATX_TYPE | STATX_MODE | STATX_INO
+                                  | STATX_SIZE | STATX_BLOCKS | STATX_ATIME
+                                  | STATX_MTIME | STATX_CTIME;
+
+static DirEntry::stat_t
+statx_to_stat(const struct statx& stx)
+{
+  DirEntry::stat_t st;
+  memset(&st, 0, sizeof(st));
+  st.st_dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+  st.st_ino = stx.stx_ino;
+  st.st_mode = stx.stx_mode;
+  st.st_size = static_cast<off_t>(stx.stx_size);
+  st.st_blocks = static_cast<blkcnt_t>(stx.stx_blocks);
+  st.st_blksize = static_cast<blksize_t>(stx.stx_blksize);
+  st.st_atim.tv_sec = stx.stx_atime.tv_sec;
+  st.st_atim.tv_nsec = stx.stx_atime.tv_nsec;
+  st.st_mtim.tv_sec = stx.stx_mtime.tv_sec;
+  st.st_mtim.tv_nsec = stx.stx_mtime.tv_nsec;
+  st.st_ctim.tv_sec = stx.stx_ctime.tv_sec;
+  st.st_ctim.tv_nsec = stx.stx_ctime.tv_nsec;
+  return st;
+}
+
+// Traverse `directory`, which is `name` relative to `parent_fd`. Entries are
+// read with getdents64(2) and stat-ed with statx(2) relative to the directory
+// file descriptor, which avoids resolving the full path for each file. The
+// visited DirEntry objects carry the statx result so that the visitor doesn't
+// need to stat the files again.
+static tl::expected<void, std::string>
+traverse_directory_at(int parent_fd,
+                      const char* name,
+                      const fs::path& directory,
+                      const TraverseDirectoryVisitor& visitor)
+{
+  Fd fd(openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+  if (!fd) {
+    return tl::unexpected(
+      FMT("Failed to traverse {}: {}", directory, strerror(errno)));
+  }
+
+  std::vector<uint8_t> buffer(k_getdents_buffer_size);
+  while (true) {
+    const auto bytes_read =
+      syscall(SYS_getdents64, *fd, buffer.data(), buffer.size());
+    if (bytes_read < 0) {
+      return tl::unexpected(
+        FMT("Failed to traverse {}: {}", directory, strerror(errno)));
+    }
+    if (bytes_read == 0) {
+      break;
+    }
+
+    size_t pos = 0;
+    while (pos < static_cast<size_t>(bytes_read)) {
+      const uint8_t* record = buffer.data() + pos;
+      uint16_t record_length;
+      memcpy(&record_length,
+             record + k_dirent64_reclen_offset,
+             sizeof(record_length));
+      pos += record_length;
+
+      const auto type = record[k_dirent64_type_offset];
+      const char* entry_name =
+        reinterpret_cast<const char*>(record + k_dirent64_name_offset);
+      if (strcmp(entry_name, "") == 0 || strcmp(entry_name, ".") == 0
+          || strcmp(entry_name, "..") == 0) {
+        continue;
+      }
+
+      auto path = directory / entry_name;
+      if (type == DT_DIR) {
+        traverse_directory_at(*fd, entry_name, path, visitor);
+        continue;
+      }
+
+      struct statx stx;
+      if (statx(*fd,
+                entry_name,
+                AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT,
+                k_statx_mask,
+                &stx)
+          != 0) {
+        if (errno == ENOENT || errno == ESTALE) {
+          continue;
+        }
+        if (type == DT_UNKNOWN) {
+          return tl::unexpected(
+            FMT("Failed to lstat {}: {}", path, strerror(errno)));
+        }
+        // Let the visitor see the error when it stats the entry.
+        visitor(path);
+        continue;
+      }
+
+      if (S_ISDIR(stx.stx_mode)) {
+        traverse_directory_at(*fd, entry_name, path, visitor);
+      } else if (S_ISLNK(stx.stx_mode)
+                 || (stx.stx_mask & k_statx_mask) != k_statx_mask) {
+        // Let DirEntry follow the symlink or stat the file the normal way.
+        visitor(path);
+      } else {
+        visitor(DirEntry(path, statx_to_stat(stx)));
+      }
+    }
+  }
+  visitor(directory);
+
+  return {};
+}
+
+tl::expected<void, std::string>
+traverse_directory(const fs::path& directory,
+                   const TraverseDirectoryVisitor& visitor)
+{
+  return traverse_directory_at(
+    AT_FDCWD, util::pstr(directory).c_str(), directory, visitor);
+}
+
+#elif defined(HAVE_DIRENT_H)
 
 tl::expected<void, std::string>
 traverse_directory(const fs::path& directory,
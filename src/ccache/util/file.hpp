@@ -65,6 +65,11 @@ void create_cachedir_tag(const std::filesystem::path& dir);
 // supported.
 tl::expected<void, std::string> fallocate(int fd, size_t new_size);
 
+// Return whether `fd` refers to a file on a network file system (NFS, SMB,
+// etc.) where memory mappings and kernel file locks may not be coherent
+// between hosts.
+bool is_on_network_file_system(int fd);
+
 // Return how much a file of `size` bytes likely would take on disk.
 uint64_t likely_size_on_disk(uint64_t size);
 
@@ -127,7 +132,8 @@ void set_timestamps(const std::filesystem::path& path,
                     std::optional<TimePoint> atime = std::nullopt);
 
 // Traverse `path` recursively in postorder (directory entries are visited
-// before their parent directory).
+// before their parent directory). Where supported, the visited entries are
+// already stat-ed in a batched directory scan.
 tl::expected<void, std::string>
 traverse_directory(const std::filesystem::path& directory,
                    const TraverseDirectoryVisitor& visitor);
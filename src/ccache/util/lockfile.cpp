@@ -33,17 +33,24 @@
 #  include <unistd.h>
 #endif
 
-#ifdef __CYGWIN__
+#ifndef _WIN32
 #  include <fcntl.h>
+#  include <sys/file.h>
 #endif
 
 #include <algorithm>
+#include <cerrno>
+#include <cstring>
 #include <random>
 #include <sstream>
 
 const uint32_t k_min_sleep_time_ms = 10;
 const uint32_t k_max_sleep_time_ms = 50;
 #ifndef _WIN32
+// Polling the kernel lock is a single system call, so poll it more often than
+// the symlink.
+const uint32_t k_min_kernel_lock_sleep_time_ms = 1;
+const uint32_t k_max_kernel_lock_sleep_time_ms = 10;
 const util::Duration k_staleness_limit(2);
 #endif
 
@@ -80,6 +87,7 @@ LockFile::LockFile(const fs::path& path)
   : m_lock_file(util::pstr(path).str() + ".lock"),
 #ifndef _WIN32
     m_alive_file(util::pstr(path).str() + ".alive"),
+    m_kernel_lock_file(util::pstr(path).str() + k_kernel_lock_file_suffix),
     m_acquired(false)
 #else
     m_handle(INVALID_HANDLE_VALUE)
@@ -92,6 +100,8 @@ LockFile::LockFile(LockFile&& other) noexcept
 #ifndef _WIN32
     m_lock_manager(other.m_lock_manager),
     m_alive_file(std::move(other.m_alive_file)),
+    m_kernel_lock_file(std::move(other.m_kernel_lock_file)),
+    m_kernel_lock_fd(std::move(other.m_kernel_lock_fd)),
     m_acquired(other.m_acquired)
 #else
     m_handle(other.m_handle)
@@ -114,6 +124,8 @@ LockFile::operator=(LockFile&& other) noexcept
     m_lock_manager = other.m_lock_manager;
     other.m_lock_manager = nullptr;
     m_alive_file = std::move(other.m_alive_file);
+    m_kernel_lock_file = std::move(other.m_kernel_lock_file);
+    m_kernel_lock_fd = std::move(other.m_kernel_lock_fd);
     m_acquired = other.m_acquired;
     other.m_acquired = false;
 #else
@@ -164,6 +176,9 @@ LockFile::release()
   }
   fs::remove(m_alive_file);
   fs::remove(m_lock_file);
+  // Release the kernel lock last so that a waiting process finds the symlink
+  // removed when it wakes up.
+  m_kernel_lock_fd.close();
 #else
   CloseHandle(m_handle);
 #endif
@@ -191,7 +206,10 @@ LockFile::acquire(const bool blocking)
   ASSERT(!acquired());
 
 #ifndef _WIN32
-  m_acquired = do_acquire(blocking);
+  m_acquired = acquire_kernel_lock(blocking) && do_acquire(blocking);
+  if (!m_acquired) {
+    m_kernel_lock_fd.close();
+  }
 #else
   m_handle = do_acquire(blocking);
 #endif
@@ -217,6 +235,86 @@ LockFile::acquire(const bool blocking)
 
 #ifndef _WIN32
 
+bool
+LockFile::acquire_kernel_lock(const bool blocking)
+{
+  const auto open_lock_file = [&] {
+    return Fd(open(util::pstr(m_kernel_lock_file).c_str(),
+                   O_RDWR | O_CREAT | O_CLOEXEC,
+                   0666));
+  };
+  Fd fd = open_lock_file();
+  if (!fd && errno == ENOENT
+      && fs::create_directories(m_kernel_lock_file.parent_path())) {
+    fd = open_lock_file();
+  }
+  if (!fd) {
+    // Rely on the symlink lock only.
+    LOG("Failed to open {}: {}", m_kernel_lock_file, strerror(errno));
+    return true;
+  }
+  if (is_on_network_file_system(*fd)) {
+    // Kernel locks are not reliable between hosts on network file systems, so
+    // rely on the symlink lock only.
+    return true;
+  }
+
+  // Don't wait in the kernel since a stopped or hung holder would then block
+  // the waiter indefinitely. Instead poll the lock and fall back to the symlink
+  // lock, which is broken when stale, if the holder seems inactive.
+  TimePoint last_seen_activity = [this] {
+    const auto last_lock_update = get_last_lock_update();
+    return last_lock_update ? *last_lock_update : TimePoint::now();
+  }();
+  RandomNumberGenerator sleep_ms_generator(k_min_kernel_lock_sleep_time_ms,
+                                           k_max_kernel_lock_sleep_time_ms);
+
+  while (true) {
+#  ifdef F_OFD_SETLK
+    struct flock lock = {};
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+    const int result = fcntl(*fd, F_OFD_SETLK, &lock);
+#  else
+    const int result = flock(*fd, LOCK_EX | LOCK_NB);
+#  endif
+    if (result == 0) {
+      m_kernel_lock_fd = std::move(fd);
+      return true;
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    if (errno != EAGAIN && errno != EACCES && errno != EWOULDBLOCK) {
+      // Kernel locks not supported by the file system?
+      LOG("Failed to lock {}: {}", m_kernel_lock_file, strerror(errno));
+      return true;
+    }
+
+    // Held by another process.
+    if (!blocking) {
+      return false;
+    }
+    const auto last_lock_update = get_last_lock_update();
+    if (last_lock_update && *last_lock_update > last_seen_activity) {
+      last_seen_activity = *last_lock_update;
+    }
+    const Duration inactive_duration = TimePoint::now() - last_seen_activity;
+    if (inactive_duration >= k_staleness_limit) {
+      LOG("Falling back to {} since {} has been held by a process inactive for"
+          " {}.{:03} seconds",
+          m_lock_file,
+          m_kernel_lock_file,
+          inactive_duration.sec(),
+          inactive_duration.nsec_decimal_part() / 1'000'000);
+      return true;
+    }
+
+    std::this_thread::sleep_for(
+      std::chrono::milliseconds{sleep_ms_generator.get()});
+  }
+}
+
 bool
 LockFile::do_acquire(const bool blocking)
 {
@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include <ccache/util/fd.hpp>
 #include <ccache/util/longlivedlockfilemanager.hpp>
 #include <ccache/util/noncopyable.hpp>
 #include <ccache/util/timepoint.hpp>
@@ -30,9 +31,22 @@ namespace util {
 // Unless make_long_lived is called, the lock is expected to be released shortly
 // after being acquired - if it is held for more than two seconds it risks being
 // considered stale by another client.
+//
+// On non-Windows systems the lock is a symlink (`<path>.lock`) that works on
+// network file systems. On local file systems, an exclusive kernel lock (OFD
+// lock or flock) on `<path>.flock` is acquired first. The kernel lock is
+// released even if the holder dies and is cheaper to poll than the symlink. A
+// waiter falls back to the symlink, which can be broken when stale, if the
+// holder seems inactive. The symlink is still created while the kernel lock is
+// held so that older ccache versions that only know about the symlink are
+// excluded as well.
 class LockFile : util::NonCopyable
 {
 public:
+  // Suffix of the kernel lock file. Unlike the symlink, the file is kept when
+  // the lock is released.
+  static constexpr char k_kernel_lock_file_suffix[] = ".flock";
+
   explicit LockFile(const std::filesystem::path& path);
   LockFile(LockFile&& other) noexcept;
 
@@ -62,6 +76,8 @@ private:
 #ifndef _WIN32
   LongLivedLockFileManager* m_lock_manager = nullptr;
   std::filesystem::path m_alive_file;
+  std::filesystem::path m_kernel_lock_file;
+  Fd m_kernel_lock_fd;
   bool m_acquired;
 #else
   void* m_handle;
@@ -69,6 +85,7 @@ private:
 
   bool acquire(bool blocking);
 #ifndef _WIN32
+  bool acquire_kernel_lock(bool blocking);
   bool do_acquire(bool blocking);
   std::optional<TimePoint> get_last_lock_update();
 #else
@@ -25,6 +25,7 @@
 #include <ccache/util/logging.hpp>
 #include <ccache/util/time.hpp>
 
+#include <mutex>
 #include <string>
 
 #ifdef HAVE_UNISTD_H
@@ -58,6 +59,10 @@ std::string debug_log_buffer;
 // Whether debug logging is enabled via configuration or environment variable.
 bool debug_log_enabled = false;
 
+// Serializes logging from threads, e.g. when hashing include files
+// concurrently.
+std::mutex log_mutex;
+
 // Print error message to stderr about failure writing to the log file and exit
 // with failure.
 [[noreturn]] void
@@ -78,6 +83,8 @@ print_fatal_error_and_exit()
 void
 do_log(std::string_view message, bool bulk)
 {
+  std::lock_guard<std::mutex> log_lock(log_mutex);
+
   static char prefix[200];
 
   if (!bulk || prefix[0] == '\0') {
@@ -37,9 +37,8 @@ MemoryMap::~MemoryMap()
 MemoryMap::MemoryMap(MemoryMap&& other) noexcept
 {
   m_ptr = std::exchange(other.m_ptr, nullptr);
-#ifndef _WIN32
   m_size = std::exchange(other.m_size, 0);
-#else
+#ifdef _WIN32
   m_file_mapping_handle = std::exchange(other.m_file_mapping_handle, nullptr);
 #endif
 }
@@ -49,9 +48,8 @@ MemoryMap::operator=(MemoryMap&& other) noexcept
 {
   unmap();
   m_ptr = std::exchange(other.m_ptr, nullptr);
-#ifndef _WIN32
   m_size = std::exchange(other.m_size, 0);
-#else
+#ifdef _WIN32
   m_file_mapping_handle = std::exchange(other.m_file_mapping_handle, nullptr);
 #endif
 
@@ -72,6 +70,7 @@ MemoryMap::unmap()
 #else
   UnmapViewOfFile(m_ptr);
   m_ptr = nullptr;
+  m_size = 0;
   CloseHandle(m_file_mapping_handle);
   m_file_mapping_handle = nullptr;
 #endif
@@ -83,13 +82,36 @@ MemoryMap::ptr()
   return m_ptr;
 }
 
+nonstd::span<const uint8_t>
+MemoryMap::data() const
+{
+  return {static_cast<const uint8_t*>(m_ptr), m_size};
+}
+
 tl::expected<MemoryMap, std::string>
 MemoryMap::map(int fd, size_t size)
+{
+  return do_map(fd, size, true);
+}
+
+tl::expected<MemoryMap, std::string>
+MemoryMap::map_read_only(int fd, size_t size)
+{
+  return do_map(fd, size, false);
+}
+
+tl::expected<MemoryMap, std::string>
+MemoryMap::do_map(int fd, size_t size, bool writable)
 {
 #ifndef _WIN32
   const void* MMAP_FAILED =
     reinterpret_cast<void*>(-1); // NOLINT: Must cast here
-  void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  void* p = mmap(nullptr,
+                 size,
+                 writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                 writable ? MAP_SHARED : MAP_PRIVATE,
+                 fd,
+                 0);
   if (p == MMAP_FAILED) {
     return tl::unexpected(strerror(errno));
   }
@@ -107,7 +129,7 @@ MemoryMap::map(int fd, size_t size)
   HANDLE file_mapping_handle =
     CreateFileMappingA(file_handle,
                        nullptr,
-                       PAGE_READWRITE,
+                       writable ? PAGE_READWRITE : PAGE_READONLY,
                        static_cast<uint64_t>(size) >> 32,
                        size & 0xffffffff,
                        nullptr);
@@ -115,7 +137,11 @@ MemoryMap::map(int fd, size_t size)
     return tl::unexpected(FMT("Can't create file mapping: {}", GetLastError()));
   }
 
-  void* p = MapViewOfFile(file_mapping_handle, FILE_MAP_ALL_ACCESS, 0, 0, size);
+  void* p = MapViewOfFile(file_mapping_handle,
+                          writable ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ,
+                          0,
+                          0,
+                          size);
   if (!p) {
     std::string error = FMT("Can't map file: {}", GetLastError());
     CloseHandle(file_mapping_handle);
@@ -124,6 +150,7 @@ MemoryMap::map(int fd, size_t size)
 
   MemoryMap map;
   map.m_ptr = p;
+  map.m_size = size;
   map.m_file_mapping_handle = file_mapping_handle;
   return map;
 #endif
@@ -20,9 +20,11 @@
 
 #include <ccache/util/noncopyable.hpp>
 
+#include <nonstd/span.hpp>
 #include <tl/expected.hpp>
 
 #include <cstddef>
+#include <cstdint>
 #include <string>
 
 namespace util {
@@ -39,17 +41,27 @@ public:
   void unmap();
 
   void* ptr();
+  nonstd::span<const uint8_t> data() const;
 
+  // Map `size` bytes of `fd` for reading and writing, sharing changes with
+  // other processes.
   static tl::expected<MemoryMap, std::string> map(int fd, size_t size);
 
+  // Map `size` (> 0) bytes of `fd` for reading only. The file must not be
+  // truncated or modified in place while mapped.
+  static tl::expected<MemoryMap, std::string> map_read_only(int fd,
+                                                            size_t size);
+
 private:
   void* m_ptr = nullptr;
-#ifndef _WIN32
-  size_t m_size = 0; // munmap needs the size, not needed on Windows
-#else
+  size_t m_size = 0;
+#ifdef _WIN32
   void* m_file_mapping_handle =
     nullptr; // On Windows a handle on a file mapping is needed
 #endif
+
+  static tl::expected<MemoryMap, std::string>
+  do_map(int fd, size_t size, bool writable);
 };
 
 } // namespace util
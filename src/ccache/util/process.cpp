@@ -18,14 +18,25 @@
 
 #include "process.hpp"
 
+#include <ccache/util/logging.hpp>
 #include <ccache/util/wincompat.hpp>
 
+#include <cerrno>
 #include <cstring>
 
 #ifdef HAVE_UNISTD_H
 #  include <unistd.h>
 #endif
 
+#ifndef _WIN32
+#  include <fcntl.h>
+#  include <sys/wait.h>
+#endif
+
+#ifdef __linux__
+#  include <sys/syscall.h>
+#endif
+
 namespace {
 
 // Process umask, read and written by get_umask and set_umask.
@@ -35,6 +46,13 @@ mode_t g_umask = [] {
   return mask;
 }();
 
+#ifdef __linux__
+// From linux/ioprio.h, which is not installed everywhere.
+const int k_ioprio_who_process = 1;
+const int k_ioprio_class_idle = 3;
+const int k_ioprio_class_shift = 13;
+#endif
+
 } // namespace
 
 namespace util {
@@ -68,4 +86,52 @@ set_umask(mode_t mask)
   return umask(mask);
 }
 
+bool
+start_background_process()
+{
+#ifdef _WIN32
+  return false;
+#else
+  // Double fork so that the background process is reparented to init and
+  // doesn't make the caller wait for it.
+  const pid_t pid = fork();
+  if (pid == -1) {
+    LOG("Failed to fork background process: {}", strerror(errno));
+    return false;
+  }
+  if (pid > 0) {
+    waitpid(pid, nullptr, 0);
+    return false;
+  }
+
+  setsid();
+  if (fork() != 0) {
+    _exit(0);
+  }
+
+  // Don't keep the standard streams of a build system or terminal open.
+  const int null_fd = open("/dev/null", O_RDWR);
+  if (null_fd != -1) {
+    dup2(null_fd, STDIN_FILENO);
+    dup2(null_fd, STDOUT_FILENO);
+    dup2(null_fd, STDERR_FILENO);
+    if (null_fd > STDERR_FILENO) {
+      close(null_fd);
+    }
+  }
+
+  if (nice(10) == -1) {
+    // Ignore failure to lower the priority.
+  }
+#  ifdef __linux__
+  // Likewise for the I/O priority.
+  (void)syscall(SYS_ioprio_set,
+                k_ioprio_who_process,
+                0,
+                k_ioprio_class_idle << k_ioprio_class_shift);
+#  endif
+  return true;
+#endif
+}
+
 } // namespace util
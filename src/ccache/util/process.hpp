@@ -31,4 +31,12 @@ mode_t get_umask();
 // Set process umask. Returns the previous mask.
 mode_t set_umask(mode_t mask);
 
+// Start a detached background process with low CPU and I/O priority. The
+// background process is reparented to init so that the caller doesn't have to
+// wait for it, and its standard streams are redirected to /dev/null. Returns
+// true in the background process, which should call _exit when done, and false
+// in the calling process or if the process couldn't be started. Always returns
+// false on Windows.
+bool start_background_process();
+
 } // namespace util
@@ -18,24 +18,97 @@
 
 #include "zstd.hpp"
 
+#include <ccache/util/assertions.hpp>
+
+#include <zdict.h>
 #include <zstd.h>
 
+#include <algorithm>
+#include <climits>
+
 namespace util {
 
+ZstdDictionary::ZstdDictionary(Bytes data, ZSTD_DDict* ddict)
+  : m_data(std::move(data)),
+    m_ddict(ddict)
+{
+}
+
+ZstdDictionary::~ZstdDictionary()
+{
+  ZSTD_freeDDict(m_ddict);
+  for (const auto& [level, cdict] : m_cdicts) {
+    ZSTD_freeCDict(cdict);
+  }
+}
+
+tl::expected<std::unique_ptr<ZstdDictionary>, std::string>
+ZstdDictionary::create(Bytes data)
+{
+  ZSTD_DDict* ddict = ZSTD_createDDict(data.data(), data.size());
+  if (!ddict) {
+    return tl::unexpected("invalid Zstandard dictionary");
+  }
+  return std::unique_ptr<ZstdDictionary>(
+    new ZstdDictionary(std::move(data), ddict));
+}
+
+uint32_t
+ZstdDictionary::id() const
+{
+  return ZSTD_getDictID_fromDict(m_data.data(), m_data.size());
+}
+
+const ZSTD_CDict*
+ZstdDictionary::cdict(int8_t compression_level) const
+{
+  std::lock_guard<std::mutex> lock(m_cdicts_mutex);
+  auto& cdict = m_cdicts[compression_level];
+  if (!cdict) {
+    cdict = ZSTD_createCDict(m_data.data(), m_data.size(), compression_level);
+  }
+  return cdict;
+}
+
+const ZSTD_DDict*
+ZstdDictionary::ddict() const
+{
+  return m_ddict;
+}
+
 tl::expected<void, std::string>
 zstd_compress(nonstd::span<const uint8_t> input,
               Bytes& output,
-              int8_t compression_level)
+              int8_t compression_level,
+              const ZstdDictionary* dictionary)
 {
   const size_t original_output_size = output.size();
   const size_t compress_bound = zstd_compress_bound(input.size());
   output.resize(original_output_size + compress_bound);
 
-  const size_t ret = ZSTD_compress(&output[original_output_size],
+  size_t ret;
+  if (dictionary) {
+    const ZSTD_CDict* cdict = dictionary->cdict(compression_level);
+    if (!cdict) {
+      output.resize(original_output_size);
+      return tl::unexpected("failed to digest compression dictionary");
+    }
+    ZSTD_CCtx* cctx = ZSTD_createCCtx();
+    ASSERT(cctx);
+    ret = ZSTD_compress_usingCDict(cctx,
+                                   &output[original_output_size],
                                    compress_bound,
                                    input.data(),
                                    input.size(),
-                                   compression_level);
+                                   cdict);
+    ZSTD_freeCCtx(cctx);
+  } else {
+    ret = ZSTD_compress(&output[original_output_size],
+                        compress_bound,
+                        input.data(),
+                        input.size(),
+                        compression_level);
+  }
   if (ZSTD_isError(ret)) {
     return tl::unexpected(ZSTD_getErrorName(ret));
   }
@@ -47,13 +120,29 @@ zstd_compress(nonstd::span<const uint8_t> input,
 tl::expected<void, std::string>
 zstd_decompress(nonstd::span<const uint8_t> input,
                 Bytes& output,
-                size_t original_size)
+                size_t original_size,
+                const ZstdDictionary* dictionary)
 {
   const size_t original_output_size = output.size();
 
   output.resize(original_output_size + original_size);
-  const size_t ret = ZSTD_decompress(
-    &output[original_output_size], original_size, input.data(), input.size());
+  size_t ret;
+  if (dictionary) {
+    ZSTD_DCtx* dctx = ZSTD_createDCtx();
+    ASSERT(dctx);
+    ret = ZSTD_decompress_usingDDict(dctx,
+                                     &output[original_output_size],
+                                     original_size,
+                                     input.data(),
+                                     input.size(),
+                                     dictionary->ddict());
+    ZSTD_freeDCtx(dctx);
+  } else {
+    ret = ZSTD_decompress(&output[original_output_size],
+                          original_size,
+                          input.data(),
+                          input.size());
+  }
   if (ZSTD_isError(ret)) {
     return tl::unexpected(ZSTD_getErrorName(ret));
   }
@@ -63,6 +152,25 @@ zstd_decompress(nonstd::span<const uint8_t> input,
   return {};
 }
 
+tl::expected<Bytes, std::string>
+zstd_train_dictionary(nonstd::span<const uint8_t> samples,
+                      const std::vector<size_t>& sample_sizes,
+                      size_t max_size)
+{
+  Bytes dictionary(max_size);
+  const size_t ret = ZDICT_trainFromBuffer(dictionary.data(),
+                                           dictionary.size(),
+                                           samples.data(),
+                                           sample_sizes.data(),
+                                           static_cast<unsigned>(
+                                             sample_sizes.size()));
+  if (ZDICT_isError(ret)) {
+    return tl::unexpected(ZDICT_getErrorName(ret));
+  }
+  dictionary.resize(ret);
+  return dictionary;
+}
+
 size_t
 zstd_compress_bound(size_t input_size)
 {
@@ -81,4 +189,111 @@ zstd_supported_compression_level(int8_t wanted_level)
   return {level, {}};
 }
 
+ZstdCompressor::ZstdCompressor(Bytes& output,
+                               int8_t compression_level,
+                               uint32_t threads,
+                               const ZstdDictionary* dictionary)
+  : m_output(output),
+    m_cstream(ZSTD_createCStream())
+{
+  ASSERT(m_cstream);
+  if (dictionary) {
+    const ZSTD_CDict* cdict = dictionary->cdict(compression_level);
+    if (cdict) {
+      ZSTD_CCtx_refCDict(m_cstream, cdict);
+    } else {
+      m_error = "failed to digest compression dictionary";
+    }
+  } else {
+    ZSTD_CCtx_setParameter(
+      m_cstream, ZSTD_c_compressionLevel, compression_level);
+  }
+  if (threads > 1) {
+    // Fails without effect if libzstd is built without multithreading.
+    ZSTD_CCtx_setParameter(
+      m_cstream,
+      ZSTD_c_nbWorkers,
+      static_cast<int>(std::min<uint32_t>(threads, INT_MAX)));
+  }
+}
+
+ZstdCompressor::~ZstdCompressor()
+{
+  ZSTD_freeCStream(m_cstream);
+}
+
+tl::expected<void, std::string>
+ZstdCompressor::write(nonstd::span<const uint8_t> input)
+{
+  return compress(input, false);
+}
+
+tl::expected<void, std::string>
+ZstdCompressor::finish()
+{
+  return compress({}, true);
+}
+
+tl::expected<void, std::string>
+ZstdCompressor::compress(nonstd::span<const uint8_t> input, bool end)
+{
+  if (!m_error.empty()) {
+    return tl::unexpected(m_error);
+  }
+  ZSTD_inBuffer in = {input.data(), input.size(), 0};
+  const size_t out_chunk_size = ZSTD_CStreamOutSize();
+  while (true) {
+    const size_t original_output_size = m_output.size();
+    m_output.resize(original_output_size + out_chunk_size);
+    ZSTD_outBuffer out = {&m_output[original_output_size], out_chunk_size, 0};
+    const size_t ret = ZSTD_compressStream2(
+      m_cstream, &out, &in, end ? ZSTD_e_end : ZSTD_e_continue);
+    m_output.resize(original_output_size + out.pos);
+    if (ZSTD_isError(ret)) {
+      return tl::unexpected(ZSTD_getErrorName(ret));
+    }
+    if (end ? ret == 0 : in.pos == in.size) {
+      return {};
+    }
+  }
+}
+
+ZstdDecompressor::ZstdDecompressor(nonstd::span<const uint8_t> input,
+                                   const ZstdDictionary* dictionary)
+  : m_input(input),
+    m_dstream(ZSTD_createDStream())
+{
+  ASSERT(m_dstream);
+  if (dictionary) {
+    ZSTD_DCtx_refDDict(m_dstream, dictionary->ddict());
+  }
+}
+
+ZstdDecompressor::~ZstdDecompressor()
+{
+  ZSTD_freeDStream(m_dstream);
+}
+
+tl::expected<size_t, std::string>
+ZstdDecompressor::read(nonstd::span<uint8_t> output)
+{
+  ZSTD_outBuffer out = {output.data(), output.size(), 0};
+  while (out.pos < out.size) {
+    ZSTD_inBuffer in = {m_input.data(), m_input.size(), m_input_pos};
+    const size_t previous_output_pos = out.pos;
+    const size_t ret = ZSTD_decompressStream(m_dstream, &out, &in);
+    const bool progress =
+      in.pos != m_input_pos || out.pos != previous_output_pos;
+    m_input_pos = in.pos;
+    if (ZSTD_isError(ret)) {
+      return tl::unexpected(ZSTD_getErrorName(ret));
+    }
+    if (m_input_pos == m_input.size() && (ret == 0 || !progress)) {
+      // End of frame or truncated input.
+      break;
+    }
+  }
+  return out.pos;
+}
+
 } // namespace util
@@ -19,26 +19,132 @@
 #pragma once
 
 #include <ccache/util/bytes.hpp>
+#include <ccache/util/noncopyable.hpp>
 
 #include <nonstd/span.hpp>
 #include <tl/expected.hpp>
 
 #include <cstddef>
 #include <cstdint>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <tuple>
+#include <unordered_map>
+#include <vector>
+
+struct ZSTD_CCtx_s;
+struct ZSTD_CDict_s;
+struct ZSTD_DCtx_s;
+struct ZSTD_DDict_s;
 
 namespace util {
 
-[[nodiscard]] tl::expected<void, std::string> zstd_compress(
-  nonstd::span<const uint8_t> input, Bytes& output, int8_t compression_level);
+// A dictionary that improves compression of small data similar to the data
+// that it was trained on. Data compressed with a dictionary can only be
+// decompressed with the same dictionary.
+class ZstdDictionary : NonCopyable
+{
+public:
+  ~ZstdDictionary();
+
+  // Create a dictionary from `data`, failing if the data is a corrupt
+  // Zstandard dictionary.
+  static tl::expected<std::unique_ptr<ZstdDictionary>, std::string>
+  create(Bytes data);
+
+  // Return the ID stored in the dictionary, or 0 if the data isn't a
+  // Zstandard dictionary.
+  uint32_t id() const;
+
+  // Return the dictionary digested for compression at `compression_level`, or
+  // nullptr on failure. Thread-safe.
+  const ZSTD_CDict_s* cdict(int8_t compression_level) const;
+
+  // Return the dictionary digested for decompression.
+  const ZSTD_DDict_s* ddict() const;
+
+private:
+  Bytes m_data;
+  ZSTD_DDict_s* m_ddict;
+
+  ZstdDictionary(Bytes data, ZSTD_DDict_s* ddict);
+  mutable std::mutex m_cdicts_mutex;
+  mutable std::unordered_map<int8_t, ZSTD_CDict_s*> m_cdicts;
+};
+
+[[nodiscard]] tl::expected<void, std::string>
+zstd_compress(nonstd::span<const uint8_t> input,
+              Bytes& output,
+              int8_t compression_level,
+              const ZstdDictionary* dictionary = nullptr);
+
+[[nodiscard]] tl::expected<void, std::string>
+zstd_decompress(nonstd::span<const uint8_t> input,
+                Bytes& output,
+                size_t original_size,
+                const ZstdDictionary* dictionary = nullptr);
 
-[[nodiscard]] tl::expected<void, std::string> zstd_decompress(
-  nonstd::span<const uint8_t> input, Bytes& output, size_t original_size);
+// Train a dictionary of at most `max_size` bytes from `samples`, which is
+// `sample_sizes.size()` samples stored back to back.
+[[nodiscard]] tl::expected<Bytes, std::string>
+zstd_train_dictionary(nonstd::span<const uint8_t> samples,
+                      const std::vector<size_t>& sample_sizes,
+                      size_t max_size);
 
 size_t zstd_compress_bound(size_t input_size);
 
 std::tuple<int8_t, std::string>
 zstd_supported_compression_level(int8_t wanted_level);
 
+// Streaming compressor that appends compressed data to `output` so that the
+// uncompressed data doesn't need to be kept in memory. If `threads` is larger
+// than 1, data is compressed in parallel by that many worker threads, provided
+// that libzstd supports multithreading. `dictionary` must outlive the
+// compressor.
+class ZstdCompressor : NonCopyable
+{
+public:
+  ZstdCompressor(Bytes& output,
+                 int8_t compression_level,
+                 uint32_t threads = 1,
+                 const ZstdDictionary* dictionary = nullptr);
+  ~ZstdCompressor();
+
+  [[nodiscard]] tl::expected<void, std::string>
+  write(nonstd::span<const uint8_t> input);
+
+  // Flush the remaining data and end the frame.
+  [[nodiscard]] tl::expected<void, std::string> finish();
+
+private:
+  Bytes& m_output;
+  ZSTD_CCtx_s* m_cstream;
+  std::string m_error;
+
+  tl::expected<void, std::string> compress(nonstd::span<const uint8_t> input,
+                                           bool end);
+};
+
+// Streaming decompressor that decompresses `input` on demand so that the
+// decompressed data doesn't need to be kept in memory. `dictionary` must
+// outlive the decompressor.
+class ZstdDecompressor : NonCopyable
+{
+public:
+  explicit ZstdDecompressor(nonstd::span<const uint8_t> input,
+                            const ZstdDictionary* dictionary = nullptr);
+  ~ZstdDecompressor();
+
+  // Decompress data into `output`. Returns the number of bytes written, which
+  // is less than `output.size()` only if the end of the input is reached.
+  [[nodiscard]] tl::expected<size_t, std::string>
+  read(nonstd::span<uint8_t> output);
+
+private:
+  nonstd::span<const uint8_t> m_input;
+  size_t m_input_pos = 0;
+  ZSTD_DCtx_s* m_dstream;
+};
+
 } // namespace util
@@ -374,6 +374,81 @@ EOF
         test_failed "Result file seems to be uncompressed"
     fi
 
+    # -------------------------------------------------------------------------
+    TEST "Large compressed result file is streamed"
+
+    echo "char big[3000000] = {1};" >big.c
+    $COMPILER -c -o reference_big.o big.c
+
+    $CCACHE_COMPILE -c big.c
+    expect_stat cache_miss 1
+
+    rm big.o
+    $CCACHE_COMPILE -c big.c
+    expect_stat preprocessed_cache_hit 1
+    expect_equal_object_files reference_big.o big.o
+    expect_contains $CCACHE_LOGFILE "Reading streamed embedded entry #0 .o"
+
+    result_file=$(find $CCACHE_DIR -name '*R')
+    $CCACHE --inspect $result_file >result.txt
+    expect_contains result.txt "Embedded file #0: .o ($(file_size big.o) bytes)"
+
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_COMPRESSTHREADS"
+
+    echo "char big[5000000] = {1};" >big.c
+    $COMPILER -c -o reference_big.o big.c
+
+    CCACHE_COMPRESSTHREADS=4 $CCACHE_COMPILE -c big.c
+    expect_stat cache_miss 1
+    expect_contains $CCACHE_LOGFILE "Compressing with 4 threads"
+
+    CCACHE_COMPRESSTHREADS=4 $CCACHE_COMPILE -c test1.c
+    expect_stat cache_miss 2
+    if [ $(grep -c "Compressing with 4 threads" $CCACHE_LOGFILE) -ne 1 ]; then
+        test_failed "Small result compressed with several threads"
+    fi
+
+    rm big.o
+    $CCACHE_COMPILE -c big.c
+    expect_stat preprocessed_cache_hit 1
+    expect_equal_object_files reference_big.o big.o
+
+    # -------------------------------------------------------------------------
+    TEST "--train-dictionary and CCACHE_COMPRESSDICTIONARY"
+
+    for i in $(seq 50); do
+        cat <<EOF >src$i.c
+int value$i = $i;
+int function$i(int x) { return x * $i + value$i; }
+const char *name$i = "source file number $i";
+EOF
+        $CCACHE_COMPILE -c src$i.c
+    done
+    expect_stat cache_miss 50
+
+    $CCACHE --train-dictionary >train.txt
+    expect_contains train.txt "on 50 cache entries"
+    dictionary_id=$(sed -n 's/^Trained dictionary \([0-9]*\) .*/\1/p' train.txt)
+    expect_exists $CCACHE_DIR/dictionaries/$dictionary_id.dict
+
+    $COMPILER -c -o reference_test1.o test1.c
+    CCACHE_COMPRESSDICTIONARY=$dictionary_id $CCACHE_COMPILE -c test1.c
+    expect_stat cache_miss 51
+    result_file=$(find $CCACHE_DIR -name '*R' -newer train.txt)
+    $CCACHE --inspect $result_file >result.txt
+    expect_contains result.txt "Dictionary ID: $dictionary_id"
+
+    rm test1.o
+    $CCACHE_COMPILE -c test1.c
+    expect_stat preprocessed_cache_hit 1
+    expect_equal_object_files reference_test1.o test1.o
+
+    mv $CCACHE_DIR/dictionaries $CCACHE_DIR/dictionaries.moved
+    $CCACHE_COMPILE -c test1.c
+    expect_stat preprocessed_cache_hit 1
+    expect_stat cache_miss 52
+
     # -------------------------------------------------------------------------
     TEST "Corrupt result file"
 
@@ -491,8 +566,10 @@ fi
     expect_stat cache_miss 5
     $CCACHE_COMPILE -c test1.c
     expect_stat cache_miss 6
-    expect_contains "$stats_file" 101
-    expect_newer_than "$stats_file" "$CCACHE_DIR/timestamp_reference"
+    $CCACHE -c >/dev/null
+    expect_stat cache_miss 6
+    expect_missing "$stats_file"
+    expect_newer_than "$stats_file.v1" "$CCACHE_DIR/timestamp_reference"
 
     # -------------------------------------------------------------------------
     TEST "stats file with large counter values"
@@ -505,6 +582,9 @@ fi
     expect_stat cache_miss 1234567890123456789
     $CCACHE_COMPILE -c test1.c
     expect_stat cache_miss 1234567890123456790
+    $CCACHE -c >/dev/null
+    expect_stat cache_miss 1234567890123456790
+    expect_missing "$stats_file"
 
     # -------------------------------------------------------------------------
     TEST "CCACHE_RECACHE"
@@ -1131,19 +1211,19 @@ if ! $HOST_OS_WINDOWS; then
     $CCACHE -C >/dev/null
     expect_perm "$CCACHE_DIR" drwxrwxr-x
     expect_perm "$CCACHE_DIR/0" drwxrwxr-x
-    expect_perm "$CCACHE_DIR/0/stats" -rw-rw-r--
+    expect_perm "$CCACHE_DIR/0/stats.v1" -rw-rw-r--
     rm -rf $CCACHE_DIR
 
     $CCACHE -c >/dev/null
     expect_perm "$CCACHE_DIR" drwxrwxr-x
     expect_perm "$CCACHE_DIR/0" drwxrwxr-x
-    expect_perm "$CCACHE_DIR/0/stats" -rw-rw-r--
+    expect_perm "$CCACHE_DIR/0/stats.v1" -rw-rw-r--
     rm -rf $CCACHE_DIR
 
     $CCACHE -z >/dev/null
     expect_perm "$CCACHE_DIR" drwxrwxr-x
     expect_perm "$CCACHE_DIR/0" drwxrwxr-x
-    expect_perm "$CCACHE_DIR/0/stats" -rw-rw-r--
+    expect_perm "$CCACHE_DIR/0/stats.v1" -rw-rw-r--
     rm -rf $CCACHE_DIR
 
     cat <<EOF >test.c
@@ -1165,7 +1245,7 @@ EOF
     expect_perm "$CCACHE_DIR" drwxrwxr-x
     expect_perm "$CCACHE_DIR/tmp" drwxrwxr-x
     expect_perm "$level_1_dir" drwxrwxr-x
-    expect_perm "$level_1_dir/stats" -rw-rw-r--
+    expect_perm "$level_1_dir/stats.v1" -rw-rw-r--
     expect_perm "$level_2_dir" drwxrwxr-x
     expect_perm "$result_file" -rw-rw-r--
 
@@ -1188,7 +1268,7 @@ EOF
 
     $CCACHE_COMPILE --version >/dev/null
     expect_stat no_input_file 1
-    stats_file=$(find "$CCACHE_DIR" -name stats)
+    stats_file=$(find "$CCACHE_DIR" -name stats.v1)
     level_2_dir=$(dirname "$stats_file")
     level_1_dir=$(dirname $(dirname "$stats_file"))
     expect_perm "$CCACHE_DIR" drwxrwxr-x
@@ -1446,6 +1526,70 @@ EOF
     expect_stat cache_miss 1
     expect_stat files_in_cache 0
 
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_LOCAL_STORAGE_LAYOUT=pack"
+
+    export CCACHE_LOCAL_STORAGE_LAYOUT=pack
+    generate_code 2 test2.c
+    generate_code 3 test3.c
+    $COMPILER -c -o reference_test1.o test1.c
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat preprocessed_cache_hit 0
+    expect_stat cache_miss 1
+    expect_stat files_in_cache 1
+    expect_file_count 0 '*R' $CCACHE_DIR
+    expect_file_count 1 '*.seg' $CCACHE_DIR
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat preprocessed_cache_hit 1
+    expect_stat cache_miss 1
+    expect_equal_object_files reference_test1.o test1.o
+
+    $CCACHE_COMPILE -c test2.c
+    expect_stat cache_miss 2
+    expect_stat files_in_cache 2
+
+    # Entries stored with the files layout are still found.
+    CCACHE_LOCAL_STORAGE_LAYOUT=files $CCACHE_COMPILE -c test3.c
+    expect_stat cache_miss 3
+    expect_file_count 1 '*R' $CCACHE_DIR
+    $CCACHE_COMPILE -c test3.c
+    expect_stat preprocessed_cache_hit 2
+
+    $CCACHE -x | grep -q "Compressed data: *[1-9]" \
+        || test_failed "Expected compression statistics"
+
+    $CCACHE -c >/dev/null
+    expect_stat files_in_cache 3
+
+    $CCACHE --evict-older-than 0s >/dev/null
+    expect_stat files_in_cache 0
+    expect_file_count 0 '*R' $CCACHE_DIR
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat cache_miss 4
+    expect_stat files_in_cache 1
+
+    $CCACHE -C >/dev/null
+    expect_stat files_in_cache 0
+    expect_file_count 0 '*.seg' $CCACHE_DIR
+
+    # An entry that grows too large to be packed replaces the packed entry.
+    echo 'char big[100000] = {1};' >big.c
+    $CCACHE_COMPILE -c big.c
+    expect_stat files_in_cache 1
+    expect_file_count 0 '*R' $CCACHE_DIR
+
+    CCACHE_RECACHE=1 CCACHE_NOCOMPRESS=1 $CCACHE_COMPILE -c big.c
+    expect_stat files_in_cache 1
+    expect_file_count 1 '*R' $CCACHE_DIR
+
+    rm -f $CCACHE_LOGFILE
+    $CCACHE_COMPILE -c big.c
+    expect_stat preprocessed_cache_hit 3
+    expect_not_contains $CCACHE_LOGFILE "(packed)"
+
     # -------------------------------------------------------------------------
     TEST "-P -c"
 
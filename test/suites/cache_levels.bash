@@ -121,4 +121,35 @@ SUITE_cache_levels() {
     expect_stat files_in_cache $((files + 2))
     expect_on_level R 4
     expect_on_level M 4
+
+    # -------------------------------------------------------------------------
+    TEST "Cache directory stripes"
+
+    mkdir stripe1 stripe2
+    export CCACHE_DIR_STRIPES="$PWD/stripe1(1):$PWD/stripe2(1000)"
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat direct_cache_hit 0
+    expect_stat cache_miss 1
+    expect_stat files_in_cache 2
+    expect_file_count 0 '*[RM]' $CCACHE_DIR
+    expect_file_count 0 '*[RM]' stripe1
+    expect_file_count 2 '*[RM]' stripe2
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat direct_cache_hit 1
+    expect_stat cache_miss 1
+    expect_stat files_in_cache 2
+
+    $CCACHE -C >/dev/null
+    expect_stat files_in_cache 0
+    expect_file_count 0 '*[RM]' stripe2
+
+    export CCACHE_DIR_STRIPES="$PWD/stripe1:$PWD/stripe2"
+    $CCACHE_COMPILE -c test1.c
+    expect_stat files_in_cache 2
+    expect_file_count 0 '*[RM]' $CCACHE_DIR
+    if [ $(find stripe1 stripe2 -name '*[RM]' | wc -l) -ne 2 ]; then
+        test_failed "Expected 2 cache entries in the stripes"
+    fi
 }
@@ -49,6 +49,15 @@ SUITE_cleanup() {
     expect_stat files_in_cache 2543
     expect_stat cleanups_performed 17
 
+    # -------------------------------------------------------------------------
+    TEST "Forced cache cleanup, file limit, one thread"
+
+    $CCACHE --maintenance-threads 1 -F 2543 -c >/dev/null
+
+    expect_file_count 2543 '*R' $CCACHE_DIR
+    expect_stat files_in_cache 2543
+    expect_stat cleanups_performed 17
+
     # -------------------------------------------------------------------------
     TEST "Forced cache cleanup, size limit"
 
@@ -85,6 +94,167 @@ SUITE_cleanup() {
     expect_stat files_in_cache 2559
     expect_stat cleanups_performed 1
 
+    # -------------------------------------------------------------------------
+    TEST "Automatic cache cleanup, LRU index"
+
+    expect_exists $CCACHE_DIR/0/0/lru
+    $CCACHE -F 2543 >/dev/null
+
+    # Uses are only recorded in the LRU index with deferred LRU updates.
+    export CCACHE_DEFERRED_LRU_UPDATE=1
+    touch test.c
+    $CCACHE_COMPILE -c test.c
+    expect_stat files_in_cache 2559
+    expect_stat cleanups_performed 1
+    expect_contains $CCACHE_LOGFILE "Using LRU index"
+
+    # The evicted files are the oldest ones and the new result is kept.
+    $CCACHE_COMPILE -c test.c
+    expect_stat preprocessed_cache_hit 1
+
+    unset CCACHE_DEFERRED_LRU_UPDATE
+    rm -f $CCACHE_LOGFILE
+    echo 'int x;' >test2.c
+    $CCACHE_COMPILE -c test2.c
+    expect_stat cleanups_performed 2
+    expect_not_contains $CCACHE_LOGFILE "Using LRU index"
+
+    # -------------------------------------------------------------------------
+    TEST "Automatic cache cleanup, missing LRU index"
+
+    rm $CCACHE_DIR/*/*/lru
+    $CCACHE -F 2543 >/dev/null
+    rm -f $CCACHE_LOGFILE
+
+    touch test.c
+    $CCACHE_COMPILE -c test.c
+    expect_stat files_in_cache 2559
+    expect_stat cleanups_performed 1
+    expect_not_contains $CCACHE_LOGFILE "Using LRU index"
+    expect_file_count 1 lru $CCACHE_DIR
+
+    # -------------------------------------------------------------------------
+    TEST "Automatic cache cleanup, high watermark"
+
+    $CCACHE -F 2600 >/dev/null
+
+    touch test.c
+    $CCACHE_COMPILE -c test.c
+    expect_stat files_in_cache 2561
+    expect_stat cleanups_performed 0
+
+    # 2562 files are above 98% of 2600 files.
+    echo 'int x;' >test2.c
+    CCACHE_CLEANUP_HIGH_WATERMARK=98 $CCACHE_COMPILE -c test2.c
+    expect_stat cleanups_performed 1
+
+    # -------------------------------------------------------------------------
+    TEST "Background cache cleanup"
+
+    $CCACHE -F 2543 >/dev/null
+    rm -f $CCACHE_LOGFILE
+
+    touch test.c
+    CCACHE_BACKGROUND_CLEANUP=1 CCACHE_CLEANUP_LOW_WATERMARK=80 \
+        $CCACHE_COMPILE -c test.c
+    expect_stat cache_miss 1
+    expect_contains $CCACHE_LOGFILE "Starting background cleanup"
+
+    # Wait for the background cleanup to finish.
+    i=0
+    while [ $i -lt 300 ] \
+          && ! grep -q "Background cleanup finished" $CCACHE_LOGFILE; do
+        sleep 0.1
+        i=$((i + 1))
+    done
+    expect_contains $CCACHE_LOGFILE "Background cleanup finished"
+
+    # The cache is trimmed down to 80% of 2543 files.
+    files=$($CCACHE --print-stats | awk '$1 == "files_in_cache" { print $2 }')
+    if [ $files -gt 2034 ] || [ $files -lt 1500 ]; then
+        test_failed "Expected about 2034 files in cache, actual $files"
+    fi
+    expect_file_count $files '*R' $CCACHE_DIR
+
+    # -------------------------------------------------------------------------
+    TEST "Deferred LRU update"
+
+    touch test.c
+    $CCACHE_COMPILE -c test.c
+    result_file=$(find $CCACHE_DIR -name '*R' ! -name 'result*')
+    backdate $result_file
+    backdate 1 reference
+
+    CCACHE_DEFERRED_LRU_UPDATE=1 $CCACHE_COMPILE -c test.c
+    expect_stat preprocessed_cache_hit 1
+    if [ $result_file -nt reference ]; then
+        test_failed "$result_file was updated on cache hit"
+    fi
+
+    # The recorded use is applied by the next cleanup.
+    $CCACHE -c >/dev/null
+    expect_newer_than $result_file reference
+
+    # -------------------------------------------------------------------------
+    TEST "LRU update granularity"
+
+    touch test.c
+    $CCACHE_COMPILE -c test.c
+    result_file=$(find $CCACHE_DIR -name '*R' ! -name 'result*')
+    backdate $result_file
+    backdate 1 reference
+
+    CCACHE_LRU_UPDATE_GRANULARITY=20000d $CCACHE_COMPILE -c test.c
+    expect_stat preprocessed_cache_hit 1
+    if [ $result_file -nt reference ]; then
+        test_failed "$result_file was updated on cache hit"
+    fi
+
+    CCACHE_LRU_UPDATE_GRANULARITY=1d $CCACHE_COMPILE -c test.c
+    expect_stat preprocessed_cache_hit 2
+    expect_newer_than $result_file reference
+
+    # -------------------------------------------------------------------------
+    TEST "GDSF eviction policy"
+
+    cat >slow <<EOF
+#!/bin/sh
+sleep 1
+exec "\$@"
+EOF
+    chmod +x slow
+    touch test.c
+    CCACHE_PREFIX=$PWD/slow $CCACHE_COMPILE -c test.c
+    expect_stat cache_miss 1
+    result_file=$(find $CCACHE_DIR -name '*R' ! -name 'result*')
+    result_dir=$(dirname $result_file)
+
+    # Make the directory of the expensive result the largest one and the result
+    # older than the cheap entries. The LRU index is removed since it records
+    # the result as recently used.
+    cp -a $result_dir/result0R $result_dir/result10R
+    cp -a $result_dir/result0R $result_dir/result11R
+    $CCACHE -c >/dev/null # update counters
+    backdate 1 $CCACHE_DIR/*/*/result*R
+    backdate $result_file
+    rm $CCACHE_DIR/*/*/lru
+
+    $CCACHE -F 2543 >/dev/null
+    echo 'int x;' >test2.c
+    CCACHE_EVICTION_POLICY=gdsf $CCACHE_COMPILE -c test2.c
+    expect_stat cleanups_performed 1
+    expect_exists $result_file
+    expect_stat evicted_compile_milliseconds 0
+
+    # Eviction by age doesn't consider the cost.
+    CCACHE_EVICTION_POLICY=gdsf $CCACHE --evict-older-than 1d >/dev/null
+    expect_missing $result_file
+    evicted=$($CCACHE --print-stats \
+        | awk '$1 == "evicted_compile_milliseconds" { print $2 }')
+    if [ $evicted -lt 1000 ]; then
+        test_failed "Expected >= 1000 ms evicted compile time, got $evicted"
+    fi
+
     # -------------------------------------------------------------------------
     TEST "Cleanup of tmp file"
 
@@ -0,0 +1,158 @@
+SUITE_compile_server_PROBE() {
+    if $HOST_OS_WINDOWS; then
+        echo "compile server not available on Windows"
+        return
+    fi
+}
+
+start_compile_server() {
+    local socket="$1"
+
+    CCACHE_COMPILE_SERVER="${socket}" CCACHE_LOGFILE=server.log \
+        $CCACHE --compile-server &
+    compile_server_pid=$!
+    # Wait for server start.
+    i=0
+    while [ $i -lt 100 ] && [ ! -S "${socket}" ]; do
+        sleep 0.1
+        i=$((i + 1))
+    done
+    if [ ! -S "${socket}" ]; then
+        test_failed "Compile server did not start"
+    fi
+}
+
+stop_compile_server() {
+    kill "${compile_server_pid}"
+    wait "${compile_server_pid}"
+}
+
+SUITE_compile_server_SETUP() {
+    unset CCACHE_NODIRECT
+
+    generate_code 1 test.c
+}
+
+SUITE_compile_server() {
+    # -------------------------------------------------------------------------
+    TEST "Base case"
+
+    socket=$(mktemp -u)
+    export CCACHE_COMPILE_SERVER="${socket}"
+
+    start_compile_server "${socket}"
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat direct_cache_hit 0
+    expect_stat cache_miss 1
+    expect_stat files_in_cache 2
+    expect_exists test.o
+
+    rm test.o
+    $CCACHE_COMPILE -c test.c
+    expect_stat direct_cache_hit 1
+    expect_stat cache_miss 1
+    expect_exists test.o
+    expect_contains server.log "Started worker"
+
+    stop_compile_server
+    if [ -e "${socket}" ]; then
+        test_failed "Compile server did not remove ${socket}"
+    fi
+
+    # -------------------------------------------------------------------------
+    TEST "Environment, working directory and exit code"
+
+    socket=$(mktemp -u)
+    export CCACHE_COMPILE_SERVER="${socket}"
+
+    start_compile_server "${socket}"
+
+    mkdir dir
+    cp test.c dir
+    cd dir
+    CCACHE_DEBUG=1 $CCACHE_COMPILE -c test.c
+    expect_stat cache_miss 1
+    expect_exists test.o
+    expect_exists test.o.*.ccache-log
+    cd ..
+
+    echo 'int x = ;' >error.c
+    if $CCACHE_COMPILE -c error.c 2>stderr.txt; then
+        test_failed "Expected failure"
+    fi
+    expect_stat compile_failed 1
+    if [ ! -s stderr.txt ]; then
+        test_failed "Expected compiler diagnostics on stderr"
+    fi
+
+    stop_compile_server
+
+    # -------------------------------------------------------------------------
+    TEST "Configuration prepared by the server"
+
+    socket=$(mktemp -u)
+    export CCACHE_COMPILE_SERVER="${socket}"
+    export CCACHE_LOGFILE=server.log
+
+    start_compile_server "${socket}"
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat cache_miss 1
+    $CCACHE_COMPILE -c test.c
+    expect_stat direct_cache_hit 1
+    expect_not_contains server.log "Reading configuration of client"
+
+    CCACHE_DEBUG=1 $CCACHE_COMPILE -c test.c
+    expect_stat direct_cache_hit 2
+    expect_contains server.log "Reading configuration of client"
+
+    stop_compile_server
+
+    # -------------------------------------------------------------------------
+if command -v python3 >/dev/null; then
+    TEST "Slow client"
+
+    socket=$(mktemp -u)
+    export CCACHE_COMPILE_SERVER="${socket}"
+
+    start_compile_server "${socket}"
+
+    # A client that connects but never sends its request.
+    python3 -c '
+import socket, sys, time
+s = socket.socket(socket.AF_UNIX)
+s.connect(sys.argv[1])
+open("connected", "w").close()
+time.sleep(60)
+' "${socket}" &
+    slow_client_pid=$!
+    i=0
+    while [ $i -lt 100 ] && [ ! -f connected ]; do
+        sleep 0.1
+        i=$((i + 1))
+    done
+
+    start=$SECONDS
+    $CCACHE_COMPILE -c test.c
+    if [ $((SECONDS - start)) -ge 4 ]; then
+        test_failed "Waited for the slow client"
+    fi
+    expect_stat cache_miss 1
+
+    kill "${slow_client_pid}"
+    wait "${slow_client_pid}"
+    stop_compile_server
+fi
+
+    # -------------------------------------------------------------------------
+    TEST "No running server"
+
+    export CCACHE_COMPILE_SERVER="$(mktemp -u)"
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat cache_miss 1
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat direct_cache_hit 1
+}
@@ -519,6 +519,83 @@ fi
     expect_stat preprocessed_cache_hit 0
     expect_stat cache_miss 5
 
+    # -------------------------------------------------------------------------
+    TEST "Manifest results ordered by hit count"
+
+    echo "int test1_a;" >>test1.h
+    backdate test1.h
+    $CCACHE_COMPILE -c test.c
+    cp test1.h test1.h.a
+
+    echo "int test1_b;" >>test1.h
+    backdate test1.h
+    $CCACHE_COMPILE -c test.c
+    expect_stat cache_miss 2
+    expect_stat local_storage_write 4 # 2 * (result + manifest)
+
+    manifest_file=$(find $CCACHE_DIR -name '*M')
+    $CCACHE --inspect $manifest_file >manifest.txt
+    expect_contains manifest.txt "Hit count: 0"
+    expect_not_contains manifest.txt "Hit count: 1"
+
+    # The older result is tried last but is then stored as the first one to try.
+    cp test1.h.a test1.h
+    backdate test1.h
+    $CCACHE_COMPILE -c test.c
+    expect_stat direct_cache_hit 1
+    expect_stat local_storage_write 5
+    $CCACHE --inspect $manifest_file >manifest.txt
+    expect_contains manifest.txt "Hit count: 1"
+
+    # Hits on the first result to try don't store the manifest.
+    $CCACHE_COMPILE -c test.c
+    expect_stat direct_cache_hit 2
+    expect_stat local_storage_write 5
+
+    # -------------------------------------------------------------------------
+    TEST "Manifest results evicted in LRU order"
+
+    export CCACHE_MAXMANIFESTRESULTS=2
+
+    echo "int test1_a;" >>test1.h
+    backdate test1.h
+    $CCACHE_COMPILE -c test.c
+    cp test1.h test1.h.a
+
+    echo "int test1_b;" >>test1.h
+    backdate test1.h
+    $CCACHE_COMPILE -c test.c
+    cp test1.h test1.h.b
+
+    cp test1.h.a test1.h
+    backdate test1.h
+    $CCACHE_COMPILE -c test.c
+    expect_stat direct_cache_hit 1
+    expect_stat cache_miss 2
+
+    # The b result is now the least recently used one and is evicted together
+    # with its FileInfo entry.
+    echo "int test1_c;" >>test1.h
+    backdate test1.h
+    $CCACHE_COMPILE -c test.c
+    expect_stat cache_miss 3
+
+    manifest_file=$(find $CCACHE_DIR -name '*M')
+    $CCACHE --inspect $manifest_file >manifest.txt
+    expect_contains manifest.txt "Results (2):"
+    expect_contains manifest.txt "File infos (5):"
+
+    cp test1.h.a test1.h
+    backdate test1.h
+    $CCACHE_COMPILE -c test.c
+    expect_stat direct_cache_hit 2
+
+    cp test1.h.b test1.h
+    backdate test1.h
+    $CCACHE_COMPILE -c test.c
+    expect_stat direct_cache_hit 2
+    expect_stat preprocessed_cache_hit 1
+
     # -------------------------------------------------------------------------
     TEST "-MD"
 
@@ -35,6 +35,23 @@ SUITE_no_compression() {
         test_failed "Result file seems to be compressed"
     fi
 
+    # -------------------------------------------------------------------------
+    TEST "Large result file is memory-mapped"
+
+    echo "char big[200000] = {1};" >big.c
+    $COMPILER -c -o reference_big.o big.c
+
+    $CCACHE_COMPILE -c big.c
+    expect_stat cache_miss 1
+
+    rm big.o
+    $CCACHE_COMPILE -c big.c
+    expect_stat direct_cache_hit 1
+    expect_equal_object_files reference_big.o big.o
+    if ! grep -q "from local storage (.*R, mapped)" $CCACHE_LOGFILE; then
+        test_failed "Result file was not memory-mapped"
+    fi
+
     # -------------------------------------------------------------------------
     TEST "Hash sum equal for compressed and uncompressed files"
 
@@ -168,6 +168,35 @@ SUITE_remote_file() {
     expect_file_count 1 '*' remote # CACHEDIR.TAG
     expect_file_count 3 '*' remote_2 # CACHEDIR.TAG + result + manifest
 
+    # -------------------------------------------------------------------------
+    TEST "Parallel lookup in two directories"
+
+    export CCACHE_REMOTE_LOOKUP_PARALLEL=1
+    CCACHE_REMOTE_STORAGE+=" file://$PWD/remote_2"
+    mkdir remote_2
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat cache_miss 1
+    expect_stat remote_storage_read_miss 4 # 2 * (result + manifest)
+    expect_file_count 3 '*' remote_2 # CACHEDIR.TAG + result + manifest
+
+    $CCACHE -C >/dev/null
+    rm -r remote/??
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat direct_cache_hit 1
+    expect_stat cache_miss 1
+    expect_stat remote_storage_hit 1
+    expect_stat files_in_cache 2 # fetched from remote_2
+
+    $CCACHE -s -v >stats.txt
+    expect_contains stats.txt "Remote storage lookup latency:"
+    expect_contains stats.txt "/remote_2:"
+
+    $CCACHE -z >/dev/null
+    $CCACHE -s -v >stats.txt
+    expect_not_contains stats.txt "Remote storage lookup latency:"
+
     # -------------------------------------------------------------------------
     TEST "Read-only"
 
@@ -328,6 +357,53 @@ SUITE_remote_file() {
         test_failed "Expected remote/a or remote/b to exist"
     fi
 
+    # -------------------------------------------------------------------------
+    TEST "Sharding with replicas"
+
+    export CCACHE_REMOTE_STORAGE="file://$PWD/remote/*|shards=a,b,c|replicas=2"
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat direct_cache_hit 0
+    expect_stat cache_miss 1
+    expect_stat remote_storage_write 4
+    entries=$(find remote -type f ! -name CACHEDIR.TAG | wc -l)
+    if [ "${entries}" -ne 4 ]; then # result + manifest on two shards each
+        test_failed "Expected 4 entries in remote, found ${entries}"
+    fi
+
+    # Each entry is left on at least one shard.
+    rm -rf remote/a
+    $CCACHE -C >/dev/null
+    $CCACHE_COMPILE -c test.c
+    expect_stat direct_cache_hit 1
+    expect_stat cache_miss 1
+    $CCACHE -s -v >stats.txt
+    expect_contains stats.txt "hits,"
+
+    # -------------------------------------------------------------------------
+    TEST "Parallel lookup in replicas"
+
+    export CCACHE_REMOTE_LOOKUP_PARALLEL=1
+    export CCACHE_REMOTE_STORAGE="file://$PWD/remote/*|shards=a,b|replicas=2"
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat cache_miss 1
+    expect_stat remote_storage_read_miss 4 # 2 * (result + manifest)
+    expect_stat remote_storage_write 4
+
+    # Make all lookups in replica a fail.
+    for path in $(find remote/a -type f ! -name CACHEDIR.TAG); do
+        rm "${path}"
+        mkdir "${path}"
+    done
+    rm -f $CCACHE_LOGFILE
+    $CCACHE -C >/dev/null
+    $CCACHE_COMPILE -c test.c
+    expect_stat direct_cache_hit 1
+    expect_stat cache_miss 1
+    expect_stat remote_storage_hit 1
+    expect_contains $CCACHE_LOGFILE "remote storage backends in parallel"
+
     # -------------------------------------------------------------------------
     TEST "Reshare"
 
@@ -394,6 +470,53 @@ SUITE_remote_file() {
     expect_stat remote_storage_write 2
     expect_file_count 3 '*' remote # CACHEDIR.TAG + result + manifest
 
+    # -------------------------------------------------------------------------
+    TEST "Asynchronous upload"
+
+    CCACHE_REMOTE_UPLOAD_ASYNC=1 $CCACHE_COMPILE -c test.c
+    expect_stat cache_miss 1
+    expect_stat remote_storage_upload_queued 2 # result + manifest
+    expect_stat remote_storage_upload_dropped 0
+
+    $CCACHE --upload-spooled
+    expect_file_count 3 '*' remote # CACHEDIR.TAG + result + manifest
+    expect_file_count 0 '*.upload' $CCACHE_DIR/uploads
+
+    $CCACHE -C >/dev/null
+    CCACHE_REMOTE_UPLOAD_ASYNC=1 $CCACHE_COMPILE -c test.c
+    expect_stat direct_cache_hit 1
+    expect_stat remote_storage_hit 1
+
+    # -------------------------------------------------------------------------
+    TEST "Asynchronous upload with full spool"
+
+    CCACHE_REMOTE_UPLOAD_ASYNC=1 CCACHE_REMOTE_UPLOAD_SPOOL_SIZE=0.01k \
+        $CCACHE_COMPILE -c test.c
+    expect_stat cache_miss 1
+    expect_stat remote_storage_upload_queued 0
+    expect_stat remote_storage_upload_dropped 2 # result + manifest
+
+    $CCACHE --upload-spooled
+    expect_missing remote
+
+    # -------------------------------------------------------------------------
+    TEST "Asynchronous upload frees spool space"
+
+    export CCACHE_REMOTE_UPLOAD_ASYNC=1
+    export CCACHE_REMOTE_UPLOAD_SPOOL_SIZE=2k
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat remote_storage_upload_queued 2 # result + manifest, 1k each
+    expect_stat remote_storage_upload_dropped 0
+
+    $CCACHE --upload-spooled
+    expect_file_count 0 '*.upload' $CCACHE_DIR/uploads
+
+    echo "int y;" >test2.c
+    $CCACHE_COMPILE -c test2.c
+    expect_stat remote_storage_upload_queued 4
+    expect_stat remote_storage_upload_dropped 0
+
     # -------------------------------------------------------------------------
     TEST "Recache"
 
@@ -532,7 +655,7 @@ SUITE_remote_file() {
     expect_stat local_storage_miss 3
     expect_stat local_storage_read_hit 1
     expect_stat local_storage_read_miss 5 # miss: manifest + result
-    expect_stat local_storage_write 7 # miss: manifest + result
+    expect_stat local_storage_write 8 # miss: manifest + result + reordered manifest
     expect_stat remote_storage_hit 1
     expect_stat remote_storage_miss 2
     expect_stat remote_storage_read_hit 3
@@ -551,7 +674,7 @@ SUITE_remote_file() {
     expect_stat local_storage_miss 4
     expect_stat local_storage_read_hit 2 # hit: manifest with key (downloaded from previous step)
     expect_stat local_storage_read_miss 6 # miss: manifest + result
-    expect_stat local_storage_write 8 # miss: result
+    expect_stat local_storage_write 9 # remote hit: result stored locally
     expect_stat remote_storage_hit 2
     expect_stat remote_storage_miss 2
     expect_stat remote_storage_read_hit 4 # hit: result
@@ -188,7 +188,126 @@ if $RUN_WIN_XFAIL; then
     expect_contains test.o.*.ccache-log "status code: 401"
 fi
 
-     # -------------------------------------------------------------------------
+    # -------------------------------------------------------------------------
+    TEST "Shared backend health"
+
+    export CCACHE_REMOTE_STORAGE="http://localhost:1"
+
+    for i in 1 2 3; do
+        echo "int x$i;" >test$i.c
+        $CCACHE_COMPILE -c test$i.c
+    done
+    expect_stat cache_miss 3
+    expect_stat remote_storage_error 3
+    expect_exists $CCACHE_DIR/remote_health
+
+    # After three consecutive failures, the backend is skipped by all processes
+    # for a while.
+    rm -f $CCACHE_LOGFILE
+    echo "int x4;" >test4.c
+    $CCACHE_COMPILE -c test4.c
+    expect_stat cache_miss 4
+    expect_stat remote_storage_error 3
+    expect_contains $CCACHE_LOGFILE "since it failed recently"
+
+    # -------------------------------------------------------------------------
+    TEST "Adaptive operation timeout"
+
+    start_http_server 12780 remote
+    export CCACHE_REMOTE_STORAGE="http://localhost:12780|operation-timeout=auto"
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat cache_miss 1
+    expect_contains $CCACHE_LOGFILE "Using default operation timeout 10000 ms"
+    expect_exists $CCACHE_DIR/remote_latency
+
+    # 20 lookups that took 64-128 ms.
+    echo "http://localhost:12780 2000000 0 0 0 0 0 0 0 20 0 0 0 0 0 0 0 0" \
+         >$CCACHE_DIR/remote_latency
+    rm -f $CCACHE_LOGFILE
+    $CCACHE -C >/dev/null
+    CCACHE_REMOTE_LOOKUP_HEDGING=1 $CCACHE_COMPILE -c test.c
+    expect_stat direct_cache_hit 1
+    expect_contains $CCACHE_LOGFILE "Using adaptive operation timeout 512 ms"
+
+    # -------------------------------------------------------------------------
+    TEST "Parallel lookup with unresponsive server"
+
+    start_http_server 12780 remote
+    export CCACHE_REMOTE_STORAGE="http://localhost:12780"
+    $CCACHE_COMPILE -c test.c
+    expect_stat cache_miss 1
+
+    # A server that accepts connections but never replies.
+    python3 -c '
+import socket, time
+s = socket.socket()
+s.bind(("localhost", 12781))
+s.listen()
+open("listening", "w").close()
+time.sleep(120)
+' &
+    i=0
+    while [ $i -lt 100 ] && [ ! -f listening ]; do
+        sleep 0.1
+        i=$((i + 1))
+    done
+
+    export CCACHE_REMOTE_LOOKUP_PARALLEL=1
+    CCACHE_REMOTE_STORAGE+=" http://localhost:12781|operation-timeout=60000"
+    $CCACHE -C >/dev/null
+    start=$SECONDS
+    $CCACHE_COMPILE -c test.c
+    if [ $((SECONDS - start)) -ge 30 ]; then
+        test_failed "Waited for the unresponsive server"
+    fi
+    expect_stat direct_cache_hit 1
+    expect_stat cache_miss 1
+    expect_contains $CCACHE_LOGFILE "Abandoning lookup"
+
+    # -------------------------------------------------------------------------
+    TEST "Hedged lookup in replica"
+
+    start_http_server 12780 remote
+    export CCACHE_REMOTE_STORAGE="http://localhost:12780"
+    $CCACHE_COMPILE -c test.c
+    expect_stat cache_miss 1
+
+    # A server that accepts connections but never replies.
+    python3 -c '
+import socket, time
+s = socket.socket()
+s.bind(("localhost", 12781))
+s.listen()
+open("listening", "w").close()
+time.sleep(120)
+' &
+    i=0
+    while [ $i -lt 100 ] && [ ! -f listening ]; do
+        sleep 0.1
+        i=$((i + 1))
+    done
+
+    # 20 lookups in the unresponsive server that took 64-128 ms. Its high
+    # weight makes it the first replica.
+    echo "http://localhost:12781 2000000 0 0 0 0 0 0 0 20 0 0 0 0 0 0 0 0" \
+         >$CCACHE_DIR/remote_latency
+    export CCACHE_REMOTE_LOOKUP_HEDGING=1
+    export CCACHE_REMOTE_STORAGE="http://localhost:*|shards=12781(1000),12780"
+    CCACHE_REMOTE_STORAGE+="|replicas=2|operation-timeout=60000"
+    rm -f $CCACHE_LOGFILE
+    $CCACHE -C >/dev/null
+    start=$SECONDS
+    $CCACHE_COMPILE -c test.c
+    if [ $((SECONDS - start)) -ge 30 ]; then
+        test_failed "Waited for the unresponsive server"
+    fi
+    expect_stat direct_cache_hit 1
+    expect_stat cache_miss 1
+    expect_contains $CCACHE_LOGFILE "in http://localhost:12780 after"
+    expect_contains $CCACHE_LOGFILE "Abandoning lookup"
+
+    # -------------------------------------------------------------------------
     TEST "Port sharding"
 
     start_http_server 12780 remote
@@ -112,6 +112,31 @@ SUITE_remote_redis() {
     expect_stat files_in_cache 2 # fetched from remote
     expect_number_of_redis_cache_entries 2 "$redis_url" # result + manifest
 
+    # -------------------------------------------------------------------------
+    TEST "Password, database and TTL"
+
+    port=7777
+    password=secret123
+    redis_url="redis://${password}@localhost:${port}/1"
+    export CCACHE_REMOTE_STORAGE="${redis_url}|ttl=1000"
+
+    start_redis_server "${port}" "${password}"
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat cache_miss 1
+    expect_number_of_redis_cache_entries 2 "$redis_url" # result + manifest
+    for key in $(redis-cli -u "$redis_url" keys "ccache:*" 2>/dev/null); do
+        ttl=$(redis-cli -u "$redis_url" ttl "$key" 2>/dev/null)
+        if [ "$ttl" -le 0 ] || [ "$ttl" -gt 1000 ]; then
+            test_failed "Unexpected TTL $ttl for $key"
+        fi
+    done
+
+    # Resharing doesn't overwrite existing entries.
+    CCACHE_RESHARE=1 $CCACHE_COMPILE -c test.c
+    expect_stat direct_cache_hit 1
+    expect_contains $CCACHE_LOGFILE "already in Redis"
+
     # -------------------------------------------------------------------------
     TEST "Unreachable server"
 
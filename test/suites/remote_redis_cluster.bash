@@ -0,0 +1,151 @@
+SUITE_remote_redis_cluster_PROBE() {
+    if ! $CCACHE --version | grep -Fq -- redis+cluster-storage &> /dev/null; then
+        echo "redis+cluster-storage not available"
+        return
+    fi
+    if ! command -v redis-server &> /dev/null; then
+        echo "redis-server not found"
+        return
+    fi
+    if ! command -v redis-cli &> /dev/null; then
+        echo "redis-cli not found"
+        return
+    fi
+    if ! redis-cli --cluster help &> /dev/null; then
+        echo "redis-cli without cluster support"
+        return
+    fi
+}
+
+start_redis_cluster() {
+    local port
+
+    for port in "$@"; do
+        mkdir "redis-${port}"
+        redis-server --bind 127.0.0.1 --port "${port}" \
+            --dir "$PWD/redis-${port}" --cluster-enabled yes \
+            --cluster-config-file nodes.conf >/dev/null &
+    done
+    for port in "$@"; do
+        # Wait for server start.
+        i=0
+        while [ $i -lt 100 ] && ! redis-cli -p "${port}" ping &>/dev/null; do
+            sleep 0.1
+            i=$((i + 1))
+        done
+    done
+
+    redis-cli --cluster create $(printf "127.0.0.1:%s " "$@") \
+        --cluster-replicas 0 --cluster-yes >/dev/null
+    # Wait for the nodes to agree on the configuration.
+    i=0
+    while [ $i -lt 100 ] \
+          && ! redis-cli -p "$1" cluster info | grep -q cluster_state:ok; do
+        sleep 0.1
+        i=$((i + 1))
+    done
+}
+
+redis_cluster_keys() {
+    local port
+
+    for port in "$@"; do
+        redis-cli -p "${port}" keys "ccache:*" 2>/dev/null
+    done
+}
+
+expect_number_of_redis_cluster_cache_entries() {
+    local expected=$1
+    shift
+    local actual
+
+    actual=$(redis_cluster_keys "$@" | wc -l)
+    if [ "$actual" -ne "$expected" ]; then
+        test_failed_internal "Found $actual (expected $expected) entries in the cluster"
+    fi
+}
+
+SUITE_remote_redis_cluster_SETUP() {
+    unset CCACHE_NODIRECT
+
+    generate_code 1 test.c
+}
+
+SUITE_remote_redis_cluster() {
+    ports="7101 7102 7103"
+
+    # -------------------------------------------------------------------------
+    TEST "Base case"
+
+    start_redis_cluster $ports
+    export CCACHE_REMOTE_STORAGE="redis+cluster://127.0.0.1:7101"
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat direct_cache_hit 0
+    expect_stat cache_miss 1
+    expect_stat files_in_cache 2
+    expect_number_of_redis_cluster_cache_entries 2 $ports # result + manifest
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat direct_cache_hit 1
+    expect_stat cache_miss 1
+    expect_stat files_in_cache 2
+    expect_number_of_redis_cluster_cache_entries 2 $ports # result + manifest
+
+    $CCACHE -C >/dev/null
+    expect_stat files_in_cache 0
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat direct_cache_hit 2
+    expect_stat cache_miss 1
+    expect_stat files_in_cache 2 # fetched from remote
+    expect_number_of_redis_cluster_cache_entries 2 $ports # result + manifest
+
+    # -------------------------------------------------------------------------
+    TEST "ASK redirection"
+
+    start_redis_cluster $ports
+    export CCACHE_REMOTE_STORAGE="redis+cluster://127.0.0.1:7101"
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat cache_miss 1
+    expect_number_of_redis_cluster_cache_entries 2 $ports # result + manifest
+
+    # Start migrating the entries to other nodes. The old nodes still own the
+    # slots and answer with ASK redirections.
+    for key in $(redis_cluster_keys $ports); do
+        slot=$(redis-cli -p 7101 cluster keyslot "${key}")
+        for port in $ports; do
+            if [ "$(redis-cli -p "${port}" exists "${key}")" = 1 ]; then
+                src_port=${port}
+            fi
+        done
+        dst_port=$((src_port == 7103 ? 7101 : src_port + 1))
+        src_id=$(redis-cli -p "${src_port}" cluster myid)
+        dst_id=$(redis-cli -p "${dst_port}" cluster myid)
+        redis-cli -p "${dst_port}" \
+            cluster setslot "${slot}" importing "${src_id}" >/dev/null
+        redis-cli -p "${src_port}" \
+            cluster setslot "${slot}" migrating "${dst_id}" >/dev/null
+        redis-cli -p "${src_port}" \
+            migrate 127.0.0.1 "${dst_port}" "${key}" 0 5000 >/dev/null
+    done
+
+    rm -f $CCACHE_LOGFILE
+    $CCACHE -C >/dev/null
+    $CCACHE_COMPILE -c test.c
+    expect_stat direct_cache_hit 1
+    expect_stat cache_miss 1
+    expect_contains $CCACHE_LOGFILE "Redis ASK"
+
+    # -------------------------------------------------------------------------
+    TEST "Unreachable cluster"
+
+    export CCACHE_REMOTE_STORAGE="redis+cluster://127.0.0.1:1"
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat direct_cache_hit 0
+    expect_stat cache_miss 1
+    expect_stat files_in_cache 2
+    expect_stat remote_storage_error 1
+}
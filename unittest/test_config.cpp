@@ -39,20 +39,29 @@ TEST_CASE("Config: default values")
 {
   Config config;
 
+  CHECK(!config.background_cleanup());
   CHECK(config.base_dir().empty());
   CHECK(config.cache_dir().empty()); // Set later
+  CHECK(config.cache_dir_stripes().empty());
+  CHECK(config.cleanup_high_watermark() == 100);
+  CHECK(config.cleanup_low_watermark() == 90);
+  CHECK(config.compile_server().empty());
   CHECK(config.compiler().empty());
   CHECK(config.compiler_check() == "mtime");
   CHECK(config.compiler_type() == CompilerType::auto_guess);
   CHECK(config.compression());
+  CHECK(config.compression_dictionary() == 0);
   CHECK(config.compression_level() == 0);
+  CHECK(config.compression_threads() == 1);
   CHECK(config.cpp_extension().empty());
   CHECK(!config.debug());
   CHECK(config.debug_dir().empty());
   CHECK(config.debug_level() == 2);
+  CHECK(!config.deferred_lru_update());
   CHECK(!config.depend_mode());
   CHECK(config.direct_mode());
   CHECK(!config.disable());
+  CHECK(config.eviction_policy() == EvictionPolicy::lru);
   CHECK(config.extra_files_to_hash().empty());
   CHECK(!config.file_clone());
   CHECK(!config.hard_link());
@@ -65,8 +74,12 @@ TEST_CASE("Config: default values")
   CHECK_FALSE(config.inode_cache());
 #endif
   CHECK_FALSE(config.keep_comments_cpp());
+  CHECK(config.local_storage_layout() == LocalStorageLayout::files);
   CHECK(config.log_file().empty());
+  CHECK(config.lru_update_granularity() == 0);
   CHECK(config.max_files() == 0);
+  CHECK(config.max_manifest_includes() == 10000);
+  CHECK(config.max_manifest_results() == 100);
   CHECK(config.max_size() == static_cast<uint64_t>(5) * 1024 * 1024 * 1024);
   CHECK(config.msvc_dep_prefix() == "Note: including file:");
   CHECK(config.path().empty());
@@ -76,8 +89,12 @@ TEST_CASE("Config: default values")
   CHECK_FALSE(config.read_only());
   CHECK_FALSE(config.read_only_direct());
   CHECK_FALSE(config.recache());
+  CHECK_FALSE(config.remote_lookup_hedging());
+  CHECK_FALSE(config.remote_lookup_parallel());
   CHECK_FALSE(config.remote_only());
   CHECK(config.remote_storage().empty());
+  CHECK_FALSE(config.remote_upload_async());
+  CHECK(config.remote_upload_spool_size() == 1024 * 1024 * 1024);
   CHECK_FALSE(config.reshare());
   CHECK(config.run_second_cpp());
   CHECK(config.sloppiness().to_bitmask() == 0);
@@ -104,6 +121,8 @@ TEST_CASE("Config::update_from_file")
     "base_dir = " + base_dir + "\n"
     "cache_dir=\n"
     "cache_dir = $USER$/${USER}/.ccache\n"
+    "cache_dir_stripes = /a:/b(2)\n"
+    "cleanup_low_watermark = 75\n"
     "\n"
     "\n"
     "  #A comment\n"
@@ -115,9 +134,11 @@ TEST_CASE("Config::update_from_file")
     "cpp_extension = .foo\n"
     "debug_dir = $USER$/${USER}/.ccache_debug\n"
     "debug_level = 2\n"
+    "deferred_lru_update = true\n"
     "depend_mode = true\n"
     "direct_mode = false\n"
     "disable = true\n"
+    "eviction_policy = gdsf\n"
     "extra_files_to_hash = a:b c:$USER\n"
     "file_clone = true\n"
     "hard_link = true\n"
@@ -126,7 +147,9 @@ TEST_CASE("Config::update_from_file")
     "ignore_options = -a=* -b\n"
     "inode_cache = false\n"
     "keep_comments_cpp = true\n"
+    "local_storage_layout = pack\n"
     "log_file = $USER${USER} \n"
+    "lru_update_granularity = 2d\n"
     "max_files = 17\n"
     "max_size = 123M\n"
     "msvc_dep_prefix = Some other prefix:\n"
@@ -151,6 +174,8 @@ TEST_CASE("Config::update_from_file")
   REQUIRE(config.update_from_file("ccache.conf"));
   CHECK(config.base_dir() == base_dir);
   CHECK(config.cache_dir() == FMT("{0}$/{0}/.ccache", user));
+  CHECK(config.cache_dir_stripes() == "/a:/b(2)");
+  CHECK(config.cleanup_low_watermark() == 75);
   CHECK(config.compiler() == "foo");
   CHECK(config.compiler_check() == "none");
   CHECK(config.compiler_type() == CompilerType::nvcc);
@@ -159,9 +184,11 @@ TEST_CASE("Config::update_from_file")
   CHECK(config.cpp_extension() == ".foo");
   CHECK(config.debug_dir() == FMT("{0}$/{0}/.ccache_debug", user));
   CHECK(config.debug_level() == 2);
+  CHECK(config.deferred_lru_update());
   CHECK(config.depend_mode());
   CHECK_FALSE(config.direct_mode());
   CHECK(config.disable());
+  CHECK(config.eviction_policy() == EvictionPolicy::gdsf);
   CHECK(config.extra_files_to_hash() == FMT("a:b c:{}", user));
   CHECK(config.file_clone());
   CHECK(config.hard_link());
@@ -170,7 +197,9 @@ TEST_CASE("Config::update_from_file")
   CHECK(config.ignore_options() == "-a=* -b");
   CHECK_FALSE(config.inode_cache());
   CHECK(config.keep_comments_cpp());
+  CHECK(config.local_storage_layout() == LocalStorageLayout::pack);
   CHECK(config.log_file() == FMT("{0}{0}", user));
+  CHECK(config.lru_update_granularity() == 2 * 24 * 60 * 60);
   CHECK(config.max_files() == 17);
   CHECK(config.max_size() == 123 * 1000 * 1000);
   CHECK(config.msvc_dep_prefix() == "Some other prefix:");
@@ -229,6 +258,20 @@ TEST_CASE("Config::update_from_file, error handling")
                         "ccache.conf:1: not a boolean value: \"foo\"");
   }
 
+  SUBCASE("invalid eviction policy")
+  {
+    util::write_file("ccache.conf", "eviction_policy = foo");
+    REQUIRE_THROWS_WITH(config.update_from_file("ccache.conf"),
+                        "ccache.conf:1: unknown eviction policy: \"foo\"");
+  }
+
+  SUBCASE("invalid local storage layout")
+  {
+    util::write_file("ccache.conf", "local_storage_layout = foo");
+    REQUIRE_THROWS_WITH(config.update_from_file("ccache.conf"),
+                        "ccache.conf:1: unknown local storage layout: \"foo\"");
+  }
+
   SUBCASE("invalid variable reference")
   {
     util::write_file("ccache.conf", "base_dir = ${foo");
@@ -437,24 +480,33 @@ TEST_CASE("Config::visit_items")
   util::write_file(
     "test.conf",
     "absolute_paths_in_stderr = true\n"
+    "background_cleanup = true\n"
 #ifndef _WIN32
     "base_dir = /bd\n"
 #else
     "base_dir = C:\\bd\n"
 #endif
     "cache_dir = cd\n"
+    "cache_dir_stripes = cds\n"
+    "cleanup_high_watermark = 95\n"
+    "cleanup_low_watermark = 80\n"
+    "compile_server = cs\n"
     "compiler = c\n"
     "compiler_check = cc\n"
     "compiler_type = clang\n"
     "compression = true\n"
+    "compression_dictionary = 1234\n"
     "compression_level = 8\n"
+    "compression_threads = 4\n"
     "cpp_extension = ce\n"
     "debug = false\n"
     "debug_dir = /dd\n"
     "debug_level = 2\n"
+    "deferred_lru_update = true\n"
     "depend_mode = true\n"
     "direct_mode = false\n"
     "disable = true\n"
+    "eviction_policy = gdsf\n"
     "extra_files_to_hash = efth\n"
     "file_clone = true\n"
     "hard_link = true\n"
@@ -463,8 +515,12 @@ TEST_CASE("Config::visit_items")
     "ignore_options = -a=* -b\n"
     "inode_cache = false\n"
     "keep_comments_cpp = true\n"
+    "local_storage_layout = pack\n"
     "log_file = lf\n"
+    "lru_update_granularity = 3600s\n"
     "max_files = 4711\n"
+    "max_manifest_includes = 1234\n"
+    "max_manifest_results = 12\n"
     "max_size = 98.7M\n"
     "msvc_dep_prefix = mdp\n"
     "namespace = ns\n"
@@ -475,8 +531,12 @@ TEST_CASE("Config::visit_items")
     "read_only = true\n"
     "read_only_direct = true\n"
     "recache = true\n"
+    "remote_lookup_hedging = true\n"
+    "remote_lookup_parallel = true\n"
     "remote_only = true\n"
     "remote_storage = rs\n"
+    "remote_upload_async = true\n"
+    "remote_upload_spool_size = 12.3M\n"
     "reshare = true\n"
     "response_file_format = posix\n"
     "run_second_cpp = false\n"
@@ -500,24 +560,33 @@ TEST_CASE("Config::visit_items")
 
   std::vector<std::string> expected = {
     "(test.conf) absolute_paths_in_stderr = true",
+    "(test.conf) background_cleanup = true",
 #ifndef _WIN32
     "(test.conf) base_dir = /bd",
 #else
     "(test.conf) base_dir = C:\\bd",
 #endif
     "(test.conf) cache_dir = cd",
+    "(test.conf) cache_dir_stripes = cds",
+    "(test.conf) cleanup_high_watermark = 95",
+    "(test.conf) cleanup_low_watermark = 80",
+    "(test.conf) compile_server = cs",
     "(test.conf) compiler = c",
     "(test.conf) compiler_check = cc",
     "(test.conf) compiler_type = clang",
     "(test.conf) compression = true",
+    "(test.conf) compression_dictionary = 1234",
     "(test.conf) compression_level = 8",
+    "(test.conf) compression_threads = 4",
     "(test.conf) cpp_extension = ce",
     "(test.conf) debug = false",
     "(test.conf) debug_dir = /dd",
     "(test.conf) debug_level = 2",
+    "(test.conf) deferred_lru_update = true",
     "(test.conf) depend_mode = true",
     "(test.conf) direct_mode = false",
     "(test.conf) disable = true",
+    "(test.conf) eviction_policy = gdsf",
     "(test.conf) extra_files_to_hash = efth",
     "(test.conf) file_clone = true",
     "(test.conf) hard_link = true",
@@ -526,8 +595,12 @@ TEST_CASE("Config::visit_items")
     "(test.conf) ignore_options = -a=* -b",
     "(test.conf) inode_cache = false",
     "(test.conf) keep_comments_cpp = true",
+    "(test.conf) local_storage_layout = pack",
     "(test.conf) log_file = lf",
+    "(test.conf) lru_update_granularity = 3600s",
     "(test.conf) max_files = 4711",
+    "(test.conf) max_manifest_includes = 1234",
+    "(test.conf) max_manifest_results = 12",
     "(test.conf) max_size = 98.7 MB",
     "(test.conf) msvc_dep_prefix = mdp",
     "(test.conf) namespace = ns",
@@ -538,8 +611,12 @@ TEST_CASE("Config::visit_items")
     "(test.conf) read_only = true",
     "(test.conf) read_only_direct = true",
     "(test.conf) recache = true",
+    "(test.conf) remote_lookup_hedging = true",
+    "(test.conf) remote_lookup_parallel = true",
     "(test.conf) remote_only = true",
     "(test.conf) remote_storage = rs",
+    "(test.conf) remote_upload_async = true",
+    "(test.conf) remote_upload_spool_size = 12.3 MB",
     "(test.conf) reshare = true",
     "(test.conf) response_file_format = posix",
     "(test.conf) run_second_cpp = false",
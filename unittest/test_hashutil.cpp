@@ -18,9 +18,11 @@
 
 #include "testutil.hpp"
 
+#include <ccache/context.hpp>
 #include <ccache/hash.hpp>
 #include <ccache/hashutil.hpp>
 #include <ccache/util/file.hpp>
+#include <ccache/util/format.hpp>
 
 #include <doctest/doctest.h>
 
@@ -116,6 +118,43 @@ TEST_CASE("hash_multicommand_output_error_handling")
   CHECK(!hash_multicommand_output(h2, "false; true", "not used"));
 }
 
+TEST_CASE("hash_source_code_files")
+{
+  TestContext test_context;
+  Context ctx;
+
+  std::vector<SourceCodeFile> files;
+  for (size_t i = 0; i < 100; ++i) {
+    const auto path = FMT("file{}.h", i);
+    REQUIRE(util::write_file(path, FMT("int x{};\n", i)));
+    SourceCodeFile file;
+    file.path = path;
+    files.push_back(std::move(file));
+  }
+  REQUIRE(util::write_file("time.h", "__TIME__\n"));
+  SourceCodeFile time_file;
+  time_file.path = "time.h";
+  files.push_back(std::move(time_file));
+  SourceCodeFile missing_file;
+  missing_file.path = "missing.h";
+  files.push_back(std::move(missing_file));
+  SourceCodeFile directory;
+  directory.path = ".";
+  files.push_back(std::move(directory));
+
+  hash_source_code_files(ctx, files);
+
+  for (size_t i = 0; i < 100; ++i) {
+    Hash::Digest expected_digest;
+    CHECK(hash_source_code_file(ctx, expected_digest, files[i].path).empty());
+    CHECK(files[i].result.empty());
+    CHECK(files[i].digest == expected_digest);
+  }
+  CHECK(files[100].result.contains(HashSourceCode::found_time));
+  CHECK(files[101].result.contains(HashSourceCode::error));
+  CHECK(files[102].result.contains(HashSourceCode::error));
+}
+
 TEST_CASE("check_for_temporal_macros")
 {
   const std::string_view time_start =
@@ -0,0 +1,132 @@
+// Copyright (C) 2025 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "testutil.hpp"
+
+#include <ccache/storage/backendhealthfile.hpp>
+#include <ccache/util/direntry.hpp>
+#include <ccache/util/format.hpp>
+
+#include <doctest/doctest.h>
+
+using storage::BackendHealthFile;
+using TestUtil::TestContext;
+using State = BackendHealthFile::State;
+
+TEST_SUITE_BEGIN("storage::BackendHealthFile");
+
+TEST_CASE("No file")
+{
+  TestContext test_context;
+
+  BackendHealthFile health("health");
+  CHECK(health.allow_request("a"));
+  health.record_success("a");
+  CHECK(health.state("a") == State::closed);
+  CHECK(!util::DirEntry("health").exists());
+}
+
+TEST_CASE("Circuit breaker")
+{
+  TestContext test_context;
+
+  const util::TimePoint now(1000);
+  const auto after = [&](int64_t sec) { return now + util::Duration(sec); };
+
+  BackendHealthFile health("health");
+  for (uint32_t i = 1; i < BackendHealthFile::k_failure_threshold; ++i) {
+    health.record_failure("a", now);
+    CHECK(health.state("a", now) == State::closed);
+    CHECK(health.allow_request("a", now));
+  }
+
+  // Another process sees the same state.
+  BackendHealthFile other("health");
+
+  health.record_failure("a", now);
+  CHECK(health.state("a", now) == State::open);
+  CHECK(!health.allow_request("a", now));
+  CHECK(!other.allow_request("a", now));
+  CHECK(other.allow_request("b", now));
+
+  const auto cooldown = BackendHealthFile::k_initial_cooldown_sec;
+  CHECK(other.state("a", after(cooldown - 1)) == State::open);
+  CHECK(other.state("a", after(cooldown)) == State::half_open);
+
+  SUBCASE("successful probe")
+  {
+    // Only one process gets to probe.
+    CHECK(other.allow_request("a", after(cooldown)));
+    CHECK(!health.allow_request("a", after(cooldown)));
+
+    other.record_success("a");
+    CHECK(health.state("a", after(cooldown)) == State::closed);
+    CHECK(health.allow_request("a", after(cooldown)));
+  }
+
+  SUBCASE("failed probe")
+  {
+    CHECK(other.allow_request("a", after(cooldown)));
+    other.record_failure("a", after(cooldown));
+
+    // The cooldown is doubled.
+    CHECK(health.state("a", after(3 * cooldown - 1)) == State::open);
+    CHECK(health.state("a", after(3 * cooldown)) == State::half_open);
+  }
+
+  SUBCASE("abandoned probe")
+  {
+    CHECK(other.allow_request("a", after(cooldown)));
+    const auto lease_end = cooldown + BackendHealthFile::k_probe_lease_sec;
+    CHECK(!health.allow_request("a", after(lease_end - 1)));
+    CHECK(health.allow_request("a", after(lease_end)));
+  }
+
+  SUBCASE("maximum cooldown")
+  {
+    for (int i = 0; i < 20; ++i) {
+      health.record_failure("a", now);
+    }
+    const auto max_cooldown = BackendHealthFile::k_max_cooldown_sec;
+    CHECK(health.state("a", after(max_cooldown - 1)) == State::open);
+    CHECK(health.state("a", after(max_cooldown)) == State::half_open);
+  }
+}
+
+TEST_CASE("Many backends")
+{
+  TestContext test_context;
+
+  BackendHealthFile health("health");
+  for (int i = 0; i < 100; ++i) {
+    for (uint32_t j = 0; j < BackendHealthFile::k_failure_threshold; ++j) {
+      health.record_failure(FMT("backend{}", i));
+    }
+  }
+
+  // Backends that don't fit in the file are always allowed.
+  int open = 0;
+  for (int i = 0; i < 100; ++i) {
+    if (health.state(FMT("backend{}", i)) == State::open) {
+      ++open;
+    }
+  }
+  CHECK(open == 64);
+}
+
+TEST_SUITE_END();
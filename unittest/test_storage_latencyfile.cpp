@@ -0,0 +1,120 @@
+// Copyright (C) 2025 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "testutil.hpp"
+
+#include <ccache/storage/latencyfile.hpp>
+#include <ccache/util/file.hpp>
+
+#include <doctest/doctest.h>
+
+using storage::LatencyFile;
+using storage::LatencyHistogram;
+using storage::LatencyHistograms;
+using TestUtil::TestContext;
+
+TEST_SUITE_BEGIN("storage::LatencyFile");
+
+TEST_CASE("LatencyHistogram")
+{
+  LatencyHistogram histogram;
+  CHECK(histogram.count() == 0);
+  CHECK(histogram.mean_ms() == 0.0);
+  CHECK(histogram.quantile_ms(0.9) == 0.0);
+
+  for (int i = 0; i < 9; ++i) {
+    histogram.add(3.0);
+  }
+  histogram.add(100.0);
+
+  CHECK(histogram.count() == 10);
+  CHECK(histogram.mean_ms() == doctest::Approx(12.7));
+  CHECK(histogram.quantile_ms(0.5) == 4.0);
+  CHECK(histogram.quantile_ms(0.9) == 4.0);
+  CHECK(histogram.quantile_ms(1.0) == 128.0);
+
+  histogram.add_hit();
+  histogram.add_miss();
+  histogram.add_miss();
+  CHECK(histogram.hits() == 1);
+  CHECK(histogram.misses() == 2);
+
+  const auto copy = LatencyHistogram::from_string(histogram.to_string());
+  CHECK(copy.to_string() == histogram.to_string());
+  CHECK(copy.misses() == 2);
+
+  // Without hits and misses.
+  const auto old = LatencyHistogram::from_string("1000 1 0 0");
+  CHECK(old.count() == 1);
+  CHECK(old.hits() == 0);
+  CHECK(old.misses() == 0);
+}
+
+TEST_CASE("Adaptive timeout and hedge delay")
+{
+  using std::chrono::milliseconds;
+
+  const milliseconds max{10000};
+  LatencyHistogram histogram;
+  for (uint64_t i = 1; i < storage::k_min_latency_samples; ++i) {
+    histogram.add(100.0);
+  }
+  CHECK(!storage::get_adaptive_timeout(histogram, max));
+  CHECK(!storage::get_hedge_delay(histogram));
+
+  histogram.add(100.0);
+  CHECK(storage::get_adaptive_timeout(histogram, max) == milliseconds(512));
+  CHECK(storage::get_adaptive_timeout(histogram, milliseconds(300))
+        == milliseconds(300));
+  CHECK(storage::get_hedge_delay(histogram) == milliseconds(128));
+
+  LatencyHistogram fast;
+  for (uint64_t i = 0; i < storage::k_min_latency_samples; ++i) {
+    fast.add(1.0);
+  }
+  CHECK(storage::get_adaptive_timeout(fast, max)
+        == storage::k_min_adaptive_timeout);
+}
+
+TEST_CASE("Read nonexistent")
+{
+  TestContext test_context;
+
+  CHECK(LatencyFile("test").read().empty());
+}
+
+TEST_CASE("Update")
+{
+  TestContext test_context;
+
+  LatencyHistograms updates;
+  updates["file:/a"].add(0.5);
+  updates["http://b"].add(20.0);
+
+  LatencyFile("test").update(updates);
+  LatencyFile("test").update(updates);
+
+  const auto histograms = LatencyFile("test").read();
+  REQUIRE(histograms.size() == 2);
+  CHECK(histograms.at("file:/a").count() == 2);
+  CHECK(histograms.at("file:/a").quantile_ms(1.0) == 1.0);
+  CHECK(histograms.at("http://b").count() == 2);
+  CHECK(histograms.at("http://b").mean_ms() == doctest::Approx(20.0));
+}
+
+TEST_SUITE_END();
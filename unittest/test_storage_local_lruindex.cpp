@@ -0,0 +1,290 @@
+// Copyright (C) 2025 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "testutil.hpp"
+
+#include <ccache/storage/local/lruindex.hpp>
+#include <ccache/util/direntry.hpp>
+#include <ccache/util/file.hpp>
+#include <ccache/util/filesystem.hpp>
+#include <ccache/util/format.hpp>
+#include <ccache/util/lockfile.hpp>
+
+#include <doctest/doctest.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = util::filesystem;
+
+using storage::local::LruIndex;
+using RecordResult = storage::local::LruIndex::RecordResult;
+using TestUtil::TestContext;
+
+namespace {
+
+std::vector<std::string>
+names(const std::vector<LruIndex::Entry>& entries)
+{
+  std::vector<std::string> result;
+  for (const auto& entry : entries) {
+    result.push_back(entry.path.filename().string());
+  }
+  return result;
+}
+
+} // namespace
+
+TEST_SUITE_BEGIN("storage::local::LruIndex");
+
+TEST_CASE("Missing index")
+{
+  TestContext test_context;
+
+  LruIndex index("dir");
+  CHECK(!index.load());
+
+  // Records are not appended without a snapshot.
+  REQUIRE(fs::create_directories("dir"));
+  CHECK(index.record_use("dir/aR", 17) == RecordResult::not_recorded);
+  CHECK(!index.load());
+}
+
+TEST_CASE("Snapshot and journal")
+{
+  TestContext test_context;
+
+  REQUIRE(fs::create_directories("dir/c"));
+  LruIndex index("dir");
+  index.write({
+    {"dir/aR", util::TimePoint(1), 4096},
+    {"dir/bM", util::TimePoint(2), 8192},
+    {"dir/c/dR", util::TimePoint(3), 4096},
+  });
+
+  auto entries = index.load();
+  REQUIRE(entries);
+  REQUIRE(entries->size() == 3);
+  CHECK(names(*entries) == std::vector<std::string>{"aR", "bM", "dR"});
+  CHECK((*entries)[1].path == fs::path("dir/bM"));
+  CHECK((*entries)[1].last_used == util::TimePoint(2));
+  CHECK((*entries)[1].size_on_disk == 8192);
+  CHECK((*entries)[2].path == fs::path("dir/c/dR"));
+
+  // Use aR, add eW and remove bM.
+  CHECK(index.record_use("dir/aR", 4096) == RecordResult::recorded);
+  CHECK(index.record_use("dir/eW", 12288) == RecordResult::recorded);
+  index.record_removal("dir/bM");
+
+  entries = index.load();
+  REQUIRE(entries);
+  CHECK(names(*entries) == std::vector<std::string>{"dR", "aR", "eW"});
+  CHECK(!(*entries)[0].journaled);
+  CHECK((*entries)[1].journaled);
+  CHECK((*entries)[1].last_used > util::TimePoint(3));
+  CHECK((*entries)[2].journaled);
+  CHECK((*entries)[2].size_on_disk == 12288);
+
+  SUBCASE("Compact")
+  {
+    const auto size_before = util::DirEntry("dir/lru").size();
+    index.compact();
+    CHECK(util::DirEntry("dir/lru").size() < size_before);
+    entries = index.load();
+    REQUIRE(entries);
+    CHECK(names(*entries) == std::vector<std::string>{"dR", "aR", "eW"});
+    CHECK(!(*entries)[2].journaled);
+  }
+
+  SUBCASE("Records appended after load are kept")
+  {
+    entries = index.load();
+    REQUIRE(entries);
+    CHECK(index.record_use("dir/fR", 4096) == RecordResult::recorded);
+    entries->erase(entries->begin());
+    index.write(*entries);
+    entries = index.load();
+    REQUIRE(entries);
+    CHECK(names(*entries) == std::vector<std::string>{"aR", "eW", "fR"});
+  }
+
+  SUBCASE("Partially written record")
+  {
+    const auto content = util::read_file<std::string>("dir/lru");
+    REQUIRE(content);
+    util::write_file("dir/lru", *content + "+ 5 4096 gR");
+    entries = index.load();
+    REQUIRE(entries);
+    CHECK(entries->size() == 3);
+  }
+
+  SUBCASE("Remove")
+  {
+    index.remove();
+    CHECK(!index.load());
+  }
+}
+
+TEST_CASE("Corrupt index")
+{
+  TestContext test_context;
+
+  REQUIRE(fs::create_directories("dir"));
+  LruIndex index("dir");
+
+  SUBCASE("Bad header")
+  {
+    util::write_file("dir/lru", "ccache-lru 0 0\n");
+    CHECK(!index.load());
+  }
+
+  SUBCASE("Old version")
+  {
+    util::write_file("dir/lru", "ccache-lru 1 0\n+ 1 4096 aR\n");
+    CHECK(!index.load());
+    CHECK(index.record_use("dir/aR", 4096) == RecordResult::not_recorded);
+  }
+
+  SUBCASE("Bad record")
+  {
+    util::write_file("dir/lru",
+                     "ccache-lru 2 0\n+ 1 x 0 1 aR\n+ 1 4+ 2 4096 0 1 bR\n"
+                     "+ 3 4096 0 1 cR\n");
+    const auto entries = index.load();
+    REQUIRE(entries);
+    CHECK(names(*entries) == std::vector<std::string>{"cR"});
+  }
+}
+
+TEST_CASE("Cost and use count")
+{
+  TestContext test_context;
+
+  REQUIRE(fs::create_directories("dir"));
+  LruIndex index("dir");
+  index.write({
+    {"dir/aR", util::TimePoint(1), 4096, 1500, 3},
+    {"dir/bR", util::TimePoint(2), 4096},
+  });
+
+  auto entries = index.load();
+  REQUIRE(entries);
+  REQUIRE(entries->size() == 2);
+  CHECK((*entries)[0].cost == 1500);
+  CHECK((*entries)[0].uses == 3);
+  CHECK((*entries)[1].cost == 0);
+  CHECK((*entries)[1].uses == 1);
+
+  // A use without a cost keeps the recorded cost and increments the use count.
+  CHECK(index.record_use("dir/aR", 4096) == RecordResult::recorded);
+  CHECK(index.record_use("dir/bR", 4096, 200) == RecordResult::recorded);
+  entries = index.load();
+  REQUIRE(entries);
+  CHECK(names(*entries) == std::vector<std::string>{"aR", "bR"});
+  CHECK((*entries)[0].cost == 1500);
+  CHECK((*entries)[0].uses == 4);
+  CHECK((*entries)[1].cost == 200);
+  CHECK((*entries)[1].uses == 2);
+
+  // The use count restarts when an entry is removed and added again.
+  index.record_removal("dir/aR");
+  CHECK(index.record_use("dir/aR", 4096, 700) == RecordResult::recorded);
+  index.compact();
+  entries = index.load();
+  REQUIRE(entries);
+  CHECK(names(*entries) == std::vector<std::string>{"bR", "aR"});
+  CHECK((*entries)[1].cost == 700);
+  CHECK((*entries)[1].uses == 1);
+  CHECK((*entries)[0].uses == 2);
+}
+
+TEST_CASE("Compaction is requested when the journal grows")
+{
+  TestContext test_context;
+
+  REQUIRE(fs::create_directories("dir"));
+  LruIndex index("dir");
+  index.write({{"dir/aR", util::TimePoint(1), 4096}});
+
+  bool compaction_requested = false;
+  for (int i = 0; i < 10000 && !compaction_requested; ++i) {
+    compaction_requested = index.record_use("dir/aR", 4096)
+                           == RecordResult::compaction_needed;
+  }
+  CHECK(compaction_requested);
+  index.compact();
+  CHECK(index.record_use("dir/aR", 4096) == RecordResult::recorded);
+  CHECK(index.load()->size() == 1);
+}
+
+TEST_CASE("Records appended concurrently with a rewrite")
+{
+  TestContext test_context;
+
+  REQUIRE(fs::create_directories("dir"));
+  LruIndex("dir").write({});
+
+  // Appending and rewriting are serialized by the level 2 content lock.
+  constexpr int count = 200;
+  std::thread appender([] {
+    LruIndex index("dir");
+    for (int i = 0; i < count; ++i) {
+      util::LockFile lock("dir/lock");
+      if (lock.acquire()) {
+        index.record_use(FMT("dir/{}R", i), 4096);
+      }
+    }
+  });
+  LruIndex index("dir");
+  for (int i = 0; i < count / 4; ++i) {
+    util::LockFile lock("dir/lock");
+    if (lock.acquire()) {
+      index.compact();
+    }
+  }
+  appender.join();
+
+  const auto entries = index.load();
+  REQUIRE(entries);
+  CHECK(entries->size() == count);
+}
+
+TEST_CASE("Recent uses")
+{
+  TestContext test_context;
+
+  REQUIRE(fs::create_directories("dir"));
+  LruIndex index("dir");
+  index.write({
+    {"dir/aR", util::TimePoint(1), 4096},
+    {"dir/bM", util::TimePoint(2), 4096},
+  });
+
+  const auto since = util::TimePoint::now() - util::Duration(60);
+  CHECK(!index.has_recorded_use_since("dir/aR", since));
+
+  CHECK(index.record_use("dir/aR", 4096) == RecordResult::recorded);
+  CHECK(index.has_recorded_use_since("dir/aR", since));
+  CHECK(!index.has_recorded_use_since("dir/bM", since));
+
+  index.record_removal("dir/aR");
+  CHECK(!index.has_recorded_use_since("dir/aR", since));
+}
+
+TEST_SUITE_END();
@@ -0,0 +1,230 @@
+// Copyright (C) 2025 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "testutil.hpp"
+
+#include <ccache/core/types.hpp>
+#include <ccache/hash.hpp>
+#include <ccache/storage/local/packstore.hpp>
+#include <ccache/util/bytes.hpp>
+#include <ccache/util/direntry.hpp>
+#include <ccache/util/conversion.hpp>
+#include <ccache/util/format.hpp>
+
+#include <doctest/doctest.h>
+
+#include <string>
+
+using core::CacheEntryType;
+using storage::local::PackStore;
+using TestUtil::TestContext;
+
+namespace {
+
+Hash::Digest
+make_key(const std::string& s)
+{
+  return Hash().hash(s).digest();
+}
+
+std::optional<std::string>
+get_string(const PackStore& store,
+           const Hash::Digest& key,
+           CacheEntryType type = CacheEntryType::result)
+{
+  std::optional<std::string> value;
+  const auto result = store.get(key, type, [&](auto data) {
+    value = std::string(data.begin(), data.end());
+    return true;
+  });
+  return result && *result ? value : std::nullopt;
+}
+
+void
+put_string(PackStore& store,
+           const Hash::Digest& key,
+           const std::string& value,
+           CacheEntryType type = CacheEntryType::result)
+{
+  REQUIRE(store.put(key, type, util::to_span(value)));
+}
+
+} // namespace
+
+TEST_SUITE_BEGIN("storage::local::PackStore");
+
+TEST_CASE("Empty store")
+{
+  TestContext test_context;
+
+  PackStore store("pack");
+  CHECK(!store.get(make_key("a"), CacheEntryType::result, [](auto) {
+    return true;
+  }));
+  CHECK(!store.contains(make_key("a"), CacheEntryType::result));
+  CHECK(store.entries().empty());
+  CHECK(store.usage().entries == 0);
+  CHECK(store.usage().size == 0);
+  CHECK(!store.remove(make_key("a"), CacheEntryType::result));
+  store.compact();
+  store.clear();
+  CHECK(!util::DirEntry("pack").exists());
+}
+
+TEST_CASE("Put and get")
+{
+  TestContext test_context;
+
+  PackStore store("pack");
+  const auto key_a = make_key("a");
+  const auto key_b = make_key("b");
+
+  const auto result = store.put(
+    key_a, CacheEntryType::result, util::to_span(std::string("value a")));
+  REQUIRE(result);
+  CHECK(result->added);
+  CHECK(result->old_data_size == 0);
+  CHECK(result->new_data_size > 7);
+
+  put_string(store, key_b, "value b");
+  put_string(store, key_a, "manifest a", CacheEntryType::manifest);
+
+  CHECK(get_string(store, key_a) == "value a");
+  CHECK(get_string(store, key_b) == "value b");
+  CHECK(get_string(store, key_a, CacheEntryType::manifest) == "manifest a");
+  CHECK(!get_string(store, key_b, CacheEntryType::manifest));
+  CHECK(store.contains(key_a, CacheEntryType::manifest));
+  CHECK(store.entries().size() == 3);
+  CHECK(store.usage().entries == 3);
+
+  SUBCASE("Reopen")
+  {
+    PackStore other_store("pack");
+    CHECK(get_string(other_store, key_b) == "value b");
+  }
+
+  SUBCASE("Entry too large")
+  {
+    const std::string value(PackStore::k_max_entry_size + 1, 'x');
+    CHECK(!store.put(key_a, CacheEntryType::result, util::to_span(value)));
+    CHECK(get_string(store, key_a) == "value a");
+  }
+}
+
+TEST_CASE("Replace and remove")
+{
+  TestContext test_context;
+
+  PackStore store("pack");
+  const auto key_a = make_key("a");
+  const auto key_b = make_key("b");
+
+  put_string(store, key_a, "old");
+  const auto result =
+    store.put(key_a, CacheEntryType::result, util::to_span(std::string("new")));
+  REQUIRE(result);
+  CHECK(!result->added);
+  CHECK(result->new_data_size > result->old_data_size);
+  CHECK(get_string(store, key_a) == "new");
+  CHECK(store.usage().entries == 1);
+
+  put_string(store, key_b, "b");
+  CHECK(store.remove(key_a, CacheEntryType::result));
+  CHECK(!store.remove(key_a, CacheEntryType::result));
+  CHECK(!get_string(store, key_a));
+  CHECK(get_string(store, key_b) == "b");
+  CHECK(store.usage().entries == 1);
+
+  const auto entries = store.entries();
+  REQUIRE(entries.size() == 1);
+  CHECK(entries[0].key == key_b);
+  CHECK(entries[0].type == CacheEntryType::result);
+  CHECK(entries[0].size == 1);
+  const auto data = store.read(entries[0]);
+  REQUIRE(data);
+  CHECK(*data == util::Bytes(util::to_span(std::string("b"))));
+
+  store.remove(entries);
+  CHECK(!get_string(store, key_b));
+  CHECK(store.usage().entries == 0);
+}
+
+TEST_CASE("Compact")
+{
+  TestContext test_context;
+
+  PackStore store("pack");
+  const std::string value(1000, 'x');
+  for (int i = 0; i < 100; ++i) {
+    put_string(store, make_key(FMT("{}", i)), value);
+  }
+  const auto size_before = store.usage().size;
+
+  // Compacting a store without removed entries does nothing.
+  store.compact();
+  CHECK(store.usage().size == size_before);
+
+  for (int i = 0; i < 50; ++i) {
+    REQUIRE(store.remove(make_key(FMT("{}", i)), CacheEntryType::result));
+  }
+  CHECK(store.usage().size == size_before);
+
+  store.compact();
+  CHECK(store.usage().entries == 50);
+  CHECK(store.usage().size < size_before);
+  for (int i = 0; i < 50; ++i) {
+    CHECK(!get_string(store, make_key(FMT("{}", i))));
+  }
+  for (int i = 50; i < 100; ++i) {
+    CHECK(get_string(store, make_key(FMT("{}", i))) == value);
+  }
+
+  // The store is still usable after compaction.
+  put_string(store, make_key("new"), "new");
+  CHECK(get_string(store, make_key("new")) == "new");
+  CHECK(store.usage().entries == 51);
+}
+
+TEST_CASE("Index growth")
+{
+  TestContext test_context;
+
+  PackStore store("pack");
+  for (int i = 0; i < 2000; ++i) {
+    put_string(store, make_key(FMT("{}", i)), FMT("{}", i));
+  }
+  CHECK(store.usage().entries == 2000);
+  for (int i = 0; i < 2000; i += 100) {
+    CHECK(get_string(store, make_key(FMT("{}", i))) == FMT("{}", i));
+  }
+}
+
+TEST_CASE("Clear")
+{
+  TestContext test_context;
+
+  PackStore store("pack");
+  put_string(store, make_key("a"), "a");
+  store.clear();
+  CHECK(!get_string(store, make_key("a")));
+  CHECK(store.usage().entries == 0);
+  put_string(store, make_key("a"), "a2");
+  CHECK(get_string(store, make_key("a")) == "a2");
+}
+
+TEST_SUITE_END();
@@ -20,6 +20,7 @@
 
 #include <ccache/core/statistic.hpp>
 #include <ccache/storage/local/statsfile.hpp>
+#include <ccache/util/direntry.hpp>
 #include <ccache/util/file.hpp>
 #include <ccache/util/format.hpp>
 
@@ -27,6 +28,7 @@
 
 using core::Statistic;
 using storage::local::StatsFile;
+using util::DirEntry;
 using TestUtil::TestContext;
 
 TEST_SUITE_BEGIN("storage::local::StatsFile");
@@ -103,4 +105,95 @@ TEST_CASE("Update")
   CHECK(counters->get(Statistic::cache_miss) == 33);
 }
 
+TEST_CASE("Update migrates legacy file")
+{
+  TestContext test_context;
+
+  util::write_file("test", "0 1 2 3 27 5\n");
+  StatsFile stats_file("test");
+  CHECK(stats_file.read().get(Statistic::cache_miss) == 27);
+  CHECK(!DirEntry(stats_file.get_mapped_path()).exists());
+
+  REQUIRE(stats_file.update(
+    [](auto& cs) { cs.increment(Statistic::cache_miss); }));
+  CHECK(!DirEntry("test").exists());
+  CHECK(DirEntry(stats_file.get_mapped_path()).exists());
+  CHECK(stats_file.read().get(Statistic::cache_miss) == 28);
+
+  // Counters written by an older ccache version after migration are added.
+  util::write_file("test", "0 0 0 0 2\n");
+  CHECK(stats_file.read().get(Statistic::cache_miss) == 30);
+  REQUIRE(stats_file.update([](auto&) {}));
+  CHECK(!DirEntry("test").exists());
+  CHECK(stats_file.read().get(Statistic::cache_miss) == 30);
+}
+
+TEST_CASE("Update preserves future counters")
+{
+  TestContext test_context;
+
+  std::string content;
+  size_t count = static_cast<size_t>(Statistic::END) + 1;
+  for (size_t i = 0; i < count; ++i) {
+    content += FMT("{}\n", i);
+  }
+  util::write_file("test", content);
+
+  StatsFile stats_file("test");
+  REQUIRE(stats_file.update(
+    [](auto& cs) { cs.increment(Statistic::cache_miss); }));
+
+  const auto counters = stats_file.read();
+  REQUIRE(counters.size() == count);
+  CHECK(counters.get(Statistic::cache_miss) == 5);
+  CHECK(counters.get_raw(count - 1) == count - 1);
+}
+
+TEST_CASE("Update adds changes to concurrently updated counters")
+{
+  TestContext test_context;
+
+  StatsFile stats_file("test");
+  REQUIRE(stats_file.update([](auto& cs) {
+    cs.set(Statistic::files_in_cache, 10);
+    cs.set(Statistic::cache_miss, 10);
+  }));
+
+  const auto counters = stats_file.update([&](auto& cs) {
+    // Simulate another process updating the counters meanwhile.
+    StatsFile("test").update([](auto& other_cs) {
+      other_cs.increment(Statistic::cache_miss, 5);
+      other_cs.increment(Statistic::files_in_cache, -8);
+    });
+    cs.increment(Statistic::cache_miss, 1);
+    cs.increment(Statistic::files_in_cache, -5);
+  });
+  REQUIRE(counters);
+  CHECK(counters->get(Statistic::cache_miss) == 16);
+  CHECK(counters->get(Statistic::files_in_cache) == 0);
+  CHECK(stats_file.read().get(Statistic::cache_miss) == 16);
+  CHECK(stats_file.read().get(Statistic::files_in_cache) == 0);
+}
+
+TEST_CASE("Last updated")
+{
+  TestContext test_context;
+
+  StatsFile stats_file("test");
+  CHECK(stats_file.last_updated() == util::TimePoint());
+
+  const auto before = util::TimePoint::now();
+  REQUIRE(stats_file.update(
+    [](auto& cs) { cs.increment(Statistic::cache_miss); }));
+  CHECK(stats_file.last_updated() >= before);
+}
+
+TEST_CASE("Stats file names")
+{
+  CHECK(StatsFile::is_stats_file_name("stats"));
+  CHECK(StatsFile::is_stats_file_name(StatsFile("stats").get_mapped_path()));
+  CHECK(!StatsFile::is_stats_file_name("stats.tmp.123456"));
+  CHECK(!StatsFile::is_stats_file_name("CACHEDIR.TAG"));
+}
+
 TEST_SUITE_END();
@@ -26,6 +26,8 @@
 #include <doctest/doctest.h>
 
 #include <algorithm>
+#include <mutex>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
@@ -47,6 +49,131 @@ TEST_CASE("storage::local::for_each_cache_subdir")
   CHECK(actual == expected);
 }
 
+TEST_CASE("storage::local::for_each_level_2_cache_subdir")
+{
+  std::mutex mutex;
+  std::vector<int> visits(256);
+  std::vector<int> begun(16);
+  std::vector<int> ended(16);
+  std::vector<double> progress;
+
+  SUBCASE("visits")
+  {
+    for (uint32_t threads : {1, 4}) {
+      std::fill(visits.begin(), visits.end(), 0);
+      std::fill(begun.begin(), begun.end(), 0);
+      std::fill(ended.begin(), ended.end(), 0);
+      progress.clear();
+
+      storage::local::for_each_level_2_cache_subdir(
+        threads,
+        [&](double p) { progress.push_back(p); },
+        [&](uint8_t l1_index, uint8_t l2_index) {
+          std::lock_guard<std::mutex> lock(mutex);
+          // The level 1 directory has begun but not ended.
+          CHECK(begun[l1_index] == 1);
+          CHECK(ended[l1_index] == 0);
+          ++visits[16 * l1_index + l2_index];
+        },
+        [&](uint8_t l1_index) {
+          std::lock_guard<std::mutex> lock(mutex);
+          ++begun[l1_index];
+        },
+        [&](uint8_t l1_index) {
+          std::lock_guard<std::mutex> lock(mutex);
+          for (size_t i = 0; i < 16; ++i) {
+            CHECK(visits[16 * l1_index + i] == 1);
+          }
+          ++ended[l1_index];
+        });
+
+      CHECK(std::all_of(visits.begin(), visits.end(), [](int v) {
+        return v == 1;
+      }));
+      CHECK(std::all_of(ended.begin(), ended.end(), [](int v) {
+        return v == 1;
+      }));
+      REQUIRE(!progress.empty());
+      CHECK(std::is_sorted(progress.begin(), progress.end()));
+      CHECK(progress.back() == 1.0);
+    }
+  }
+
+  SUBCASE("exception")
+  {
+    CHECK_THROWS_WITH(storage::local::for_each_level_2_cache_subdir(
+                        4,
+                        [](double) {},
+                        [&](uint8_t l1_index, uint8_t l2_index) {
+                          if (l1_index == 2 && l2_index == 3) {
+                            throw std::runtime_error("failure");
+                          }
+                        }),
+                      "failure");
+  }
+}
+
+TEST_CASE("storage::local::get_level_1_dirs")
+{
+#ifdef _WIN32
+  const std::string sep = ";";
+#else
+  const std::string sep = ":";
+#endif
+  using storage::local::get_level_1_dirs;
+
+  auto count = [](const storage::local::Level1Dirs& dirs, const fs::path& dir) {
+    return std::count(dirs.begin(), dirs.end(), dir);
+  };
+
+  SUBCASE("no stripes")
+  {
+    const auto dirs = get_level_1_dirs("cd", "");
+    CHECK(count(dirs, "cd") == 16);
+  }
+
+  SUBCASE("equal weights")
+  {
+    const auto dirs = get_level_1_dirs("cd", "a" + sep + "b");
+    CHECK(count(dirs, "a") == 8);
+    CHECK(count(dirs, "b") == 8);
+    CHECK(dirs[0] == "a");
+    CHECK(dirs[15] == "b");
+  }
+
+  SUBCASE("weights")
+  {
+    const auto dirs = get_level_1_dirs("cd", "a" + sep + "b(2)");
+    CHECK(count(dirs, "a") == 5);
+    CHECK(count(dirs, "b") == 11);
+
+    const auto dirs2 =
+      get_level_1_dirs("cd", "a(1)" + sep + "b(1)" + sep + "c(1)");
+    CHECK(count(dirs2, "a") == 6);
+    CHECK(count(dirs2, "b") == 5);
+    CHECK(count(dirs2, "c") == 5);
+  }
+
+  SUBCASE("too small weight")
+  {
+    const auto dirs = get_level_1_dirs("cd", "a(1)" + sep + "b(1000)");
+    CHECK(count(dirs, "a") == 0);
+    CHECK(count(dirs, "b") == 16);
+  }
+
+  SUBCASE("invalid weight")
+  {
+    CHECK_THROWS_WITH(
+      get_level_1_dirs("cd", "a(0)"),
+      "Invalid cache directory stripe \"a(0)\": weight must be between 1 and"
+      " 1000");
+    CHECK_THROWS_WITH(
+      get_level_1_dirs("cd", "a(x)"),
+      "Invalid cache directory stripe \"a(x)\": invalid unsigned integer:"
+      " \"x\"");
+  }
+}
+
 TEST_CASE("storage::local::get_cache_dir_files")
 {
   TestContext test_context;
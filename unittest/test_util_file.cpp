@@ -34,6 +34,7 @@
 #  include <unistd.h>
 #endif
 
+#include <algorithm>
 #include <cstring>
 #include <string>
 #include <string_view>
@@ -307,4 +308,35 @@ TEST_CASE("util::traverse_directory")
     CHECK(visited[1] == fs::path("[d] dir-with-subdir-and-file/subdir"));
     CHECK(visited[2] == "[d] dir-with-subdir-and-file");
   }
+
+  SUBCASE("visited entries have correct metadata")
+  {
+    util::write_file("dir-with-files/f2", "123");
+    util::set_timestamps("dir-with-files/f2", util::TimePoint(4711));
+
+    std::vector<DirEntry> entries;
+    CHECK_NOTHROW(util::traverse_directory(
+      "dir-with-files", [&](const auto& de) { entries.push_back(de); }));
+    REQUIRE(entries.size() == 3);
+    for (const auto& entry : entries) {
+      DirEntry fresh(entry.path());
+      CHECK(entry);
+      CHECK(entry.is_regular_file() == fresh.is_regular_file());
+      CHECK(entry.is_directory() == fresh.is_directory());
+      CHECK(entry.same_inode_as(fresh));
+      CHECK(entry.mode() == fresh.mode());
+      if (entry.is_regular_file()) {
+        CHECK(entry.size() == fresh.size());
+        CHECK(entry.size_on_disk() == fresh.size_on_disk());
+        CHECK(entry.mtime() == fresh.mtime());
+      }
+    }
+    const auto f2 = std::find_if(
+      entries.begin(), entries.end(), [](const auto& entry) {
+        return entry.path() == fs::path("dir-with-files/f2");
+      });
+    REQUIRE(f2 != entries.end());
+    CHECK(f2->size() == 3);
+    CHECK(f2->mtime() == util::TimePoint(4711));
+  }
 }
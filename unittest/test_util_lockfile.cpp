@@ -20,6 +20,7 @@
 
 #include <ccache/util/direntry.hpp>
 #include <ccache/util/file.hpp>
+#include <ccache/util/filesystem.hpp>
 #include <ccache/util/lockfile.hpp>
 #include <ccache/util/wincompat.hpp>
 
@@ -29,8 +30,13 @@
 #  include <unistd.h>
 #endif
 
+#include <atomic>
+#include <thread>
+
 using namespace std::chrono_literals;
 
+namespace fs = util::filesystem;
+
 using util::DirEntry;
 
 TEST_SUITE_BEGIN("LockFile");
@@ -141,6 +147,67 @@ TEST_CASE("Break stale lock, non-blocking")
   CHECK(lock.try_acquire());
   CHECK(lock.acquired());
 }
+
+TEST_CASE("Kernel lock excludes other lock objects")
+{
+  TestContext test_context;
+
+  util::LockFile lock1("test");
+  util::LockFile lock2("test");
+  CHECK(lock1.acquire());
+  CHECK(DirEntry("test.flock"));
+  CHECK(!lock2.try_acquire());
+
+  lock1.release();
+  CHECK(DirEntry("test.flock"));
+  CHECK(lock2.try_acquire());
+}
+
+TEST_CASE("Kernel lock is released if symlink lock can't be acquired")
+{
+  TestContext test_context;
+
+  // A directory can't be read as a symlink.
+  REQUIRE(fs::create_directory("test.lock"));
+
+  util::LockFile lock1("test");
+  CHECK(!lock1.acquire());
+
+  REQUIRE(fs::remove("test.lock"));
+  util::LockFile lock2("test");
+  CHECK(lock2.try_acquire());
+}
+
+TEST_CASE("Blocking acquire wakes up when lock is released")
+{
+  TestContext test_context;
+
+  util::LockFile lock1("test");
+  CHECK(lock1.acquire());
+
+  std::atomic<bool> acquired = false;
+  std::thread thread([&] {
+    util::LockFile lock2("test");
+    acquired = lock2.acquire();
+  });
+  std::this_thread::sleep_for(100ms);
+  CHECK(!acquired);
+  lock1.release();
+  thread.join();
+  CHECK(acquired);
+}
+
+TEST_CASE("Blocking acquire doesn't wait for inactive kernel lock holder")
+{
+  TestContext test_context;
+
+  util::LockFile lock1("test");
+  CHECK(lock1.acquire());
+  util::set_timestamps("test.alive", util::TimePoint(0, 0));
+
+  util::LockFile lock2("test");
+  CHECK(lock2.acquire());
+}
 #endif // !_WIN32
 
 TEST_SUITE_END();
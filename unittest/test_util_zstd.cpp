@@ -19,11 +19,14 @@
 #include "testutil.hpp"
 
 #include <ccache/util/bytes.hpp>
+#include <ccache/util/conversion.hpp>
+#include <ccache/util/format.hpp>
 #include <ccache/util/zstd.hpp>
 
 #include <doctest/doctest.h>
 
 #include <string>
+#include <vector>
 
 using TestUtil::TestContext;
 
@@ -76,3 +79,148 @@ TEST_CASE("ZSTD roundtrip")
   CHECK(result);
   CHECK(decompressed_input == original_input);
 }
+
+TEST_CASE("util::ZstdCompressor and util::ZstdDecompressor")
+{
+  TestContext test_context;
+
+  util::Bytes original_input(1000000);
+  for (size_t i = 0; i < original_input.size(); i++) {
+    original_input[i] = static_cast<uint8_t>(i % 251);
+  }
+
+  util::Bytes compressed{'x'};
+  {
+    util::ZstdCompressor compressor(compressed, 1);
+    for (size_t pos = 0; pos < original_input.size(); pos += 4711) {
+      CHECK(compressor.write(nonstd::span<const uint8_t>(original_input)
+                               .subspan(pos)
+                               .first(std::min<size_t>(
+                                 4711, original_input.size() - pos))));
+    }
+    CHECK(compressor.finish());
+  }
+  CHECK(compressed[0] == 'x');
+  CHECK(compressed.size() < original_input.size() / 10);
+
+  util::Bytes one_shot;
+  CHECK(util::zstd_decompress(
+    nonstd::span<const uint8_t>(compressed).subspan(1),
+    one_shot,
+    original_input.size()));
+  CHECK(one_shot == original_input);
+
+  SUBCASE("Chunked reads")
+  {
+    util::ZstdDecompressor decompressor(
+      nonstd::span<const uint8_t>(compressed).subspan(1));
+    util::Bytes output;
+    util::Bytes chunk(10007);
+    while (true) {
+      const auto n = decompressor.read(chunk);
+      REQUIRE(n);
+      output.insert(output.end(), chunk.data(), chunk.data() + *n);
+      if (*n < chunk.size()) {
+        break;
+      }
+    }
+    CHECK(output == original_input);
+  }
+
+  SUBCASE("Truncated input")
+  {
+    util::ZstdDecompressor decompressor(
+      nonstd::span<const uint8_t>(compressed).subspan(1, 100));
+    util::Bytes output(original_input.size());
+    const auto n = decompressor.read(output);
+    CHECK((!n || *n < original_input.size()));
+  }
+}
+
+TEST_CASE("util::ZstdCompressor with threads")
+{
+  TestContext test_context;
+
+  util::Bytes original_input(10000000);
+  for (size_t i = 0; i < original_input.size(); i++) {
+    original_input[i] = static_cast<uint8_t>((i * i) % 251);
+  }
+
+  util::Bytes compressed;
+  util::ZstdCompressor compressor(compressed, 1, 4);
+  CHECK(compressor.write(original_input));
+  CHECK(compressor.finish());
+
+  util::Bytes decompressed;
+  CHECK(
+    util::zstd_decompress(compressed, decompressed, original_input.size()));
+  CHECK(decompressed == original_input);
+}
+
+TEST_CASE("util::ZstdDictionary")
+{
+  TestContext test_context;
+
+  util::Bytes samples;
+  std::vector<size_t> sample_sizes;
+  for (size_t i = 0; i < 1000; ++i) {
+    const auto sample =
+      FMT("int function_{0}(int x) {{ return helper_{1}(x) * {0}; }}\n"
+          "static const char* name_{1} = \"ccache sample {2}\";\n",
+          i,
+          (i * 7919) % 1000,
+          (i * i) % 97);
+    samples.insert(samples.end(), util::to_span(sample));
+    sample_sizes.push_back(sample.size());
+  }
+
+  const auto trained = util::zstd_train_dictionary(samples, sample_sizes, 4096);
+  REQUIRE(trained);
+  const auto created = util::ZstdDictionary::create(*trained);
+  REQUIRE(created);
+  const util::ZstdDictionary& dictionary = **created;
+  CHECK(dictionary.id() != 0);
+
+  const std::string text =
+    "int function_1234(int x) { return helper_42(x) * 1234; }\n";
+  const util::Bytes input(util::to_span(text));
+
+  util::Bytes without_dictionary;
+  REQUIRE(util::zstd_compress(input, without_dictionary, 1));
+  util::Bytes with_dictionary;
+  REQUIRE(util::zstd_compress(input, with_dictionary, 1, &dictionary));
+  CHECK(with_dictionary.size() < without_dictionary.size());
+
+  SUBCASE("one-shot")
+  {
+    util::Bytes output;
+    REQUIRE(util::zstd_decompress(
+      with_dictionary, output, input.size(), &dictionary));
+    CHECK(output == input);
+
+    output.clear();
+    CHECK(!util::zstd_decompress(with_dictionary, output, input.size()));
+  }
+
+  SUBCASE("streaming")
+  {
+    util::Bytes compressed;
+    util::ZstdCompressor compressor(compressed, 1, 1, &dictionary);
+    CHECK(compressor.write(input));
+    CHECK(compressor.finish());
+
+    util::ZstdDecompressor decompressor(compressed, &dictionary);
+    util::Bytes output(input.size());
+    const auto n = decompressor.read(output);
+    REQUIRE(n);
+    CHECK(*n == input.size());
+    CHECK(output == input);
+  }
+
+  SUBCASE("corrupt")
+  {
+    util::Bytes truncated(*trained);
+    truncated.resize(32);
+    CHECK(!util::ZstdDictionary::create(truncated));
+  }
+}